@@ -0,0 +1,119 @@
+/* Copyright © 2013-2020 Graphia Technologies Ltd.
+ *
+ * This file is part of Graphia.
+ *
+ * Graphia is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Graphia is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Graphia.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "adjacencysnapshot.h"
+
+#include "graph.h"
+
+#include <algorithm>
+
+AdjacencySnapshot::AdjacencySnapshot(const Graph& graph) :
+    _nodeIds(graph.nodeIds()), _edgeIds(graph.edgeIds())
+{
+    Q_ASSERT(_edgeIds.size() < NullIndex / 2);
+
+    int maxNodeId = -1;
+    for(auto nodeId : _nodeIds)
+        maxNodeId = std::max(maxNodeId, static_cast<int>(nodeId));
+
+    int maxEdgeId = -1;
+    for(auto edgeId : _edgeIds)
+        maxEdgeId = std::max(maxEdgeId, static_cast<int>(edgeId));
+
+    _nodeIndices.resize(static_cast<size_t>(maxNodeId + 1), NullIndex);
+    for(Index node = 0; node < _nodeIds.size(); node++)
+        _nodeIndices[static_cast<size_t>(static_cast<int>(_nodeIds[node]))] = node;
+
+    _edgeIndices.resize(static_cast<size_t>(maxEdgeId + 1), NullIndex);
+    _edgeSources.resize(_edgeIds.size());
+    _edgeTargets.resize(_edgeIds.size());
+
+    std::vector<Index> outDegrees(_nodeIds.size(), 0);
+    std::vector<Index> inDegrees(_nodeIds.size(), 0);
+
+    for(Index edge = 0; edge < _edgeIds.size(); edge++)
+    {
+        auto edgeId = _edgeIds[edge];
+        const auto& e = graph.edgeById(edgeId);
+
+        _edgeIndices[static_cast<size_t>(static_cast<int>(edgeId))] = edge;
+
+        auto source = indexOf(e.sourceId());
+        auto target = indexOf(e.targetId());
+        Q_ASSERT(source != NullIndex && target != NullIndex);
+
+        _edgeSources[edge] = source;
+        _edgeTargets[edge] = target;
+
+        outDegrees[source]++;
+        inDegrees[target]++;
+    }
+
+    _offsets.resize(_nodeIds.size() + 1);
+    _inOffsets.resize(_nodeIds.size());
+
+    Index offset = 0;
+    for(Index node = 0; node < _nodeIds.size(); node++)
+    {
+        _offsets[node] = offset;
+        _inOffsets[node] = offset + outDegrees[node];
+        offset += outDegrees[node] + inDegrees[node];
+    }
+
+    _offsets[_nodeIds.size()] = offset;
+
+    _neighbours.resize(offset);
+    _edges.resize(offset);
+
+    // Reuse the degree vectors as insertion cursors
+    auto& outCursors = outDegrees;
+    auto& inCursors = inDegrees;
+    std::copy(_offsets.begin(), _offsets.end() - 1, outCursors.begin());
+    std::copy(_inOffsets.begin(), _inOffsets.end(), inCursors.begin());
+
+    for(Index edge = 0; edge < _edgeIds.size(); edge++)
+    {
+        auto source = _edgeSources[edge];
+        auto target = _edgeTargets[edge];
+
+        auto outPosition = outCursors[source]++;
+        _neighbours[outPosition] = target;
+        _edges[outPosition] = edge;
+
+        auto inPosition = inCursors[target]++;
+        _neighbours[inPosition] = source;
+        _edges[inPosition] = edge;
+    }
+}
+
+AdjacencySnapshot::Index AdjacencySnapshot::indexOf(NodeId nodeId) const
+{
+    auto i = static_cast<int>(nodeId);
+    if(i < 0 || static_cast<size_t>(i) >= _nodeIndices.size())
+        return NullIndex;
+
+    return _nodeIndices[static_cast<size_t>(i)];
+}
+
+AdjacencySnapshot::Index AdjacencySnapshot::indexOf(EdgeId edgeId) const
+{
+    auto i = static_cast<int>(edgeId);
+    if(i < 0 || static_cast<size_t>(i) >= _edgeIndices.size())
+        return NullIndex;
+
+    return _edgeIndices[static_cast<size_t>(i)];
+}
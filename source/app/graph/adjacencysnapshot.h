@@ -0,0 +1,117 @@
+/* Copyright © 2013-2020 Graphia Technologies Ltd.
+ *
+ * This file is part of Graphia.
+ *
+ * Graphia is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Graphia is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Graphia.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ADJACENCYSNAPSHOT_H
+#define ADJACENCYSNAPSHOT_H
+
+#include "shared/graph/elementid.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+class Graph;
+
+// An immutable compressed sparse row copy of a graph's adjacency, for read only
+// algorithms that traverse the graph many times. Nodes and edges are referred to
+// by dense indices, [0, numNodes()) and [0, numEdges()) respectively, so that any
+// per element state can be kept in plain vectors. The adjacency of each node is
+// stored contiguously, its out edges followed by its in edges, so iterating over
+// neighbours involves no allocation or pointer chasing.
+class AdjacencySnapshot
+{
+public:
+    using Index = uint32_t;
+    static constexpr Index NullIndex = std::numeric_limits<Index>::max();
+
+    template<typename T>
+    class Range
+    {
+    private:
+        const T* _begin = nullptr;
+        const T* _end = nullptr;
+
+    public:
+        Range(const T* begin, const T* end) : _begin(begin), _end(end) {}
+
+        const T* begin() const { return _begin; }
+        const T* end() const { return _end; }
+        size_t size() const { return static_cast<size_t>(_end - _begin); }
+        bool empty() const { return _begin == _end; }
+        const T& operator[](size_t i) const { return _begin[i]; }
+    };
+
+    explicit AdjacencySnapshot(const Graph& graph);
+
+    size_t numNodes() const { return _nodeIds.size(); }
+    size_t numEdges() const { return _edgeIds.size(); }
+
+    // The order of these is the same as the graph's nodeIds() and edgeIds()
+    const std::vector<NodeId>& nodeIds() const { return _nodeIds; }
+    const std::vector<EdgeId>& edgeIds() const { return _edgeIds; }
+
+    NodeId nodeIdOf(Index node) const { return _nodeIds[node]; }
+    EdgeId edgeIdOf(Index edge) const { return _edgeIds[edge]; }
+
+    // NullIndex if the element isn't in the graph
+    Index indexOf(NodeId nodeId) const;
+    Index indexOf(EdgeId edgeId) const;
+
+    Index sourceOf(Index edge) const { return _edgeSources[edge]; }
+    Index targetOf(Index edge) const { return _edgeTargets[edge]; }
+
+    // All of a node's neighbours; the edge connecting the node to neighboursOf(node)[i]
+    // is edgesOf(node)[i]. As with Node::edgeIds(), loops are present twice
+    Range<Index> neighboursOf(Index node) const { return range(_neighbours, _offsets[node], _offsets[node + 1]); }
+    Range<Index> edgesOf(Index node) const { return range(_edges, _offsets[node], _offsets[node + 1]); }
+
+    Range<Index> targetsOf(Index node) const { return range(_neighbours, _offsets[node], _inOffsets[node]); }
+    Range<Index> outEdgesOf(Index node) const { return range(_edges, _offsets[node], _inOffsets[node]); }
+
+    Range<Index> sourcesOf(Index node) const { return range(_neighbours, _inOffsets[node], _offsets[node + 1]); }
+    Range<Index> inEdgesOf(Index node) const { return range(_edges, _inOffsets[node], _offsets[node + 1]); }
+
+    size_t degreeOf(Index node) const { return _offsets[node + 1] - _offsets[node]; }
+    size_t outDegreeOf(Index node) const { return _inOffsets[node] - _offsets[node]; }
+    size_t inDegreeOf(Index node) const { return _offsets[node + 1] - _inOffsets[node]; }
+
+private:
+    std::vector<NodeId> _nodeIds;
+    std::vector<EdgeId> _edgeIds;
+
+    // Indexed by NodeId and EdgeId respectively
+    std::vector<Index> _nodeIndices;
+    std::vector<Index> _edgeIndices;
+
+    std::vector<Index> _edgeSources;
+    std::vector<Index> _edgeTargets;
+
+    // The adjacency of node i is [_offsets[i], _offsets[i + 1]), of which
+    // [_offsets[i], _inOffsets[i]) are out edges and the remainder in edges
+    std::vector<Index> _offsets;
+    std::vector<Index> _inOffsets;
+    std::vector<Index> _neighbours;
+    std::vector<Index> _edges;
+
+    static Range<Index> range(const std::vector<Index>& v, Index begin, Index end)
+    {
+        return {v.data() + begin, v.data() + end};
+    }
+};
+
+#endif // ADJACENCYSNAPSHOT_H
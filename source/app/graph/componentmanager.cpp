@@ -20,20 +20,23 @@
 
 #include "shared/utils/thread.h"
 #include "shared/utils/container.h"
+#include "shared/utils/threadpool.h"
 #include "shared/graph/elementid_debug.h"
 
 #include "graph.h"
 #include "graphcomponent.h"
 
 #include <map>
-#include <queue>
+#include <atomic>
+#include <thread>
 
 ComponentManager::ComponentManager(Graph& graph,
                                    const NodeConditionFn& nodeFilter,
                                    const EdgeConditionFn& edgeFilter) :
     _nextComponentId(0),
     _nodesComponentId(graph),
-    _edgesComponentId(graph)
+    _edgesComponentId(graph),
+    _edgesNodeIds(graph)
 {
     // Ignore all multi-elements
     addNodeFilter([&graph](NodeId nodeId) { return graph.typeOf(nodeId) == MultiElementType::Tail; });
@@ -58,47 +61,161 @@ ComponentManager::~ComponentManager()
         componentArray->invalidate();
 }
 
-ComponentIdSet ComponentManager::assignConnectedElementsComponentId(const Graph* graph,
-        NodeId rootId, ComponentId componentId,
-        NodeArray<ComponentId>& nodesComponentId,
-        EdgeArray<ComponentId>& edgesComponentId)
+namespace
 {
-    std::queue<NodeId> nodeIds;
-    ComponentIdSet oldComponentIdsAffected;
+// Lock free union-find; a root is only ever linked to a root with a smaller
+// index, so concurrent unions can never form a cycle
+class ConcurrentDisjointSet
+{
+private:
+    std::vector<std::atomic<int>> _parents;
+
+public:
+    explicit ConcurrentDisjointSet(size_t size) : _parents(size) {}
 
-    nodeIds.push(rootId);
+    void setParent(int index, int parent) { _parents[index].store(parent, std::memory_order_relaxed); }
 
-    while(!nodeIds.empty())
+    int find(int index)
     {
-        auto nodeId = nodeIds.front();
-        nodeIds.pop();
-        oldComponentIdsAffected.insert(_nodesComponentId[nodeId]);
-        for(auto mergedNodeId : graph->mergedNodeIdsForNodeId(nodeId))
-            nodesComponentId[mergedNodeId] = componentId;
+        auto parent = _parents[index].load();
 
-        for(auto edgeId : graph->edgeIdsForNodeId(nodeId))
+        while(parent != index)
         {
-            if(edgeIdFiltered(edgeId))
-                continue;
+            // Path halving; if another thread beats us to it, that's fine
+            auto grandparent = _parents[parent].load();
 
-            for(auto mergedEdgeId : graph->mergedEdgeIdsForEdgeId(edgeId))
-                edgesComponentId[mergedEdgeId] = componentId;
+            if(grandparent != parent)
+                _parents[index].compare_exchange_weak(parent, grandparent);
 
-            auto oppositeNodeId = graph->edgeById(edgeId).oppositeId(nodeId);
+            index = grandparent;
+            parent = _parents[index].load();
+        }
 
-            if(nodesComponentId[oppositeNodeId] != componentId)
-            {
-                nodeIds.push(oppositeNodeId);
-                for(auto mergedNodeId : graph->mergedNodeIdsForNodeId(oppositeNodeId))
-                    nodesComponentId[mergedNodeId] = componentId;
-            }
+        return index;
+    }
+
+    void unite(int a, int b)
+    {
+        while(true)
+        {
+            a = find(a);
+            b = find(b);
+
+            if(a == b)
+                return;
+
+            if(a < b)
+                std::swap(a, b);
+
+            // Fails if a has since been linked by another thread, in which case try again
+            auto expected = a;
+            if(_parents[a].compare_exchange_strong(expected, b))
+                return;
         }
     }
+};
+} // namespace
+
+// Labels each node with a representative node of its connected component. Components that
+// have lost nothing since the last update remain connected, so their nodes start out in a
+// single set and only edges that have been added need considering; only the nodes of
+// components that may have split are relabelled from scratch
+std::vector<int> ComponentManager::labelConnectedNodes(const Graph* graph,
+        std::vector<bool>& brokenComponentIds, std::vector<EdgeId>& unitedEdgeIds)
+{
+    brokenComponentIds.assign(static_cast<size_t>(componentArrayCapacity()), false);
+
+    auto edgeUnchanged = [this, graph](EdgeId edgeId)
+    {
+        const auto& edge = graph->edgeById(edgeId);
+        const auto& edgeNodeIds = _edgesNodeIds[edgeId];
+
+        return !_edgesComponentId[edgeId].isNull() &&
+            edge.sourceId() == edgeNodeIds._sourceId &&
+            edge.targetId() == edgeNodeIds._targetId;
+    };
+
+    auto intact = [&brokenComponentIds](ComponentId componentId)
+    {
+        return !componentId.isNull() && !brokenComponentIds[static_cast<int>(componentId)];
+    };
 
-    // We don't count nodes that haven't yet been assigned a component
-    oldComponentIdsAffected.erase(ComponentId());
+    for(NodeId nodeId(0); nodeId < _nodesComponentId.size(); ++nodeId)
+    {
+        auto componentId = _nodesComponentId[nodeId];
+        if(!componentId.isNull() && !graph->containsNodeId(nodeId))
+            brokenComponentIds[static_cast<int>(componentId)] = true;
+    }
 
-    return oldComponentIdsAffected;
+    for(EdgeId edgeId(0); edgeId < _edgesComponentId.size(); ++edgeId)
+    {
+        auto componentId = _edgesComponentId[edgeId];
+        if(!componentId.isNull() && (!graph->containsEdgeId(edgeId) || !edgeUnchanged(edgeId)))
+            brokenComponentIds[static_cast<int>(componentId)] = true;
+    }
+
+    ConcurrentDisjointSet disjointSet(static_cast<size_t>(_nodesComponentId.size()));
+
+    for(NodeId nodeId(0); nodeId < _nodesComponentId.size(); ++nodeId)
+        disjointSet.setParent(static_cast<int>(nodeId), static_cast<int>(nodeId));
+
+    // Nodes that are merged into others aren't listed by their GraphComponent; they are
+    // joined to their heads below, which also accounts for any merges that have occurred
+    for(auto componentId : _componentIds)
+    {
+        if(!intact(componentId))
+            continue;
+
+        const auto& componentNodeIds = componentFor(componentId)->nodeIds();
+        Q_ASSERT(!componentNodeIds.empty());
+        auto representative = static_cast<int>(componentNodeIds.front());
+
+        for(auto nodeId : componentNodeIds)
+            disjointSet.setParent(static_cast<int>(nodeId), representative);
+    }
+
+    const auto& nodeIds = graph->nodeIds();
+    const auto& edgeIds = graph->edgeIds();
+
+    concurrent_for(nodeIds.begin(), nodeIds.end(),
+    [&](NodeId nodeId)
+    {
+        if(graph->typeOf(nodeId) != MultiElementType::Head)
+            return;
+
+        for(auto mergedNodeId : graph->mergedNodeIdsForNodeId(nodeId))
+            disjointSet.unite(static_cast<int>(nodeId), static_cast<int>(mergedNodeId));
+    });
+
+    std::vector<std::vector<EdgeId>> threadUnitedEdgeIds(std::thread::hardware_concurrency());
+
+    concurrent_for(edgeIds.begin(), edgeIds.end(),
+    [&](EdgeId edgeId, size_t threadIndex)
+    {
+        if(edgeIdFiltered(edgeId))
+            return;
+
+        if(intact(_edgesComponentId[edgeId]) && edgeUnchanged(edgeId))
+            return;
+
+        const auto& edge = graph->edgeById(edgeId);
+        disjointSet.unite(static_cast<int>(edge.sourceId()), static_cast<int>(edge.targetId()));
+        threadUnitedEdgeIds.at(threadIndex).push_back(edgeId);
+    });
+
+    unitedEdgeIds.clear();
+    for(const auto& edgeIdsForThread : threadUnitedEdgeIds)
+        unitedEdgeIds.insert(unitedEdgeIds.end(), edgeIdsForThread.begin(), edgeIdsForThread.end());
+
+    std::vector<int> labels(static_cast<size_t>(_nodesComponentId.size()));
+
+    concurrent_for(nodeIds.begin(), nodeIds.end(),
+    [&](NodeId nodeId)
+    {
+        labels[static_cast<int>(nodeId)] = disjointSet.find(static_cast<int>(nodeId));
+    });
+
+    return labels;
 }
 
 void ComponentManager::insertComponentArray(IGraphArray* componentArray)
@@ -117,6 +234,12 @@ void ComponentManager::update(const Graph* graph)
 {
     if(_debug) qDebug() << "ComponentManager::update begins" << this;
 
+    // Only this function writes the state the labelling depends on, so it
+    // can be done in parallel before taking the lock that readers contend for
+    std::vector<bool> changedComponentIds;
+    std::vector<EdgeId> unitedEdgeIds;
+    auto labels = labelConnectedNodes(graph, changedComponentIds, unitedEdgeIds);
+
     std::unique_lock<std::recursive_mutex> lock(_updateMutex);
 
     std::map<ComponentId, ComponentIdSet> splitComponents;
@@ -128,6 +251,55 @@ void ComponentManager::update(const Graph* graph)
     NodeArray<ComponentId> newNodesComponentId(*graph);
     EdgeArray<ComponentId> newEdgesComponentId(*graph);
 
+    // Find the old component IDs that each new component encompasses; these are
+    // only ever plural when components merge, so they're stored separately
+    std::vector<ComponentId> labelsOldComponentId(labels.size());
+    std::map<int, ComponentIdSet> labelsOldComponentIds;
+
+    auto addOldComponentId = [&](NodeId nodeId)
+    {
+        auto oldComponentId = _nodesComponentId[nodeId];
+
+        // We don't count nodes that haven't yet been assigned a component
+        if(oldComponentId.isNull())
+            return;
+
+        auto label = labels[static_cast<int>(nodeId)];
+        auto& labelOldComponentId = labelsOldComponentId[label];
+
+        if(labelOldComponentId.isNull())
+            labelOldComponentId = oldComponentId;
+        else if(labelOldComponentId != oldComponentId)
+        {
+            auto& oldComponentIds = labelsOldComponentIds[label];
+            oldComponentIds.insert(labelOldComponentId);
+            oldComponentIds.insert(oldComponentId);
+        }
+    };
+
+    for(auto nodeId : graph->nodeIds())
+    {
+        if(!nodeIdFiltered(nodeId))
+            addOldComponentId(nodeId);
+    }
+
+    for(auto edgeId : unitedEdgeIds)
+    {
+        const auto& edge = graph->edgeById(edgeId);
+
+        for(auto nodeId : {edge.sourceId(), edge.targetId()})
+        {
+            addOldComponentId(nodeId);
+
+            // Components that have gained edges need their GraphComponent rebuilt
+            auto oldComponentId = _nodesComponentId[nodeId];
+            if(!oldComponentId.isNull())
+                changedComponentIds[static_cast<int>(oldComponentId)] = true;
+        }
+    }
+
+    std::vector<ComponentId> labelsComponentId(labels.size());
+
     // Search for mergers and splitters
     for(auto nodeId : graph->nodeIds())
     {
@@ -135,38 +307,41 @@ void ComponentManager::update(const Graph* graph)
             continue;
 
         auto oldComponentId = _nodesComponentId[nodeId];
+        auto label = labels[static_cast<int>(nodeId)];
+        auto& componentId = labelsComponentId[label];
 
-        if(newNodesComponentId[nodeId].isNull() && !oldComponentId.isNull())
+        if(componentId.isNull() && !oldComponentId.isNull())
         {
             if(u::contains(componentIds, oldComponentId))
             {
                 // We have already used this ID so this is a component that has split
-                auto newComponentId = generateComponentId();
-                componentIds.insert(newComponentId);
-                assignConnectedElementsComponentId(graph, nodeId, newComponentId,
-                                                   newNodesComponentId, newEdgesComponentId);
+                componentId = generateComponentId();
+                componentIds.insert(componentId);
 
                 queueGraphComponentUpdate(graph, oldComponentId);
-                queueGraphComponentUpdate(graph, newComponentId);
+                queueGraphComponentUpdate(graph, componentId);
 
                 splitComponents[oldComponentId].insert(oldComponentId);
-                splitComponents[oldComponentId].insert(newComponentId);
-                splitComponentIds.insert(newComponentId);
+                splitComponents[oldComponentId].insert(componentId);
+                splitComponentIds.insert(componentId);
             }
             else
             {
+                componentId = oldComponentId;
                 componentIds.insert(oldComponentId);
-                auto componentIdsAffected = assignConnectedElementsComponentId(graph, nodeId, oldComponentId,
-                                                                               newNodesComponentId, newEdgesComponentId);
-                queueGraphComponentUpdate(graph, oldComponentId);
 
-                if(componentIdsAffected.size() > 1)
+                if(u::contains(labelsOldComponentIds, label))
                 {
                     // More than one old component IDs were observed so components have merged
+                    auto& componentIdsAffected = labelsOldComponentIds.at(label);
                     mergedComponents[oldComponentId].insert(componentIdsAffected.begin(), componentIdsAffected.end());
                     componentIdsAffected.erase(oldComponentId);
                     mergedComponentIds.insert(componentIdsAffected.begin(), componentIdsAffected.end());
+
+                    queueGraphComponentUpdate(graph, oldComponentId);
                 }
+                else if(changedComponentIds[static_cast<int>(oldComponentId)])
+                    queueGraphComponentUpdate(graph, oldComponentId);
             }
         }
     }
@@ -177,15 +352,33 @@ void ComponentManager::update(const Graph* graph)
         if(nodeIdFiltered(nodeId))
             continue;
 
-        if(newNodesComponentId[nodeId].isNull() && _nodesComponentId[nodeId].isNull())
+        auto& componentId = labelsComponentId[labels[static_cast<int>(nodeId)]];
+
+        if(componentId.isNull() && _nodesComponentId[nodeId].isNull())
         {
-            auto newComponentId = generateComponentId();
-            componentIds.insert(newComponentId);
-            assignConnectedElementsComponentId(graph, nodeId, newComponentId, newNodesComponentId, newEdgesComponentId);
-            queueGraphComponentUpdate(graph, newComponentId);
+            componentId = generateComponentId();
+            componentIds.insert(componentId);
+            queueGraphComponentUpdate(graph, componentId);
         }
     }
 
+    for(auto nodeId : graph->nodeIds())
+        newNodesComponentId[nodeId] = labelsComponentId[labels[static_cast<int>(nodeId)]];
+
+    for(auto edgeId : graph->edgeIds())
+    {
+        const auto& edge = graph->edgeById(edgeId);
+        _edgesNodeIds[edgeId] = {edge.sourceId(), edge.targetId()};
+
+        if(edgeIdFiltered(edgeId))
+            continue;
+
+        auto componentId = newNodesComponentId[edge.sourceId()];
+
+        for(auto mergedEdgeId : graph->mergedEdgeIdsForEdgeId(edgeId))
+            newEdgesComponentId[mergedEdgeId] = componentId;
+    }
+
     // Resize the component arrays
     for(auto* componentArray : _componentArrays)
         componentArray->resize(componentArrayCapacity());
@@ -353,37 +546,39 @@ void ComponentManager::queueGraphComponentUpdate(const Graph* graph, ComponentId
 
 void ComponentManager::updateGraphComponents(const Graph* graph)
 {
-    for(auto componentId : _componentIds)
+    if(_updatesRequired.empty())
+        return;
+
+    std::vector<bool> updateRequired(static_cast<size_t>(componentArrayCapacity()), false);
+
+    for(auto componentId : _updatesRequired)
     {
-        if(u::contains(_updatesRequired, componentId))
-        {
-            auto* graphComponent = componentFor(componentId);
+        updateRequired[static_cast<int>(componentId)] = true;
 
-            graphComponent->_nodeIds.clear();
-            graphComponent->_edgeIds.clear();
-        }
+        auto* graphComponent = componentFor(componentId);
+
+        graphComponent->_nodeIds.clear();
+        graphComponent->_edgeIds.clear();
     }
 
     for(auto nodeId : graph->nodeIds())
     {
-        if(nodeIdFiltered(nodeId))
-            continue;
-
         auto componentId = _nodesComponentId[nodeId];
 
-        if(u::contains(_updatesRequired, componentId))
-            componentFor(componentId)->_nodeIds.push_back(nodeId);
+        if(componentId.isNull() || !updateRequired[static_cast<int>(componentId)] || nodeIdFiltered(nodeId))
+            continue;
+
+        componentFor(componentId)->_nodeIds.push_back(nodeId);
     }
 
     for(auto edgeId : graph->edgeIds())
     {
-        if(edgeIdFiltered(edgeId))
-            continue;
-
         auto componentId = _edgesComponentId[edgeId];
 
-        if(u::contains(_updatesRequired, componentId))
-            componentFor(componentId)->_edgeIds.push_back(edgeId);
+        if(componentId.isNull() || !updateRequired[static_cast<int>(componentId)] || edgeIdFiltered(edgeId))
+            continue;
+
+        componentFor(componentId)->_edgeIds.push_back(edgeId);
     }
 }
 
@@ -95,6 +95,16 @@ private:
     NodeArray<ComponentId> _nodesComponentId;
     EdgeArray<ComponentId> _edgesComponentId;
 
+    // The nodes each edge connected when components were last assigned; this
+    // allows us to spot edges that have been removed then re-added elsewhere
+    struct EdgeNodeIds
+    {
+        NodeId _sourceId;
+        NodeId _targetId;
+    };
+
+    EdgeArray<EdgeNodeIds> _edgesNodeIds;
+
     mutable std::recursive_mutex _updateMutex;
 
     std::mutex _componentArraysMutex;
@@ -115,9 +125,8 @@ private:
 
     void update(const Graph* graph);
     int componentArrayCapacity() const { return static_cast<int>(_nextComponentId); }
-    ComponentIdSet assignConnectedElementsComponentId(const Graph* graph, NodeId rootId, ComponentId componentId,
-                                                      NodeArray<ComponentId>& nodesComponentId,
-                                                      EdgeArray<ComponentId>& edgesComponentId);
+    std::vector<int> labelConnectedNodes(const Graph* graph, std::vector<bool>& brokenComponentIds,
+                                         std::vector<EdgeId>& unitedEdgeIds);
 
     void insertComponentArray(IGraphArray* componentArray);
     void eraseComponentArray(IGraphArray* componentArray);
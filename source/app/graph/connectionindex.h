@@ -0,0 +1,175 @@
+/* Copyright © 2013-2020 Graphia Technologies Ltd.
+ *
+ * This file is part of Graphia.
+ *
+ * Graphia is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Graphia is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Graphia.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONNECTIONINDEX_H
+#define CONNECTIONINDEX_H
+
+#include "shared/graph/elementid.h"
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+// Maps each unordered pair of nodes to the head of the (merged) set of edges that
+// connect them; this is an open addressed hash table with linear probing, so that
+// lookups are typically a single cache line, and there is no per entry allocation
+class ConnectionIndex
+{
+private:
+    using Key = uint64_t;
+
+    static constexpr Key EmptyKey = ~Key(0);
+
+    struct Slot
+    {
+        Key _key = EmptyKey;
+        EdgeId _head;
+    };
+
+    std::vector<Slot> _slots;
+    size_t _size = 0;
+
+    static Key keyFor(NodeId nodeIdA, NodeId nodeIdB)
+    {
+        auto a = static_cast<uint32_t>(static_cast<int>(nodeIdA));
+        auto b = static_cast<uint32_t>(static_cast<int>(nodeIdB));
+        auto [lo, hi] = std::minmax(a, b);
+
+        return (static_cast<Key>(lo) << 32u) | hi;
+    }
+
+    // The splitmix64 finaliser; node ids are dense and sequential, so
+    // they need thorough mixing before being used to pick a slot
+    static size_t hash(Key key)
+    {
+        key = (key ^ (key >> 30u)) * 0xbf58476d1ce4e5b9ull;
+        key = (key ^ (key >> 27u)) * 0x94d049bb133111ebull;
+        return static_cast<size_t>(key ^ (key >> 31u));
+    }
+
+    size_t mask() const { return _slots.size() - 1; }
+
+    // Either the slot containing key, or the empty slot where it would go
+    size_t slotFor(Key key) const
+    {
+        auto slot = hash(key) & mask();
+
+        while(_slots[slot]._key != key && _slots[slot]._key != EmptyKey)
+            slot = (slot + 1) & mask();
+
+        return slot;
+    }
+
+    void rehash(size_t numSlots)
+    {
+        std::vector<Slot> oldSlots(numSlots);
+        std::swap(_slots, oldSlots);
+
+        for(const auto& oldSlot : oldSlots)
+        {
+            if(oldSlot._key != EmptyKey)
+                _slots[slotFor(oldSlot._key)] = oldSlot;
+        }
+    }
+
+public:
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    void clear()
+    {
+        _slots.clear();
+        _size = 0;
+    }
+
+    // Ensure that size entries can be held without rehashing
+    void reserve(size_t size)
+    {
+        // Keep the load factor at or below 0.5
+        size_t numSlots = 16;
+        while(numSlots < size * 2)
+            numSlots *= 2;
+
+        if(numSlots > _slots.size())
+            rehash(numSlots);
+    }
+
+    // The head of the edges between the nodes, or null if there are none
+    EdgeId find(NodeId nodeIdA, NodeId nodeIdB) const
+    {
+        if(_size == 0)
+            return {};
+
+        return _slots[slotFor(keyFor(nodeIdA, nodeIdB))]._head;
+    }
+
+    // The head of the edges between the nodes, for modification; if the
+    // pair isn't yet present, a null head is added. Note that the reference
+    // is invalidated by any subsequent insertion
+    EdgeId& operator()(NodeId nodeIdA, NodeId nodeIdB)
+    {
+        // Grow only once the load factor would exceed 0.5, as per reserve(...)
+        if((_size + 1) * 2 > _slots.size())
+            rehash(std::max(_slots.size() * 2, static_cast<size_t>(16)));
+
+        auto key = keyFor(nodeIdA, nodeIdB);
+        auto& slot = _slots[slotFor(key)];
+
+        if(slot._key == EmptyKey)
+        {
+            slot._key = key;
+            slot._head.setToNull();
+            _size++;
+        }
+
+        return slot._head;
+    }
+
+    void erase(NodeId nodeIdA, NodeId nodeIdB)
+    {
+        if(_size == 0)
+            return;
+
+        auto slot = slotFor(keyFor(nodeIdA, nodeIdB));
+        if(_slots[slot]._key == EmptyKey)
+            return;
+
+        // Shift subsequent entries of the probe sequence back into the gap, so
+        // that no tombstones are needed and lookups never degrade over time
+        auto gap = slot;
+        for(auto next = (gap + 1) & mask(); _slots[next]._key != EmptyKey; next = (next + 1) & mask())
+        {
+            auto ideal = hash(_slots[next]._key) & mask();
+
+            // Only move the entry if the gap lies cyclically within [ideal, next)
+            if(((next - ideal) & mask()) >= ((next - gap) & mask()))
+            {
+                _slots[gap] = _slots[next];
+                gap = next;
+            }
+        }
+
+        _slots[gap] = Slot();
+        _size--;
+    }
+
+    size_t memoryUsage() const { return _slots.capacity() * sizeof(Slot); }
+};
+
+#endif // CONNECTIONINDEX_H
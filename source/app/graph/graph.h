@@ -35,6 +35,7 @@
 
 class GraphComponent;
 class ComponentManager;
+class AdjacencySnapshot;
 class ComponentSplitSet;
 class ComponentMergeSet;
 
@@ -235,6 +236,10 @@ public:
     std::vector<NodeId> targetsOf(NodeId nodeId) const override;
     std::vector<NodeId> neighboursOf(NodeId nodeId) const override;
 
+    // A compact, immutable copy of the graph's adjacency, as of its last update; it
+    // is built on first use, then shared by all callers until the graph next changes
+    virtual std::shared_ptr<const AdjacencySnapshot> adjacencySnapshot() const;
+
     // Call this to ensure the Graph is in a consistent state
     // Usually it is called automatically and is generally only
     // necessary when accessing the Graph before changes have
@@ -266,6 +271,9 @@ private:
 
     std::unique_ptr<ComponentManager> _componentManager;
 
+    mutable std::mutex _adjacencySnapshotMutex;
+    mutable std::shared_ptr<const AdjacencySnapshot> _adjacencySnapshot;
+
     mutable std::recursive_mutex _phaseMutex;
     mutable QString _phase;
     mutable QString _subPhase;
@@ -295,6 +303,8 @@ protected:
 
     void clear();
 
+    void invalidateAdjacencySnapshot();
+
 signals:
     // The signals are listed here in the order in which they are emitted
     void graphWillChange(const Graph*) const;
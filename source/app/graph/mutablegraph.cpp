@@ -22,6 +22,10 @@
 #include "componentmanager.h"
 
 #include "shared/utils/container.h"
+#include "shared/utils/threadpool.h"
+
+#include <array>
+#include <functional>
 
 MutableGraph::MutableGraph(const MutableGraph& other)
 {
@@ -98,10 +102,10 @@ std::vector<EdgeId> MutableGraph::edgeIdsBetween(NodeId nodeIdA, NodeId nodeIdB)
 {
     std::vector<EdgeId> edgeIds;
 
-    auto undirectedEdge = UndirectedEdge(nodeIdA, nodeIdB);
-    if(u::contains(_e._connections, undirectedEdge))
+    auto head = _e._connections.find(nodeIdA, nodeIdB);
+    if(!head.isNull())
     {
-        const auto& edgeIdDistinctSet = _e._connections.at(undirectedEdge);
+        ConstEdgeIdDistinctSet edgeIdDistinctSet(head, &_e._mergedEdgeIds);
         std::copy(edgeIdDistinctSet.begin(), edgeIdDistinctSet.end(), std::back_inserter(edgeIds));
     }
 
@@ -110,6 +114,13 @@ std::vector<EdgeId> MutableGraph::edgeIdsBetween(NodeId nodeIdA, NodeId nodeIdB)
 
 EdgeId MutableGraph::firstEdgeIdBetween(NodeId nodeIdA, NodeId nodeIdB) const
 {
+    auto head = _e._connections.find(nodeIdA, nodeIdB);
+
+    // Almost always the nodes are connected by no more than one edge
+    if(head.isNull() || _e._mergedEdgeIds.typeOf(head) == MultiElementType::Not)
+        return head;
+
+    // Otherwise, prefer edges in the direction A -> B
     const auto& nodeA = nodeById(nodeIdA);
 
     for(auto edgeId : nodeA._outEdgeIds)
@@ -129,7 +140,7 @@ EdgeId MutableGraph::firstEdgeIdBetween(NodeId nodeIdA, NodeId nodeIdB) const
 
 bool MutableGraph::edgeExistsBetween(NodeId nodeIdA, NodeId nodeIdB) const
 {
-    return !firstEdgeIdBetween(nodeIdA, nodeIdB).isNull();
+    return !_e._connections.find(nodeIdA, nodeIdB).isNull();
 }
 
 NodeId MutableGraph::addNode()
@@ -230,6 +241,62 @@ NodeId MutableGraph::addNode(const INode& node)
     return addNode(node.id());
 }
 
+std::vector<NodeId> MutableGraph::addNewNodes(size_t numNodes)
+{
+    std::vector<NodeId> nodeIds;
+
+    if(numNodes == 0)
+        return nodeIds;
+
+    nodeIds.reserve(numNodes);
+
+    beginTransaction();
+
+    // Reuse any vacated IDs first, as addNode does...
+    while(!_unusedNodeIds.empty() && nodeIds.size() < numNodes)
+    {
+        auto nodeId = _unusedNodeIds.front();
+        _unusedNodeIds.pop_front();
+
+        if(nodeId < nextNodeId() && !containsNodeId(nodeId))
+        {
+            claimNodeId(nodeId);
+            nodeIds.push_back(nodeId);
+        }
+    }
+
+    // ...then allocate the remainder as a single block
+    if(nodeIds.size() < numNodes)
+    {
+        auto firstNodeId = nextNodeId();
+        auto numNewNodeIds = static_cast<int>(numNodes - nodeIds.size());
+
+        Graph::reserveNodeId(firstNodeId + (numNewNodeIds - 1));
+        _n.resize(static_cast<int>(nextNodeId()));
+
+        for(auto nodeId = firstNodeId; nodeId < nextNodeId(); ++nodeId)
+        {
+            claimNodeId(nodeId);
+            nodeIds.push_back(nodeId);
+        }
+    }
+
+    for(auto nodeId : nodeIds)
+    {
+        auto& node = nodeBy(nodeId);
+        node._id = nodeId;
+        node._inEdgeIds.setCollection(&_e._inEdgeIdsCollection);
+        node._outEdgeIds.setCollection(&_e._outEdgeIdsCollection);
+
+        emit nodeAdded(this, nodeId);
+    }
+
+    _updateRequired = true;
+    endTransaction();
+
+    return nodeIds;
+}
+
 void MutableGraph::removeNode(NodeId nodeId)
 {
     Q_ASSERT(containsNodeId(nodeId));
@@ -393,11 +460,8 @@ EdgeId MutableGraph::addEdge(EdgeId edgeId, NodeId sourceId, NodeId targetId)
     nodeBy(sourceId)._outEdgeIds.add(edgeId);
     nodeBy(targetId)._inEdgeIds.add(edgeId);
 
-    auto undirectedEdge = UndirectedEdge(sourceId, targetId);
-    if(!u::contains(_e._connections, undirectedEdge))
-        _e._connections.emplace(undirectedEdge, EdgeIdDistinctSet(&_e._mergedEdgeIds));
-
-    _e._connections[undirectedEdge].add(edgeId);
+    auto& connection = _e._connections(sourceId, targetId);
+    connection = _e._mergedEdgeIds.add(connection, edgeId);
 
     emit edgeAdded(this, edgeId);
     _updateRequired = true;
@@ -411,6 +475,94 @@ EdgeId MutableGraph::addEdge(const IEdge& edge)
     return addEdge(edge.id(), edge.sourceId(), edge.targetId());
 }
 
+std::vector<EdgeId> MutableGraph::addEdges(const EdgeList& edges)
+{
+    std::vector<EdgeId> edgeIds;
+
+    if(edges.empty())
+        return edgeIds;
+
+    edgeIds.reserve(edges.size());
+
+    beginTransaction();
+
+    while(!_unusedEdgeIds.empty() && edgeIds.size() < edges.size())
+    {
+        auto edgeId = _unusedEdgeIds.front();
+        _unusedEdgeIds.pop_front();
+
+        if(edgeId < nextEdgeId() && !containsEdgeId(edgeId))
+        {
+            claimEdgeId(edgeId);
+            edgeIds.push_back(edgeId);
+        }
+    }
+
+    if(edgeIds.size() < edges.size())
+    {
+        auto firstEdgeId = nextEdgeId();
+        auto numNewEdgeIds = static_cast<int>(edges.size() - edgeIds.size());
+
+        Graph::reserveEdgeId(firstEdgeId + (numNewEdgeIds - 1));
+        _e.resize(static_cast<int>(nextEdgeId()));
+
+        for(auto edgeId = firstEdgeId; edgeId < nextEdgeId(); ++edgeId)
+        {
+            claimEdgeId(edgeId);
+            edgeIds.push_back(edgeId);
+        }
+    }
+
+    for(size_t i = 0; i < edges.size(); i++)
+    {
+        Q_ASSERT(containsNodeId(edges[i]._source));
+        Q_ASSERT(containsNodeId(edges[i]._target));
+
+        auto& edge = edgeBy(edgeIds[i]);
+        edge._id = edgeIds[i];
+        edge._sourceId = edges[i]._source;
+        edge._targetId = edges[i]._target;
+    }
+
+    // The out lists, in lists and connections are entirely separate structures,
+    // so they can be built concurrently; within each, edges are added in the
+    // same order as a sequence of addEdge calls would add them
+    const std::array<std::function<void()>, 3> passes =
+    {{
+        [&]
+        {
+            for(size_t i = 0; i < edges.size(); i++)
+                nodeBy(edges[i]._source)._outEdgeIds.add(edgeIds[i]);
+        },
+        [&]
+        {
+            for(size_t i = 0; i < edges.size(); i++)
+                nodeBy(edges[i]._target)._inEdgeIds.add(edgeIds[i]);
+        },
+        [&]
+        {
+            _e._connections.reserve(_e._connections.size() + edges.size());
+
+            for(size_t i = 0; i < edges.size(); i++)
+            {
+                auto& connection = _e._connections(edges[i]._source, edges[i]._target);
+                connection = _e._mergedEdgeIds.add(connection, edgeIds[i]);
+            }
+        }
+    }};
+
+    concurrent_for(passes.begin(), passes.end(),
+    [](const std::function<void()>& pass) { pass(); });
+
+    for(auto edgeId : edgeIds)
+        emit edgeAdded(this, edgeId);
+
+    _updateRequired = true;
+    endTransaction();
+
+    return edgeIds;
+}
+
 void MutableGraph::removeEdge(EdgeId edgeId)
 {
     Q_ASSERT(containsEdgeId(edgeId));
@@ -423,13 +575,12 @@ void MutableGraph::removeEdge(EdgeId edgeId)
     nodeBy(edge.sourceId())._outEdgeIds.remove(edgeId);
     nodeBy(edge.targetId())._inEdgeIds.remove(edgeId);
 
-    auto undirectedEdge = UndirectedEdge(edge.sourceId(), edge.targetId());
-    auto& connection = _e._connections[undirectedEdge];
-    Q_ASSERT(!connection.empty());
-    connection.remove(edgeId);
+    auto& connection = _e._connections(edge.sourceId(), edge.targetId());
+    Q_ASSERT(!connection.isNull());
+    connection = _e._mergedEdgeIds.remove(connection, edgeId);
 
-    if(connection.empty())
-        _e._connections.erase(undirectedEdge);
+    if(connection.isNull())
+        _e._connections.erase(edge.sourceId(), edge.targetId());
 
     releaseEdgeId(edgeId);
     _unusedEdgeIds.push_back(edgeId);
@@ -550,9 +701,6 @@ MutableGraph& MutableGraph::clone(const MutableGraph& other)
         node._outEdgeIds.setCollection(&_e._outEdgeIdsCollection);
     }
 
-    for(auto& connection : _e._connections)
-        connection.second.setCollection(&_e._mergedEdgeIds);
-
     // Signal all the changes based on the diff before we cloned
     for(NodeId nodeId : diff._nodesAdded)
         emit nodeAdded(this, nodeId);
@@ -620,6 +768,30 @@ MutableGraph::Diff MutableGraph::diffTo(const MutableGraph& other)
     return diff;
 }
 
+size_t MutableGraph::memoryUsage() const
+{
+    const auto numNodeIds = static_cast<size_t>(static_cast<int>(nextNodeId()));
+    const auto numEdgeIds = static_cast<size_t>(static_cast<int>(nextEdgeId()));
+
+    // Each entry in a distinct set collection is three ids
+    const size_t nodeSetEntrySize = 3 * sizeof(NodeId);
+    const size_t edgeSetEntrySize = 3 * sizeof(EdgeId);
+
+    size_t bytes = 0;
+
+    bytes += numNodeIds * (sizeof(Node) + sizeof(int) + nodeSetEntrySize);
+    bytes += numNodeIds / 8;
+    bytes += (_nodeIds.size() + _unusedNodeIds.size()) * sizeof(NodeId);
+
+    // The merged, in and out edge collections
+    bytes += numEdgeIds * (sizeof(Edge) + sizeof(int) + (3 * edgeSetEntrySize));
+    bytes += numEdgeIds / 8;
+    bytes += (_edgeIds.size() + _unusedEdgeIds.size()) * sizeof(EdgeId);
+    bytes += _e._connections.memoryUsage();
+
+    return bytes;
+}
+
 void MutableGraph::beginTransaction()
 {
     if(_graphChangeDepth++ <= 0)
@@ -650,6 +822,7 @@ bool MutableGraph::update()
         return false;
 
     _updateRequired = false;
+    invalidateAdjacencySnapshot();
 
     _nodeIds.clear();
     _unusedNodeIds.clear();
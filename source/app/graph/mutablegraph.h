@@ -20,14 +20,13 @@
 #define MUTABLEGRAPH_H
 
 #include "graph.h"
+#include "connectionindex.h"
 
 #include "shared/graph/imutablegraph.h"
-#include "shared/graph/undirectededge.h"
 
 #include <deque>
 #include <mutex>
 #include <vector>
-#include <map>
 
 class MutableGraph : public Graph, public virtual IMutableGraph
 {
@@ -77,7 +76,8 @@ private:
         EdgeIdDistinctSetCollection _inEdgeIdsCollection;
         EdgeIdDistinctSetCollection _outEdgeIdsCollection;
 
-        std::map<UndirectedEdge, EdgeIdDistinctSet> _connections;
+        // The heads of the sets (in _mergedEdgeIds) of edges between each pair of nodes
+        ConnectionIndex _connections;
 
         void resize(std::size_t size)
         {
@@ -143,6 +143,7 @@ public:
     NodeId addNode() override;
     NodeId addNode(NodeId nodeId) override;
     NodeId addNode(const INode& node) override;
+    std::vector<NodeId> addNewNodes(size_t numNodes) override;
     void removeNode(NodeId nodeId) override;
 
     const std::vector<EdgeId>& edgeIds() const override;
@@ -181,6 +182,8 @@ public:
     EdgeId addEdge(NodeId sourceId, NodeId targetId) override;
     EdgeId addEdge(EdgeId edgeId, NodeId sourceId, NodeId targetId) override;
     EdgeId addEdge(const IEdge& edge) override;
+    using IMutableGraph::addEdges;
+    std::vector<EdgeId> addEdges(const EdgeList& edges) override;
     void removeEdge(EdgeId edgeId) override;
 
     void contractEdge(EdgeId edgeId) override;
@@ -207,6 +210,9 @@ public:
 
     Diff diffTo(const MutableGraph& other);
 
+    // An approximation of the heap memory used by the graph's structures
+    size_t memoryUsage() const;
+
     bool update() override;
 
 private:
@@ -15,47 +15,57 @@
  * You should have received a copy of the GNU General Public License
  * along with Graphia.  If not, see <http://www.gnu.org/licenses/>.
  */
-
 #ifndef BARNESHUTTREE_H
 #define BARNESHUTTREE_H
 
-#include "spatialtree.h"
-#include "shared/utils/fixedsizestack.h"
+#include "shared/utils/threadpool.h"
+#include "shared/utils/scopetimer.h"
 
 #include <QVector3D>
 
-#include <functional>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cstdint>
 
-class AbstractBarnesHutTree : virtual public AbstractSpatialTree
+// A linear quadtree or octree, for approximating n-body interactions. Points are
+// sorted by their Morton code, so that each cell of the tree covers a contiguous
+// range of the sorted points, and the cells themselves are stored in flat arrays,
+// parents before children. Points are identified by their index in the arrays
+// the tree is built from.
+template<size_t NumDimensions>
+class BarnesHutTree
 {
-public:
-    virtual QVector3D evaluateKernel(const NodeLayoutPositions& nodePositions, NodeId nodeId,
-        const std::function<QVector3D(int, const QVector3D&, float)>& kernel) const = 0;
-};
+private:
+    static_assert(NumDimensions == 2 || NumDimensions == 3);
 
-template<size_t NumDimensions>
-class BarnesHutTree;
+    static constexpr size_t NumChildren = size_t{1} << NumDimensions;
+    static constexpr uint64_t ChildMask = NumChildren - 1;
 
-template<size_t NumDimensions>
-struct BarnesHutSubVolume : SubVolume<BarnesHutTree<NumDimensions>, NumDimensions> { float _sSq = 0.0f; };
+    // The number of bits per dimension in a Morton code, which is also the maximum depth
+    static constexpr int MaxDepth = NumDimensions == 3 ? 21 : 31;
+
+    // A depth first traversal never has more than this many cells pending
+    static constexpr size_t MaxStackSize = (MaxDepth * (NumChildren - 1)) + 1;
+
+    // Points are sorted in chunks of this size, which are then merged
+    static constexpr size_t SortChunkSize = 1u << 14;
+
+    // Passes over fewer points or cells than this aren't worth distributing over threads
+    static constexpr size_t MinimumConcurrentSize = 1024;
 
-template<size_t NumDimensions>
-class BarnesHutTree :
-    public SpatialTree<BarnesHutTree<NumDimensions>, NumDimensions, BarnesHutSubVolume<NumDimensions>>,
-    public AbstractBarnesHutTree
-{
-private:
     static constexpr float E = 0.0001f;
     static constexpr float E2 = E * E;
 
     // Cycle through different epsilon vectors so that there is enough
     // variation that the forces don't get stuck in 2 or fewer dimensions
-    mutable size_t _di = 0;
-    QVector3D differenceEpsilon() const
+    static QVector3D differenceEpsilon(size_t& di)
     {
         if constexpr(NumDimensions == 3)
         {
-            static std::array<QVector3D, 6> vs =
+            static const std::array<QVector3D, 6> vs =
             {{
                 {   E, 0.0f, 0.0f},
                 {0.0f,    E, 0.0f},
@@ -65,12 +75,12 @@ private:
                 {0.0f, 0.0f,   -E},
             }};
 
-            _di = (_di + 1) % vs.size();
-            return vs.at(_di);
+            di = (di + 1) % vs.size();
+            return vs.at(di);
         }
-        else if constexpr(NumDimensions == 2)
+        else
         {
-            static std::array<QVector3D, 4> vs =
+            static const std::array<QVector3D, 4> vs =
             {{
                 {   E, 0.0f, 0.0f},
                 {0.0f,    E, 0.0f},
@@ -78,91 +88,398 @@ private:
                 {0.0f,   -E, 0.0f},
             }};
 
-            _di = (_di + 1) % vs.size();
-            return vs.at(_di);
+            di = (di + 1) % vs.size();
+            return vs.at(di);
         }
     }
 
+    // Spread the low bits of v out so that there are NumDimensions - 1 zeros between each
+    static uint64_t spreadBits(uint64_t v)
+    {
+        if constexpr(NumDimensions == 3)
+        {
+            v &= 0x1FFFFFu;
+            v = (v | (v << 32u)) & 0x1F00000000FFFFu;
+            v = (v | (v << 16u)) & 0x1F0000FF0000FFu;
+            v = (v | (v << 8u))  & 0x100F00F00F00F00Fu;
+            v = (v | (v << 4u))  & 0x10C30C30C30C30C3u;
+            v = (v | (v << 2u))  & 0x1249249249249249u;
+        }
+        else
+        {
+            v &= 0x7FFFFFFFu;
+            v = (v | (v << 16u)) & 0x0000FFFF0000FFFFu;
+            v = (v | (v << 8u))  & 0x00FF00FF00FF00FFu;
+            v = (v | (v << 4u))  & 0x0F0F0F0F0F0F0F0Fu;
+            v = (v | (v << 2u))  & 0x3333333333333333u;
+            v = (v | (v << 1u))  & 0x5555555555555555u;
+        }
+
+        return v;
+    }
+
+    struct MortonPoint
+    {
+        uint64_t _code;
+        size_t _index;
+
+        bool operator<(const MortonPoint& other) const
+        {
+            return _code < other._code || (_code == other._code && _index < other._index);
+        }
+    };
+
     float _theta = 0.8f;
-    int _mass = 0;
-    QVector3D _centreOfMass;
 
-    void initialise(const NodeLayoutPositions& nodePositions, const std::vector<NodeId>& nodeIds) override
+    // The points, in Morton order
+    std::vector<uint64_t> _codes;
+    std::vector<float> _x;
+    std::vector<float> _y;
+    std::vector<float> _z;
+
+    // For each point (as indexed by the caller), its index in the sorted points
+    std::vector<size_t> _sortedIndices;
+
+    // The cells, each of which covers the sorted points [_begins[i], _ends[i]) and,
+    // if it isn't a leaf, has children [_firstChildren[i], _firstChildren[i] + _numChildren[i])
+    std::vector<size_t> _begins;
+    std::vector<size_t> _ends;
+    std::vector<size_t> _firstChildren;
+    std::vector<uint8_t> _numChildren;
+    std::vector<float> _sSqs;
+    std::vector<float> _centreOfMassX;
+    std::vector<float> _centreOfMassY;
+    std::vector<float> _centreOfMassZ;
+
+    // The first cell of each depth, and one past the last cell
+    std::vector<size_t> _depthBegins;
+
+    size_t numCells() const { return _begins.size(); }
+    bool leaf(size_t cell) const { return _numChildren[cell] == 0; }
+    int mass(size_t cell) const { return static_cast<int>(_ends[cell] - _begins[cell]); }
+
+    void addCell(size_t begin, size_t end, float sSq)
     {
-        _mass = static_cast<int>(nodeIds.size());
-        _centreOfMass = nodePositions.centreOfMass(nodeIds);
+        _begins.push_back(begin);
+        _ends.push_back(end);
+        _firstChildren.push_back(0);
+        _numChildren.push_back(0);
+        _sSqs.push_back(sSq);
+    }
 
-        for(auto& subVolume : this->_subVolumes)
-            subVolume._sSq = subVolume._boundingBox.maxLength() * subVolume._boundingBox.maxLength();
+    void sort(std::vector<MortonPoint>& points)
+    {
+        if(points.size() <= SortChunkSize)
+        {
+            std::sort(points.begin(), points.end());
+            return;
+        }
+
+        std::vector<size_t> begins;
+        for(size_t begin = 0; begin < points.size(); begin += SortChunkSize)
+            begins.push_back(begin);
+
+        concurrent_for(begins.cbegin(), begins.cend(),
+        [&points](size_t begin)
+        {
+            auto end = std::min(begin + SortChunkSize, points.size());
+            std::sort(points.begin() + begin, points.begin() + end);
+        });
+
+        for(size_t width = SortChunkSize; width < points.size(); width *= 2)
+        {
+            begins.clear();
+            for(size_t begin = 0; begin + width < points.size(); begin += 2 * width)
+                begins.push_back(begin);
+
+            concurrent_for(begins.cbegin(), begins.cend(),
+            [&points, width](size_t begin)
+            {
+                auto end = std::min(begin + (2 * width), points.size());
+                std::inplace_merge(points.begin() + begin,
+                    points.begin() + begin + width, points.begin() + end);
+            });
+        }
     }
 
-public:
-    BarnesHutTree()
+    // Where the cell [begin, end) at depth should be split, i.e. the start of each child's range
+    std::array<size_t, NumChildren + 1> split(size_t begin, size_t end, int depth) const
+    {
+        std::array<size_t, NumChildren + 1> boundaries = {};
+        const auto shift = static_cast<uint64_t>(MaxDepth - 1 - depth) * NumDimensions;
+
+        boundaries[0] = begin;
+        for(size_t child = 1; child < NumChildren; child++)
+        {
+            auto it = std::partition_point(_codes.begin() + boundaries[child - 1], _codes.begin() + end,
+                [shift, child](uint64_t code) { return ((code >> shift) & ChildMask) < child; });
+
+            boundaries[child] = static_cast<size_t>(std::distance(_codes.begin(), it));
+        }
+        boundaries[NumChildren] = end;
+
+        return boundaries;
+    }
+
+    void computeCentreOfMass(size_t cell)
     {
-        this->setMaxNodesPerLeaf(1);
+        float x = 0.0f, y = 0.0f, z = 0.0f;
+
+        if(leaf(cell))
+        {
+            for(auto i = _begins[cell]; i < _ends[cell]; i++)
+            {
+                x += _x[i];
+                y += _y[i];
+                z += _z[i];
+            }
+        }
+        else
+        {
+            for(auto child = _firstChildren[cell]; child < _firstChildren[cell] + _numChildren[cell]; child++)
+            {
+                auto childMass = static_cast<float>(mass(child));
+
+                x += _centreOfMassX[child] * childMass;
+                y += _centreOfMassY[child] * childMass;
+                z += _centreOfMassZ[child] * childMass;
+            }
+        }
+
+        auto reciprocal = 1.0f / static_cast<float>(mass(cell));
+
+        _centreOfMassX[cell] = x * reciprocal;
+        _centreOfMassY[cell] = y * reciprocal;
+        _centreOfMassZ[cell] = z * reciprocal;
     }
 
+public:
     void setTheta(float theta) { _theta = theta; }
 
-    QVector3D evaluateKernel(const NodeLayoutPositions& nodePositions, NodeId nodeId,
-        const std::function<QVector3D(int, const QVector3D&, float)>& kernel) const override
+    // Build the tree over numPoints points; in 2D, z may be nullptr
+    void build(const float* x, const float* y, const float* z, size_t numPoints)
     {
-        const QVector3D& nodePosition = nodePositions.get(nodeId);
-        QVector3D result;
-        FixedSizeStack<const BarnesHutTree*> stack(this->_depthFirstTraversalStackSizeRequirement);
+        SCOPE_TIMER_MULTISAMPLES(50)
+
+        _begins.clear();
+        _ends.clear();
+        _firstChildren.clear();
+        _numChildren.clear();
+        _sSqs.clear();
+        _depthBegins.clear();
+
+        if(numPoints == 0)
+            return;
 
-        stack.push(this);
+        // The root cell is the bounding cube of the points
+        QVector3D min(x[0], y[0], NumDimensions == 3 ? z[0] : 0.0f);
+        QVector3D max = min;
 
-        while(!stack.empty())
+        for(size_t i = 1; i < numPoints; i++)
         {
-            const BarnesHutTree* subTree = stack.pop();
+            min.setX(std::min(min.x(), x[i]));
+            max.setX(std::max(max.x(), x[i]));
+            min.setY(std::min(min.y(), y[i]));
+            max.setY(std::max(max.y(), y[i]));
 
-            for(int i = 0; i < subTree->_numInternalNodes; i++)
+            if constexpr(NumDimensions == 3)
             {
-                auto subVolume = subTree->_internalNodes.at(i);
+                min.setZ(std::min(min.z(), z[i]));
+                max.setZ(std::max(max.z(), z[i]));
+            }
+        }
 
-                const QVector3D& centreOfMass = subVolume->_subTree->_centreOfMass;
-                QVector3D difference = (centreOfMass - nodePosition);
-                float distanceSq = difference.lengthSquared();
+        const auto extent = max - min;
+        const float size = std::max({extent.x(), extent.y(), extent.z()});
+        const uint64_t maxQuantised = (uint64_t{1} << static_cast<uint64_t>(MaxDepth)) - 1;
+        const float scale = size > 0.0f ? static_cast<float>(maxQuantised) / size : 0.0f;
 
-                if(distanceSq == 0.0f)
-                {
-                    difference = differenceEpsilon();
-                    distanceSq = E2;
-                }
+        auto quantise = [scale, maxQuantised](float value, float minValue)
+        {
+            return std::min(static_cast<uint64_t>(std::max((value - minValue) * scale, 0.0f)), maxQuantised);
+        };
 
-                const float sOverD = subVolume->_sSq / distanceSq;
+        std::vector<MortonPoint> points(numPoints);
+        std::vector<size_t> indices(numPoints);
+        std::iota(indices.begin(), indices.end(), 0);
 
-                if(sOverD > _theta)
-                    stack.push(subVolume->_subTree.get());
+        concurrent_for_if_large(indices.cbegin(), indices.cend(), MinimumConcurrentSize,
+        [&](size_t index)
+        {
+            uint64_t code = spreadBits(quantise(x[index], min.x())) |
+                (spreadBits(quantise(y[index], min.y())) << 1u);
+
+            if constexpr(NumDimensions == 3)
+                code |= spreadBits(quantise(z[index], min.z())) << 2u;
+
+            points[index] = {code, index};
+        });
+
+        sort(points);
+
+        _codes.resize(numPoints);
+        _x.resize(numPoints);
+        _y.resize(numPoints);
+        _z.resize(numPoints);
+        _sortedIndices.resize(numPoints);
+
+        concurrent_for_if_large(indices.cbegin(), indices.cend(), MinimumConcurrentSize,
+        [&](size_t sortedIndex)
+        {
+            const auto& point = points[sortedIndex];
+
+            _codes[sortedIndex] = point._code;
+            _x[sortedIndex] = x[point._index];
+            _y[sortedIndex] = y[point._index];
+            _z[sortedIndex] = NumDimensions == 3 ? z[point._index] : 0.0f;
+            _sortedIndices[point._index] = sortedIndex;
+        });
+
+        // Build the cells a depth at a time; since the points are sorted, a cell's
+        // children are found by partitioning its range on the next digit of the codes
+        addCell(0, numPoints, size * size);
+        _depthBegins.push_back(0);
+
+        for(int depth = 0; depth < MaxDepth; depth++)
+        {
+            const auto depthBegin = _depthBegins.back();
+            const auto depthEnd = numCells();
+            _depthBegins.push_back(depthEnd);
+
+            if(depthBegin == depthEnd)
+                break;
+
+            std::vector<size_t> cells(depthEnd - depthBegin);
+            std::iota(cells.begin(), cells.end(), depthBegin);
+
+            std::vector<std::array<size_t, NumChildren + 1>> splits(cells.size());
+            concurrent_for_if_large(cells.cbegin(), cells.cend(), MinimumConcurrentSize,
+            [this, &splits, depthBegin, depth](size_t cell)
+            {
+                auto& boundaries = splits[cell - depthBegin];
+
+                // Cells with a single point, or with points that can't be separated, are leaves
+                if(_codes[_ends[cell] - 1] == _codes[_begins[cell]])
+                    boundaries.fill(_begins[cell]);
                 else
-                    result += kernel(subVolume->_subTree->_mass, difference, distanceSq);
-            }
+                    boundaries = split(_begins[cell], _ends[cell], depth);
+            });
 
-            for(int i = 0; i < subTree->_numNonEmptyLeaves; i++)
+            const float childSize = size / static_cast<float>(uint64_t{1} << static_cast<uint64_t>(depth + 1));
+            for(auto cell : cells)
             {
-                auto subVolume = subTree->_nonEmptyLeaves.at(i);
+                const auto& boundaries = splits[cell - depthBegin];
+                _firstChildren[cell] = numCells();
 
-                NodeId otherNodeId = subVolume->_nodeIds.front();
-                if(otherNodeId != nodeId)
+                for(size_t child = 0; child < NumChildren; child++)
                 {
-                    const QVector3D& otherNodePosition = nodePositions.get(otherNodeId);
-                    QVector3D difference = otherNodePosition - nodePosition;
+                    if(boundaries[child] == boundaries[child + 1])
+                        continue;
+
+                    addCell(boundaries[child], boundaries[child + 1], childSize * childSize);
+                    _numChildren[cell]++;
+                }
+            }
+        }
+
+        if(_depthBegins.back() != numCells())
+            _depthBegins.push_back(numCells());
+
+        // Accumulate the centres of mass, from the deepest cells up
+        _centreOfMassX.resize(numCells());
+        _centreOfMassY.resize(numCells());
+        _centreOfMassZ.resize(numCells());
+
+        for(auto depth = _depthBegins.size() - 1; depth-- > 0;)
+        {
+            std::vector<size_t> cells(_depthBegins[depth + 1] - _depthBegins[depth]);
+            std::iota(cells.begin(), cells.end(), _depthBegins[depth]);
+
+            concurrent_for_if_large(cells.cbegin(), cells.cend(), MinimumConcurrentSize,
+                [this](size_t cell) { computeCentreOfMass(cell); });
+        }
+    }
+
+    // Evaluate kernel against the tree for the point at index, i.e. the sum of the kernel
+    // applied to each point's or distant cell's mass, difference in position and distance squared
+    template<typename Kernel>
+    QVector3D evaluateKernel(size_t index, const Kernel& kernel) const
+    {
+        QVector3D result;
+
+        if(numCells() == 0)
+            return result;
+
+        const auto sortedIndex = _sortedIndices[index];
+        const QVector3D position(_x[sortedIndex], _y[sortedIndex], _z[sortedIndex]);
+
+        size_t di = 0;
+        std::array<size_t, MaxStackSize> stack; // NOLINT cppcoreguidelines-pro-type-member-init
+        size_t stackSize = 0;
+
+        stack[stackSize++] = 0;
+
+        while(stackSize > 0)
+        {
+            auto cell = stack[--stackSize];
+
+            if(leaf(cell))
+            {
+                for(auto i = _begins[cell]; i < _ends[cell]; i++)
+                {
+                    if(i == sortedIndex)
+                        continue;
+
+                    QVector3D difference(_x[i] - position.x(), _y[i] - position.y(), _z[i] - position.z());
                     float distanceSq = difference.lengthSquared();
 
                     if(distanceSq == 0.0f)
                     {
-                        difference = differenceEpsilon();
+                        difference = differenceEpsilon(di);
                         distanceSq = E2;
                     }
 
                     result += kernel(1, difference, distanceSq);
                 }
+
+                continue;
+            }
+
+            for(auto child = _firstChildren[cell]; child < _firstChildren[cell] + _numChildren[cell]; child++)
+            {
+                QVector3D difference(_centreOfMassX[child] - position.x(),
+                    _centreOfMassY[child] - position.y(), _centreOfMassZ[child] - position.z());
+                float distanceSq = difference.lengthSquared();
+
+                if(distanceSq == 0.0f)
+                {
+                    difference = differenceEpsilon(di);
+                    distanceSq = E2;
+                }
+
+                const float sOverD = _sSqs[child] / distanceSq;
+
+                if(sOverD > _theta)
+                    stack[stackSize++] = child;
+                else
+                    result += kernel(mass(child), difference, distanceSq);
             }
         }
 
         return result;
     }
+
+    // The indices of the points in Morton order; evaluating kernels in this order
+    // means consecutive evaluations visit largely the same cells
+    std::vector<size_t> indicesInMortonOrder() const
+    {
+        std::vector<size_t> indices(_sortedIndices.size());
+
+        for(size_t index = 0; index < _sortedIndices.size(); index++)
+            indices[_sortedIndices[index]] = index;
+
+        return indices;
+    }
 };
 
 using BarnesHutTree2D = BarnesHutTree<2>;
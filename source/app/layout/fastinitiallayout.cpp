@@ -19,6 +19,7 @@
 #include "fastinitiallayout.h"
 
 #include "shared/utils/constants.h"
+#include "shared/utils/container.h"
 
 #include <QMatrix4x4>
 #include <QVector4D>
@@ -27,25 +28,25 @@
 
 void FastInitialLayout::positionNode(QVector3D& offsetPosition, const QMatrix4x4& orientationMatrix,
                                      const QVector3D& parentNodePosition, NodeId childNodeId,
-                                     NodeArray<QVector3D>& directionNodeVectors)
+                                     NodeIdMap<QVector3D>& directionNodeVectors)
 {
     const float SPHERE_RADIUS = 20.0f;
     offsetPosition = offsetPosition * SPHERE_RADIUS;
     offsetPosition = offsetPosition * orientationMatrix;
 
-    directionNodeVectors.set(childNodeId, offsetPosition.normalized());
+    directionNodeVectors[childNodeId] = offsetPosition.normalized();
     positions().set(childNodeId, parentNodePosition + offsetPosition);
 }
 
 void FastInitialLayout::execute(bool, Dimensionality dimensionality)
 {
     const auto& graph = graphComponent().graph();
-    NodeArray<bool> visitedNodes(graph);
-    NodeArray<QVector3D> directionNodeVectors(graph);
+    NodeIdSet visitedNodes;
+    NodeIdMap<QVector3D> directionNodeVectors;
 
     std::queue<NodeId> nodeQueue;
     nodeQueue.push(nodeIds().front());
-    visitedNodes.set(nodeIds().front(), true);
+    visitedNodes.insert(nodeIds().front());
 
     // This performs a breadth-first tree layout, positioning child nodes in a "spiral"
     // configuration around the parent. This approximates equal distrubution on a sphere.
@@ -60,7 +61,7 @@ void FastInitialLayout::execute(bool, Dimensionality dimensionality)
 
         QMatrix4x4 orientationMatrix;
         orientationMatrix.setToIdentity();
-        QVector3D forward = directionNodeVectors.at(parentNodeId);
+        QVector3D forward = directionNodeVectors[parentNodeId];
         // All except initial node, calculate an orientation matrix. This makes
         // the tree grow outwards from parent nodes
         if(parentNodeId != nodeIds().front())
@@ -89,7 +90,7 @@ void FastInitialLayout::execute(bool, Dimensionality dimensionality)
             const auto& edge = graph.edgeById(*edgeIdIterator);
             auto childNodeId = edge.oppositeId(parentNodeId);
 
-            bool visited = visitedNodes.get(childNodeId);
+            bool visited = u::contains(visitedNodes, childNodeId);
             if(!visited)
             {
                 QVector3D offsetPosition(1.0, 0.0, 0.0);
@@ -100,7 +101,7 @@ void FastInitialLayout::execute(bool, Dimensionality dimensionality)
                              directionNodeVectors);
 
                 nodeQueue.push(childNodeId);
-                visitedNodes.set(childNodeId, true);
+                visitedNodes.insert(childNodeId);
                 ++edgeIdIterator;
             }
         }
@@ -115,7 +116,7 @@ void FastInitialLayout::execute(bool, Dimensionality dimensionality)
         {
             const auto& edge = graph.edgeById(*edgeIdIterator);
             auto childNodeId = edge.oppositeId(parentNodeId);
-            bool visited = visitedNodes.get(childNodeId);
+            bool visited = u::contains(visitedNodes, childNodeId);
 
             // Find the next connected node which has not been visted already
             while(visited)
@@ -125,7 +126,7 @@ void FastInitialLayout::execute(bool, Dimensionality dimensionality)
                 {
                     const auto &newEdge = graph.edgeById(*edgeIdIterator);
                     childNodeId = newEdge.oppositeId(parentNodeId);
-                    visited = visitedNodes.get(childNodeId);
+                    visited = u::contains(visitedNodes, childNodeId);
                 }
                 else
                     break;
@@ -143,7 +144,7 @@ void FastInitialLayout::execute(bool, Dimensionality dimensionality)
                              childNodeId,
                              directionNodeVectors);
 
-                visitedNodes.set(childNodeId, true);
+                visitedNodes.insert(childNodeId);
 
                 ++edgeIdIterator;
             }
@@ -157,7 +158,7 @@ void FastInitialLayout::execute(bool, Dimensionality dimensionality)
             const auto& edge = graph.edgeById(*edgeIdIterator);
             auto childNodeId = edge.oppositeId(parentNodeId);
 
-            if(visitedNodes.get(childNodeId))
+            if(u::contains(visitedNodes, childNodeId))
                 continue;
 
             nodeQueue.push(childNodeId);
@@ -177,7 +178,7 @@ void FastInitialLayout::execute(bool, Dimensionality dimensionality)
                          childNodeId,
                          directionNodeVectors);
 
-            visitedNodes.set(childNodeId, true);
+            visitedNodes.insert(childNodeId);
             i++;
         }
     }
@@ -21,6 +21,8 @@
 
 #include "layout.h"
 
+#include "shared/graph/elementid_containers.h"
+
 class FastInitialLayout : public Layout
 {
     Q_OBJECT
@@ -28,7 +30,7 @@ class FastInitialLayout : public Layout
 private:
     void positionNode(QVector3D& offsetPosition, const QMatrix4x4& orientationMatrix,
                       const QVector3D& parentNodePosition, NodeId childNodeId,
-                      NodeArray<QVector3D>& directionNodeVectors);
+                      NodeIdMap<QVector3D>& directionNodeVectors);
 public:
     FastInitialLayout(const IGraphComponent& graphComponent, NodeLayoutPositions& positions)
         : Layout(graphComponent, positions)
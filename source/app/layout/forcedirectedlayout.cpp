@@ -23,11 +23,14 @@
 #include "graph/graph.h"
 #include "graph/graphmodel.h"
 
+#include "shared/graph/elementid_containers.h"
+
 #include "shared/utils/threadpool.h"
 #include "shared/utils/preferences.h"
 #include "shared/utils/scopetimer.h"
 
 #include <cmath>
+#include <numeric>
 
 template<typename T> float meanWeightedAvgBuffer(int start, int end, const T& buffer)
 {
@@ -53,42 +56,50 @@ static QVector3D normalized(const QVector3D& v)
     return {};
 }
 
-void ForceDirectedDisplacement::computeAndDamp()
+// Limits the size of a displacement, then damps it relative to the previous displacement,
+// returning its (limited, but undamped) length. The computation encourages movements
+// where the direction is constant and discourages movements when it changes.
+static float damp(QVector3D& next, const QVector3D& previous, float previousLength)
 {
-    _next = _repulsive + _attractive;
-    _nextLength = _next.length();
-
-    // Reset for next iteration
-    _repulsive = {};
-    _attractive = {};
-
-    // The following computation encouragements movements where the
-    // direction is constant and discourages movements when it changes
+    float nextLength = next.length();
 
     const float MAX_DISPLACEMENT = 10.0f;
 
     // Filter large displacements that can induce instability
-    if(_nextLength > MAX_DISPLACEMENT)
+    if(nextLength > MAX_DISPLACEMENT)
     {
-        _nextLength = MAX_DISPLACEMENT;
-        _next = normalized(_next) * _nextLength;
+        nextLength = MAX_DISPLACEMENT;
+        next = normalized(next) * nextLength;
     }
 
-    if(_previousLength > 0.0f && _nextLength > 0.0f)
+    if(previousLength > 0.0f && nextLength > 0.0f)
     {
-        const float dotProduct = QVector3D::dotProduct(_previous / _previousLength, _next / _nextLength);
+        const float dotProduct = QVector3D::dotProduct(previous / previousLength, next / nextLength);
 
         // http://www.wolframalpha.com/input/?i=plot+0.5x%5E2%2B1.2x%2B1+from+x%3D-1to1
         // cppcheck-suppress unreadVariable
         const float f = (0.5f * dotProduct * dotProduct) + (1.2f * dotProduct) + 1.0f;
 
-        if(_nextLength > (_previousLength * f))
+        if(nextLength > (previousLength * f))
         {
-            const float r = _previousLength / _nextLength;
-            _next *= (f * r);
+            const float r = previousLength / nextLength;
+            next *= (f * r);
         }
     }
 
+    return nextLength;
+}
+
+void ForceDirectedDisplacement::computeAndDamp()
+{
+    _next = _repulsive + _attractive;
+
+    // Reset for next iteration
+    _repulsive = {};
+    _attractive = {};
+
+    _nextLength = damp(_next, _previous, _previousLength);
+
     _previous = _next;
     _previousLength = _previous.length();
 }
@@ -96,27 +107,99 @@ void ForceDirectedDisplacement::computeAndDamp()
 // This is a fairly arbitrary function that was arrived at through experimentation. The parameters
 // shortRange and longRange affect the emphasis that the result places on local forces and global
 // forces, respectively.
-static float repulse(const float distanceSq, const float shortRange, const float longRange)
+float ForceDirectedLayout::repulse(const float distanceSq, const float shortRange, const float longRange)
 {
     return ((distanceSq * distanceSq * longRange) + shortRange) /
         ((distanceSq * distanceSq * distanceSq) + 0.0001f);
 }
 
+// Rebuilds the dense indexing of the component, if it has changed since the last iteration
+void ForceDirectedLayout::updateTopology()
+{
+    if(nodeIds() == _nodeIds && edgeIds() == _edgeIds)
+        return;
+
+    const auto& graph = graphComponent().graph();
+
+    // This is deliberately not a (graph sized) NodeArray, as there may be many small components
+    NodeIdMap<size_t> indices;
+    indices.reserve(nodeIds().size());
+    for(size_t index = 0; index < nodeIds().size(); index++)
+        indices.emplace(nodeIds()[index], index);
+
+    // Carry the damping state of any nodes that remain over to their new indices
+    ForceDirectedVectors previousDisplacements;
+    previousDisplacements.assign(nodeIds().size());
+    std::vector<float> previousDisplacementLengths(nodeIds().size(), 0.0f);
+
+    for(size_t oldIndex = 0; oldIndex < _nodeIds.size(); oldIndex++)
+    {
+        auto it = indices.find(_nodeIds[oldIndex]);
+        if(it == indices.end())
+            continue;
+
+        previousDisplacements.set(it->second, _previousDisplacements.get(oldIndex));
+        previousDisplacementLengths[it->second] = _previousDisplacementLengths[oldIndex];
+    }
+
+    _previousDisplacements = std::move(previousDisplacements);
+    _previousDisplacementLengths = std::move(previousDisplacementLengths);
+
+    _nodeIds = nodeIds();
+    _edgeIds = edgeIds();
+
+    // Each (non-loop) edge appears in the adjacency of both of its nodes, so that
+    // each node can accumulate its own attractive force, independently of the others
+    _adjacencyOffsets.assign(_nodeIds.size() + 1, 0);
+    for(auto edgeId : _edgeIds)
+    {
+        const auto& edge = graph.edgeById(edgeId);
+
+        if(!edge.isLoop())
+        {
+            _adjacencyOffsets[indices[edge.sourceId()] + 1]++;
+            _adjacencyOffsets[indices[edge.targetId()] + 1]++;
+        }
+    }
+
+    std::partial_sum(_adjacencyOffsets.begin(), _adjacencyOffsets.end(), _adjacencyOffsets.begin());
+
+    auto insertPositions = _adjacencyOffsets;
+    _adjacency.resize(_adjacencyOffsets.back());
+    for(auto edgeId : _edgeIds)
+    {
+        const auto& edge = graph.edgeById(edgeId);
+
+        if(!edge.isLoop())
+        {
+            auto sourceIndex = indices[edge.sourceId()];
+            auto targetIndex = indices[edge.targetId()];
+
+            _adjacency[insertPositions[sourceIndex]++] = targetIndex;
+            _adjacency[insertPositions[targetIndex]++] = sourceIndex;
+        }
+    }
+
+    _positions.assign(_nodeIds.size());
+    _forces.assign(_nodeIds.size());
+    _forceLengths.assign(_nodeIds.size(), 0.0f);
+}
+
 void ForceDirectedLayout::execute(bool firstIteration, Dimensionality dimensionality)
 {
     SCOPE_TIMER_MULTISAMPLES(50)
 
+    updateTopology();
+
     if(firstIteration)
     {
         FastInitialLayout initialLayout(graphComponent(), positions());
         initialLayout.execute(firstIteration, dimensionality);
 
-        for(NodeId nodeId : nodeIds())
-            _displacements->at(nodeId)._previous = {};
+        _previousDisplacements.assign(_nodeIds.size());
+        _previousDisplacementLengths.assign(_nodeIds.size(), 0.0f);
     }
 
-    std::unique_ptr<AbstractBarnesHutTree> barnesHutTree;
-
     if(dimensionality == Dimensionality::ThreeDee)
     {
         if(_hasBeenFlattened)
@@ -139,68 +222,102 @@ void ForceDirectedLayout::execute(bool firstIteration, Dimensionality dimensiona
 
             _hasBeenFlattened = false;
         }
-
-        barnesHutTree = std::make_unique<BarnesHutTree3D>();
     }
     else if(dimensionality == Dimensionality::TwoDee)
-    {
         _hasBeenFlattened = true;
-        barnesHutTree = std::make_unique<BarnesHutTree2D>();
-    }
 
-    barnesHutTree->build(graphComponent(), positions());
+    for(size_t index = 0; index < _nodeIds.size(); index++)
+        _positions.set(index, positions().get(_nodeIds[index]));
 
     const float SHORT_RANGE = _settings->value(QStringLiteral("ShortRangeRepulseTerm"));
     const float LONG_RANGE = 0.01f + _settings->value(QStringLiteral("LongRangeRepulseTerm"));
 
-    // Repulsive forces
-    auto repulsiveResults = concurrent_for(nodeIds().begin(), nodeIds().end(),
-    [this, &barnesHutTree, SHORT_RANGE, LONG_RANGE](NodeId nodeId)
+    auto computeForces = [this, SHORT_RANGE, LONG_RANGE](const auto& barnesHutTree)
     {
-        if(cancelled())
-            return;
-
-        _displacements->at(nodeId)._repulsive -= barnesHutTree->evaluateKernel(positions(), nodeId,
-        [SHORT_RANGE, LONG_RANGE](int mass, const QVector3D& difference, float distanceSq)
+        // Consecutive nodes in Morton order are close to each other, so they tend to
+        // visit the same cells of the tree, which is kind to the cache
+        auto mortonOrderedIndices = barnesHutTree.indicesInMortonOrder();
+
+        // Each node's forces are written only to its own slot, so no synchronisation is needed
+        concurrent_for_if_large(mortonOrderedIndices.cbegin(), mortonOrderedIndices.cend(),
+            MINIMUM_NODES_FOR_CONCURRENCY,
+        [this, &barnesHutTree, SHORT_RANGE, LONG_RANGE](size_t index)
         {
-            return difference * (static_cast<float>(mass) * repulse(distanceSq, SHORT_RANGE, LONG_RANGE));
-        });
-    }, ThreadPool::NonBlocking);
+            if(cancelled())
+                return;
 
-    // Attractive forces
-    auto attractiveResults = concurrent_for(edgeIds().begin(), edgeIds().end(),
-    [this](EdgeId edgeId)
-    {
-        if(cancelled())
-            return;
+            // Repulsive forces
+            QVector3D force = -barnesHutTree.evaluateKernel(index,
+            [SHORT_RANGE, LONG_RANGE](int mass, const QVector3D& difference, float distanceSq)
+            {
+                return difference * (static_cast<float>(mass) * repulse(distanceSq, SHORT_RANGE, LONG_RANGE));
+            });
+
+            // Attractive forces
+            const float x = _positions._x[index];
+            const float y = _positions._y[index];
+            const float z = _positions._z[index];
+            float attractiveX = 0.0f;
+            float attractiveY = 0.0f;
+            float attractiveZ = 0.0f;
+
+            for(auto i = _adjacencyOffsets[index]; i < _adjacencyOffsets[index + 1]; i++)
+            {
+                auto neighbour = _adjacency[i];
 
-        const IEdge& edge = graphComponent().graph().edgeById(edgeId);
-        if(!edge.isLoop())
-        {
-            const QVector3D difference = positions().get(edge.targetId()) - positions().get(edge.sourceId());
-            float distanceSq = difference.lengthSquared();
-            const float force = distanceSq * 0.001f;
+                const float dx = _positions._x[neighbour] - x;
+                const float dy = _positions._y[neighbour] - y;
+                const float dz = _positions._z[neighbour] - z;
+                const float attraction = ((dx * dx) + (dy * dy) + (dz * dz)) * ATTRACTION_SCALE;
 
-            _displacements->at(edge.targetId())._attractive -= (force * difference);
-            _displacements->at(edge.sourceId())._attractive += (force * difference);
-        }
-    }, ThreadPool::NonBlocking);
+                attractiveX += attraction * dx;
+                attractiveY += attraction * dy;
+                attractiveZ += attraction * dz;
+            }
 
-    repulsiveResults.wait();
-    attractiveResults.wait();
+            _forces._x[index] = force.x() + attractiveX;
+            _forces._y[index] = force.y() + attractiveY;
+            _forces._z[index] = force.z() + attractiveZ;
+        });
+    };
+
+    if(dimensionality == Dimensionality::TwoDee)
+    {
+        BarnesHutTree2D barnesHutTree;
+        barnesHutTree.build(_positions._x.data(), _positions._y.data(), nullptr, _nodeIds.size());
+        computeForces(barnesHutTree);
+    }
+    else
+    {
+        BarnesHutTree3D barnesHutTree;
+        barnesHutTree.build(_positions._x.data(), _positions._y.data(), _positions._z.data(), _nodeIds.size());
+        computeForces(barnesHutTree);
+    }
 
     if(cancelled())
         return;
 
-    concurrent_for(nodeIds().begin(), nodeIds().end(),
-    [this](NodeId nodeId)
+    std::vector<size_t> indices(_nodeIds.size());
+    std::iota(indices.begin(), indices.end(), 0);
+
+    // Turn the forces into (damped) displacements
+    concurrent_for_if_large(indices.cbegin(), indices.cend(), MINIMUM_NODES_FOR_CONCURRENCY,
+    [this](size_t index)
     {
-        _displacements->at(nodeId).computeAndDamp();
+        auto displacement = _forces.get(index);
+        auto previousDisplacement = _previousDisplacements.get(index);
+
+        _forceLengths[index] = damp(displacement, previousDisplacement,
+            _previousDisplacementLengths[index]);
+
+        _forces.set(index, displacement);
+        _previousDisplacements.set(index, displacement);
+        _previousDisplacementLengths[index] = displacement.length();
     });
 
-    // Apply the forces
-    for(auto nodeId : nodeIds())
-        positions().set(nodeId, positions().get(nodeId) + _displacements->at(nodeId)._next);
+    // Apply the displacements
+    for(size_t index = 0; index < _nodeIds.size(); index++)
+        positions().set(_nodeIds[index], _positions.get(index) + _forces.get(index));
 
     // There are three main phases which decide when to stop the layout.
     // The phases operate primarily on the stddev of the forces within the graph
@@ -219,20 +336,20 @@ void ForceDirectedLayout::execute(bool firstIteration, Dimensionality dimensiona
 
     // Calculate force averages
     float deltaForceTotal = 0.0f;
-    for(auto nodeId : nodeIds())
-        deltaForceTotal += _displacements->at(nodeId)._nextLength;
+    for(auto forceLength : _forceLengths)
+        deltaForceTotal += forceLength;
 
-    _forceMean = deltaForceTotal / nodeIds().size();
+    _forceMean = deltaForceTotal / _forceLengths.size();
 
     // Calculate Standard Deviation
     float variance = 0.0f;
-    for(auto nodeId : nodeIds())
+    for(auto forceLength : _forceLengths)
     {
-        float d = _displacements->at(nodeId)._nextLength - _forceMean;
+        float d = forceLength - _forceMean;
         variance += (d * d);
     }
 
-    _forceStdDeviation = std::sqrt(variance / nodeIds().size());
+    _forceStdDeviation = std::sqrt(variance / _forceLengths.size());
     switch(_changeDetectionPhase)
     {
         case ChangeDetectionPhase::Initial:
@@ -351,7 +468,7 @@ void ForceDirectedLayout::oscillateChangeDetection()
 }
 
 ForceDirectedLayoutFactory::ForceDirectedLayoutFactory(GraphModel* graphModel) :
-    LayoutFactory(graphModel), _displacements(graphModel->graph())
+    LayoutFactory(graphModel)
 {
     _layoutSettings.registerSetting("ShortRangeRepulseTerm", QObject::tr("Local"),
                                     1000.0f, 1000000000.0f, 1000000.0f, LayoutSettingScaleType::Log);
@@ -364,6 +481,6 @@ std::unique_ptr<Layout> ForceDirectedLayoutFactory::create(ComponentId component
     NodeLayoutPositions& nodePositions, Layout::Dimensionality dimensionalityMode)
 {
     const auto* component = _graphModel->graph().componentById(componentId);
-    return std::make_unique<ForceDirectedLayout>(*component, _displacements,
+    return std::make_unique<ForceDirectedLayout>(*component,
         nodePositions, dimensionalityMode, &_layoutSettings);
 }
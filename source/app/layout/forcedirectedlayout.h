@@ -42,6 +42,29 @@ struct ForceDirectedDisplacement
 
 using ForceDirectedDisplacements = NodeArray<ForceDirectedDisplacement>;
 
+// A dense array of 3D vectors, stored as a structure of arrays
+struct ForceDirectedVectors
+{
+    std::vector<float> _x;
+    std::vector<float> _y;
+    std::vector<float> _z;
+
+    void assign(size_t size, float value = 0.0f)
+    {
+        _x.assign(size, value);
+        _y.assign(size, value);
+        _z.assign(size, value);
+    }
+
+    QVector3D get(size_t index) const { return {_x[index], _y[index], _z[index]}; }
+    void set(size_t index, const QVector3D& v)
+    {
+        _x[index] = v.x();
+        _y[index] = v.y();
+        _z[index] = v.z();
+    }
+};
+
 class ForceDirectedLayout : public Layout
 {
     Q_OBJECT
@@ -65,7 +88,19 @@ private:
 
     ChangeDetectionPhase _changeDetectionPhase = ChangeDetectionPhase::Initial;
 
-    ForceDirectedDisplacements* _displacements;
+    // The layout's state is kept densely, indexed in the same order as _nodeIds,
+    // rather than in graph sized NodeArrays; this means each node's forces can
+    // be computed independently, without any locking or contention
+    std::vector<NodeId> _nodeIds;
+    std::vector<EdgeId> _edgeIds;
+    std::vector<size_t> _adjacencyOffsets;
+    std::vector<size_t> _adjacency;
+
+    ForceDirectedVectors _positions;
+    ForceDirectedVectors _forces;
+    ForceDirectedVectors _previousDisplacements;
+    std::vector<float> _previousDisplacementLengths;
+    std::vector<float> _forceLengths;
 
     float _forceStdDeviation = 0;
     float _forceMean = 0;
@@ -81,15 +116,15 @@ private:
     void initialChangeDetection();
     void finishChangeDetection();
 
+    void updateTopology();
+
 public:
     ForceDirectedLayout(const IGraphComponent& graphComponent,
-                        ForceDirectedDisplacements& displacements,
                         NodeLayoutPositions& positions,
                         Layout::Dimensionality dimensionalityMode,
                         const LayoutSettings* settings) :
         Layout(graphComponent, positions, settings, Iterative::Yes,
             Dimensionality::TwoOrThreeDee, 0.4f, 4),
-        _displacements(&displacements),
         _hasBeenFlattened(dimensionalityMode == Layout::Dimensionality::TwoDee)
     {}
 
@@ -97,13 +132,13 @@ public:
     void unfinish() override;
 
     void execute(bool firstIteration, Dimensionality dimensionality) override;
+
+    static float repulse(float distanceSq, float shortRange, float longRange);
+    static constexpr float ATTRACTION_SCALE = 0.001f;
 };
 
 class ForceDirectedLayoutFactory : public LayoutFactory
 {
-private:
-    ForceDirectedDisplacements _displacements;
-
 public:
     explicit ForceDirectedLayoutFactory(GraphModel* graphModel);
 
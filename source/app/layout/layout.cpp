@@ -19,6 +19,7 @@
 #include "layout.h"
 #include "shared/utils/thread.h"
 #include "shared/utils/container.h"
+#include "shared/utils/threadpool.h"
 
 #include "graph/graph.h"
 #include "graph/graphmodel.h"
@@ -213,20 +214,51 @@ void LayoutThread::run()
     {
         u::setCurrentThreadName(QStringLiteral("Layout >"));
 
+        // Large components are laid out one after another, each spreading its work over the
+        // thread pool, while the small components are laid out concurrently with each other
+        std::vector<ScheduledLayout> largeLayouts;
+        std::vector<ScheduledLayout> smallLayouts;
+        bool flatten = false;
+
         for(auto& [componentId, layout] : _layouts)
         {
             if(layoutIsFinished(*layout))
                 continue;
 
+            // If we're in 2D mode and the layout can handle it, flatten the positions
             if(_dimensionalityMode == Layout::Dimensionality::TwoDee &&
                (layout->dimensionality() & _dimensionalityMode))
             {
-                // If we're in 2D mode and the layout can handle it, flatten the positions
-                _nodeLayoutPositions.flatten();
+                flatten = true;
             }
 
-            layout->execute(!_executedAtLeastOnce.get(componentId), _dimensionalityMode);
-            _executedAtLeastOnce.set(componentId, true);
+            ScheduledLayout scheduledLayout{componentId, layout.get(),
+                !_executedAtLeastOnce.get(componentId)};
+
+            if(layout->graphComponent().numNodes() >= Layout::MINIMUM_NODES_FOR_CONCURRENCY)
+                largeLayouts.push_back(scheduledLayout);
+            else
+                smallLayouts.push_back(scheduledLayout);
+        }
+
+        if(flatten)
+            _nodeLayoutPositions.flatten();
+
+        auto smallLayoutResults = concurrent_for(smallLayouts.begin(), smallLayouts.end(),
+        [dimensionalityMode = _dimensionalityMode](const ScheduledLayout& scheduledLayout)
+        {
+            scheduledLayout._layout->execute(scheduledLayout._firstIteration, dimensionalityMode);
+        }, ThreadPool::NonBlocking);
+
+        for(const auto& scheduledLayout : largeLayouts)
+            scheduledLayout._layout->execute(scheduledLayout._firstIteration, _dimensionalityMode);
+
+        smallLayoutResults.wait();
+
+        for(const auto* scheduledLayouts : {&largeLayouts, &smallLayouts})
+        {
+            for(const auto& scheduledLayout : *scheduledLayouts)
+                _executedAtLeastOnce.set(scheduledLayout._componentId, true);
         }
 
         {
@@ -99,6 +99,10 @@ public:
         _settings(settings)
     {}
 
+    // Components smaller than this aren't worth distributing over the thread pool;
+    // LayoutThread instead lays out many such components concurrently
+    static const int MINIMUM_NODES_FOR_CONCURRENCY = 1000;
+
     float scaling() const { return _scaling; }
     int smoothing() const { return _smoothing; }
 
@@ -187,6 +191,22 @@ private:
 
     std::unique_ptr<LayoutFactory> _layoutFactory;
     std::map<ComponentId, std::unique_ptr<Layout>> _layouts;
+
+    // A layout that is to be executed in the current iteration
+    struct ScheduledLayout
+    {
+        ComponentId _componentId;
+        Layout* _layout;
+        bool _firstIteration;
+
+        // Used by concurrent_for to balance the layouts over the threads
+        uint64_t computeCostHint() const
+        {
+            const auto& component = _layout->graphComponent();
+            return static_cast<uint64_t>(component.numNodes() + component.numEdges());
+        }
+    };
+
     ComponentArray<bool> _executedAtLeastOnce;
 
     Layout::Dimensionality _dimensionalityMode =
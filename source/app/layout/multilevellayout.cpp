@@ -0,0 +1,463 @@
+/* Copyright © 2013-2020 Graphia Technologies Ltd.
+ *
+ * This file is part of Graphia.
+ *
+ * Graphia is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Graphia is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Graphia.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "multilevellayout.h"
+#include "barneshuttree.h"
+
+#include "graph/graph.h"
+#include "graph/graphmodel.h"
+
+#include "shared/utils/threadpool.h"
+#include "shared/utils/random.h"
+
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cstdint>
+#include <cmath>
+
+// A pseudo random, but repeatable, unit-ish offset for a node, so that the nodes
+// which share an ancestor are spread around it instead of being coincident
+static QVector3D offsetFor(NodeId nodeId, Layout::Dimensionality dimensionality)
+{
+    auto hash = static_cast<uint32_t>(static_cast<int>(nodeId)) * 2654435761u;
+
+    auto component = [&hash]
+    {
+        hash ^= hash >> 15;
+        hash *= 2246822519u;
+        hash ^= hash >> 13;
+
+        return (static_cast<float>(hash & 0xFFFFu) / 32767.5f) - 1.0f;
+    };
+
+    QVector3D offset(component(), component(), component());
+
+    if(dimensionality == Layout::Dimensionality::TwoDee)
+        offset.setZ(0.0f);
+
+    return offset;
+}
+
+void MultilevelLayout::Level::setEdges(std::vector<std::pair<size_t, size_t>> edges)
+{
+    for(auto& edge : edges)
+    {
+        if(edge.first > edge.second)
+            std::swap(edge.first, edge.second);
+    }
+
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    _adjacencyOffsets.assign(numNodes() + 1, 0);
+    for(const auto& edge : edges)
+    {
+        _adjacencyOffsets[edge.first + 1]++;
+        _adjacencyOffsets[edge.second + 1]++;
+    }
+
+    std::partial_sum(_adjacencyOffsets.begin(), _adjacencyOffsets.end(), _adjacencyOffsets.begin());
+
+    auto insertPositions = _adjacencyOffsets;
+    _adjacency.resize(_adjacencyOffsets.back());
+    for(const auto& edge : edges)
+    {
+        _adjacency[insertPositions[edge.first]++] = edge.second;
+        _adjacency[insertPositions[edge.second]++] = edge.first;
+    }
+}
+
+void MultilevelLayout::coarsen()
+{
+    _levels.clear();
+
+    const auto& graph = graphComponent().graph();
+
+    Level componentLevel;
+    componentLevel._nodeIds = nodeIds();
+
+    NodeArray<size_t> indices(graph);
+    for(size_t index = 0; index < componentLevel.numNodes(); index++)
+        indices[componentLevel._nodeIds[index]] = index;
+
+    std::vector<std::pair<size_t, size_t>> edges;
+    edges.reserve(edgeIds().size());
+
+    for(auto edgeId : edgeIds())
+    {
+        const auto& edge = graph.edgeById(edgeId);
+
+        if(!edge.isLoop())
+            edges.emplace_back(indices[edge.sourceId()], indices[edge.targetId()]);
+    }
+
+    componentLevel.setEdges(std::move(edges));
+    _levels.push_back(std::move(componentLevel));
+
+    // The number of component nodes that each node of the current level represents
+    std::vector<int> masses(nodeIds().size(), 1);
+
+    const auto Unassigned = std::numeric_limits<size_t>::max();
+
+    while(_levels.back().numNodes() > static_cast<size_t>(COARSEST_LEVEL_NUM_NODES) && !cancelled())
+    {
+        auto& level = _levels.back();
+        const auto numNodes = level.numNodes();
+
+        auto degree = [&level](size_t index)
+        {
+            return level._adjacencyOffsets[index + 1] - level._adjacencyOffsets[index];
+        };
+
+        // Visiting the lowest degree nodes first leaves fewer of them unmatched
+        std::vector<size_t> order(numNodes);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(),
+            [&degree](size_t a, size_t b) { return degree(a) < degree(b); });
+
+        std::vector<size_t> clusters(numNodes, Unassigned);
+        std::vector<int> clusterMasses;
+
+        // Match each node with its lightest unmatched neighbour, which keeps the masses even
+        for(auto index : order)
+        {
+            if(clusters[index] != Unassigned)
+                continue;
+
+            auto match = Unassigned;
+            for(auto i = level._adjacencyOffsets[index]; i < level._adjacencyOffsets[index + 1]; i++)
+            {
+                auto neighbour = level._adjacency[i];
+
+                if(clusters[neighbour] == Unassigned && neighbour != index &&
+                    (match == Unassigned || masses[neighbour] < masses[match]))
+                {
+                    match = neighbour;
+                }
+            }
+
+            if(match != Unassigned)
+            {
+                clusters[index] = clusters[match] = clusterMasses.size();
+                clusterMasses.push_back(masses[index] + masses[match]);
+            }
+        }
+
+        // Since the matching is maximal, the neighbours of any node that is still unmatched
+        // are all matched, so it joins whichever of their clusters is the lightest
+        for(auto index : order)
+        {
+            if(clusters[index] != Unassigned)
+                continue;
+
+            auto cluster = Unassigned;
+            for(auto i = level._adjacencyOffsets[index]; i < level._adjacencyOffsets[index + 1]; i++)
+            {
+                auto neighbourCluster = clusters[level._adjacency[i]];
+
+                if(cluster == Unassigned || clusterMasses[neighbourCluster] < clusterMasses[cluster])
+                    cluster = neighbourCluster;
+            }
+
+            if(cluster == Unassigned)
+            {
+                cluster = clusterMasses.size();
+                clusterMasses.push_back(0);
+            }
+
+            clusters[index] = cluster;
+            clusterMasses[cluster] += masses[index];
+        }
+
+        const auto numClusters = clusterMasses.size();
+
+        // Little has been merged, so further coarsening is not going to be productive
+        if(static_cast<float>(numClusters) > static_cast<float>(numNodes) * MAXIMUM_COARSENING_RATIO)
+            break;
+
+        // The heaviest node of each cluster represents it
+        std::vector<size_t> representatives(numClusters, Unassigned);
+        for(size_t index = 0; index < numNodes; index++)
+        {
+            auto& representative = representatives[clusters[index]];
+
+            if(representative == Unassigned || masses[index] > masses[representative])
+                representative = index;
+        }
+
+        Level coarseLevel;
+        coarseLevel._nodeIds.reserve(numClusters);
+        for(auto representative : representatives)
+            coarseLevel._nodeIds.push_back(level._nodeIds[representative]);
+
+        edges.clear();
+        for(size_t index = 0; index < numNodes; index++)
+        {
+            for(auto i = level._adjacencyOffsets[index]; i < level._adjacencyOffsets[index + 1]; i++)
+            {
+                auto cluster = clusters[index];
+                auto neighbourCluster = clusters[level._adjacency[i]];
+
+                if(cluster < neighbourCluster)
+                    edges.emplace_back(cluster, neighbourCluster);
+            }
+        }
+
+        coarseLevel.setEdges(std::move(edges));
+
+        level._parents = std::move(clusters);
+        masses = std::move(clusterMasses);
+        _levels.push_back(std::move(coarseLevel));
+    }
+}
+
+void MultilevelLayout::placeCoarsestLevel(Dimensionality dimensionality)
+{
+    const auto& coarsestLevel = _levels.back();
+
+    // Roughly the volume (or area) the coarsest level's nodes would occupy if laid out
+    auto numNodes = static_cast<float>(coarsestLevel.numNodes());
+    float spread = SPREAD * (dimensionality == Dimensionality::TwoDee ?
+        std::sqrt(numNodes) : std::cbrt(numNodes));
+
+    for(auto nodeId : coarsestLevel._nodeIds)
+    {
+        auto position = u::randQVector3D(-spread, spread);
+
+        if(dimensionality == Dimensionality::TwoDee)
+            position.setZ(0.0f);
+
+        positions().set(nodeId, position);
+        _displacements->at(nodeId)._previous = {};
+    }
+}
+
+float MultilevelLayout::iterate(const Level& level, Dimensionality dimensionality)
+{
+    ForceDirectedVectors levelPositions;
+    levelPositions.assign(level.numNodes());
+
+    for(size_t index = 0; index < level.numNodes(); index++)
+        levelPositions.set(index, positions().get(level._nodeIds[index]));
+
+    const float SHORT_RANGE = _settings->value(QStringLiteral("ShortRangeRepulseTerm"));
+    const float LONG_RANGE = 0.01f + _settings->value(QStringLiteral("LongRangeRepulseTerm"));
+
+    // Each node accumulates the attraction of its own neighbours, so unlike
+    // ForceDirectedLayout, both kinds of force can be computed in the one pass
+    auto computeForces = [this, &level, &levelPositions, SHORT_RANGE, LONG_RANGE](const auto& barnesHutTree)
+    {
+        auto mortonOrderedIndices = barnesHutTree.indicesInMortonOrder();
+
+        concurrent_for_if_large(mortonOrderedIndices.cbegin(), mortonOrderedIndices.cend(),
+            MINIMUM_NODES_FOR_CONCURRENCY,
+        [this, &level, &levelPositions, &barnesHutTree, SHORT_RANGE, LONG_RANGE](size_t index)
+        {
+            if(cancelled())
+                return;
+
+            const auto position = levelPositions.get(index);
+            auto& displacement = _displacements->at(level._nodeIds[index]);
+
+            displacement._repulsive -= barnesHutTree.evaluateKernel(index,
+            [SHORT_RANGE, LONG_RANGE](int mass, const QVector3D& difference, float distanceSq)
+            {
+                return difference * (static_cast<float>(mass) *
+                    ForceDirectedLayout::repulse(distanceSq, SHORT_RANGE, LONG_RANGE));
+            });
+
+            for(auto i = level._adjacencyOffsets[index]; i < level._adjacencyOffsets[index + 1]; i++)
+            {
+                const QVector3D difference = levelPositions.get(level._adjacency[i]) - position;
+                const float force = difference.lengthSquared() * ForceDirectedLayout::ATTRACTION_SCALE;
+
+                displacement._attractive += (force * difference);
+            }
+
+            displacement.computeAndDamp();
+        });
+    };
+
+    if(dimensionality == Dimensionality::TwoDee)
+    {
+        BarnesHutTree2D barnesHutTree;
+        barnesHutTree.build(levelPositions._x.data(), levelPositions._y.data(), nullptr, level.numNodes());
+        computeForces(barnesHutTree);
+    }
+    else
+    {
+        BarnesHutTree3D barnesHutTree;
+        barnesHutTree.build(levelPositions._x.data(), levelPositions._y.data(),
+            levelPositions._z.data(), level.numNodes());
+        computeForces(barnesHutTree);
+    }
+
+    if(cancelled())
+        return 0.0f;
+
+    float forceTotal = 0.0f;
+    for(size_t index = 0; index < level.numNodes(); index++)
+    {
+        auto nodeId = level._nodeIds[index];
+        const auto& displacement = _displacements->at(nodeId);
+
+        positions().set(nodeId, levelPositions.get(index) + displacement._next);
+        forceTotal += displacement._nextLength;
+    }
+
+    return forceTotal / static_cast<float>(level.numNodes());
+}
+
+void MultilevelLayout::setLevel(size_t level, Dimensionality dimensionality)
+{
+    if(level < _level)
+    {
+        // Place the nodes that are new to this level around their parents
+        const auto& coarseLevel = _levels.at(_level);
+        const auto& fineLevel = _levels.at(level);
+
+        for(size_t index = 0; index < fineLevel.numNodes(); index++)
+        {
+            auto nodeId = fineLevel._nodeIds[index];
+            auto parentNodeId = coarseLevel._nodeIds[fineLevel._parents[index]];
+
+            if(nodeId != parentNodeId)
+            {
+                positions().set(nodeId, positions().get(parentNodeId) +
+                    (offsetFor(nodeId, dimensionality) * OFFSET_RADIUS));
+            }
+
+            _displacements->at(nodeId)._previous = {};
+        }
+    }
+
+    _level = level;
+    _levelIteration = 0;
+
+    if(_level == 0)
+    {
+        // The component itself is reached; from here on it's ForceDirectedLayout's job
+        _levels.clear();
+        _levels.shrink_to_fit();
+        _ancestors.clear();
+        _ancestors.shrink_to_fit();
+
+        return;
+    }
+
+    _ancestors.resize(_levels.front().numNodes());
+    std::iota(_ancestors.begin(), _ancestors.end(), 0);
+
+    for(size_t i = 0; i < _level; i++)
+    {
+        const auto& parents = _levels.at(i)._parents;
+
+        for(auto& ancestor : _ancestors)
+            ancestor = parents[ancestor];
+    }
+}
+
+void MultilevelLayout::updateAncestorPositions(Dimensionality dimensionality)
+{
+    const auto& componentNodeIds = _levels.front()._nodeIds;
+    const auto& level = _levels.at(_level);
+
+    for(size_t index = 0; index < componentNodeIds.size(); index++)
+    {
+        auto nodeId = componentNodeIds[index];
+        auto ancestorNodeId = level._nodeIds[_ancestors[index]];
+
+        if(nodeId != ancestorNodeId)
+        {
+            positions().set(nodeId, positions().get(ancestorNodeId) +
+                (offsetFor(nodeId, dimensionality) * OFFSET_RADIUS));
+        }
+    }
+}
+
+void MultilevelLayout::execute(bool firstIteration, Dimensionality dimensionality)
+{
+    if(firstIteration)
+    {
+        coarsen();
+
+        if(_levels.size() < 2 || cancelled())
+        {
+            // Nothing to be gained from coarsening, so lay the component out directly
+            _levels.clear();
+            _forceDirectedLayout.execute(true, dimensionality);
+            return;
+        }
+
+        placeCoarsestLevel(dimensionality);
+        setLevel(_levels.size() - 1, dimensionality);
+    }
+    else if(!_levels.empty() && _levels.front()._nodeIds != nodeIds())
+    {
+        // The component has changed underneath the hierarchy, so abandon it
+        _levels.clear();
+        _ancestors.clear();
+    }
+
+    if(_levels.empty())
+    {
+        _forceDirectedLayout.execute(false, dimensionality);
+        return;
+    }
+
+    // Do about as much work as an iteration of the component as a whole would take,
+    // which typically means many iterations of the smaller levels
+    size_t work = 0;
+    while(!_levels.empty() && work < nodeIds().size() && !cancelled())
+    {
+        const auto& level = _levels.at(_level);
+        float forceMean = iterate(level, dimensionality);
+
+        if(cancelled())
+            return;
+
+        work += level.numNodes();
+        _levelIteration++;
+
+        if(_levelIteration >= MAXIMUM_ITERATIONS_PER_LEVEL ||
+            (_levelIteration >= MINIMUM_ITERATIONS_PER_LEVEL && forceMean < MAXIMUM_AVG_FORCE_FOR_NEXT_LEVEL))
+        {
+            setLevel(_level - 1, dimensionality);
+        }
+    }
+
+    if(!_levels.empty())
+        updateAncestorPositions(dimensionality);
+}
+
+MultilevelLayoutFactory::MultilevelLayoutFactory(GraphModel* graphModel) :
+    ForceDirectedLayoutFactory(graphModel), _displacements(graphModel->graph())
+{}
+
+std::unique_ptr<Layout> MultilevelLayoutFactory::create(ComponentId componentId,
+    NodeLayoutPositions& nodePositions, Layout::Dimensionality dimensionalityMode)
+{
+    const auto* component = _graphModel->graph().componentById(componentId);
+
+    if(component->numNodes() < MINIMUM_NUM_NODES)
+        return ForceDirectedLayoutFactory::create(componentId, nodePositions, dimensionalityMode);
+
+    return std::make_unique<MultilevelLayout>(*component, _displacements,
+        nodePositions, dimensionalityMode, &_layoutSettings);
+}
@@ -0,0 +1,129 @@
+/* Copyright © 2013-2020 Graphia Technologies Ltd.
+ *
+ * This file is part of Graphia.
+ *
+ * Graphia is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Graphia is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Graphia.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MULTILEVELLAYOUT_H
+#define MULTILEVELLAYOUT_H
+
+#include "layout.h"
+#include "forcedirectedlayout.h"
+
+#include <utility>
+#include <vector>
+
+// A multilevel force directed layout, in the manner of FM3 or sfdp. The component is
+// repeatedly coarsened, by merging matched neighbouring nodes, into a hierarchy of smaller
+// graphs. The coarsest of these is laid out first, then each level is used as the starting
+// point for the next finer level, and finally a ForceDirectedLayout refines the component.
+// The early levels are cheap to lay out and establish the global structure of the
+// component, which is otherwise the slowest part of a layout to converge.
+class MultilevelLayout : public Layout
+{
+    Q_OBJECT
+
+private:
+    static const int COARSEST_LEVEL_NUM_NODES = 50;
+    static constexpr float MAXIMUM_COARSENING_RATIO = 0.9f;
+    static const int MINIMUM_ITERATIONS_PER_LEVEL = 20;
+    static const int MAXIMUM_ITERATIONS_PER_LEVEL = 200;
+    const float MAXIMUM_AVG_FORCE_FOR_NEXT_LEVEL = 1.0f;
+    const float SPREAD = 20.0f;
+    const float OFFSET_RADIUS = 5.0f;
+
+    // The nodes of a coarse level are identified by a representative NodeId from the
+    // component, so that the levels can share positions (and displacements) with it;
+    // a representative at one level is also a representative at each finer level
+    struct Level
+    {
+        std::vector<NodeId> _nodeIds;
+
+        // Compressed adjacency lists, by index into _nodeIds
+        std::vector<size_t> _adjacencyOffsets;
+        std::vector<size_t> _adjacency;
+
+        // The index of each node's (merged) node in the next coarser level
+        std::vector<size_t> _parents;
+
+        size_t numNodes() const { return _nodeIds.size(); }
+        void setEdges(std::vector<std::pair<size_t, size_t>> edges);
+    };
+
+    ForceDirectedDisplacements* _displacements;
+    ForceDirectedLayout _forceDirectedLayout;
+
+    // _levels[0] is the component itself; it's refined by _forceDirectedLayout
+    std::vector<Level> _levels;
+    size_t _level = 0;
+    int _levelIteration = 0;
+
+    // For each node of the component, the index of its ancestor in _levels[_level]
+    std::vector<size_t> _ancestors;
+
+    void coarsen();
+    void placeCoarsestLevel(Dimensionality dimensionality);
+    float iterate(const Level& level, Dimensionality dimensionality);
+    void setLevel(size_t level, Dimensionality dimensionality);
+    void updateAncestorPositions(Dimensionality dimensionality);
+
+public:
+    MultilevelLayout(const IGraphComponent& graphComponent,
+                     ForceDirectedDisplacements& displacements,
+                     NodeLayoutPositions& positions,
+                     Layout::Dimensionality dimensionalityMode,
+                     const LayoutSettings* settings) :
+        Layout(graphComponent, positions, settings, Iterative::Yes,
+            Dimensionality::TwoOrThreeDee, 0.4f, 4),
+        _displacements(&displacements),
+        _forceDirectedLayout(graphComponent, positions, dimensionalityMode, settings)
+    {}
+
+    void cancel() override
+    {
+        Layout::cancel();
+        _forceDirectedLayout.cancel();
+    }
+
+    void uncancel() override
+    {
+        Layout::uncancel();
+        _forceDirectedLayout.uncancel();
+    }
+
+    bool finished() const override { return _levels.empty() && _forceDirectedLayout.finished(); }
+    void unfinish() override { _forceDirectedLayout.unfinish(); }
+
+    void execute(bool firstIteration, Dimensionality dimensionality) override;
+};
+
+// Components below a certain size converge quickly enough that it's not worth
+// the overhead of coarsening them, so they get a plain ForceDirectedLayout
+class MultilevelLayoutFactory : public ForceDirectedLayoutFactory
+{
+private:
+    static const int MINIMUM_NUM_NODES = 2000;
+
+    ForceDirectedDisplacements _displacements;
+
+public:
+    explicit MultilevelLayoutFactory(GraphModel* graphModel);
+
+    QString name() const override { return QStringLiteral("MultilevelForceDirected"); }
+    QString displayName() const override { return QObject::tr("Multilevel Force Directed"); }
+    std::unique_ptr<Layout> create(ComponentId componentId, NodeLayoutPositions& nodePositions,
+        Layout::Dimensionality dimensionalityMode) override;
+};
+
+#endif // MULTILEVELLAYOUT_H
@@ -18,6 +18,8 @@
 
 #include "nodepositions.h"
 
+#include "shared/utils/threadpool.h"
+
 #include <cmath>
 #include <numeric>
 
@@ -59,11 +61,18 @@ std::vector<QVector3D> NodePositions::get(const std::vector<NodeId>& nodeIds) co
 {
     std::unique_lock<const NodePositions> lock(*this);
 
-    std::vector<QVector3D> positions;
-    positions.reserve(nodeIds.size());
+    std::vector<QVector3D> positions(nodeIds.size());
+    std::vector<size_t> indices(nodeIds.size());
+    std::iota(indices.begin(), indices.end(), 0);
 
-    for(auto nodeId : nodeIds)
-        positions.emplace_back(getNoLocking(nodeId));
+    // This is called every frame by the renderer during a layout, for every visible node,
+    // so share the work out; the lock is held here so that the workers needn't take it
+    const size_t MINIMUM_NODES_FOR_CONCURRENCY = 10000;
+    concurrent_for_if_large(indices.cbegin(), indices.cend(), MINIMUM_NODES_FOR_CONCURRENCY,
+    [&](size_t index)
+    {
+        positions[index] = getNoLocking(nodeIds[index]);
+    });
 
     return positions;
 }
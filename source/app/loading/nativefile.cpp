@@ -0,0 +1,348 @@
+/* Copyright © 2013-2020 Graphia Technologies Ltd.
+ *
+ * This file is part of Graphia.
+ *
+ * Graphia is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Graphia is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Graphia.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nativefile.h"
+
+#include "shared/utils/container.h"
+#include "shared/utils/scope_exit.h"
+#include "shared/utils/threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include <zlib.h>
+
+static const char Magic[] = {'G', 'R', 'A', 'P', 'H', 'I', 'A', '\x06'};
+
+// The uncompressed size of each independently compressed block; large enough that
+// compression ratio doesn't suffer much, small enough to spread over many threads
+static const quint32 BlockSize = 1u << 22;
+
+// Compresses a block into a self contained gzip member
+static bool compressBlock(const char* in, size_t size, QByteArray& out)
+{
+    z_stream zstream = {};
+    auto ret = deflateInit2(&zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                            MAX_WBITS + 16, // 16 means write gzip header/trailer
+                            8, Z_DEFAULT_STRATEGY);
+    if(ret != Z_OK)
+        return false;
+
+    auto atExit = std::experimental::make_scope_exit([&zstream] { deflateEnd(&zstream); });
+    Q_UNUSED(atExit);
+
+    out.resize(static_cast<int>(deflateBound(&zstream, static_cast<uLong>(size))));
+
+    zstream.avail_in = static_cast<uInt>(size);
+    zstream.next_in = reinterpret_cast<z_const Bytef*>(const_cast<char*>(in)); // NOLINT
+    zstream.avail_out = static_cast<uInt>(out.size());
+    zstream.next_out = reinterpret_cast<Bytef*>(out.data()); // NOLINT
+
+    // The output is sized such that a single call always suffices
+    if(deflate(&zstream, Z_FINISH) != Z_STREAM_END)
+        return false;
+
+    out.resize(out.size() - static_cast<int>(zstream.avail_out));
+
+    return true;
+}
+
+// Decompresses a gzip member directly into its final location
+static bool decompressBlock(const uchar* in, size_t size, char* out, size_t uncompressedSize)
+{
+    z_stream zstream = {};
+    if(inflateInit2(&zstream, MAX_WBITS + 16) != Z_OK)
+        return false;
+
+    auto atExit = std::experimental::make_scope_exit([&zstream] { inflateEnd(&zstream); });
+    Q_UNUSED(atExit);
+
+    zstream.avail_in = static_cast<uInt>(size);
+    zstream.next_in = const_cast<Bytef*>(in); // NOLINT
+    zstream.avail_out = static_cast<uInt>(uncompressedSize);
+    zstream.next_out = reinterpret_cast<Bytef*>(out); // NOLINT
+
+    return inflate(&zstream, Z_FINISH) == Z_STREAM_END && zstream.avail_out == 0;
+}
+
+static bool decompressSection(const uchar* in, const NativeFile::Section& section, QByteArray& out)
+{
+    if(section._size > static_cast<quint64>(std::numeric_limits<int>::max()))
+        return false;
+
+    out.resize(static_cast<int>(section._size));
+
+    const auto numBlocks = section._compressedBlockSizes.size();
+    std::vector<size_t> inOffsets(numBlocks);
+    std::vector<size_t> blocks(numBlocks);
+
+    size_t inOffset = 0;
+    for(size_t block = 0; block < numBlocks; block++)
+    {
+        inOffsets[block] = inOffset;
+        inOffset += section._compressedBlockSizes[block];
+        blocks[block] = block;
+    }
+
+    auto* outData = out.data();
+    std::atomic<bool> success(true);
+
+    auto decompress = [&](size_t block)
+    {
+        auto outOffset = block * section._blockSize;
+        auto blockSize = std::min(static_cast<size_t>(section._size) - outOffset,
+            static_cast<size_t>(section._blockSize));
+
+        if(!decompressBlock(in + inOffsets[block], section._compressedBlockSizes[block],
+            outData + outOffset, blockSize))
+        {
+            success = false;
+        }
+    };
+
+    if(numBlocks == 1)
+        decompress(0);
+    else
+        concurrent_for(blocks.begin(), blocks.end(), decompress);
+
+    return success;
+}
+
+void NativeFile::initialiseStream(QDataStream& stream)
+{
+    stream.setVersion(QDataStream::Qt_5_8);
+    stream.setByteOrder(QDataStream::LittleEndian);
+}
+
+bool NativeFile::isNativeFile(const QString& filePath)
+{
+    QFile file(filePath);
+
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    char magic[sizeof(Magic)];
+    if(file.read(magic, sizeof(magic)) != sizeof(magic))
+        return false;
+
+    return std::memcmp(magic, Magic, sizeof(Magic)) == 0;
+}
+
+bool NativeFile::Writer::open(const QString& filePath, const QByteArray& header)
+{
+    _file.setFileName(filePath);
+
+    if(!_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    _stream.setDevice(&_file);
+    initialiseStream(_stream);
+
+    _stream.writeRawData(Magic, sizeof(Magic));
+
+    // Placeholder for the table of contents offset, filled in on close
+    _stream << quint64(0);
+    _stream << header;
+
+    return _stream.status() == QDataStream::Ok;
+}
+
+bool NativeFile::Writer::addSection(const QString& name, const QByteArray& data)
+{
+    Q_ASSERT(_file.isOpen());
+
+    Section section;
+    section._offset = static_cast<quint64>(_file.pos());
+    section._size = static_cast<quint64>(data.size());
+    section._blockSize = BlockSize;
+
+    const auto numBlocks = std::max(static_cast<size_t>(1),
+        (static_cast<size_t>(data.size()) + BlockSize - 1) / BlockSize);
+
+    std::vector<size_t> blocks(numBlocks);
+    std::iota(blocks.begin(), blocks.end(), 0);
+    std::vector<QByteArray> compressedBlocks(numBlocks);
+    std::atomic<bool> success(true);
+
+    auto compress = [&](size_t block)
+    {
+        auto offset = block * BlockSize;
+        auto size = std::min(static_cast<size_t>(data.size()) - offset, static_cast<size_t>(BlockSize));
+
+        if(!compressBlock(data.constData() + offset, size, compressedBlocks[block]))
+            success = false;
+    };
+
+    if(numBlocks == 1)
+        compress(0);
+    else
+        concurrent_for(blocks.begin(), blocks.end(), compress);
+
+    if(!success)
+        return false;
+
+    for(const auto& compressedBlock : compressedBlocks)
+    {
+        if(_stream.writeRawData(compressedBlock.constData(), compressedBlock.size()) != compressedBlock.size())
+            return false;
+
+        section._compressedBlockSizes.push_back(static_cast<quint64>(compressedBlock.size()));
+        section._compressedSize += static_cast<quint64>(compressedBlock.size());
+    }
+
+    _sections.emplace_back(name, section);
+
+    return true;
+}
+
+bool NativeFile::Writer::close()
+{
+    auto tocOffset = static_cast<quint64>(_file.pos());
+
+    _stream << static_cast<quint32>(_sections.size());
+    for(const auto& [name, section] : _sections)
+    {
+        _stream << name << section._offset << section._compressedSize << section._size <<
+            section._blockSize << static_cast<quint32>(section._compressedBlockSizes.size());
+
+        for(auto compressedBlockSize : section._compressedBlockSizes)
+            _stream << compressedBlockSize;
+    }
+
+    if(!_file.seek(sizeof(Magic)))
+        return false;
+
+    _stream << tocOffset;
+
+    // Buffered data is only written when flushed, which is where a full disk shows up
+    auto success = _stream.status() == QDataStream::Ok && _file.flush();
+    _file.close();
+
+    return success && _file.error() == QFileDevice::NoError;
+}
+
+bool NativeFile::Reader::open(const QString& filePath, bool headerOnly)
+{
+    _file.setFileName(filePath);
+
+    if(!_file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&_file);
+    initialiseStream(stream);
+
+    char magic[sizeof(Magic)];
+    if(stream.readRawData(magic, sizeof(magic)) != sizeof(magic) ||
+        std::memcmp(magic, Magic, sizeof(Magic)) != 0)
+    {
+        return false;
+    }
+
+    quint64 tocOffset = 0;
+    stream >> tocOffset >> _header;
+
+    if(stream.status() != QDataStream::Ok)
+        return false;
+
+    if(headerOnly)
+        return true;
+
+    if(tocOffset >= static_cast<quint64>(_file.size()) || !_file.seek(static_cast<qint64>(tocOffset)))
+        return false;
+
+    quint32 numSections = 0;
+    stream >> numSections;
+
+    for(quint32 i = 0; i < numSections && stream.status() == QDataStream::Ok; i++)
+    {
+        QString name;
+        Section section;
+        quint32 numBlocks = 0;
+        stream >> name >> section._offset >> section._compressedSize >> section._size >>
+            section._blockSize >> numBlocks;
+
+        // Written so as not to overflow, whatever values the file contains
+        if(section._offset > tocOffset || section._compressedSize > tocOffset - section._offset ||
+            section._blockSize == 0)
+        {
+            return false;
+        }
+
+        quint64 compressedSize = 0;
+        for(quint32 block = 0; block < numBlocks && stream.status() == QDataStream::Ok; block++)
+        {
+            quint64 compressedBlockSize = 0;
+            stream >> compressedBlockSize;
+
+            if(compressedBlockSize > section._compressedSize - compressedSize)
+                return false;
+
+            section._compressedBlockSizes.push_back(compressedBlockSize);
+            compressedSize += compressedBlockSize;
+        }
+
+        auto expectedNumBlocks = std::max(static_cast<quint64>(1),
+            (section._size / section._blockSize) + (section._size % section._blockSize != 0 ? 1 : 0));
+
+        if(compressedSize != section._compressedSize || numBlocks != expectedNumBlocks)
+            return false;
+
+        _sections[name] = section;
+    }
+
+    if(stream.status() != QDataStream::Ok)
+        return false;
+
+    // If the file can't be mapped, sections are read from it as needed instead
+    _map = _file.map(0, _file.size());
+
+    return true;
+}
+
+bool NativeFile::Reader::hasSection(const QString& name) const
+{
+    return u::contains(_sections, name);
+}
+
+bool NativeFile::Reader::readSection(const QString& name, QByteArray& data)
+{
+    if(!hasSection(name))
+        return false;
+
+    const auto& section = _sections.at(name);
+
+    if(_map != nullptr)
+        return decompressSection(_map + section._offset, section, data);
+
+    if(section._compressedSize > static_cast<quint64>(std::numeric_limits<int>::max()) ||
+        !_file.seek(static_cast<qint64>(section._offset)))
+    {
+        return false;
+    }
+
+    auto compressed = _file.read(static_cast<qint64>(section._compressedSize));
+    if(static_cast<quint64>(compressed.size()) != section._compressedSize)
+        return false;
+
+    return decompressSection(reinterpret_cast<const uchar*>(compressed.constData()), // NOLINT
+        section, data);
+}
@@ -0,0 +1,95 @@
+/* Copyright © 2013-2020 Graphia Technologies Ltd.
+ *
+ * This file is part of Graphia.
+ *
+ * Graphia is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Graphia is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Graphia.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NATIVEFILE_H
+#define NATIVEFILE_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QFile>
+#include <QString>
+
+#include <map>
+#include <utility>
+#include <vector>
+
+// A container of independently compressed sections, as used by the native format
+// from version 6 onwards:
+//
+//   magic      8 bytes
+//   tocOffset  offset of the table of contents
+//   header     length prefixed, uncompressed, so that it's cheap to read
+//   sections   each a series of gzip members
+//   toc        number of sections, then for each its name, offset,
+//              compressed size, uncompressed size, block size and the
+//              compressed size of each block
+//
+// Sections are only read and decompressed when they're asked for, so loading a
+// subset of a file only costs as much as that subset. Each section is split
+// into blocks which are compressed independently, so that they can be
+// (de)compressed in parallel; as concatenated gzip members are themselves a
+// valid gzip stream, the bytes of a section can be inflated by stock gzip.
+namespace NativeFile
+{
+// Configures a stream in the way all the data in the file is encoded
+void initialiseStream(QDataStream& stream);
+
+bool isNativeFile(const QString& filePath);
+
+struct Section
+{
+    quint64 _offset = 0;
+    quint64 _compressedSize = 0;
+    quint64 _size = 0;
+    quint32 _blockSize = 0;
+    std::vector<quint64> _compressedBlockSizes;
+};
+
+class Writer
+{
+private:
+    QFile _file;
+    QDataStream _stream;
+    std::vector<std::pair<QString, Section>> _sections;
+
+public:
+    bool open(const QString& filePath, const QByteArray& header);
+    bool addSection(const QString& name, const QByteArray& data);
+    bool close();
+};
+
+class Reader
+{
+private:
+    QFile _file;
+    const uchar* _map = nullptr;
+    QByteArray _header;
+    std::map<QString, Section> _sections;
+
+public:
+    // If headerOnly is set, the table of contents isn't read
+    bool open(const QString& filePath, bool headerOnly = false);
+
+    const QByteArray& header() const { return _header; }
+
+    bool hasSection(const QString& name) const;
+    bool readSection(const QString& name, QByteArray& data);
+};
+} // namespace NativeFile
+
+#endif // NATIVEFILE_H
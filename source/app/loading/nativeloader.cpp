@@ -18,6 +18,7 @@
 
 #include "nativeloader.h"
 #include "nativesaver.h"
+#include "nativefile.h"
 
 #include "application.h"
 
@@ -34,6 +35,7 @@
 #include <QDataStream>
 #include <QRegularExpression>
 
+#include <limits>
 #include <vector>
 
 #include <json_helper.h>
@@ -70,10 +72,37 @@ static bool decompress(const QString& filePath, QByteArray& byteArray,
     if(totalBytes == 0)
         return false;
 
+    // The gzip trailer holds the uncompressed size (modulo 2^32), which makes for a
+    // decent guess at how much space to reserve, avoiding repeated reallocation
+    if(maxReadSize < 0 && totalBytes > 4 && file.seek(static_cast<qint64>(totalBytes - 4)))
+    {
+        unsigned char trailer[4];
+        if(file.read(reinterpret_cast<char*>(trailer), sizeof(trailer)) == sizeof(trailer)) // NOLINT
+        {
+            auto uncompressedSize = static_cast<uint64_t>(trailer[0]) |
+                (static_cast<uint64_t>(trailer[1]) << 8) |
+                (static_cast<uint64_t>(trailer[2]) << 16) |
+                (static_cast<uint64_t>(trailer[3]) << 24);
+
+            if(uncompressedSize >= totalBytes &&
+                uncompressedSize < static_cast<uint64_t>(std::numeric_limits<int>::max()))
+            {
+                byteArray.reserve(static_cast<int>(uncompressedSize));
+            }
+        }
+
+        if(!file.seek(0))
+            return false;
+    }
+
     uint64_t bytesRead = 0;
     uint64_t bytesDecompressed = 0;
     QDataStream input(&file);
 
+    const int ChunkSize = 1 << 16;
+    std::vector<unsigned char> inBuffer(ChunkSize);
+    std::vector<unsigned char> outBuffer(ChunkSize);
+
     z_stream zstream = {};
     auto ret = inflateInit2(&zstream, MAX_WBITS + 32); // 32 means read gzip header/trailer
     if(ret != Z_OK)
@@ -87,9 +116,6 @@ static bool decompress(const QString& filePath, QByteArray& byteArray,
 
     do
     {
-        const int ChunkSize = 1 << 14;
-        std::vector<unsigned char> inBuffer(ChunkSize);
-
         auto numBytes = input.readRawData(reinterpret_cast<char*>(inBuffer.data()), ChunkSize); // NOLINT
 
         bytesRead += numBytes;
@@ -105,7 +131,6 @@ static bool decompress(const QString& filePath, QByteArray& byteArray,
 
         do
         {
-            std::vector<unsigned char> outBuffer(ChunkSize);
             zstream.avail_out = ChunkSize;
             zstream.next_out = static_cast<Bytef*>(outBuffer.data());
 
@@ -188,8 +213,43 @@ struct Header
     int _pluginDataVersion = -1;
 };
 
+static bool parseJsonHeader(const json& jsonHeader, Header* header)
+{
+    if(jsonHeader.is_discarded() || jsonHeader.is_null() || !jsonHeader.is_object())
+        return false;
+
+    if(!u::contains(jsonHeader, "version"))
+        return false;
+
+    if(!u::contains(jsonHeader, "pluginName"))
+        return false;
+
+    if(!u::contains(jsonHeader, "pluginDataVersion"))
+        return false;
+
+    if(header != nullptr)
+    {
+        header->_version            = jsonHeader["version"];
+        header->_pluginName         = QString::fromStdString(jsonHeader["pluginName"]);
+        header->_pluginDataVersion  = jsonHeader["pluginDataVersion"];
+    }
+
+    return true;
+}
+
 static bool parseHeader(const QUrl& url, Header* header = nullptr)
 {
+    if(NativeFile::isNativeFile(url.toLocalFile()))
+    {
+        NativeFile::Reader reader;
+        if(!reader.open(url.toLocalFile(), true))
+            return false;
+
+        const auto& headerByteArray = reader.header();
+        return parseJsonHeader(json::parse(headerByteArray.begin(),
+            headerByteArray.end(), nullptr, false), header);
+    }
+
     QByteArray byteArray;
 
     if(!load(url.toLocalFile(), byteArray, NativeSaver::MaxHeaderSize))
@@ -231,24 +291,284 @@ static bool parseHeader(const QUrl& url, Header* header = nullptr)
     auto headerByteArray = headerString.toUtf8();
     json jsonHeader = json::parse(headerByteArray.begin(), headerByteArray.end(), nullptr, false);
 
-    if(jsonHeader.is_discarded() || jsonHeader.is_null() || !jsonHeader.is_object())
-        return false;
+    return parseJsonHeader(jsonHeader, header);
+}
 
-    if(!u::contains(jsonHeader, "version"))
+void Loader::parseContent(const json& jsonBody)
+{
+    if(u::contains(jsonBody, "transforms"))
+    {
+        for(const auto& transform : jsonBody["transforms"])
+            _transforms.append(QString::fromStdString(transform));
+    }
+
+    if(u::contains(jsonBody, "visualisations"))
+    {
+        for(const auto& visualisation : jsonBody["visualisations"])
+            _visualisations.append(QString::fromStdString(visualisation));
+    }
+
+    if(u::contains(jsonBody, "projection"))
+        _projection = jsonBody["projection"];
+
+    if(u::contains(jsonBody, "2dshading"))
+        _shading = jsonBody["2dshading"];
+
+    if(u::contains(jsonBody, "3dshading"))
+        _shading = jsonBody["3dshading"];
+
+    if(u::contains(jsonBody, "bookmarks"))
+    {
+        const auto bookmarks = jsonBody["bookmarks"];
+        for(auto bookmarkIt = bookmarks.begin(); bookmarkIt != bookmarks.end(); ++bookmarkIt)
+        {
+            QString name = QString::fromStdString(bookmarkIt.key());
+            const auto& array = bookmarkIt.value();
+
+            if(array.is_array())
+            {
+                NodeIdSet nodeIds;
+                nodeIds.reserve(array.size());
+
+                for(const auto& nodeId : array)
+                    nodeIds.insert(nodeId.get<int>());
+
+                _bookmarks.insert({name, nodeIds});
+            }
+        }
+    }
+
+    if(u::contains(jsonBody, "enrichmentTables"))
+    {
+        for(const auto& tableModel : jsonBody["enrichmentTables"])
+        {
+            _enrichmentTablesData.emplace_back();
+            auto& table = _enrichmentTablesData.back();
+            // If Data is empty then it's just an empty table
+            if(u::contains(tableModel, "data"))
+            {
+                for(const auto& dataRow : tableModel["data"])
+                {
+                    table.emplace_back();
+                    auto& row = table.back();
+                    row.reserve(dataRow.size());
+                    for(const auto& value : dataRow)
+                    {
+                        if(value.is_number())
+                            row.emplace_back(value.get<std::double_t>());
+                        else
+                            row.emplace_back(QString::fromStdString(value.get<std::string>()));
+                    }
+                }
+            }
+        }
+    }
+
+    if(u::contains(jsonBody, "layout"))
+    {
+        const auto& jsonLayout = jsonBody["layout"];
+
+        if(u::contains(jsonLayout, "algorithm"))
+            _layoutName = QString::fromStdString(jsonLayout["algorithm"]);
+
+        if(u::contains(jsonLayout, "settings"))
+        {
+            const auto settings = jsonLayout["settings"];
+            for(auto settingsIt = settings.begin(); settingsIt != settings.end(); ++settingsIt)
+            {
+                QString name = QString::fromStdString(settingsIt.key());
+                const auto& value = settingsIt.value();
+
+                if(value.is_number())
+                    _layoutSettings.push_back({name, value});
+            }
+        }
+
+        if(u::contains(jsonLayout, "paused"))
+            _layoutPaused = jsonLayout["paused"];
+    }
+}
+
+bool Loader::loadPluginData(const QByteArray& pluginData, int pluginDataVersion, GraphModel* graphModel)
+{
+    if(pluginDataVersion > _pluginInstance->plugin()->dataVersion())
+    {
+        setFailureReason(QObject::tr("Produced using a newer version of the plugin '%1'.")
+            .arg(_pluginInstance->plugin()->name()));
         return false;
+    }
 
-    if(!u::contains(jsonHeader, "pluginName"))
+    if(!_pluginInstance->load(pluginData, pluginDataVersion, graphModel->mutableGraph(), *this))
+    {
+        setFailureReason(_pluginInstance->failureReason());
         return false;
+    }
 
-    if(!u::contains(jsonHeader, "pluginDataVersion"))
+    return true;
+}
+
+bool Loader::parseSections(const QString& filePath, int pluginDataVersion, GraphModel* graphModel)
+{
+    NativeFile::Reader reader;
+    if(!reader.open(filePath))
         return false;
 
-    if(header != nullptr)
+    auto& mutableGraph = graphModel->mutableGraph();
+
+    // Sections are decompressed one at a time, as they're needed
+    auto readSection = [this, &reader](const QString& name, auto&& readFn)
     {
-        header->_version            = jsonHeader["version"];
-        header->_pluginName         = QString::fromStdString(jsonHeader["pluginName"]);
-        header->_pluginDataVersion  = jsonHeader["pluginDataVersion"];
-    }
+        QByteArray byteArray;
+        if(!reader.readSection(name, byteArray))
+            return false;
+
+        if(cancelled())
+            return false;
+
+        QDataStream stream(byteArray);
+        NativeFile::initialiseStream(stream);
+
+        return readFn(stream) && stream.status() == QDataStream::Ok;
+    };
+
+    std::vector<NodeId> nodeIds;
+
+    mutableGraph.setPhase(QObject::tr("Nodes"));
+    if(!readSection(QStringLiteral("nodes"), [&](QDataStream& stream)
+    {
+        quint32 numNodes = 0;
+        stream >> numNodes;
+
+        for(quint32 i = 0; i < numNodes && stream.status() == QDataStream::Ok; i++)
+        {
+            qint32 id = 0;
+            stream >> id;
+
+            if(id < 0)
+                return false;
+
+            nodeIds.emplace_back(id);
+        }
+
+        if(nodeIds.empty())
+            return true;
+
+        mutableGraph.reserveNodeId(*std::max_element(nodeIds.begin(), nodeIds.end()));
+
+        uint64_t i = 0;
+        for(auto nodeId : nodeIds)
+        {
+            mutableGraph.addNode(nodeId);
+            setProgress(static_cast<int>((i++ * 100) / nodeIds.size()));
+        }
+
+        return true;
+    })) return false;
+
+    setProgress(-1);
+
+    mutableGraph.setPhase(QObject::tr("Edges"));
+    if(!readSection(QStringLiteral("edges"), [&](QDataStream& stream)
+    {
+        quint32 numEdges = 0;
+        stream >> numEdges;
+
+        struct SavedEdge { EdgeId _id; NodeId _sourceId; NodeId _targetId; };
+        std::vector<SavedEdge> edges;
+
+        for(quint32 i = 0; i < numEdges && stream.status() == QDataStream::Ok; i++)
+        {
+            qint32 id = 0, sourceId = 0, targetId = 0;
+            stream >> id >> sourceId >> targetId;
+
+            if(id < 0 || !mutableGraph.containsNodeId(sourceId) || !mutableGraph.containsNodeId(targetId))
+                return false;
+
+            edges.push_back({id, sourceId, targetId});
+        }
+
+        if(edges.empty())
+            return true;
+
+        mutableGraph.reserveEdgeId(std::max_element(edges.begin(), edges.end(),
+            [](const auto& a, const auto& b) { return a._id < b._id; })->_id);
+
+        uint64_t i = 0;
+        for(const auto& edge : edges)
+        {
+            mutableGraph.addEdge(edge._id, edge._sourceId, edge._targetId);
+            setProgress(static_cast<int>((i++ * 100) / edges.size()));
+        }
+
+        return true;
+    })) return false;
+
+    setProgress(-1);
+
+    if(!readSection(QStringLiteral("nodeNames"), [&](QDataStream& stream)
+    {
+        for(auto nodeId : nodeIds)
+        {
+            QString nodeName;
+            stream >> nodeName;
+            graphModel->setNodeName(nodeId, nodeName);
+        }
+
+        return true;
+    })) return false;
+
+    mutableGraph.setPhase(QObject::tr("Positions"));
+    if(!readSection(QStringLiteral("positions"), [&](QDataStream& stream)
+    {
+        stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+        _nodePositions = std::make_unique<ExactNodePositions>(mutableGraph);
+
+        for(auto nodeId : nodeIds)
+        {
+            float x = 0.0f, y = 0.0f, z = 0.0f;
+            stream >> x >> y >> z;
+            _nodePositions->set(nodeId, QVector3D(x, y, z));
+        }
+
+        return true;
+    })) return false;
+
+    mutableGraph.setPhase(QObject::tr("Attributes"));
+    if(!readSection(QStringLiteral("userNodeData"), [&](QDataStream& stream)
+    {
+        return graphModel->userNodeData().load(stream, *this);
+    })) return false;
+
+    if(!readSection(QStringLiteral("userEdgeData"), [&](QDataStream& stream)
+    {
+        return graphModel->userEdgeData().load(stream, *this);
+    })) return false;
+
+    QByteArray byteArray;
+
+    if(!reader.readSection(QStringLiteral("content"), byteArray))
+        return false;
+
+    auto jsonContent = json::parse(byteArray.begin(), byteArray.end(), nullptr, false);
+    if(jsonContent.is_discarded() || !jsonContent.is_object())
+        return false;
+
+    parseContent(jsonContent);
+
+    if(!reader.readSection(QStringLiteral("ui"), _uiData))
+        return false;
+
+    mutableGraph.setPhase(_pluginInstance->plugin()->name());
+    if(!reader.readSection(QStringLiteral("pluginData"), byteArray))
+        return false;
+
+    if(!loadPluginData(byteArray, pluginDataVersion, graphModel))
+        return false;
+
+    if(!reader.readSection(QStringLiteral("pluginUiData"), _pluginUiData))
+        return false;
+
+    _pluginUiDataVersion = pluginDataVersion;
 
     return true;
 }
@@ -274,6 +594,9 @@ bool Loader::parse(const QUrl& url, IGraphModel* igraphModel)
         return false;
     }
 
+    if(version >= 6)
+        return parseSections(url.toLocalFile(), header._pluginDataVersion, graphModel);
+
     QByteArray byteArray;
 
     if(!load(url.toLocalFile(), byteArray, -1, &graphModel->mutableGraph(), this))
@@ -350,94 +673,12 @@ bool Loader::parse(const QUrl& url, IGraphModel* igraphModel)
             return false;
     }
 
-    if(u::contains(jsonBody, "transforms"))
-    {
-        for(const auto& transform : jsonBody["transforms"])
-            _transforms.append(QString::fromStdString(transform));
-    }
-
-    if(u::contains(jsonBody, "visualisations"))
-    {
-        for(const auto& visualisation : jsonBody["visualisations"])
-            _visualisations.append(QString::fromStdString(visualisation));
-    }
-
-    if(u::contains(jsonBody, "projection"))
-        _projection = jsonBody["projection"];
-
-    if(u::contains(jsonBody, "2dshading"))
-        _shading = jsonBody["2dshading"];
-
-    if(u::contains(jsonBody, "3dshading"))
-        _shading = jsonBody["3dshading"];
-
-    if(u::contains(jsonBody, "bookmarks"))
-    {
-        const auto bookmarks = jsonBody["bookmarks"];
-        for(auto bookmarkIt = bookmarks.begin(); bookmarkIt != bookmarks.end(); ++bookmarkIt)
-        {
-            QString name = QString::fromStdString(bookmarkIt.key());
-            const auto& array = bookmarkIt.value();
-
-            if(array.is_array())
-            {
-                NodeIdSet nodeIds;
-                nodeIds.reserve(array.size());
-
-                for(const auto& nodeId : array)
-                    nodeIds.insert(nodeId.get<int>());
-
-                _bookmarks.insert({name, nodeIds});
-            }
-        }
-    }
-
-    if(u::contains(jsonBody, "enrichmentTables"))
-    {
-        for(const auto& tableModel : jsonBody["enrichmentTables"])
-        {
-            _enrichmentTablesData.emplace_back();
-            auto& table = _enrichmentTablesData.back();
-            // If Data is empty then it's just an empty table
-            if(u::contains(tableModel, "data"))
-            {
-                for(const auto& dataRow : tableModel["data"])
-                {
-                    table.emplace_back();
-                    auto& row = table.back();
-                    row.reserve(dataRow.size());
-                    for(const auto& value : dataRow)
-                    {
-                        if(value.is_number())
-                            row.emplace_back(value.get<std::double_t>());
-                        else
-                            row.emplace_back(QString::fromStdString(value.get<std::string>()));
-                    }
-                }
-            }
-        }
-    }
+    parseContent(jsonBody);
 
     if(u::contains(jsonBody, "layout"))
     {
         const auto& jsonLayout = jsonBody["layout"];
 
-        if(u::contains(jsonLayout, "algorithm"))
-            _layoutName = QString::fromStdString(jsonLayout["algorithm"]);
-
-        if(u::contains(jsonLayout, "settings"))
-        {
-            const auto settings = jsonLayout["settings"];
-            for(auto settingsIt = settings.begin(); settingsIt != settings.end(); ++settingsIt)
-            {
-                QString name = QString::fromStdString(settingsIt.key());
-                const auto& value = settingsIt.value();
-
-                if(value.is_number())
-                    _layoutSettings.push_back({name, value});
-            }
-        }
-
         if(u::contains(jsonLayout, "positions"))
         {
             _nodePositions = std::make_unique<ExactNodePositions>(graphModel->mutableGraph());
@@ -473,8 +714,6 @@ bool Loader::parse(const QUrl& url, IGraphModel* igraphModel)
                 }
             }
         }
-
-        _layoutPaused = jsonLayout["paused"];
     }
 
     if(version >= 2 && u::contains(jsonBody, "ui"))
@@ -501,18 +740,8 @@ bool Loader::parse(const QUrl& url, IGraphModel* igraphModel)
     else
         return false;
 
-    if(header._pluginDataVersion > _pluginInstance->plugin()->dataVersion())
-    {
-        setFailureReason(QObject::tr("Produced using a newer version of the plugin '%1'.")
-            .arg(_pluginInstance->plugin()->name()));
-        return false;
-    }
-
-    if(!_pluginInstance->load(pluginData, header._pluginDataVersion, graphModel->mutableGraph(), *this))
-    {
-        setFailureReason(_pluginInstance->failureReason());
+    if(!loadPluginData(pluginData, header._pluginDataVersion, graphModel))
         return false;
-    }
 
     const auto* pluginUiDataKey = version >= 2 ? "pluginUiData" : "ui";
     if(u::contains(jsonBody, pluginUiDataKey))
@@ -34,9 +34,13 @@
 #include <QStringList>
 #include <QByteArray>
 
+#include <json_helper.h>
+
 #include <memory>
 #include <map>
 
+class GraphModel;
+
 class Loader : public IParser
 {
 private:
@@ -60,6 +64,10 @@ private:
     Projection _projection = Projection::Perspective;
     Shading _shading = Shading::Smooth;
 
+    void parseContent(const json& jsonBody);
+    bool loadPluginData(const QByteArray& pluginData, int pluginDataVersion, GraphModel* graphModel);
+    bool parseSections(const QString& filePath, int pluginDataVersion, GraphModel* graphModel);
+
 public:
     bool parse(const QUrl& url, IGraphModel* igraphModel) override;
     void setPluginInstance(IPluginInstance* pluginInstance);
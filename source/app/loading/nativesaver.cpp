@@ -17,13 +17,11 @@
  */
 
 #include "nativesaver.h"
-#include "jsongraphsaver.h"
+#include "nativefile.h"
 
-#include "shared/graph/grapharray_json.h"
 
 #include "shared/plugins/iplugin.h"
 #include "shared/utils/iterator_range.h"
-#include "shared/utils/scope_exit.h"
 #include "shared/utils/string.h"
 #include "shared/loading/userelementdata.h"
 
@@ -38,73 +36,9 @@
 
 #include <vector>
 
-#include <zlib.h>
-
-const int NativeSaver::Version = 5;
+const int NativeSaver::Version = 6;
 const int NativeSaver::MaxHeaderSize = 1 << 12;
 
-static bool compress(const QByteArray& byteArray, const QString& filePath, Progressable& progressable)
-{
-    QFile file(filePath);
-
-    if(!file.open(QIODevice::WriteOnly))
-        return false;
-
-    uint64_t totalBytes = byteArray.size();
-    uint64_t bytePosition = 0;
-    QDataStream input(byteArray);
-    QDataStream output(&file);
-
-    z_stream zstream = {};
-    auto ret = deflateInit2(&zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
-                            MAX_WBITS + 16, // 16 means write gzip header/trailer
-                            8, Z_DEFAULT_STRATEGY);
-    if(ret != Z_OK)
-        return false;
-
-    auto atExit = std::experimental::make_scope_exit([&zstream] { deflateEnd(&zstream); });
-    Q_UNUSED(atExit);
-
-    int flush = Z_ERRNO;
-
-    do
-    {
-        const int ChunkSize = 1 << 14;
-        std::vector<unsigned char> inBuffer(ChunkSize);
-
-        auto numBytes = input.readRawData(reinterpret_cast<char*>(inBuffer.data()), ChunkSize); // NOLINT
-
-        bytePosition += numBytes;
-        progressable.setProgress(static_cast<int>((bytePosition * 100u) / totalBytes));
-
-        zstream.avail_in = numBytes;
-        zstream.next_in = static_cast<z_const Bytef*>(inBuffer.data());
-        flush = input.atEnd() ? Z_FINISH : Z_NO_FLUSH;
-
-        do
-        {
-            std::vector<unsigned char> outBuffer(ChunkSize);
-            zstream.avail_out = ChunkSize;
-            zstream.next_out = static_cast<Bytef*>(outBuffer.data());
-
-            ret = deflate(&zstream, flush);
-            if(ret == Z_STREAM_ERROR)
-                return false;
-
-            numBytes = ChunkSize - zstream.avail_out;
-            if(output.writeRawData(reinterpret_cast<const char*>(outBuffer.data()), numBytes) !=
-               numBytes) // NOLINT
-                return false;
-
-        } while(zstream.avail_out == 0);
-        Q_ASSERT(zstream.avail_in == 0);
-
-    } while(flush != Z_FINISH);
-    Q_ASSERT(ret == Z_STREAM_END);
-
-    return true;
-}
-
 static json bookmarksAsJson(const Document& document)
 {
     json jsonObject = json::object();
@@ -163,8 +97,6 @@ static json enrichmentTableModelAsJson(const EnrichmentTableModel& table)
 
 bool NativeSaver::save()
 {
-    json jsonArray;
-
     auto* graphModel = dynamic_cast<GraphModel*>(_document->graphModel());
 
     Q_ASSERT(graphModel != nullptr);
@@ -177,31 +109,91 @@ bool NativeSaver::save()
     header["version"] = NativeSaver::Version;
     header["pluginName"] = graphModel->pluginName();
     header["pluginDataVersion"] = graphModel->pluginDataVersion();
-    jsonArray.emplace_back(header);
 
     // The header must fit within a certain size, which is the maximum the loader will look at
-    if(json({header}).dump().size() > MaxHeaderSize)
+    if(header.dump().size() > MaxHeaderSize)
         return false;
 
-    json content;
+    NativeFile::Writer writer;
+    if(!writer.open(_fileUrl.toLocalFile(), QByteArray::fromStdString(header.dump())))
+        return false;
 
-    content["graph"] = JSONGraphSaver::graphAsJson(graph, *this);
-    content["nodeNames"] = u::graphArrayAsJson(graphModel->nodeNames(), graph.nodeIds(), this);
+    // Each section is built and compressed in turn, so that only one of them is in memory at once
+    auto addSection = [&writer](const QString& name, auto&& writeFn)
+    {
+        QByteArray byteArray;
+        QDataStream stream(&byteArray, QIODevice::WriteOnly);
+        NativeFile::initialiseStream(stream);
 
-    content["userNodeData"] = graphModel->userNodeData().save(graph, graph.nodeIds(), *this);
-    content["userEdgeData"] = graphModel->userEdgeData().save(graph, graph.edgeIds(), *this);
+        writeFn(stream);
 
-    json layout;
+        return writer.addSection(name, byteArray);
+    };
 
-    layout["algorithm"] = _document->layoutName();
-    layout["settings"] = layoutSettingsAsJson(*_document);
+    const auto& nodeIds = graph.nodeIds();
+    const auto& edgeIds = graph.edgeIds();
+
+    graph.setPhase(QObject::tr("Nodes"));
+    if(!addSection(QStringLiteral("nodes"), [&](QDataStream& stream)
+    {
+        stream << static_cast<quint32>(nodeIds.size());
+
+        for(auto nodeId : nodeIds)
+            stream << static_cast<qint32>(static_cast<int>(nodeId));
+    })) return false;
+
+    graph.setPhase(QObject::tr("Edges"));
+    if(!addSection(QStringLiteral("edges"), [&](QDataStream& stream)
+    {
+        stream << static_cast<quint32>(edgeIds.size());
+
+        for(auto edgeId : edgeIds)
+        {
+            const auto& edge = graph.edgeById(edgeId);
+            stream << static_cast<qint32>(static_cast<int>(edgeId)) <<
+                static_cast<qint32>(static_cast<int>(edge.sourceId())) <<
+                static_cast<qint32>(static_cast<int>(edge.targetId()));
+        }
+    })) return false;
+
+    // Per node sections are in the same order as the nodes section
+    if(!addSection(QStringLiteral("nodeNames"), [&](QDataStream& stream)
+    {
+        const auto& nodeNames = graphModel->nodeNames();
+
+        for(auto nodeId : nodeIds)
+            stream << nodeNames[nodeId];
+    })) return false;
+
+    graph.setPhase(QObject::tr("Positions"));
+    if(!addSection(QStringLiteral("positions"), [&](QDataStream& stream)
+    {
+        stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+        const auto& nodePositions = graphModel->nodePositions();
 
-    layout["positions"] = u::graphArrayAsJson(graphModel->nodePositions(), graph.nodeIds(), this,
-    [](const auto& v)
+        for(auto nodeId : nodeIds)
+        {
+            const auto& position = nodePositions.at(nodeId);
+            stream << position.x() << position.y() << position.z();
+        }
+    })) return false;
+
+    graph.setPhase(QObject::tr("Attributes"));
+    if(!addSection(QStringLiteral("userNodeData"), [&](QDataStream& stream)
     {
-        return json({v.x(), v.y(), v.z()});
-    });
+        graphModel->userNodeData().save(graph, nodeIds, stream, *this);
+    })) return false;
 
+    if(!addSection(QStringLiteral("userEdgeData"), [&](QDataStream& stream)
+    {
+        graphModel->userEdgeData().save(graph, edgeIds, stream, *this);
+    })) return false;
+
+    json content;
+
+    json layout;
+    layout["algorithm"] = _document->layoutName();
+    layout["settings"] = layoutSettingsAsJson(*_document);
     layout["paused"] = _document->layoutPauseState() == LayoutPauseState::Paused;
     content["layout"] = layout;
 
@@ -217,36 +209,26 @@ bool NativeSaver::save()
     for(const auto* table : *_document->enrichmentTableModels())
         content["enrichmentTables"].push_back(enrichmentTableModelAsJson(*table));
 
-    auto uiDataJson = json::parse(_uiData.begin(), _uiData.end(), nullptr, false);
+    if(!writer.addSection(QStringLiteral("content"), QByteArray::fromStdString(content.dump())))
+        return false;
 
-    if(uiDataJson.is_object() || uiDataJson.is_array())
-        content["ui"] = uiDataJson;
+    if(!writer.addSection(QStringLiteral("ui"), _uiData))
+        return false;
 
     graph.setPhase(graphModel->pluginName());
     auto pluginData = _pluginInstance->save(graph, *this);
 
     setProgress(-1);
 
-    auto pluginDataJson = json::parse(pluginData.begin(), pluginData.end(), nullptr, false);
-
-    // If the plugin data is itself JSON, just whack it in
-    // as is, but if it's not, hex encode it
-    if(!pluginDataJson.is_discarded() && (pluginDataJson.is_object() || pluginDataJson.is_array()))
-        content["pluginData"] = pluginDataJson;
-    else
-        content["pluginData"] = QString(pluginData.toHex());
-
-    auto pluginUiDataJson = json::parse(_pluginUiData.begin(), _pluginUiData.end(), nullptr, false);
-
-    if(!pluginUiDataJson.is_discarded() && (pluginUiDataJson.is_object() || pluginUiDataJson.is_array()))
-        content["pluginUiData"] = pluginUiDataJson;
-    else
-        content["pluginUiData"] = QString(_pluginUiData.toHex());
+    // Plugin data is opaque, so it's stored verbatim
+    graph.setPhase(QObject::tr("Compressing"));
+    if(!writer.addSection(QStringLiteral("pluginData"), pluginData))
+        return false;
 
-    jsonArray.emplace_back(content);
+    if(!writer.addSection(QStringLiteral("pluginUiData"), _pluginUiData))
+        return false;
 
-    graph.setPhase(QObject::tr("Compressing"));
-    return compress(QByteArray::fromStdString(jsonArray.dump()), _fileUrl.toLocalFile(), *this);
+    return writer.close();
 }
 
 std::unique_ptr<ISaver> NativeSaverFactory::create(const QUrl& url, Document* document,
@@ -231,6 +231,7 @@ int start(int argc, char *argv[])
     u::definePref(QStringLiteral("visuals/disableMultisampling"),           false);
 
     u::definePref(QStringLiteral("misc/maxUndoLevels"),                     25);
+    u::definePref(QStringLiteral("misc/transformCacheMemoryBudget"),        2048);
 
     u::definePref(QStringLiteral("misc/showGraphMetrics"),                  false);
     u::definePref(QStringLiteral("misc/showLayoutSettings"),                false);
@@ -156,7 +156,7 @@ GraphRenderer::~GraphRenderer()
 }
 
 void GraphRenderer::createGPUGlyphData(const QString& text, const QColor& textColor, const TextAlignment& textAlignment,
-                                    float textScale, float elementSize, const QVector3D& elementPosition,
+                                    float textScale, float elementSize, const GPUGraphData::PositionSource& positionSource,
                                     int componentIndex, GPUGraphData* gpuGraphData)
 {
     Q_ASSERT(gpuGraphData != nullptr);
@@ -199,35 +199,50 @@ void GraphRenderer::createGPUGlyphData(const QString& text, const QColor& textCo
         glyphData._textureCoord[1] = textureGlyph._v;
         glyphData._textureLayer = textureGlyph._layer;
 
-        glyphData._basePosition[0] = elementPosition.x();
-        glyphData._basePosition[1] = elementPosition.y();
-        glyphData._basePosition[2] = elementPosition.z();
-
         glyphData._color[0] = textColor.redF();
         glyphData._color[1] = textColor.greenF();
         glyphData._color[2] = textColor.blueF();
 
         gpuGraphData->_glyphData.push_back(glyphData);
+        gpuGraphData->_glyphPositionSources.push_back(positionSource);
     }
 }
 
 void GraphRenderer::updateGPUDataIfRequired()
 {
-    if(!_gpuDataRequiresUpdate)
-        return;
+    if(_gpuDataRequiresUpdate)
+    {
+        _gpuDataRequiresUpdate = false;
+        _gpuPositionDataRequiresUpdate = false;
+
+        rebuildGPUData();
+    }
+    else if(_gpuPositionDataRequiresUpdate)
+    {
+        _gpuPositionDataRequiresUpdate = false;
 
-    _gpuDataRequiresUpdate = false;
+        updateGPUGraphDataPositions(gpuNodePositions());
+        uploadGPUGraphDataPositions();
+    }
+}
 
-    std::unique_lock<NodePositions> nodePositionsLock(_graphModel->nodePositions());
+std::vector<QVector3D> GraphRenderer::gpuNodePositions() const
+{
+    return _graphModel->nodePositions().get(_gpuNodeIds);
+}
+
+void GraphRenderer::rebuildGPUData()
+{
     std::unique_lock<std::recursive_mutex> glyphMapLock(_glyphMap->mutex());
 
     int componentIndex = 0;
 
-    auto& nodePositions = _graphModel->nodePositions();
-
     resetGPUGraphData();
+    _gpuNodeIds.clear();
 
-    NodeArray<QVector3D> scaledAndSmoothedNodePositions(_graphModel->graph());
+    // Maps each visible node to its index in _gpuNodeIds, and thus to the
+    // position from which the GPU position data is (re)generated
+    NodeArray<size_t> positionIndices(_graphModel->graph());
 
     float textScale = u::pref("visuals/textSize").toFloat();
     auto textAlignment = static_cast<TextAlignment>(u::pref("visuals/textAlignment").toInt());
@@ -253,16 +268,14 @@ void GraphRenderer::updateGPUDataIfRequired()
             if(_hiddenNodes.get(nodeId))
                 continue;
 
-            const QVector3D nodePosition = nodePositions.get(nodeId);
-            scaledAndSmoothedNodePositions[nodeId] = nodePosition;
+            const auto positionIndex = _gpuNodeIds.size();
+            positionIndices[nodeId] = positionIndex;
+            _gpuNodeIds.push_back(nodeId);
 
             const auto& nodeVisual = _graphModel->nodeVisual(nodeId);
 
             // Create and add NodeData
             GPUGraphData::NodeData nodeData;
-            nodeData._position[0] = nodePosition.x();
-            nodeData._position[1] = nodePosition.y();
-            nodeData._position[2] = nodePosition.z();
             nodeData._component = componentIndex;
             nodeData._size = nodeVisual._size;
             nodeData._outerColor[0] = nodeVisual._outerColor.redF();
@@ -279,6 +292,7 @@ void GraphRenderer::updateGPUDataIfRequired()
             if(gpuGraphData != nullptr)
             {
                 gpuGraphData->_nodeData.push_back(nodeData);
+                gpuGraphData->_nodePositionSources.push_back(positionIndex);
 
                 if(nodeData._selected != 0.0f)
                     gpuGraphData->_elementsSelected = true;
@@ -293,54 +307,25 @@ void GraphRenderer::updateGPUDataIfRequired()
                     continue;
 
                 createGPUGlyphData(nodeVisual._text, textColor, textAlignment, textScale,
-                    nodeVisual._size, nodePosition, componentIndex,
+                    nodeVisual._size, {positionIndex, positionIndex}, componentIndex,
                     gpuGraphDataForOverlay(componentRenderer->alpha()));
             }
         }
 
+        // Note that edges which are entirely occluded by the nodes at either end
+        // are culled by the edge shader, so that which edges are present here
+        // doesn't depend on the node positions
         for(auto& edge : componentRenderer->edges())
         {
             if(_hiddenEdges.get(edge->id()) || _hiddenNodes.get(edge->sourceId()) || _hiddenNodes.get(edge->targetId()))
                 continue;
 
-            const QVector3D& sourcePosition = scaledAndSmoothedNodePositions[edge->sourceId()];
-            const QVector3D& targetPosition = scaledAndSmoothedNodePositions[edge->targetId()];
+            const GPUGraphData::PositionSource positionSource{
+                positionIndices[edge->sourceId()], positionIndices[edge->targetId()]};
 
             const auto& edgeVisual = _graphModel->edgeVisual(edge->id());
-            const auto& sourceNodeVisual = _graphModel->nodeVisual(edge->sourceId());
-            const auto& targetNodeVisual = _graphModel->nodeVisual(edge->targetId());
-
-            auto nodeRadiusSumSq = sourceNodeVisual._size + targetNodeVisual._size;
-            nodeRadiusSumSq *= nodeRadiusSumSq;
-            const auto edgeLengthSq = (targetPosition - sourcePosition).lengthSquared();
-
-            if(edgeLengthSq < nodeRadiusSumSq)
-            {
-                // The edge's nodes are intersecting. Their overlap defines a lens of a
-                // certain radius. If this is greater than the edge radius, the edge is
-                // entirely enclosed within the nodes and we can safely skip rendering
-                // it altogether since it is entirely occluded.
-
-                const auto sourceRadiusSq = sourceNodeVisual._size * sourceNodeVisual._size;
-                const auto targetRadiusSq = targetNodeVisual._size * targetNodeVisual._size;
-
-                const auto n = edgeLengthSq - sourceRadiusSq + targetRadiusSq;
-                const auto d = 4.0f * edgeLengthSq;
-                const auto intersectionLensRadiusSq = targetRadiusSq - ((n * n) / d);
-
-                const auto edgeRadiusSq = edgeVisual._size * edgeVisual._size;
-
-                if(edgeRadiusSq < intersectionLensRadiusSq)
-                    continue;
-            }
 
             GPUGraphData::EdgeData edgeData;
-            edgeData._sourcePosition[0] = sourcePosition.x();
-            edgeData._sourcePosition[1] = sourcePosition.y();
-            edgeData._sourcePosition[2] = sourcePosition.z();
-            edgeData._targetPosition[0] = targetPosition.x();
-            edgeData._targetPosition[1] = targetPosition.y();
-            edgeData._targetPosition[2] = targetPosition.z();
             edgeData._sourceSize = _graphModel->nodeVisual(edge->sourceId())._size;
             edgeData._targetSize = _graphModel->nodeVisual(edge->targetId())._size;
             edgeData._edgeType = static_cast<int>(edgeVisualType);
@@ -360,6 +345,7 @@ void GraphRenderer::updateGPUDataIfRequired()
             if(gpuGraphData != nullptr)
             {
                 gpuGraphData->_edgeData.push_back(edgeData);
+                gpuGraphData->_edgePositionSources.push_back(positionSource);
 
                 if(edgeData._selected != 0.0f)
                     gpuGraphData->_elementsSelected = true;
@@ -370,9 +356,8 @@ void GraphRenderer::updateGPUDataIfRequired()
                 if(showEdgeText == TextState::Selected && !edgeVisual._state.test(VisualFlags::Selected))
                     continue;
 
-                QVector3D midPoint = (sourcePosition + targetPosition) * 0.5f;
                 createGPUGlyphData(edgeVisual._text, textColor, textAlignment, textScale,
-                    edgeVisual._size, midPoint, componentIndex,
+                    edgeVisual._size, positionSource, componentIndex,
                     gpuGraphDataForOverlay(componentRenderer->alpha()));
             }
         }
@@ -380,6 +365,7 @@ void GraphRenderer::updateGPUDataIfRequired()
         componentIndex++;
     }
 
+    updateGPUGraphDataPositions(gpuNodePositions());
     uploadGPUGraphData();
 }
 
@@ -391,6 +377,14 @@ void GraphRenderer::updateGPUData(GraphRenderer::When when)
         updateGPUDataIfRequired();
 }
 
+void GraphRenderer::updateGPUPositionData(GraphRenderer::When when)
+{
+    _gpuPositionDataRequiresUpdate = true;
+
+    if(when == When::Now)
+        updateGPUDataIfRequired();
+}
+
 void GraphRenderer::onPreviewRequested(int width, int height, bool fillSize)
 {
     _screenshotRenderer->requestPreview(*this, width, height, fillSize);
@@ -984,7 +978,7 @@ void GraphRenderer::updateScene()
         _scene->update(dTime);
 
         if(layoutChanged())
-            updateGPUData(When::Later);
+            updateGPUPositionData(When::Later);
 
         updateGPUDataIfRequired();
         updateComponentGPUData();
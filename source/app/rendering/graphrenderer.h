@@ -233,6 +233,11 @@ private:
     EdgeArray<bool> _hiddenEdges;
 
     bool _gpuDataRequiresUpdate = false;
+    bool _gpuPositionDataRequiresUpdate = false;
+
+    // The visible nodes, in the order that their positions are
+    // indexed by the GPU data, as of its last full rebuild
+    std::vector<NodeId> _gpuNodeIds;
 
     QRect _selectionRect;
 
@@ -262,8 +267,11 @@ private:
     void clearHiddenElements();
 
     void updateGPUDataIfRequired();
+    std::vector<QVector3D> gpuNodePositions() const;
+    void rebuildGPUData();
     enum class When { Later, Now };
     void updateGPUData(When when);
+    void updateGPUPositionData(When when);
     void updateComponentGPUData();
 
     // For high DPI displays (mostly MacOS "Retina" display)
@@ -305,7 +313,7 @@ private:
     void moveFocusToComponent(ComponentId componentId);
 
     void createGPUGlyphData(const QString& text, const QColor& textColor, const TextAlignment& textAlignment,
-                         float textScale, float elementSize, const QVector3D& elementPosition,
+                         float textScale, float elementSize, const GPUGraphData::PositionSource& positionSource,
                          int componentIndex, GPUGraphData* gpuGraphData);
 
 signals:
@@ -19,6 +19,7 @@
 #include "graphrenderercore.h"
 
 #include "shared/utils/preferences.h"
+#include "shared/utils/threadpool.h"
 #include "shared/rendering/multisamples.h"
 
 #include "shadertools.h"
@@ -27,6 +28,8 @@
 
 #include <QColor>
 
+#include <numeric>
+
 template<typename T>
 void setupTexture(T t, GLuint& texture, int width, int height, GLint format, int numMultiSamples)
 {
@@ -111,6 +114,17 @@ void GPUGraphData::prepareVertexBuffers()
         _edgeVBO.create();
         _edgeVBO.setUsagePattern(QOpenGLBuffer::DynamicDraw);
     }
+
+    // The position buffers are respecified in their entirety far more often than
+    // the others, i.e. every frame during a layout
+    for(auto* positionVBO : {&_nodePositionVBO, &_textPositionVBO, &_edgePositionVBO})
+    {
+        if(!positionVBO->isCreated())
+        {
+            positionVBO->create();
+            positionVBO->setUsagePattern(QOpenGLBuffer::StreamDraw);
+        }
+    }
 }
 
 void GPUGraphData::prepareTextVAO(QOpenGLShaderProgram& shader)
@@ -122,7 +136,6 @@ void GPUGraphData::prepareTextVAO(QOpenGLShaderProgram& shader)
     shader.enableAttributeArray("component");
     shader.enableAttributeArray("textureCoord");
     shader.enableAttributeArray("textureLayer");
-    shader.enableAttributeArray("basePosition");
     shader.enableAttributeArray("glyphOffset");
     shader.enableAttributeArray("glyphSize");
     shader.enableAttributeArray("color");
@@ -132,7 +145,6 @@ void GPUGraphData::prepareTextVAO(QOpenGLShaderProgram& shader)
     shader.setAttributeBuffer("textureCoord",    GL_FLOAT, offsetof(GlyphData, _textureCoord),    2, sizeof(GlyphData));
     glVertexAttribIPointer(shader.attributeLocation("textureLayer"),                              1, GL_INT, sizeof(GlyphData),
                              reinterpret_cast<const void*>(offsetof(GlyphData, _textureLayer))); // NOLINT
-    shader.setAttributeBuffer("basePosition",    GL_FLOAT, offsetof(GlyphData, _basePosition),    3, sizeof(GlyphData));
     shader.setAttributeBuffer("glyphOffset",     GL_FLOAT, offsetof(GlyphData, _glyphOffset),     2, sizeof(GlyphData));
     shader.setAttributeBuffer("glyphSize",       GL_FLOAT, offsetof(GlyphData, _glyphSize),       2, sizeof(GlyphData));
     shader.setAttributeBuffer("color",           GL_FLOAT, offsetof(GlyphData, _color),           3, sizeof(GlyphData));
@@ -144,8 +156,14 @@ void GPUGraphData::prepareTextVAO(QOpenGLShaderProgram& shader)
     glVertexAttribDivisor(shader.attributeLocation("glyphOffset"), 1);
     glVertexAttribDivisor(shader.attributeLocation("glyphSize"), 1);
     glVertexAttribDivisor(shader.attributeLocation("color"), 1);
-
     _textVBO.release();
+
+    _textPositionVBO.bind();
+    shader.enableAttributeArray("basePosition");
+    shader.setAttributeBuffer("basePosition", GL_FLOAT, offsetof(GlyphPositionData, _basePosition), 3, sizeof(GlyphPositionData));
+    glVertexAttribDivisor(shader.attributeLocation("basePosition"), 1);
+    _textPositionVBO.release();
+
     shader.release();
     _rectangle.vertexArrayObject()->release();
 }
@@ -156,20 +174,17 @@ void GPUGraphData::prepareNodeVAO(QOpenGLShaderProgram& shader)
     shader.bind();
 
     _nodeVBO.bind();
-    shader.enableAttributeArray("nodePosition");
     shader.enableAttributeArray("component");
     shader.enableAttributeArray("size");
     shader.enableAttributeArray("outerColor");
     shader.enableAttributeArray("innerColor");
     shader.enableAttributeArray("selected");
-    shader.setAttributeBuffer("nodePosition", GL_FLOAT, offsetof(NodeData, _position),     3,         sizeof(NodeData));
     glVertexAttribIPointer(shader.attributeLocation("component"),                          1, GL_INT, sizeof(NodeData),
                           reinterpret_cast<const void*>(offsetof(NodeData, _component))); // NOLINT
     shader.setAttributeBuffer("size",         GL_FLOAT, offsetof(NodeData, _size),         1,         sizeof(NodeData));
     shader.setAttributeBuffer("outerColor",   GL_FLOAT, offsetof(NodeData, _outerColor),   3,         sizeof(NodeData));
     shader.setAttributeBuffer("innerColor",   GL_FLOAT, offsetof(NodeData, _innerColor),   3,         sizeof(NodeData));
     shader.setAttributeBuffer("selected",     GL_FLOAT, offsetof(NodeData, _selected),     1,         sizeof(NodeData));
-    glVertexAttribDivisor(shader.attributeLocation("nodePosition"), 1);
     glVertexAttribDivisor(shader.attributeLocation("component"),    1);
     glVertexAttribDivisor(shader.attributeLocation("size"),         1);
     glVertexAttribDivisor(shader.attributeLocation("innerColor"),   1);
@@ -177,6 +192,12 @@ void GPUGraphData::prepareNodeVAO(QOpenGLShaderProgram& shader)
     glVertexAttribDivisor(shader.attributeLocation("selected"),     1);
     _nodeVBO.release();
 
+    _nodePositionVBO.bind();
+    shader.enableAttributeArray("nodePosition");
+    shader.setAttributeBuffer("nodePosition", GL_FLOAT, offsetof(NodePositionData, _position), 3, sizeof(NodePositionData));
+    glVertexAttribDivisor(shader.attributeLocation("nodePosition"), 1);
+    _nodePositionVBO.release();
+
     shader.release();
     _sphere.vertexArrayObject()->release();
 }
@@ -187,8 +208,6 @@ void GPUGraphData::prepareEdgeVAO(QOpenGLShaderProgram& shader)
     shader.bind();
 
     _edgeVBO.bind();
-    shader.enableAttributeArray("sourcePosition");
-    shader.enableAttributeArray("targetPosition");
     shader.enableAttributeArray("sourceSize");
     shader.enableAttributeArray("targetSize");
     shader.enableAttributeArray("edgeType");
@@ -197,8 +216,6 @@ void GPUGraphData::prepareEdgeVAO(QOpenGLShaderProgram& shader)
     shader.enableAttributeArray("outerColor");
     shader.enableAttributeArray("innerColor");
     shader.enableAttributeArray("selected");
-    shader.setAttributeBuffer("sourcePosition", GL_FLOAT, offsetof(EdgeData, _sourcePosition),  3,         sizeof(EdgeData));
-    shader.setAttributeBuffer("targetPosition", GL_FLOAT, offsetof(EdgeData, _targetPosition),  3,         sizeof(EdgeData));
     shader.setAttributeBuffer("sourceSize",     GL_FLOAT, offsetof(EdgeData, _sourceSize),      1,         sizeof(EdgeData));
     shader.setAttributeBuffer("targetSize",     GL_FLOAT, offsetof(EdgeData, _targetSize),      1,         sizeof(EdgeData));
     glVertexAttribIPointer(shader.attributeLocation("edgeType"),                                1, GL_INT, sizeof(EdgeData),
@@ -209,8 +226,6 @@ void GPUGraphData::prepareEdgeVAO(QOpenGLShaderProgram& shader)
     shader.setAttributeBuffer("outerColor",     GL_FLOAT, offsetof(EdgeData, _outerColor),      3,         sizeof(EdgeData));
     shader.setAttributeBuffer("innerColor",     GL_FLOAT, offsetof(EdgeData, _innerColor),      3,         sizeof(EdgeData));
     shader.setAttributeBuffer("selected",       GL_FLOAT, offsetof(EdgeData, _selected),        1,         sizeof(EdgeData));
-    glVertexAttribDivisor(shader.attributeLocation("sourcePosition"),   1);
-    glVertexAttribDivisor(shader.attributeLocation("targetPosition"),   1);
     glVertexAttribDivisor(shader.attributeLocation("sourceSize"),       1);
     glVertexAttribDivisor(shader.attributeLocation("targetSize"),       1);
     glVertexAttribDivisor(shader.attributeLocation("edgeType"),         1);
@@ -221,6 +236,15 @@ void GPUGraphData::prepareEdgeVAO(QOpenGLShaderProgram& shader)
     glVertexAttribDivisor(shader.attributeLocation("selected"),         1);
     _edgeVBO.release();
 
+    _edgePositionVBO.bind();
+    shader.enableAttributeArray("sourcePosition");
+    shader.enableAttributeArray("targetPosition");
+    shader.setAttributeBuffer("sourcePosition", GL_FLOAT, offsetof(EdgePositionData, _sourcePosition), 3, sizeof(EdgePositionData));
+    shader.setAttributeBuffer("targetPosition", GL_FLOAT, offsetof(EdgePositionData, _targetPosition), 3, sizeof(EdgePositionData));
+    glVertexAttribDivisor(shader.attributeLocation("sourcePosition"), 1);
+    glVertexAttribDivisor(shader.attributeLocation("targetPosition"), 1);
+    _edgePositionVBO.release();
+
     shader.release();
     _arrow.vertexArrayObject()->release();
 }
@@ -255,8 +279,14 @@ void GPUGraphData::reset()
     _isOverlay = false;
     _elementsSelected = false;
     _nodeData.clear();
+    _nodePositionSources.clear();
+    _nodePositionData.clear();
     _edgeData.clear();
+    _edgePositionSources.clear();
+    _edgePositionData.clear();
     _glyphData.clear();
+    _glyphPositionSources.clear();
+    _glyphPositionData.clear();
 }
 
 void GPUGraphData::clearFramebuffer(GLbitfield buffers)
@@ -293,6 +323,54 @@ void GPUGraphData::drawToFramebuffer()
     glDrawBuffers(3, static_cast<GLenum*>(drawBuffers));
 }
 
+template<typename Fn>
+static void forEachIndex(size_t size, Fn&& f)
+{
+    const size_t MINIMUM_ELEMENTS_FOR_CONCURRENCY = 10000;
+
+    std::vector<size_t> indices(size);
+    std::iota(indices.begin(), indices.end(), 0);
+
+    concurrent_for_if_large(indices.cbegin(), indices.cend(),
+        MINIMUM_ELEMENTS_FOR_CONCURRENCY, std::forward<Fn>(f));
+}
+
+static void setPosition(float (&to)[3], const QVector3D& from)
+{
+    to[0] = from.x();
+    to[1] = from.y();
+    to[2] = from.z();
+}
+
+void GPUGraphData::updatePositions(const std::vector<QVector3D>& nodePositions)
+{
+    _nodePositionData.resize(_nodePositionSources.size());
+    forEachIndex(_nodePositionSources.size(), [&](size_t index)
+    {
+        setPosition(_nodePositionData[index]._position,
+            nodePositions[_nodePositionSources[index]]);
+    });
+
+    _edgePositionData.resize(_edgePositionSources.size());
+    forEachIndex(_edgePositionSources.size(), [&](size_t index)
+    {
+        const auto& positionSource = _edgePositionSources[index];
+        auto& edgePositionData = _edgePositionData[index];
+
+        setPosition(edgePositionData._sourcePosition, nodePositions[positionSource._source]);
+        setPosition(edgePositionData._targetPosition, nodePositions[positionSource._target]);
+    });
+
+    _glyphPositionData.resize(_glyphPositionSources.size());
+    forEachIndex(_glyphPositionSources.size(), [&](size_t index)
+    {
+        const auto& positionSource = _glyphPositionSources[index];
+
+        setPosition(_glyphPositionData[index]._basePosition,
+            (nodePositions[positionSource._source] + nodePositions[positionSource._target]) * 0.5f);
+    });
+}
+
 void GPUGraphData::upload()
 {
     _nodeVBO.bind();
@@ -306,6 +384,29 @@ void GPUGraphData::upload()
     _textVBO.bind();
     _textVBO.allocate(_glyphData.data(), static_cast<int>(_glyphData.size() * sizeof(GlyphData)));
     _textVBO.release();
+
+    uploadPositions();
+}
+
+void GPUGraphData::uploadPositions()
+{
+    // Respecifying the whole of each buffer orphans its previous storage, so the
+    // driver can hand us fresh memory while any in flight draws still read the old
+    // positions, rather than stalling until the GPU has finished with them
+    _nodePositionVBO.bind();
+    _nodePositionVBO.allocate(_nodePositionData.data(),
+        static_cast<int>(_nodePositionData.size() * sizeof(NodePositionData)));
+    _nodePositionVBO.release();
+
+    _edgePositionVBO.bind();
+    _edgePositionVBO.allocate(_edgePositionData.data(),
+        static_cast<int>(_edgePositionData.size() * sizeof(EdgePositionData)));
+    _edgePositionVBO.release();
+
+    _textPositionVBO.bind();
+    _textPositionVBO.allocate(_glyphPositionData.data(),
+        static_cast<int>(_glyphPositionData.size() * sizeof(GlyphPositionData)));
+    _textPositionVBO.release();
 }
 
 int GPUGraphData::numNodes() const
@@ -367,8 +468,14 @@ void GPUGraphData::copyState(const GPUGraphData& gpuGraphData,
     _unhighlightAlpha = gpuGraphData._unhighlightAlpha;
     _isOverlay = gpuGraphData._isOverlay;
     _nodeData = gpuGraphData._nodeData;
+    _nodePositionSources = gpuGraphData._nodePositionSources;
+    _nodePositionData = gpuGraphData._nodePositionData;
     _glyphData = gpuGraphData._glyphData;
+    _glyphPositionSources = gpuGraphData._glyphPositionSources;
+    _glyphPositionData = gpuGraphData._glyphPositionData;
     _edgeData = gpuGraphData._edgeData;
+    _edgePositionSources = gpuGraphData._edgePositionSources;
+    _edgePositionData = gpuGraphData._edgePositionData;
     _elementsSelected = gpuGraphData._elementsSelected;
 
     // Cause VBO to be recreated
@@ -380,6 +487,9 @@ void GPUGraphData::copyState(const GPUGraphData& gpuGraphData,
     _edgeVBO.destroy();
     _nodeVBO.destroy();
     _textVBO.destroy();
+    _edgePositionVBO.destroy();
+    _nodePositionVBO.destroy();
+    _textPositionVBO.destroy();
 
     initialise(nodesShader, edgesShader, textShader);
 }
@@ -636,6 +746,15 @@ void GraphRendererCore::resetGPUGraphData()
         gpuGraphData.reset();
 }
 
+void GraphRendererCore::updateGPUGraphDataPositions(const std::vector<QVector3D>& nodePositions)
+{
+    for(auto& gpuGraphData : _gpuGraphData)
+    {
+        if(gpuGraphData.alpha() > 0.0f)
+            gpuGraphData.updatePositions(nodePositions);
+    }
+}
+
 void GraphRendererCore::uploadGPUGraphData()
 {
     for(auto& gpuGraphData : _gpuGraphData)
@@ -645,6 +764,15 @@ void GraphRendererCore::uploadGPUGraphData()
     }
 }
 
+void GraphRendererCore::uploadGPUGraphDataPositions()
+{
+    for(auto& gpuGraphData : _gpuGraphData)
+    {
+        if(gpuGraphData.alpha() > 0.0f)
+            gpuGraphData.uploadPositions();
+    }
+}
+
 void GraphRendererCore::resetGPUComponentData()
 {
     _componentData.clear();
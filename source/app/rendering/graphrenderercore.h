@@ -33,6 +33,7 @@
 #include <QOpenGLVertexArrayObject>
 #include <QRect>
 #include <QMatrix4x4>
+#include <QVector3D>
 
 #include <array>
 #include <vector>
@@ -59,7 +60,10 @@ struct GPUGraphData : OpenGLFunctions
     void clearDepthbuffer();
     void drawToFramebuffer();
 
+    void updatePositions(const std::vector<QVector3D>& nodePositions);
+
     void upload();
+    void uploadPositions();
 
     int numNodes() const;
     int numEdges() const;
@@ -79,9 +83,11 @@ struct GPUGraphData : OpenGLFunctions
 
     bool hasGraphElements() const;
 
+    // The positions are kept apart from the rest of the element data, so that when
+    // only the layout has changed, the (much smaller) position streams can be
+    // refreshed and uploaded without rebuilding everything else
     struct NodeData
     {
-        float _position[3] = {0.0f, 0.0f, 0.0f};
         int _component = -1;
         float _size = -1.0f;
         float _outerColor[3] = {0.0f, 0.0f, 0.0f};
@@ -91,8 +97,6 @@ struct GPUGraphData : OpenGLFunctions
 
     struct EdgeData
     {
-        float _sourcePosition[3] = {0.0f, 0.0f, 0.0f};
-        float _targetPosition[3] = {0.0f, 0.0f, 0.0f};
         float _sourceSize = 0.0f;
         float _targetSize = 0.0f;
         int _edgeType = -1;
@@ -108,12 +112,35 @@ struct GPUGraphData : OpenGLFunctions
         int _component = -1;
         float _textureCoord[2] = {0.0f, 0.0f};
         int _textureLayer = -1;
-        float _basePosition[3] = {0.0f, 0.0f, 0.0f};
         float _glyphOffset[2] = {0.0f, 0.0f};
         float _glyphSize[2] = {0.0f, 0.0f};
         float _color[3] = {0.0f, 0.0f, 0.0f};
     };
 
+    struct NodePositionData
+    {
+        float _position[3] = {0.0f, 0.0f, 0.0f};
+    };
+
+    struct EdgePositionData
+    {
+        float _sourcePosition[3] = {0.0f, 0.0f, 0.0f};
+        float _targetPosition[3] = {0.0f, 0.0f, 0.0f};
+    };
+
+    struct GlyphPositionData
+    {
+        float _basePosition[3] = {0.0f, 0.0f, 0.0f};
+    };
+
+    // Indexes the node positions that an element's position is derived from; for
+    // edges and edge text these differ, with the text placed at the midpoint
+    struct PositionSource
+    {
+        size_t _source = 0;
+        size_t _target = 0;
+    };
+
     // There are two alpha values so that we can split the alpha blended layers
     // depending on their purpose. The rendering occurs in order based on _componentAlpha,
     // going from opaque to transparent, then resorting to _unhighlightAlpha in the same order,
@@ -124,13 +151,22 @@ struct GPUGraphData : OpenGLFunctions
     bool _isOverlay = false;
 
     std::vector<NodeData> _nodeData;
+    std::vector<size_t> _nodePositionSources;
+    std::vector<NodePositionData> _nodePositionData;
     QOpenGLBuffer _nodeVBO;
+    QOpenGLBuffer _nodePositionVBO;
 
     std::vector<GlyphData> _glyphData;
+    std::vector<PositionSource> _glyphPositionSources;
+    std::vector<GlyphPositionData> _glyphPositionData;
     QOpenGLBuffer _textVBO;
+    QOpenGLBuffer _textPositionVBO;
 
     std::vector<EdgeData> _edgeData;
+    std::vector<PositionSource> _edgePositionSources;
+    std::vector<EdgePositionData> _edgePositionData;
     QOpenGLBuffer _edgeVBO;
+    QOpenGLBuffer _edgePositionVBO;
 
     bool _elementsSelected = false;
 
@@ -197,7 +233,9 @@ protected:
     GPUGraphData* gpuGraphDataForAlpha(float componentAlpha, float unhighlightAlpha);
     GPUGraphData* gpuGraphDataForOverlay(float alpha);
     void resetGPUGraphData();
+    void updateGPUGraphDataPositions(const std::vector<QVector3D>& nodePositions);
     void uploadGPUGraphData();
+    void uploadGPUGraphDataPositions();
 
     void resetGPUComponentData();
     void appendGPUComponentData(const QMatrix4x4& modelViewMatrix,
@@ -116,6 +116,31 @@ void main()
     // Make the index negative so that it doesn't overlap with the node indicies
     element = float(-(gl_InstanceID + 1));
 
+    vec3 edgeVector = targetPosition - sourcePosition;
+    float edgeLengthSq = dot(edgeVector, edgeVector);
+    float nodeRadiusSum = sourceSize + targetSize;
+
+    if(edgeLengthSq < nodeRadiusSum * nodeRadiusSum)
+    {
+        // The edge's nodes are intersecting. Their overlap defines a lens of a
+        // certain radius. If this is greater than the edge radius, the edge is
+        // entirely enclosed within the nodes and we can safely skip rendering
+        // it altogether since it is entirely occluded.
+        float sourceRadiusSq = sourceSize * sourceSize;
+        float targetRadiusSq = targetSize * targetSize;
+
+        float n = edgeLengthSq - sourceRadiusSq + targetRadiusSq;
+        float d = 4.0 * edgeLengthSq;
+
+        if(d <= 0.0 || (size * size) < targetRadiusSq - ((n * n) / d))
+        {
+            // Collapse every vertex of the instance to the same (clipped)
+            // point, so that it produces no fragments
+            gl_Position = vec4(0.0);
+            return;
+        }
+    }
+
     float edgeLength = distance(sourcePosition, targetPosition);
     float edgeLengthMinusNodeRadii = edgeLength - (sourceSize + targetSize);
     vec3 midpoint = mix(sourcePosition, targetPosition, 0.5);
@@ -24,6 +24,7 @@
 
 #include "shared/utils/iterator_range.h"
 #include "shared/utils/container.h"
+#include "shared/utils/preferences.h"
 
 #include <algorithm>
 
@@ -35,6 +36,7 @@ TransformCache& TransformCache::operator=(TransformCache&& other) noexcept
 {
     _graphModel = other._graphModel;
     _cache = std::move(other._cache);
+    _statistics = other._statistics;
     return *this;
 }
 
@@ -116,7 +118,10 @@ TransformCache::Result TransformCache::apply(int index, const GraphTransformConf
     result._config = config;
 
     if(_cache.empty())
+    {
+        _statistics._misses++;
         return result;
+    }
 
     auto& resultSet = _cache.front();
 
@@ -126,31 +131,36 @@ TransformCache::Result TransformCache::apply(int index, const GraphTransformConf
         return cachedResult._index == index && cachedResult._config == config;
     });
 
-    if(it != resultSet.end())
+    if(it == resultSet.end())
     {
-        auto& cachedResult = *it;
+        _statistics._misses++;
+        return result;
+    }
 
-        // Apply the cached result
-        _graphModel->addAttributes(cachedResult._newAttributes);
-        if(cachedResult._graph != nullptr)
-            graph = *(cachedResult._graph);
+    _statistics._hits++;
 
-        result = std::move(cachedResult);
+    auto& cachedResult = *it;
 
-        if(result._graph != nullptr)
-        {
-            // If the graph was changed, remove the entire set...
-            _cache.erase(_cache.begin());
-        }
-        else
-        {
-            // ...otherwise just remove the specific result
-            resultSet.erase(it);
+    // Apply the cached result
+    _graphModel->addAttributes(cachedResult._newAttributes);
+    if(cachedResult._graph != nullptr)
+        graph = *(cachedResult._graph);
 
-            // If that was the last result, remove the set as well
-            if(resultSet.empty())
-                _cache.erase(_cache.begin());
-        }
+    result = std::move(cachedResult);
+
+    if(result._graph != nullptr)
+    {
+        // If the graph was changed, remove the entire set...
+        _cache.erase(_cache.begin());
+    }
+    else
+    {
+        // ...otherwise just remove the specific result
+        resultSet.erase(it);
+
+        // If that was the last result, remove the set as well
+        if(resultSet.empty())
+            _cache.erase(_cache.begin());
     }
 
     return result;
@@ -190,3 +200,31 @@ std::map<QString, Attribute> TransformCache::attributes() const
 
     return map;
 }
+
+size_t TransformCache::memoryUsage() const
+{
+    size_t bytes = 0;
+
+    for(const auto& resultSet : _cache)
+    {
+        for(const auto& cachedResult : resultSet)
+            bytes += cachedResult._graphMemoryUsage;
+    }
+
+    return bytes;
+}
+
+void TransformCache::enforceMemoryBudget()
+{
+    const auto budget = static_cast<size_t>(u::pref(QStringLiteral("misc/transformCacheMemoryBudget")).toInt()) * 1024 * 1024;
+    auto bytes = memoryUsage();
+
+    while(bytes > budget && !_cache.empty())
+    {
+        for(const auto& cachedResult : _cache.back())
+            bytes -= cachedResult._graphMemoryUsage;
+
+        _statistics._evictions += _cache.back().size();
+        _cache.pop_back();
+    }
+}
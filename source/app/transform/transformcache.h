@@ -22,6 +22,7 @@
 #include "graphtransformconfig.h"
 #include "attributes/attribute.h"
 
+#include <memory>
 #include <vector>
 
 class MutableGraph;
@@ -33,32 +34,6 @@ class TransformCache
 public:
     struct Result
     {
-        Result() = default;
-
-        Result(const Result& other) :
-            _index(other._index),
-            _config(other._config),
-            _graph(other._graph ? std::make_unique<MutableGraph>(*other._graph) : nullptr),
-            _newAttributes(other._newAttributes)
-        {}
-
-        Result(Result&& other) noexcept :
-            _index(other._index),
-            _config(std::move(other._config)),
-            _graph(std::move(other._graph)),
-            _newAttributes(std::move(other._newAttributes))
-        {}
-
-        Result& operator=(Result&& other) noexcept
-        {
-            _index = other._index;
-            _config = std::move(other._config);
-            _graph = std::move(other._graph);
-            _newAttributes = std::move(other._newAttributes);
-
-            return *this;
-        }
-
         bool changesGraph() const { return _graph != nullptr; }
         bool isApplicable() const { return changesGraph() || !_newAttributes.empty(); }
 
@@ -69,12 +44,23 @@ public:
 
         int _index = -1;
         GraphTransformConfig _config;
-        std::unique_ptr<MutableGraph> _graph;
+
+        // Cached graphs are never modified, so copies of the cache share them
+        std::shared_ptr<const MutableGraph> _graph;
+        size_t _graphMemoryUsage = 0;
+
         std::map<QString, Attribute> _newAttributes;
     };
 
     using ResultSet = std::vector<Result>;
 
+    struct Statistics
+    {
+        size_t _hits = 0;
+        size_t _misses = 0;
+        size_t _evictions = 0;
+    };
+
 private:
     bool lastResultChangesGraph() const;
     bool lastResultCreatedAnyOf(const std::vector<QString>& attributeNames) const;
@@ -82,6 +68,7 @@ private:
 
     GraphModel* _graphModel;
     std::vector<ResultSet> _cache;
+    Statistics _statistics;
 
 public:
     explicit TransformCache(GraphModel& graphModel);
@@ -97,6 +84,16 @@ public:
 
     const MutableGraph* graph() const;
     std::map<QString, Attribute> attributes() const;
+
+    size_t memoryUsage() const;
+
+    // Discards results, deepest first, until the cached graphs fit within the
+    // memory budget preference; later results are only reachable via earlier
+    // ones, so there is no point in retaining them in preference
+    void enforceMemoryBudget();
+
+    const Statistics& statistics() const { return _statistics; }
+    void setStatistics(const Statistics& statistics) { _statistics = statistics; }
 };
 
 #endif // TRANSFORMCACHE_H
@@ -24,6 +24,8 @@
 #include "shared/commands/icommand.h"
 #include "shared/utils/container.h"
 
+#include <QDebug>
+
 #include <functional>
 
 TransformedGraph::TransformedGraph(GraphModel& graphModel, const MutableGraph& source) :
@@ -46,6 +48,9 @@ TransformedGraph::TransformedGraph(GraphModel& graphModel, const MutableGraph& s
     connect(&_target, &Graph::graphChanged, this, &TransformedGraph::onTargetGraphChanged, Qt::DirectConnection);
     enableComponentManagement();
 
+    if(qEnvironmentVariableIntValue("TRANSFORM_CACHE_DEBUG") != 0)
+        enableDebug();
+
     // These connections allow us to track what changes, so we can then
     // re-emit a canonical set of signals once the transform is complete
     connect(_source, &Graph::nodeRemoved,  [this](const Graph*, NodeId nodeId) { _nodesState[nodeId].remove(); });
@@ -160,7 +165,8 @@ void TransformedGraph::rebuild()
 
             if(transform->applyAndUpdate(*this, *_graphModel))
             {
-                result._graph = std::make_unique<MutableGraph>(_target);
+                result._graph = std::make_shared<MutableGraph>(_target);
+                result._graphMemoryUsage = result._graph->memoryUsage();
 
                 // Graph has changed, so the cache is now invalid
                 _cache.clear();
@@ -207,8 +213,19 @@ void TransformedGraph::rebuild()
         }
         else
         {
+            newCache.setStatistics(_cache.statistics());
+            newCache.enforceMemoryBudget();
+
             _cache = std::move(newCache);
             _createdAttributeNames = std::move(newCreatedAttributeNames);
+
+            if(_debug)
+            {
+                const auto& statistics = _cache.statistics();
+                qDebug() << "TransformCache" << statistics._hits << "hits" <<
+                    statistics._misses << "misses" << statistics._evictions << "evictions" <<
+                    (_cache.memoryUsage() / (1024 * 1024)) << "MiB";
+            }
         }
     });
 
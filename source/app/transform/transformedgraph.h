@@ -56,6 +56,9 @@ public:
 
     void setCommand(ICommand* command) { _command = command; }
 
+    void enableDebug() { _debug = true; }
+    void disableDebug() { _debug = false; }
+
     const std::vector<NodeId>& nodeIds() const override { return _target.nodeIds(); }
     int numNodes() const override { return _target.numNodes(); }
     const INode& nodeById(NodeId nodeId) const override { return _target.nodeById(nodeId); }
@@ -78,6 +81,8 @@ public:
     EdgeId firstEdgeIdBetween(NodeId nodeIdA, NodeId nodeIdB) const override { return _target.firstEdgeIdBetween(nodeIdA, nodeIdB); }
     bool edgeExistsBetween(NodeId nodeIdA, NodeId nodeIdB) const override { return _target.edgeExistsBetween(nodeIdA, nodeIdB); }
 
+    std::shared_ptr<const AdjacencySnapshot> adjacencySnapshot() const override { return _target.adjacencySnapshot(); }
+
     void setPhase(const QString& phase) const override { _source->setPhase(phase); }
     void clearPhase() const override { _source->clearPhase(); }
     QString phase() const override { return _source->phase(); }
@@ -118,6 +123,7 @@ private:
     bool _graphChangeOccurred = false;
     bool _changeSignalsEmitted = false;
     bool _autoRebuild = false;
+    bool _debug = false;
     ICommand* _command = nullptr;
 
     std::atomic_bool _cancelled;
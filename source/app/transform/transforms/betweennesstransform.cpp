@@ -20,134 +20,199 @@
 
 #include "transform/transformedgraph.h"
 #include "graph/graphmodel.h"
+#include "graph/adjacencysnapshot.h"
 
 #include "shared/graph/grapharray.h"
 #include "shared/utils/threadpool.h"
+#include "shared/utils/container_randomsample.h"
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
-#include <stack>
-#include <queue>
-#include <map>
+#include <numeric>
 #include <thread>
+#include <vector>
+
+// There is no std::atomic<double>::fetch_add until C++20
+static void atomicAdd(std::atomic<double>& value, double addend)
+{
+    auto expected = value.load(std::memory_order_relaxed);
+    while(!value.compare_exchange_weak(expected, expected + addend, std::memory_order_relaxed));
+}
+
+static QString remainingTimeAsString(std::chrono::seconds remaining)
+{
+    auto minutes = remaining.count() / 60;
+    auto seconds = remaining.count() % 60;
+
+    if(minutes > 0)
+        return QObject::tr("%1m %2s remaining").arg(minutes).arg(seconds);
+
+    return QObject::tr("%1s remaining").arg(seconds);
+}
 
 void BetweennessTransform::apply(TransformedGraph& target) const
 {
-    target.setPhase(QStringLiteral("Betweenness"));
+    const auto phase = QStringLiteral("Betweenness");
+    target.setPhase(phase);
     target.setProgress(0);
 
-    const auto& nodeIds = target.nodeIds();
-    const auto& edegIds = target.edgeIds();
-    std::atomic_int progress(0);
+    auto adjacency = target.adjacencySnapshot();
+    const auto numNodes = adjacency->numNodes();
+    const auto numEdges = adjacency->numEdges();
+
+    if(numNodes == 0)
+        return;
+
+    using Index = AdjacencySnapshot::Index;
+
+    std::vector<Index> sources(numNodes);
+    std::iota(sources.begin(), sources.end(), 0);
 
-    struct BetweennessArrays
+    // Brandes-Pich: the dependencies accumulated from a uniform sample of
+    // sources, scaled up, are an unbiased estimate of the exact betweenness
+    auto numSamples = static_cast<size_t>(std::get<int>(
+        config().parameterByName(QStringLiteral("Samples"))->_value));
+    double scale = 1.0;
+
+    if(numSamples > 0 && numSamples < numNodes)
     {
-        explicit BetweennessArrays(TransformedGraph& graph) :
-            nodeBetweenness(graph, 0.0),
-            edgeBetweenness(graph, 0.0)
-        {}
+        sources = u::randomSample(sources, numSamples);
+        scale = static_cast<double>(numNodes) / static_cast<double>(numSamples);
+    }
+
+    // Scratch space for each thread, reused for every source it processes
+    struct Scratch
+    {
+        explicit Scratch(size_t size) :
+            _distance(size, -1), _sigma(size, 0.0), _delta(size, 0.0)
+        {
+            _order.reserve(size);
+        }
 
-        NodeArray<double> nodeBetweenness;
-        EdgeArray<double> edgeBetweenness;
+        std::vector<int> _distance;
+        std::vector<double> _sigma;
+        std::vector<double> _delta;
+        std::vector<Index> _order;
     };
 
-    std::vector<BetweennessArrays> betweennessArrays(
-        std::thread::hardware_concurrency(),
-        BetweennessArrays{target});
+    std::vector<Scratch> scratches(std::thread::hardware_concurrency(), Scratch(numNodes));
 
-    concurrent_for(nodeIds.begin(), nodeIds.end(),
-    [&](const NodeId nodeId, size_t threadIndex)
-    {
-        auto& arrays = betweennessArrays.at(threadIndex);
-        auto& _nodeBetweenness = arrays.nodeBetweenness;
-        auto& _edgeBetweenness = arrays.edgeBetweenness;
+    std::vector<std::atomic<double>> nodeBetweenness(numNodes);
+    std::vector<std::atomic<double>> edgeBetweenness(numEdges);
+
+    std::atomic<size_t> numSourcesProcessed(0);
+    const auto startTime = std::chrono::steady_clock::now();
 
-        // Brandes algorithm
-        NodeArray<std::vector<NodeId>> predecessors(target);
-        NodeArray<int64_t> sigma(target, 0);
-        NodeArray<int64_t> distance(target, -1);
-        NodeArray<double> delta(target, 0.0);
+    concurrent_for(sources.begin(), sources.end(),
+    [&](const Index source, size_t threadIndex)
+    {
+        if(cancelled())
+            return;
 
-        std::stack<NodeId> stack;
-        std::queue<NodeId> queue;
+        auto& scratch = scratches.at(threadIndex);
+        auto& distance = scratch._distance;
+        auto& sigma = scratch._sigma;
+        auto& delta = scratch._delta;
+        auto& order = scratch._order;
 
-        sigma[nodeId] = 1.0;
-        distance[nodeId] = 0;
-        queue.push(nodeId);
+        // Breadth first search, counting shortest paths; order doubles as the queue
+        order.clear();
+        order.push_back(source);
+        distance[source] = 0;
+        sigma[source] = 1.0;
 
-        while(!queue.empty() && !cancelled())
+        for(size_t head = 0; head < order.size(); head++)
         {
-            auto other = queue.front();
-            queue.pop();
-            stack.push(other);
+            auto node = order[head];
+            auto nextDistance = distance[node] + 1;
 
-            for(auto neighbour : target.neighboursOf(other))
+            for(auto neighbour : adjacency->neighboursOf(node))
             {
                 if(distance[neighbour] < 0)
                 {
-                    queue.push(neighbour);
-                    distance[neighbour] = distance[other] + 1;
+                    distance[neighbour] = nextDistance;
+                    order.push_back(neighbour);
                 }
 
-                if(distance[neighbour] == distance[other] + 1)
-                {
-                    sigma[neighbour] += sigma[other];
-                    predecessors[neighbour].push_back(other);
-                }
+                if(distance[neighbour] == nextDistance)
+                    sigma[neighbour] += sigma[node];
             }
         }
 
-        while(!stack.empty() && !cancelled())
+        // Accumulate dependencies in order of decreasing distance; a node's
+        // predecessors are simply its neighbours that are one step closer,
+        // so there is no need to record them during the search
+        for(auto it = order.rbegin(); it != order.rend(); ++it)
         {
-            auto other = stack.top();
-            stack.pop();
+            auto node = *it;
+            auto previousDistance = distance[node] - 1;
+            auto coefficient = (1.0 + delta[node]) / sigma[node];
 
-            for(auto predecessor : predecessors[other])
+            auto neighbours = adjacency->neighboursOf(node);
+            auto edges = adjacency->edgesOf(node);
+
+            for(size_t i = 0; i < neighbours.size(); i++)
             {
-                auto d = (static_cast<double>(sigma[predecessor]) /
-                    static_cast<double>(sigma[other])) * (1.0 + delta[other]);
+                auto predecessor = neighbours[i];
 
-                auto edgeIds = target.edgeIdsBetween(predecessor, other);
-                for(auto edgeId : edgeIds)
-                    _edgeBetweenness[edgeId] += d;
+                if(distance[predecessor] != previousDistance)
+                    continue;
 
+                auto d = sigma[predecessor] * coefficient;
+                atomicAdd(edgeBetweenness[edges[i]], d * scale);
                 delta[predecessor] += d;
             }
 
-            if(other != nodeId)
-                _nodeBetweenness[other] += delta[other];
+            if(node != source)
+                atomicAdd(nodeBetweenness[node], delta[node] * scale);
         }
 
-        progress++;
-        target.setProgress(progress.load() * 100 / static_cast<int>(target.numNodes()));
+        // Only the visited nodes need resetting
+        for(auto node : order)
+        {
+            distance[node] = -1;
+            sigma[node] = 0.0;
+            delta[node] = 0.0;
+        }
 
-        if(cancelled())
-            return;
+        auto processed = ++numSourcesProcessed;
+        target.setProgress(static_cast<int>((processed * 100) / sources.size()));
+
+        // Each source costs roughly the same, so extrapolate
+        auto elapsed = std::chrono::steady_clock::now() - startTime;
+        auto remaining = std::chrono::duration_cast<std::chrono::seconds>(
+            (elapsed * (sources.size() - processed)) / processed);
+
+        if(remaining.count() > 0)
+            target.setPhase(QStringLiteral("%1 (%2)").arg(phase, remainingTimeAsString(remaining)));
+        else
+            target.setPhase(phase);
     });
 
     target.setProgress(-1);
+    target.setPhase(phase);
 
     if(cancelled())
         return;
 
-    NodeArray<double> nodeBetweenness(target, 0.0);
-    EdgeArray<double> edgeBetweenness(target, 0.0);
-    for(const auto& arrays : betweennessArrays)
-    {
-        for(auto nodeId : nodeIds)
-            nodeBetweenness[nodeId] += arrays.nodeBetweenness[nodeId];
+    NodeArray<double> nodeBetweennessArray(target, 0.0);
+    EdgeArray<double> edgeBetweennessArray(target, 0.0);
 
-        for(auto edgeId : edegIds)
-            edgeBetweenness[edgeId] += arrays.edgeBetweenness[edgeId];
-    }
+    for(Index node = 0; node < numNodes; node++)
+        nodeBetweennessArray[adjacency->nodeIdOf(node)] = nodeBetweenness[node];
+
+    for(Index edge = 0; edge < numEdges; edge++)
+        edgeBetweennessArray[adjacency->edgeIdOf(edge)] = edgeBetweenness[edge];
 
     _graphModel->createAttribute(QObject::tr("Node Betweenness"))
         .setDescription(QObject::tr("A node's betweenness is the number of shortest paths that pass through it."))
-        .setFloatValueFn([nodeBetweenness](NodeId nodeId) { return nodeBetweenness[nodeId]; })
+        .setFloatValueFn([nodeBetweennessArray](NodeId nodeId) { return nodeBetweennessArray[nodeId]; })
         .setFlag(AttributeFlag::VisualiseByComponent);
 
     _graphModel->createAttribute(QObject::tr("Edge Betweenness"))
         .setDescription(QObject::tr("An edge's betweenness is the number of shortest paths that pass through it."))
-        .setFloatValueFn([edgeBetweenness](EdgeId edgeId) { return edgeBetweenness[edgeId]; })
+        .setFloatValueFn([edgeBetweennessArray](EdgeId edgeId) { return edgeBetweennessArray[edgeId]; })
         .setFlag(AttributeFlag::VisualiseByComponent);
 }
 
@@ -50,6 +50,23 @@ public:
     }
     QString category() const override { return QObject::tr("Metrics"); }
     ElementType elementType() const override { return ElementType::None; }
+
+    GraphTransformParameters parameters() const override
+    {
+        return
+        {
+            {
+                "Samples",
+                ValueType::Int,
+                QObject::tr("The number of randomly chosen source nodes from which shortest paths "
+                    "are computed. Values are scaled to estimate the exact result, trading "
+                    "accuracy for speed on large graphs. If 0, every node is used and the "
+                    "result is exact."),
+                0, 0
+            }
+        };
+    }
+
     DefaultVisualisations defaultVisualisations() const override
     {
         return
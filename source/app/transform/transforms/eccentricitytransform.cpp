@@ -19,10 +19,11 @@
 #include "eccentricitytransform.h"
 #include "transform/transformedgraph.h"
 #include "graph/graphmodel.h"
+#include "graph/adjacencysnapshot.h"
 #include "shared/utils/threadpool.h"
 
-#include <map>
-#include <queue>
+#include <numeric>
+#include <vector>
 
 void EccentricityTransform::apply(TransformedGraph& target) const
 {
@@ -32,76 +33,53 @@ void EccentricityTransform::apply(TransformedGraph& target) const
 
 void EccentricityTransform::calculateDistances(TransformedGraph& target) const
 {
-    // Setup the contiguous ids
-    std::map<NodeId, int> nodeIdToMatrixIndex;
-    std::map<int, NodeId> matrixIndexToNodeId;
-    for(auto nodeId : target.nodeIds())
-    {
-        auto size = static_cast<int>(nodeIdToMatrixIndex.size());
-        nodeIdToMatrixIndex[nodeId] = size;
-        matrixIndexToNodeId[size - 1] = nodeId;
-    }
+    auto adjacency = target.adjacencySnapshot();
+    const auto numNodes = adjacency->numNodes();
 
-    NodeArray<int> maxDistances(target);
+    std::vector<int> distances(numNodes, 0);
 
     target.setProgress(0);
 
-    const auto& nodeIds = target.nodeIds();
+    std::vector<AdjacencySnapshot::Index> sources(numNodes);
+    std::iota(sources.begin(), sources.end(), 0);
+
     std::atomic_int progress(0);
-    concurrent_for(nodeIds.begin(), nodeIds.end(),
-    [this, &maxDistances, &progress, &target](const NodeId source)
+    concurrent_for(sources.begin(), sources.end(),
+    [this, &adjacency, &distances, &progress, &target, numNodes](const AdjacencySnapshot::Index source)
     {
         if(cancelled())
             return;
 
-        NodeArray<int> distance(target);
-        NodeArray<bool> visited(target);
+        // All edges have unit length, so a breadth first search suffices
+        std::vector<int> distance(numNodes, -1);
+        std::vector<AdjacencySnapshot::Index> queue;
+        queue.reserve(numNodes);
 
-        auto comparator = [&distance](NodeId a, NodeId b){ return distance[a] > distance[b]; };
-        std::priority_queue<NodeId, std::vector<NodeId>, decltype(comparator)> queue(comparator);
-
-        for(auto nodeId : target.nodeIds())
-            distance[nodeId] = std::numeric_limits<int>::max();
-
-        queue.push(source);
+        queue.push_back(source);
         distance[source] = 0;
 
-        while(!queue.empty())
+        for(size_t head = 0; head < queue.size(); head++)
         {
             if(cancelled())
                 return;
 
-            auto nodeId = queue.top();
-            queue.pop();
-
-            if(visited.get(nodeId))
-                continue;
+            auto node = queue[head];
+            auto nextDistance = distance[node] + 1;
 
-            visited.set(nodeId, true);
-
-            auto nodeWeight = distance[nodeId];
-            for(EdgeId edgeId : target.edgeIdsForNodeId(nodeId))
+            for(auto neighbour : adjacency->neighboursOf(node))
             {
-                NodeId adjacentNodeId = target.edgeById(edgeId).oppositeId(nodeId);
-                const int adjacentNodeWeight = 1;
-                if(!visited.get(adjacentNodeId) && (nodeWeight + adjacentNodeWeight < distance[adjacentNodeId]))
+                if(distance[neighbour] < 0)
                 {
-                    distance[adjacentNodeId] = nodeWeight + adjacentNodeWeight;
-                    queue.push(adjacentNodeId);
+                    distance[neighbour] = nextDistance;
+                    queue.push_back(neighbour);
                 }
             }
         }
 
-        int maxDistance = 0;
-        for(auto nodeId : target.nodeIds())
-        {
-            if(distance[nodeId] != std::numeric_limits<int>::max())
-                maxDistance = std::max(distance[nodeId], maxDistance);
-        }
-
-        maxDistances[source] = maxDistance;
+        // The last node to be visited is necessarily one of the furthest away
+        distances[source] = distance[queue.back()];
         progress++;
-        target.setProgress(progress.load() * 100 / static_cast<int>(target.numNodes()));
+        target.setProgress(progress.load() * 100 / static_cast<int>(numNodes));
     });
 
     target.setProgress(-1);
@@ -109,6 +87,10 @@ void EccentricityTransform::calculateDistances(TransformedGraph& target) const
     if(cancelled())
         return;
 
+    NodeArray<int> maxDistances(target);
+    for(AdjacencySnapshot::Index node = 0; node < numNodes; node++)
+        maxDistances[adjacency->nodeIdOf(node)] = distances[node];
+
     _graphModel->createAttribute(QObject::tr("Node Eccentricity"))
         .setDescription(QObject::tr("A node's eccentricity is the length of the shortest path to the furthest node."))
         .setIntValueFn([maxDistances](NodeId nodeId) { return maxDistances[nodeId]; })
@@ -21,16 +21,304 @@
 #include "transform/transformedgraph.h"
 
 #include "shared/graph/grapharray.h"
-#include "shared/utils/container.h"
+#include "shared/utils/threadpool.h"
 
 #include "graph/graphmodel.h"
+#include "graph/adjacencysnapshot.h"
 
-#include <map>
 #include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include <algorithm>
+#include <functional>
+#include <numeric>
 #include <cmath>
 
 // https://arxiv.org/abs/0803.0476
+// The local moving phase is parallelised by colouring the graph, as per
+// https://arxiv.org/abs/1410.1237; nodes of the same colour are not adjacent
+// to each other so can all be considered at once
+
+namespace
+{
+using Index = AdjacencySnapshot::Index;
+constexpr Index NullIndex = AdjacencySnapshot::NullIndex;
+
+// A compact weighted graph, forming one level of the hierarchy
+struct LouvainLevel
+{
+    // The adjacency of node i is [_offsets[i], _offsets[i + 1]), excluding loops
+    std::vector<size_t> _offsets;
+    std::vector<Index> _neighbours;
+    std::vector<double> _weights;
+
+    // Includes loops, counted twice
+    std::vector<double> _degrees;
+
+    size_t numNodes() const { return _degrees.size(); }
+};
+
+// For each level, the community (i.e. node in the next level) of each of its nodes
+using LouvainHierarchy = std::vector<std::vector<Index>>;
+
+// Accumulates the weights from a node to each of its neighbouring communities,
+// using open addressing so that its size only depends on the node's degree
+class CommunityWeights
+{
+private:
+    std::vector<Index> _communities;
+    std::vector<double> _weights;
+    std::vector<size_t> _usedSlots;
+    size_t _mask = 0;
+
+    size_t slotFor(Index community) const
+    {
+        auto slot = static_cast<size_t>(community * 2654435761u) & _mask;
+
+        while(_communities[slot] != community && _communities[slot] != NullIndex)
+            slot = (slot + 1) & _mask;
+
+        return slot;
+    }
+
+public:
+    void reset(size_t maxNumCommunities)
+    {
+        for(auto slot : _usedSlots)
+            _communities[slot] = NullIndex;
+
+        _usedSlots.clear();
+
+        size_t capacity = 16;
+        while(capacity < maxNumCommunities * 2)
+            capacity <<= 1;
+
+        if(capacity > _communities.size())
+        {
+            _communities.assign(capacity, NullIndex);
+            _weights.resize(capacity);
+        }
+
+        _mask = _communities.size() - 1;
+    }
+
+    void add(Index community, double weight)
+    {
+        auto slot = slotFor(community);
+
+        if(_communities[slot] == NullIndex)
+        {
+            _communities[slot] = community;
+            _weights[slot] = 0.0;
+            _usedSlots.push_back(slot);
+        }
+
+        _weights[slot] += weight;
+    }
+
+    size_t size() const { return _usedSlots.size(); }
+
+    // In the order the communities were first added
+    template<typename Fn>
+    void forEach(Fn&& fn) const
+    {
+        for(auto slot : _usedSlots)
+            fn(_communities[slot], _weights[slot]);
+    }
+};
+
+std::vector<std::vector<Index>> colourClassesOf(const LouvainLevel& level)
+{
+    std::vector<Index> colours(level.numNodes(), NullIndex);
+    std::vector<Index> lastUsedBy;
+    std::vector<std::vector<Index>> classes;
+
+    for(Index node = 0; node < level.numNodes(); node++)
+    {
+        for(auto i = level._offsets[node]; i < level._offsets[node + 1]; i++)
+        {
+            auto colour = colours[level._neighbours[i]];
+            if(colour != NullIndex)
+                lastUsedBy[colour] = node;
+        }
+
+        // Lowest colour that none of the neighbours have
+        Index colour = 0;
+        while(colour < lastUsedBy.size() && lastUsedBy[colour] == node)
+            colour++;
+
+        if(colour == lastUsedBy.size())
+        {
+            lastUsedBy.push_back(NullIndex);
+            classes.emplace_back();
+        }
+
+        colours[node] = colour;
+        classes[colour].push_back(node);
+    }
+
+    return classes;
+}
+
+// Renumbers communities to be contiguous, in order of first appearance,
+// returning the number of communities
+size_t relabel(std::vector<Index>& communities)
+{
+    std::vector<Index> idMap(communities.size(), NullIndex);
+    Index nextCommunity = 0;
+
+    for(auto& community : communities)
+    {
+        if(idMap[community] == NullIndex)
+            idMap[community] = nextCommunity++;
+
+        community = idMap[community];
+    }
+
+    return nextCommunity;
+}
+
+LouvainLevel coarsen(const LouvainLevel& level, const std::vector<Index>& communities,
+    size_t numCommunities, std::vector<CommunityWeights>& scratches)
+{
+    LouvainLevel coarseLevel;
+    coarseLevel._degrees.resize(numCommunities, 0.0);
+
+    // Bucket the nodes by community
+    std::vector<size_t> memberOffsets(numCommunities + 1, 0);
+    for(Index node = 0; node < level.numNodes(); node++)
+    {
+        memberOffsets[communities[node] + 1]++;
+        coarseLevel._degrees[communities[node]] += level._degrees[node];
+    }
+
+    std::partial_sum(memberOffsets.begin(), memberOffsets.end(), memberOffsets.begin());
+
+    std::vector<Index> members(level.numNodes());
+    auto cursors = memberOffsets;
+    for(Index node = 0; node < level.numNodes(); node++)
+        members[cursors[communities[node]]++] = node;
+
+    std::vector<Index> coarseNodes(numCommunities);
+    std::iota(coarseNodes.begin(), coarseNodes.end(), 0);
+
+    // Edges internal to a community become loops, which don't need to be stored
+    // explicitly as they are already accounted for in the degree
+    auto aggregate = [&](Index coarseNode, CommunityWeights& weights)
+    {
+        size_t maxNumNeighbours = 0;
+        for(auto i = memberOffsets[coarseNode]; i < memberOffsets[coarseNode + 1]; i++)
+        {
+            auto node = members[i];
+            maxNumNeighbours += level._offsets[node + 1] - level._offsets[node];
+        }
+
+        weights.reset(maxNumNeighbours);
+
+        for(auto i = memberOffsets[coarseNode]; i < memberOffsets[coarseNode + 1]; i++)
+        {
+            auto node = members[i];
+            for(auto j = level._offsets[node]; j < level._offsets[node + 1]; j++)
+            {
+                auto neighbourCommunity = communities[level._neighbours[j]];
+                if(neighbourCommunity != coarseNode)
+                    weights.add(neighbourCommunity, level._weights[j]);
+            }
+        }
+    };
+
+    std::vector<size_t> numNeighbours(numCommunities);
+    concurrent_for(coarseNodes.begin(), coarseNodes.end(),
+    [&](Index coarseNode, size_t threadIndex)
+    {
+        auto& weights = scratches.at(threadIndex);
+        aggregate(coarseNode, weights);
+        numNeighbours[coarseNode] = weights.size();
+    });
+
+    coarseLevel._offsets.resize(numCommunities + 1, 0);
+    std::partial_sum(numNeighbours.begin(), numNeighbours.end(), coarseLevel._offsets.begin() + 1);
+    coarseLevel._neighbours.resize(coarseLevel._offsets.back());
+    coarseLevel._weights.resize(coarseLevel._offsets.back());
+
+    concurrent_for(coarseNodes.begin(), coarseNodes.end(),
+    [&](Index coarseNode, size_t threadIndex)
+    {
+        auto& weights = scratches.at(threadIndex);
+        aggregate(coarseNode, weights);
+
+        auto i = coarseLevel._offsets[coarseNode];
+        weights.forEach([&](Index neighbour, double weight)
+        {
+            coarseLevel._neighbours[i] = neighbour;
+            coarseLevel._weights[i] = weight;
+            i++;
+        });
+    });
+
+    return coarseLevel;
+}
+
+size_t hashOf(const LouvainLevel& level)
+{
+    size_t seed = level.numNodes();
+
+    auto combine = [&seed](size_t hash)
+    {
+        seed ^= hash + 0x9e3779b9 + (seed << 6u) + (seed >> 2u);
+    };
+
+    for(auto offset : level._offsets)
+        combine(offset);
+
+    for(auto neighbour : level._neighbours)
+        combine(neighbour);
+
+    for(auto weight : level._weights)
+        combine(std::hash<double>{}(weight));
+
+    return seed;
+}
+} // namespace
+
+// Hierarchies are only reused for exactly the same resolution; starting from the
+// levels of a different resolution would make the clustering depend on the order
+// in which the settings happened to be explored
+struct LouvainCache
+{
+    static constexpr size_t MaxNumHierarchies = 8;
+
+    std::mutex _mutex;
+
+    // The base level the hierarchies were computed from; the hash is a
+    // quick rejection, but the level itself is what decides a match
+    size_t _key = 0;
+    std::vector<size_t> _offsets;
+    std::vector<Index> _neighbours;
+    std::vector<double> _weights;
+    std::vector<double> _degrees;
+
+    // Most recently used first
+    std::deque<std::pair<double, LouvainHierarchy>> _hierarchies;
+
+    bool isFor(size_t key, const LouvainLevel& level) const
+    {
+        return _key == key &&
+            _offsets == level._offsets && _neighbours == level._neighbours &&
+            _weights == level._weights && _degrees == level._degrees;
+    }
+
+    void resetFor(size_t key, const LouvainLevel& level)
+    {
+        _key = key;
+        _offsets = level._offsets;
+        _neighbours = level._neighbours;
+        _weights = level._weights;
+        _degrees = level._degrees;
+        _hierarchies.clear();
+    }
+};
 
 void LouvainTransform::apply(TransformedGraph& target) const
 {
@@ -46,10 +334,10 @@ void LouvainTransform::apply(TransformedGraph& target) const
 
     resolution = std::pow(10.0f, logMin + (resolution * logRange));
 
-    using CommunityId = NodeId; // Slight Hack, be careful with this
+    target.setPhase(QStringLiteral("Louvain Initialising"));
 
-    const auto& edgeIds = target.edgeIds();
-    EdgeArray<double> weights(target, 1.0);
+    auto adjacency = target.adjacencySnapshot();
+    std::vector<double> edgeWeights(adjacency->numEdges(), 1.0);
 
     if(_weighted)
     {
@@ -62,122 +350,123 @@ void LouvainTransform::apply(TransformedGraph& target) const
         auto attribute = _graphModel->attributeValueByName(
             config().attributeNames().front());
 
-        for(auto edgeId : edgeIds)
-            weights[edgeId] = attribute.numericValueOf(edgeId);
+        for(Index edge = 0; edge < adjacency->numEdges(); edge++)
+            edgeWeights[edge] = attribute.numericValueOf(adjacency->edgeIdOf(edge));
     }
 
-    double totalWeight = std::accumulate(edgeIds.begin(), edgeIds.end(), 0.0,
-    [&weights](double d, EdgeId edgeId)
+    // Build the base level from the nodes that aren't merged into others
+    std::vector<Index> levelIndices(adjacency->numNodes(), NullIndex);
+    std::vector<Index> snapshotIndices;
+    for(Index node = 0; node < adjacency->numNodes(); node++)
     {
-        return d + weights[edgeId];
-    });
-
-    std::vector<NodeArray<CommunityId>> iterations;
-    size_t progressIteration = 1;
-    target.setPhase(QStringLiteral("Louvain Initialising"));
-
-    NodeArray<CommunityId> communities(target);
-    NodeArray<double> weightedDegrees(target);
-    std::map<CommunityId, int> communityDegrees;
+        if(target.typeOf(adjacency->nodeIdOf(node)) == MultiElementType::Tail)
+            continue;
 
-    auto add = [&](CommunityId community, NodeId nodeId)
-    {
-        communities[nodeId] = community;
-        communityDegrees[community] += weightedDegrees[nodeId];
-    };
+        levelIndices[node] = static_cast<Index>(snapshotIndices.size());
+        snapshotIndices.push_back(node);
+    }
 
-    auto remove = [&](CommunityId community, NodeId nodeId)
-    {
-        communities[nodeId].setToNull();
-        communityDegrees[community] -= weightedDegrees[nodeId];
-    };
+    LouvainLevel baseLevel;
+    baseLevel._offsets.reserve(snapshotIndices.size() + 1);
+    baseLevel._degrees.reserve(snapshotIndices.size());
+    baseLevel._offsets.push_back(0);
 
-    auto relabel = [&](MutableGraph& graph)
+    for(auto node : snapshotIndices)
     {
-        std::map<CommunityId, CommunityId> idMap;
-        CommunityId nextCommunityId = 0;
+        double degree = 0.0;
+        auto neighbours = adjacency->neighboursOf(node);
+        auto edges = adjacency->edgesOf(node);
 
-        for(auto nodeId : graph.nodeIds())
+        for(size_t i = 0; i < neighbours.size(); i++)
         {
-            if(graph.typeOf(nodeId) == MultiElementType::Tail)
+            auto neighbour = levelIndices[neighbours[i]];
+            if(neighbour == NullIndex)
                 continue;
 
-            auto oldCommunityId = communities[nodeId];
+            auto weight = edgeWeights[edges[i]];
+            degree += weight;
 
-            if(!u::contains(idMap, oldCommunityId))
-                communities[nodeId] = idMap[oldCommunityId] = nextCommunityId++;
-            else
-                communities[nodeId] = idMap.at(oldCommunityId);
+            if(neighbours[i] != node)
+            {
+                baseLevel._neighbours.push_back(neighbour);
+                baseLevel._weights.push_back(weight);
+            }
         }
-    };
 
-    auto coarsen = [&](MutableGraph& graph)
-    {
-        MutableGraph coarseGraph;
-        EdgeArray<double> newWeights(target, 0.0);
+        baseLevel._degrees.push_back(degree);
+        baseLevel._offsets.push_back(baseLevel._neighbours.size());
+    }
 
-        coarseGraph.performTransaction([&](IMutableGraph&)
-        {
-            // Create a node for each community
-            for(auto nodeId : graph.nodeIds())
-            {
-                if(graph.typeOf(nodeId) == MultiElementType::Tail)
-                    continue;
+    const double totalWeight = std::accumulate(baseLevel._degrees.begin(),
+        baseLevel._degrees.end(), 0.0) * 0.5;
 
-                auto newNodeId = communities[nodeId];
+    std::vector<CommunityWeights> scratches(std::thread::hardware_concurrency());
+    size_t progressIteration = 1;
 
-                if(coarseGraph.containsNodeId(newNodeId))
-                    continue;
+    // Returns true if any node changed community
+    auto moveNodes = [&](const LouvainLevel& level, std::vector<Index>& communities)
+    {
+        communities.resize(level.numNodes());
+        std::iota(communities.begin(), communities.end(), 0);
+        auto communityDegrees = level._degrees;
 
-                coarseGraph.reserveNodeId(newNodeId);
-                auto assignedNodeId = coarseGraph.addNode(newNodeId);
-                Q_ASSERT(assignedNodeId == newNodeId);
-            }
+        auto colourClasses = colourClassesOf(level);
 
-            uint64_t edgeIndex = 0;
+        // Nodes of the same colour aren't adjacent, so moving one of them doesn't
+        // change the weights from the others to their neighbouring communities;
+        // hence these can be computed concurrently, and checked when applied
+        struct Move
+        {
+            Index _community = NullIndex;
+            double _weight = 0.0;
+            double _currentWeight = 0.0;
+        };
 
-            // Create an edge between community nodes for each
-            // pair of connected communities in the base graph
-            for(auto edgeId : graph.edgeIds())
-            {
-                target.setProgress(static_cast<int>((edgeIndex++ * 100) / graph.numEdges()));
+        std::vector<Move> moves(level.numNodes());
 
-                if(cancelled())
-                    break;
+        auto deltaQ = [&](double weight, double communityWeight, double nodeWeight)
+        {
+            return (resolution * weight) - ((communityWeight * nodeWeight) / totalWeight);
+        };
 
-                const auto& edge = graph.edgeById(edgeId);
-                auto sourceId = communities.at(edge.sourceId());
-                auto targetId = communities.at(edge.targetId());
-                double newWeight = weights[edgeId];
+        auto findMove = [&](Index node, CommunityWeights& weights)
+        {
+            weights.reset(level._offsets[node + 1] - level._offsets[node]);
 
-                auto newEdgeId = coarseGraph.firstEdgeIdBetween(sourceId, targetId);
-                if(newEdgeId.isNull())
-                    newEdgeId = coarseGraph.addEdge(sourceId, targetId);
+            for(auto i = level._offsets[node]; i < level._offsets[node + 1]; i++)
+                weights.add(communities[level._neighbours[i]], level._weights[i]);
 
-                newWeights[newEdgeId] += newWeight;
-            }
-        });
+            auto communityId = communities[node];
+            auto nodeWeight = level._degrees[node];
 
-        graph = coarseGraph;
-        weights = newWeights;
-    };
+            Move move;
+            move._community = communityId;
+            double maxDeltaQ = 0.0;
 
-    auto moveNodes = [&](MutableGraph& graph)
-    {
-        if(cancelled())
-            return false;
+            weights.forEach([&](Index neighbourCommunityId, double weight)
+            {
+                auto communityWeight = communityDegrees[neighbourCommunityId];
+                if(neighbourCommunityId == communityId)
+                {
+                    communityWeight -= nodeWeight;
+                    move._currentWeight = weight;
+                }
 
-        CommunityId nextCommunityId = 0;
-        for(auto nodeId : graph.nodeIds())
-        {
-            if(graph.typeOf(nodeId) == MultiElementType::Tail)
-                continue;
+                auto q = deltaQ(weight, communityWeight, nodeWeight);
 
-            for(auto edgeId : graph.nodeById(nodeId).edgeIds())
-                weightedDegrees[nodeId] += weights[edgeId];
+                if(q > maxDeltaQ)
+                {
+                    maxDeltaQ = q;
+                    move._community = neighbourCommunityId;
+                    move._weight = weight;
+                }
+            });
 
-            add(nextCommunityId++, nodeId);
-        }
+            moves[node] = move;
+        };
+
+        // Below this, the overhead of parallelising outweighs the benefit
+        const size_t minParallelClassSize = 256;
 
         size_t subProgressIteration = 1;
         bool modified = false;
@@ -186,157 +475,172 @@ void LouvainTransform::apply(TransformedGraph& target) const
         {
             improved = false;
             target.setProgress(0);
-            uint64_t nodeIndex = 0;
+            size_t numNodesProcessed = 0;
 
             target.setPhase(QStringLiteral("Louvain Iteration %1.%2")
                 .arg(QString::number(progressIteration), QString::number(subProgressIteration++)));
 
-            for(auto nodeId : graph.nodeIds())
+            for(const auto& colourClass : colourClasses)
             {
-                target.setProgress(static_cast<int>((nodeIndex++ * 100) / graph.numNodes()));
+                if(cancelled())
+                    break;
 
-                if(graph.typeOf(nodeId) == MultiElementType::Tail)
-                    continue;
+                if(colourClass.size() >= minParallelClassSize)
+                {
+                    concurrent_for(colourClass.begin(), colourClass.end(),
+                    [&](Index node, size_t threadIndex)
+                    {
+                        findMove(node, scratches.at(threadIndex));
+                    });
+                }
+                else
+                {
+                    for(auto node : colourClass)
+                        findMove(node, scratches.front());
+                }
 
-                std::map<CommunityId, double> neighbourCommunityWeights;
-                for(auto edgeId : graph.nodeById(nodeId).edgeIds())
+                // Community degrees may have changed since the moves were found,
+                // so only apply those that are still an improvement
+                for(auto node : colourClass)
                 {
-                    auto neighbourNodeId = graph.edgeById(edgeId).oppositeId(nodeId);
+                    const auto& move = moves[node];
+                    auto communityId = communities[node];
 
-                    // Skip loop edges
-                    if(neighbourNodeId == nodeId)
+                    if(move._community == communityId)
                         continue;
 
-                    if(graph.typeOf(neighbourNodeId) == MultiElementType::Tail)
-                        continue;
+                    auto nodeWeight = level._degrees[node];
+                    auto currentDeltaQ = std::max(0.0, deltaQ(move._currentWeight,
+                        communityDegrees[communityId] - nodeWeight, nodeWeight));
+                    auto newDeltaQ = deltaQ(move._weight,
+                        communityDegrees[move._community], nodeWeight);
 
-                    auto neighbourCommunityId = communities.at(neighbourNodeId);
+                    if(newDeltaQ <= currentDeltaQ)
+                        continue;
 
-                    neighbourCommunityWeights[neighbourCommunityId] += weights[edgeId];
+                    communityDegrees[communityId] -= nodeWeight;
+                    communityDegrees[move._community] += nodeWeight;
+                    communities[node] = move._community;
+                    improved = modified = true;
                 }
 
-                auto communityId = communities[nodeId];
-                remove(communityId, nodeId);
+                numNodesProcessed += colourClass.size();
+                target.setProgress(static_cast<int>((numNodesProcessed * 100) / level.numNodes()));
+            }
 
-                double maxDeltaQ = 0.0;
-                auto newCommunityId = communityId;
+            target.setProgress(-1);
+        }
+        while(improved && !cancelled());
 
-                for(auto [neighbourCommunityId, weight] : neighbourCommunityWeights)
-                {
-                    auto communityWeight = communityDegrees.at(neighbourCommunityId);
-                    auto nodeWeight = weightedDegrees[nodeId];
+        return modified;
+    };
 
-                    auto deltaQ = (resolution * weight) -
-                        ((communityWeight * nodeWeight) / totalWeight);
+    auto computeHierarchy = [&]
+    {
+        LouvainHierarchy hierarchy;
+        LouvainLevel level = baseLevel;
 
-                    if(deltaQ > maxDeltaQ)
-                    {
-                        maxDeltaQ = deltaQ;
-                        newCommunityId = neighbourCommunityId;
-                    }
-                }
+        bool finished = false;
+        do
+        {
+            target.setProgress(-1);
 
-                add(newCommunityId, nodeId);
+            std::vector<Index> communities;
+            finished = !moveNodes(level, communities);
 
-                if(newCommunityId != communityId)
-                    improved = modified = true;
+            if(!finished && !cancelled())
+            {
+                auto numCommunities = relabel(communities);
 
-                if(cancelled())
-                    break;
+                target.setPhase(QStringLiteral("Louvain Iteration %1 Coarsening")
+                    .arg(QString::number(progressIteration)));
+                level = coarsen(level, communities, numCommunities, scratches);
+                hierarchy.emplace_back(std::move(communities));
             }
 
-            target.setProgress(-1);
+            progressIteration++;
         }
-        while(improved && !cancelled());
+        while(!finished && !cancelled());
 
-        return modified;
+        return hierarchy;
     };
 
-    MutableGraph graph(target.mutableGraph());
+    auto key = hashOf(baseLevel);
+    LouvainHierarchy hierarchy;
+    bool cached = false;
 
-    bool finished = false;
-    do
     {
-        target.setProgress(-1);
+        std::unique_lock<std::mutex> lock(_cache->_mutex);
 
-        communities.resetElements();
-        weightedDegrees.resetElements();
-        communityDegrees.clear();
+        if(!_cache->isFor(key, baseLevel))
+            _cache->resetFor(key, baseLevel);
 
-        finished = !moveNodes(graph);
+        auto& hierarchies = _cache->_hierarchies;
+        auto it = std::find_if(hierarchies.begin(), hierarchies.end(),
+            [resolution](const auto& entry) { return entry.first == resolution; });
 
-        if(!finished && !cancelled())
+        if(it != hierarchies.end())
         {
-            relabel(graph);
-            iterations.emplace_back(communities);
+            hierarchy = it->second;
+            cached = true;
 
-            target.setPhase(QStringLiteral("Louvain Iteration %1 Coarsening")
-                .arg(QString::number(progressIteration)));
-            coarsen(graph);
+            std::rotate(hierarchies.begin(), it, it + 1);
         }
-
-        progressIteration++;
     }
-    while(!finished && !cancelled());
 
-    if(cancelled())
-        return;
+    if(!cached)
+    {
+        hierarchy = computeHierarchy();
 
-    target.setPhase(QStringLiteral("Louvain Finalising"));
+        if(cancelled())
+            return;
 
-    // Set each CommunityId to be the same as the NodeId, initially
-    for(auto nodeId : target.nodeIds())
-    {
-        if(graph.typeOf(nodeId) == MultiElementType::Tail)
-            continue;
+        std::unique_lock<std::mutex> lock(_cache->_mutex);
+
+        if(_cache->isFor(key, baseLevel))
+        {
+            _cache->_hierarchies.emplace_front(resolution, hierarchy);
 
-        communities[nodeId] = nodeId;
+            if(_cache->_hierarchies.size() > LouvainCache::MaxNumHierarchies)
+                _cache->_hierarchies.pop_back();
+        }
     }
 
-    // Walk back over our iterations to build the final communities
-    for(auto nodeId : target.nodeIds())
-    {
-        for(const auto& iteration : iterations)
-        {
-            auto communityId = communities[nodeId];
+    target.setPhase(QStringLiteral("Louvain Finalising"));
 
-            if(!communityId.isNull())
-                communities[nodeId] = iteration.at(communities[nodeId]);
+    // Walk back over the levels to find each base node's final community
+    std::vector<Index> communities(baseLevel.numNodes());
+    std::iota(communities.begin(), communities.end(), 0);
 
-            if(cancelled())
-                return;
-        }
+    for(const auto& level : hierarchy)
+    {
+        for(auto& community : communities)
+            community = level[community];
     }
 
     // Sort communities by size
-    std::map<CommunityId, size_t> communityHistogram;
-    for(auto nodeId : target.nodeIds())
-        communityHistogram[communities[nodeId]]++;
-    std::vector<std::pair<CommunityId, size_t>> sortedCommunityHistogram;
-    std::copy(communityHistogram.begin(), communityHistogram.end(),
-        std::back_inserter(sortedCommunityHistogram));
-    std::sort(sortedCommunityHistogram.begin(), sortedCommunityHistogram.end(),
-        [](const auto& a, const auto& b) { return a.second > b.second; });
+    auto numCommunities = hierarchy.empty() ? baseLevel.numNodes() : hierarchy.back().size();
+    std::vector<size_t> communityHistogram(numCommunities, 0);
+    for(auto community : communities)
+        communityHistogram[community]++;
+
+    std::vector<Index> sortedCommunities(numCommunities);
+    std::iota(sortedCommunities.begin(), sortedCommunities.end(), 0);
+    std::stable_sort(sortedCommunities.begin(), sortedCommunities.end(),
+        [&communityHistogram](auto a, auto b) { return communityHistogram[a] > communityHistogram[b]; });
 
     // Assign cluster numbers to each community
-    std::map<CommunityId, size_t> clusterNumbers;
+    std::vector<size_t> clusterNumbers(numCommunities);
     size_t clusterNumber = 1;
-    for(auto [communityId, size] : sortedCommunityHistogram)
-    {
-        if(!communityId.isNull())
-            clusterNumbers[communityId] = clusterNumber++;
-    }
+    for(auto community : sortedCommunities)
+        clusterNumbers[community] = clusterNumber++;
 
     NodeArray<QString> clusterNames(target);
 
-    for(auto nodeId : target.nodeIds())
+    for(Index node = 0; node < baseLevel.numNodes(); node++)
     {
-        auto communityId = communities[nodeId];
-        if(communityId.isNull())
-            continue;
-
-        clusterNumber = clusterNumbers[communityId];
-        clusterNames[nodeId] = QObject::tr("Cluster %1").arg(clusterNumber);
+        auto nodeId = adjacency->nodeIdOf(snapshotIndices[node]);
+        clusterNames[nodeId] = QObject::tr("Cluster %1").arg(clusterNumbers[communities[node]]);
     }
 
     _graphModel->createAttribute(QObject::tr(_weighted ? "Weighted Louvain Cluster" : "Louvain Cluster"))
@@ -346,3 +650,18 @@ void LouvainTransform::apply(TransformedGraph& target) const
         .setFlag(AttributeFlag::FindShared)
         .setFlag(AttributeFlag::Searchable);
 }
+
+LouvainTransformFactory::LouvainTransformFactory(GraphModel* graphModel) :
+    GraphTransformFactory(graphModel),
+    _cache(std::make_shared<LouvainCache>())
+{}
+
+std::unique_ptr<GraphTransform> LouvainTransformFactory::create(const GraphTransformConfig&) const
+{
+    return std::make_unique<LouvainTransform>(graphModel(), false, _cache);
+}
+
+std::unique_ptr<GraphTransform> WeightedLouvainTransformFactory::create(const GraphTransformConfig&) const
+{
+    return std::make_unique<LouvainTransform>(graphModel(), true, _cache);
+}
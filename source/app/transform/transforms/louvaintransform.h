@@ -24,24 +24,33 @@
 #include "shared/utils/flags.h"
 #include "shared/utils/redirects.h"
 
+#include <memory>
+
+// Retains the community hierarchies of previous runs, so that revisiting a
+// granularity on an unchanged graph doesn't require recomputation
+struct LouvainCache;
+
 class LouvainTransform : public GraphTransform
 {
 public:
-    explicit LouvainTransform(GraphModel* graphModel, bool weighted) :
-        _graphModel(graphModel), _weighted(weighted) {}
+    explicit LouvainTransform(GraphModel* graphModel, bool weighted,
+        std::shared_ptr<LouvainCache> cache) :
+        _graphModel(graphModel), _weighted(weighted), _cache(std::move(cache)) {}
     void apply(TransformedGraph& target) const override;
 
 private:
     GraphModel* _graphModel = nullptr;
     bool _weighted = false;
+    std::shared_ptr<LouvainCache> _cache;
 };
 
 class LouvainTransformFactory : public GraphTransformFactory
 {
+protected:
+    std::shared_ptr<LouvainCache> _cache;
+
 public:
-    explicit LouvainTransformFactory(GraphModel* graphModel) :
-        GraphTransformFactory(graphModel)
-    {}
+    explicit LouvainTransformFactory(GraphModel* graphModel);
 
     QString description() const override
     {
@@ -70,10 +79,7 @@ public:
         return {{"Louvain Cluster", ValueType::String, {}, QObject::tr("Colour")}};
     }
 
-    std::unique_ptr<GraphTransform> create(const GraphTransformConfig&) const override
-    {
-        return std::make_unique<LouvainTransform>(graphModel(), false);
-    }
+    std::unique_ptr<GraphTransform> create(const GraphTransformConfig&) const override;
 };
 
 class WeightedLouvainTransformFactory : public LouvainTransformFactory
@@ -98,10 +104,7 @@ public:
         return {{"Weighted Louvain Cluster", ValueType::String, {}, QObject::tr("Colour")}};
     }
 
-    std::unique_ptr<GraphTransform> create(const GraphTransformConfig&) const override
-    {
-        return std::make_unique<LouvainTransform>(graphModel(), true);
-    }
+    std::unique_ptr<GraphTransform> create(const GraphTransformConfig&) const override;
 };
 
 #endif // LOUVAINTRANSFORM_H
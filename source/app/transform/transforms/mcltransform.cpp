@@ -19,265 +19,270 @@
 #include "mcltransform.h"
 #include "transform/transformedgraph.h"
 #include "graph/graphmodel.h"
+#include "graph/adjacencysnapshot.h"
 #include "shared/utils/threadpool.h"
 
-#include <blaze/Blaze.h>
-
 #include <QElapsedTimer>
 #include <QDebug>
 
-#include <map>
 #include <set>
 #include <thread>
+#include <atomic>
 #include <algorithm>
+#include <numeric>
+#include <cstddef>
+#include <cmath>
 
-using MatrixType = blaze::CompressedMatrix<float,blaze::columnMajor>;
-using VectorType = blaze::DynamicVector<float,blaze::columnVector>;
+namespace
+{
+using Index = AdjacencySnapshot::Index;
 
-static void normaliseColumnsColumnMajor(MatrixType &mclMatrix)
+// A column major sparse matrix; the rows of the non-zeros in column j are
+// [_offsets[j], _offsets[j + 1]) of _rows, in ascending order
+struct MCLMatrix
 {
-    for(size_t column = 0; column<mclMatrix.columns(); column++)
-    {
-        MatrixType::Iterator lelem=mclMatrix.begin(column);
-        MatrixType::Iterator lend=mclMatrix.end(column);
+    std::vector<size_t> _offsets;
+    std::vector<Index> _rows;
+    std::vector<float> _values;
 
-        if(lelem == lend)
-            continue;
+    size_t numColumns() const { return _offsets.size() - 1; }
+    size_t nonZeros() const { return _rows.size(); }
+    size_t nonZeros(size_t column) const { return _offsets[column + 1] - _offsets[column]; }
+};
 
-        float value = 0.0f;
-        for(lelem=mclMatrix.begin(column); lelem!=lend; ++lelem)
-            value += lelem->value();
+// Per thread scratch space for accumulating one column of the expanded matrix;
+// it's sized to the whole matrix, but only ever cleared sparsely, so it is
+// allocated once per thread and reused for every column of every iteration
+struct MCLAccumulator
+{
+    std::vector<float> _values;
+    std::vector<bool> _valid;
+    std::vector<Index> _indices;
 
-        Q_ASSERT(value > 0.0f);
-        value = 1.0f / value;
+    void resize(size_t size)
+    {
+        if(_values.size() == size)
+            return;
 
-        for(lelem=mclMatrix.begin(column); lelem!=lend; ++lelem)
-            lelem->value() = lelem->value() * value;
+        _values.assign(size, 0.0f);
+        _valid.assign(size, false);
+        _indices.reserve(size);
     }
-}
+};
 
-static void sumColumns(MatrixType &mclMatrix, VectorType &output)
+// The columns computed by one thread during an iteration, stored contiguously
+struct MCLThreadOutput
 {
-    for(size_t column = 0; column<mclMatrix.columns(); column++)
+    std::vector<Index> _rows;
+    std::vector<float> _values;
+
+    void clear()
     {
-        MatrixType::ConstIterator lend=mclMatrix.cend(column);
-        for(MatrixType::ConstIterator lelem=mclMatrix.cbegin(column); lelem!=lend; ++lelem)
-        {
-            output[column] = output[column] + lelem->value();
-        }
+        _rows.clear();
+        _values.clear();
     }
-}
-
-struct SparseMatrixEntry
-{
-    size_t _row; size_t _column; float _value;
-    SparseMatrixEntry(size_t row, size_t column, float value)
-        : _row(row), _column(column), _value(value){}
 };
 
-struct MCLRowData
+// Where each column of the next matrix was put by the thread that computed it
+struct MCLColumnLocation
 {
-    std::vector<float> values;
-    std::vector<bool> valid;
-    std::vector<size_t> indices;
-    explicit MCLRowData(size_t columnCount) : values(columnCount, 0.0f),
-        valid(columnCount, false), indices(columnCount, 0UL) {}
+    size_t _thread = 0;
+    size_t _offset = 0;
+    size_t _size = 0;
 };
+} // namespace
 
-template<typename CancelledFn>
-static void expandAndPruneRow(MatrixType& mclMatrix, size_t columnId,
-    std::vector<SparseMatrixEntry>* matrixStorage, MCLRowData& rowData,
-    float minValueCutoff, const CancelledFn& cancelledFn)
+static void debugMatrix(const QString& title, const MCLMatrix& matrix)
 {
-    const bool DEBUG = false;
+    qDebug().noquote() << title << "nnz" << matrix.nonZeros();
+
+    for(size_t column = 0; column < matrix.numColumns(); column++)
+    {
+        QString line = QStringLiteral("%1:").arg(column);
+
+        for(auto i = matrix._offsets[column]; i < matrix._offsets[column + 1]; i++)
+            line += QStringLiteral(" %1=%2").arg(matrix._rows[i]).arg(static_cast<double>(matrix._values[i]));
 
+        qDebug().noquote() << line;
+    }
+}
+
+// Computes column of the square of matrix, prunes it, then inflates and normalises
+// it, appending the result to output; returns the column's chaos, i.e. how far it
+// is from being idempotent
+static float expandColumn(const MCLMatrix& matrix, size_t column, float inflation,
+    float minValueCutoff, MCLAccumulator& accumulator, MCLThreadOutput& output)
+{
     // Perhaps make these changable parameters later
-    const int RECOVERY_COUNT = 1400;
-    const int SELECTION_COUNT = 1100;
+    const size_t RECOVERY_COUNT = 1400;
+    const size_t SELECTION_COUNT = 1100;
+    const float EPSILON = 1e-8f;
 
-    size_t nonzeros = 0;
+    // Mass is always normalised!
+    const float TARGET_MASS = 0.9f;
 
-    size_t minIndex = std::numeric_limits<size_t>::infinity();
-    size_t maxIndex = 0UL;
-    const auto* const lend = mclMatrix.cend(columnId);
+    auto& values = accumulator._values;
+    auto& valid = accumulator._valid;
+    auto& indices = accumulator._indices;
+    indices.clear();
 
-    // Perform multiply and populate prune dependant data structures
-    for(const auto* lelem = mclMatrix.cbegin(columnId); lelem != lend; ++lelem)
+    // Multiply
+    for(auto l = matrix._offsets[column]; l < matrix._offsets[column + 1]; l++)
     {
-        if(cancelledFn())
-            break;
+        auto left = matrix._rows[l];
+        auto leftValue = matrix._values[l];
 
-        // For each column (left)
-        const auto* const rend = mclMatrix.cend(lelem->index());
-        for(const auto* relem = mclMatrix.cbegin(lelem->index()); relem != rend; ++relem)
+        for(auto r = matrix._offsets[left]; r < matrix._offsets[left + 1]; r++)
         {
-            // For each column starting at left column index (right)
-            float mult = lelem->value() * relem->value();
+            auto row = matrix._rows[r];
+            float mult = leftValue * matrix._values[r];
 
-            if(!rowData.valid[relem->index()])
+            if(!valid[row])
             {
-                rowData.values[relem->index()] = mult;
-                rowData.valid[relem->index()] = true;
-                // Position in the rowData.values vector
-                rowData.indices[nonzeros] = relem->index();
-                ++nonzeros;
-
-                if(relem->index() < minIndex) minIndex = relem->index();
-                if(relem->index() > maxIndex) maxIndex = relem->index();
+                values[row] = mult;
+                valid[row] = true;
+                indices.push_back(row);
             }
             else
-                rowData.values[relem->index()] += mult;
+                values[row] += mult;
         }
     }
 
-    if(cancelledFn())
-        return;
+    const auto nonZeros = indices.size();
 
-    if(nonzeros > 0UL)
-    {
-        Q_ASSERT(minIndex <= maxIndex);
+    if(nonZeros == 0)
+        return 0.0f;
 
-        size_t remainCount = nonzeros;
-        float rowPruneSum = 0.0f;
-        // Mass is always normalised!
-        float targetMass = 0.9f;
+    // Prune
+    float cutoff = minValueCutoff;
+    size_t remainCount = nonZeros;
+    float mass = 0.0f;
 
-        for(size_t i = 0UL; i < nonzeros; ++i)
-        {
-            size_t index = rowData.indices[i];
-            if(std::abs(rowData.values[index]) <= minValueCutoff)
-            {
-                // Remove from the remainCount;
-                remainCount--;
-            }
-            else
-            {
-                // Calculate pruned sum
-                rowPruneSum += rowData.values[index];
-            }
-        }
-
-        if(DEBUG)
-            qDebug() << "RowPruneSum (mass?)" << rowPruneSum << "targetmass" << targetMass;
+    for(auto index : indices)
+    {
+        if(std::abs(values[index]) <= cutoff)
+            remainCount--;
+        else
+            mass += values[index];
+    }
 
-        if(remainCount != nonzeros && rowPruneSum < targetMass && remainCount < RECOVERY_COUNT)
+    // Raises the cutoff such that at most count values remain
+    auto keepLargest = [&](size_t count)
+    {
+        if(nonZeros <= count)
         {
-            // Recover
-            if(DEBUG)
-                qDebug() << "RECOVERY" << "MASS:" << rowPruneSum;
-            std::nth_element(rowData.indices.begin(), rowData.indices.begin() + RECOVERY_COUNT, rowData.indices.begin() + nonzeros,
-                             [&rowData](size_t i1, size_t i2) {return rowData.values[i1] > rowData.values[i2];});
-            minValueCutoff = rowData.values[rowData.indices[RECOVERY_COUNT]];
-            remainCount = RECOVERY_COUNT;
-            rowPruneSum = 0;
-            for(size_t i = 0UL; i < RECOVERY_COUNT; ++i)
-                rowPruneSum += rowData.values[rowData.indices[i]];
+            cutoff = 0.0f;
+            remainCount = nonZeros;
+            return;
         }
-        else if(remainCount > SELECTION_COUNT)
-        {
-            // Selection prune
-            // Refine the cutoff so MAXIMUM SELECTION_COUNT elements remain
-            // Should speedtest this vs copy+std::greater<float>
-            std::nth_element(rowData.indices.begin(), rowData.indices.begin() + SELECTION_COUNT, rowData.indices.begin() + nonzeros,
-                             [&rowData](size_t i1, size_t i2) {return rowData.values[i1] > rowData.values[i2];});
 
-            minValueCutoff = rowData.values[rowData.indices[SELECTION_COUNT]];
+        std::nth_element(indices.begin(), indices.begin() + static_cast<std::ptrdiff_t>(count), indices.end(),
+            [&values](Index a, Index b) { return values[a] > values[b]; });
 
-            if(DEBUG)
-            {
-                qDebug() << "Selection Cutoff" << minValueCutoff;
-                qDebug() << "Pre selection Remain" << remainCount << "mass" << rowPruneSum;
-            }
+        cutoff = values[indices[count]];
+        remainCount = count;
+        mass = 0.0f;
 
-            // Recalculate new mass
-            remainCount = SELECTION_COUNT;
-            rowPruneSum = 0;
-            for(size_t i = 0UL; i < SELECTION_COUNT; ++i)
-                rowPruneSum += rowData.values[rowData.indices[i]];
+        for(size_t i = 0; i < count; i++)
+            mass += values[indices[i]];
+    };
 
-            if(DEBUG)
-                qDebug() << "Post selection Remain" << remainCount << "mass" << rowPruneSum;
+    if(remainCount != nonZeros && mass < TARGET_MASS && remainCount < RECOVERY_COUNT)
+    {
+        // Recover
+        keepLargest(RECOVERY_COUNT);
+    }
+    else if(remainCount > SELECTION_COUNT)
+    {
+        // Select
+        keepLargest(SELECTION_COUNT);
 
-            Q_ASSERT(remainCount < RECOVERY_COUNT);
+        // Recover again if needed
+        if(remainCount != nonZeros && mass < TARGET_MASS)
+            keepLargest(RECOVERY_COUNT);
+    }
 
-            // Do Another recovery if needed
-            if(remainCount != nonzeros && rowPruneSum < targetMass)
-            {
-                if(DEBUG)
-                    qDebug() << "RECOVERY 2" << "MASS:" << rowPruneSum;
-
-                std::nth_element(rowData.indices.begin(), rowData.indices.begin() + RECOVERY_COUNT, rowData.indices.begin() + nonzeros,
-                                 [&rowData](size_t i1, size_t i2) {return rowData.values[i1] > rowData.values[i2];});
-                minValueCutoff = rowData.values[rowData.indices[RECOVERY_COUNT]];
-                remainCount = RECOVERY_COUNT;
-                rowPruneSum = 0;
-                for(size_t i = 0UL; i < RECOVERY_COUNT; ++i)
-                    rowPruneSum += rowData.values[rowData.indices[i]];
-            }
-        }
+    // Output in row order, rescaling what remains after pruning
+    const bool pruned = remainCount < nonZeros;
+    const auto begin = output._rows.size();
+    float sum = 0.0f;
 
-        // Finally, remove unneeded rowData.indices
-        if(remainCount < nonzeros)
+    auto outputRow = [&](Index row)
+    {
+        auto value = values[row];
+
+        if(!pruned || std::abs(value) > cutoff)
         {
-            if(DEBUG)
-            {
-                qDebug() << "Prune:" << nonzeros - remainCount;
-                qDebug() << "Raw count" << nonzeros;
-                qDebug() << "Remain Count" << remainCount;
-            }
-            for(size_t i = 0UL; i < nonzeros; ++i)
+            if(pruned)
+                value /= mass;
+
+            if(value > EPSILON)
             {
-                if(std::abs(rowData.values[rowData.indices[i]]) <= minValueCutoff)
-                {
-                    rowData.values[rowData.indices[i]] = 0.0f;
-                    rowData.valid[rowData.indices[i]] = false;
-                }
-                else
-                {
-                    // Rescale
-                    rowData.values[rowData.indices[i]] /= rowPruneSum;
-                }
+                // Inflate
+                value = std::pow(value, inflation);
+                sum += value;
+
+                output._rows.push_back(row);
+                output._values.push_back(value);
             }
         }
 
-        if(DEBUG)
-        {
-            qDebug() << columnId << "pruned" << nonzeros - remainCount;
-            qDebug() << rowData.values;
-        }
+        values[row] = 0.0f;
+        valid[row] = false;
+    };
 
-        // Populate new matrix
-        // If sorting is too big just brute force the whole range
-        // If the range is small just do it contiguously
-        const float EPSILON = 1e-8f;
-        if((nonzeros + nonzeros) < (maxIndex - minIndex))
-        {
-            std::sort(rowData.indices.begin(), rowData.indices.begin() + nonzeros);
+    // If the rows are dense enough, scanning their range is cheaper than sorting them
+    auto [minRow, maxRow] = std::minmax_element(indices.begin(), indices.end());
+    if((nonZeros + nonZeros) < static_cast<size_t>(*maxRow - *minRow))
+    {
+        std::sort(indices.begin(), indices.end());
 
-            for(size_t j = 0UL; j<nonzeros; ++j)
-            {
-                const size_t index = rowData.indices[j];
-                if(rowData.values[index] > EPSILON)
-                {
-                    matrixStorage->emplace_back(index, columnId, rowData.values[index]);
-                    rowData.values[index] = 0.0f;
-                }
-                rowData.valid[index] = false;
-            }
-        }
-        else
+        for(auto row : indices)
+            outputRow(row);
+    }
+    else
+    {
+        for(auto row = *minRow; row <= *maxRow; row++)
         {
-            for(size_t j = minIndex; j <= maxIndex; ++j)
-            {
-                if(rowData.values[j] > EPSILON)
-                {
-                    matrixStorage->emplace_back(j, columnId, rowData.values[j]);
-                    rowData.values[j] = 0.0f;
-                }
-                rowData.valid[j] = false;
-            }
+            if(valid[row])
+                outputRow(row);
         }
     }
+
+    const auto end = output._rows.size();
+
+    if(begin == end)
+        return 0.0f;
+
+    // Normalise
+    Q_ASSERT(sum > 0.0f);
+    const float scale = 1.0f / sum;
+    float max = 0.0f;
+    float sumOfSquares = 0.0f;
+
+    for(auto i = begin; i < end; i++)
+    {
+        auto& value = output._values[i];
+        value *= scale;
+
+        max = std::max(max, value);
+        sumOfSquares += value * value;
+    }
+
+    return (max - sumOfSquares) * static_cast<float>(end - begin);
+}
+
+static bool columnsEqual(const MCLMatrix& a, const MCLMatrix& b, size_t column)
+{
+    if(a.nonZeros(column) != b.nonZeros(column))
+        return false;
+
+    auto aBegin = a._offsets[column];
+    auto bBegin = b._offsets[column];
+    auto size = a.nonZeros(column);
+
+    return std::equal(a._rows.begin() + aBegin, a._rows.begin() + aBegin + size, b._rows.begin() + bBegin) &&
+        std::equal(a._values.begin() + aBegin, a._values.begin() + aBegin + size, b._values.begin() + bBegin);
 }
 
 void MCLTransform::apply(TransformedGraph& target) const
@@ -296,117 +301,71 @@ void MCLTransform::apply(TransformedGraph& target) const
         calculateMCL(granularity, target);
 }
 
-template<class MatrixType>
-class ColumnsIterator
-{
-public:
-    class iterator
-    {
-    public:
-        using value_type = size_t;
-        using reference = value_type&;
-        using pointer = value_type*;
-        using iterator_category = std::input_iterator_tag;
-        using difference_type = size_t;
-
-    private:
-        size_t _num = 0;
-
-    public:
-        explicit iterator(size_t num = 0) : _num(num) {}
-        iterator& operator++() { _num = _num + 1; return *this; }
-        iterator operator++(int) { iterator retval = *this; ++(*this); return retval; }
-        bool operator==(iterator other) const { return _num == other._num; }
-        bool operator!=(iterator other) const { return !(*this == other); }
-        value_type operator*() const { return _num; }
-    };
-    MatrixType& matrix;
-    explicit ColumnsIterator(MatrixType& _matrix) : matrix(_matrix) {}
-    iterator begin() { return iterator(0); }
-    iterator end() { return iterator(matrix.columns()); }
-};
-
 void MCLTransform::calculateMCL(float inflation, TransformedGraph& target) const
 {
     target.setPhase(QStringLiteral("MCL Initialising"));
 
-    int nodeCount = target.numNodes();
+    // Matrix indices are the snapshot's dense node indices
+    auto adjacency = target.adjacencySnapshot();
+    const auto nodeCount = adjacency->numNodes();
+
+    MCLMatrix clusterMatrix;
+    clusterMatrix._offsets.reserve(nodeCount + 1);
+    clusterMatrix._rows.reserve((adjacency->numEdges() * 2) + nodeCount);
+    clusterMatrix._offsets.push_back(0);
 
-    // Map NodeIds to Matrix index
-    std::map<NodeId, size_t> nodeToIndexMap;
-    std::map<size_t, NodeId> indexToNodeMap;
-    for(NodeId nodeId : target.nodeIds())
+    // Populate the matrix; each column is the node's neighbours, plus a self loop,
+    // normalised, then pre-inflated with a power of 3 and normalised again
+    std::vector<Index> column;
+    for(Index node = 0; node < nodeCount; node++)
     {
-        auto index = nodeToIndexMap.size();
-        nodeToIndexMap[nodeId] = index;
-        indexToNodeMap[index] = nodeId;
-    }
+        column.assign(adjacency->neighboursOf(node).begin(), adjacency->neighboursOf(node).end());
+        column.push_back(node);
 
-    MatrixType clusterMatrix(nodeCount, nodeCount);
-    blaze::setNumThreads(std::thread::hardware_concurrency());
+        std::sort(column.begin(), column.end());
+        column.erase(std::unique(column.begin(), column.end()), column.end());
 
-    clusterMatrix.reserve((target.numEdges() * 2) + nodeCount);
+        const float value = 1.0f / static_cast<float>(column.size());
+        const float preInflated = std::pow(value, 3.0f);
 
-    // Populate the Matrix
-    for(NodeId nodeId : target.nodeIds())
-    {
-        auto nodeIndex = nodeToIndexMap[nodeId];
-        auto connectedEdgeIds = target.edgeIdsForNodeId(nodeId);
+        float sum = 0.0f;
+        for(size_t i = 0; i < column.size(); i++)
+            sum += preInflated;
+
+        const float normalised = preInflated * (1.0f / sum);
 
-        // Add all connected node indexes to sorted set
-        std::set<size_t> sortNodeIndexes;
-        for(auto connectEdgeId : connectedEdgeIds)
+        if(!(normalised < MCL_PRUNE_LIMIT))
         {
-            auto connectedNodeId = target.edgeById(connectEdgeId).oppositeId(nodeId);
-            sortNodeIndexes.insert(nodeToIndexMap[connectedNodeId]);
+            clusterMatrix._rows.insert(clusterMatrix._rows.end(), column.begin(), column.end());
+            clusterMatrix._values.insert(clusterMatrix._values.end(), column.size(), normalised);
         }
-        // Add self loop
-        sortNodeIndexes.insert(nodeIndex);
 
-        // Append to Compressed Matrix
-        for(auto sortedConnectIndex : sortNodeIndexes)
-            clusterMatrix.append(sortedConnectIndex, nodeIndex, 1.0f);
-
-        // Finalise the row
-        clusterMatrix.finalize(nodeIndex);
-    }
-    clusterMatrix.trim();
-
-    std::stringstream matrixStream;
-    if(_debugMatrices)
-    {
-        matrixStream << clusterMatrix;
-        qDebug().noquote() << QString::fromStdString(matrixStream.str());
+        clusterMatrix._offsets.push_back(clusterMatrix._rows.size());
     }
 
-    // Normalise the columns
-    normaliseColumnsColumnMajor(clusterMatrix);
+    if(_debugIteration)
+        qDebug() << "Pre-prune nnz" << clusterMatrix.nonZeros();
 
-    // Pre-inflation
-    clusterMatrix = pow(clusterMatrix, 3.0f);
+    if(_debugMatrices)
+        debugMatrix(QStringLiteral("Pre-inflated Matrix"), clusterMatrix);
 
-    // Normalise again...
-    normaliseColumnsColumnMajor(clusterMatrix);
+    std::vector<Index> columns(nodeCount);
+    std::iota(columns.begin(), columns.end(), 0);
 
-    if(_debugIteration)
-        qDebug() << "Pre nnz" << clusterMatrix.nonZeros();
+    std::vector<MCLAccumulator> accumulators(std::thread::hardware_concurrency());
+    std::vector<MCLThreadOutput> outputs(accumulators.size());
+    std::vector<MCLColumnLocation> locations(nodeCount);
+    std::vector<float> chaos(nodeCount, 0.0f);
 
-    clusterMatrix.erase([this](float value){ return value < MCL_PRUNE_LIMIT; } );
+    // A column is stable when neither it nor any of the columns it refers to changed
+    // in the last iteration; recomputing it would exactly reproduce it, so it's skipped
+    std::vector<bool> changed(nodeCount, true);
+    std::vector<bool> stable(nodeCount, false);
 
-    if(_debugIteration)
-        qDebug() << "Pre-prune nnz" << clusterMatrix.nonZeros();
-
-    if(_debugMatrices)
-    {
-        matrixStream << "Pre-inflated Matrix \n";
-        matrixStream << clusterMatrix;
-        qDebug().noquote() << QString::fromStdString(matrixStream.str());
-        matrixStream.clear();
-        matrixStream.str(std::string());
-    }
+    MCLMatrix nextMatrix;
 
     // cppcheck-suppress variableScope
-    bool isEquiDistrubuted = true;
+    bool isEquiDistributed = true;
     // Start the MCL loop
     int iter = 0;
     do
@@ -415,44 +374,54 @@ void MCLTransform::calculateMCL(float inflation, TransformedGraph& target) const
             return;
 
         target.setPhase(QStringLiteral("MCL Iteration %1").arg(QString::number(iter + 1)));
-        if(_debugMatrices)
-        {
-            matrixStream << "Pre-Expanded Matrix\n";
-            matrixStream << clusterMatrix;
-            qDebug().noquote() << QString::fromStdString(matrixStream.str());
-            matrixStream.clear();
-            matrixStream.str(std::string());
-        }
-
-        isEquiDistrubuted = true;
 
         if(_debugIteration)
             qDebug() << "Iteration" << iter;
 
-        std::vector<std::vector<SparseMatrixEntry>> matrixStorage(clusterMatrix.rows());
-
         QElapsedTimer threadedTimer;
         if(_debugIteration)
             threadedTimer.start();
 
-        // Threaded expansion
-        ColumnsIterator<MatrixType> colIterator(clusterMatrix);
-
-        // To reduce vector allocations for every row we do some magic with rowData
-        MCLRowData rowData(clusterMatrix.columns());
+        for(auto& output : outputs)
+            output.clear();
 
         std::atomic<uint64_t> iteration(0);
-        const auto totalIterations = clusterMatrix.columns();
         target.setProgress(0);
 
-        // Pass by value rowData, this gives each THREAD a copy of rowData, rather re-allocating vectors per row (slow)
-        concurrent_for(colIterator.begin(), colIterator.end(),
-        [&, rowData, cancelledFn = [this] { return cancelled(); }](const size_t iterator) mutable
+        // Expansion, pruning, inflation and normalisation, all in one pass per column
+        concurrent_for(columns.begin(), columns.end(),
+        [&](Index columnIndex, size_t threadIndex)
         {
-            expandAndPruneRow(clusterMatrix, iterator, &matrixStorage[iterator],
-                rowData, MCL_PRUNE_LIMIT, cancelledFn);
+            if(cancelled())
+                return;
 
-            target.setProgress(static_cast<int>((iteration++ * 100) / totalIterations));
+            auto& output = outputs.at(threadIndex);
+            auto& location = locations[columnIndex];
+            location._thread = threadIndex;
+            location._offset = output._rows.size();
+
+            if(stable[columnIndex])
+            {
+                auto begin = clusterMatrix._offsets[columnIndex];
+                auto end = clusterMatrix._offsets[columnIndex + 1];
+
+                output._rows.insert(output._rows.end(),
+                    clusterMatrix._rows.begin() + begin, clusterMatrix._rows.begin() + end);
+                output._values.insert(output._values.end(),
+                    clusterMatrix._values.begin() + begin, clusterMatrix._values.begin() + end);
+            }
+            else
+            {
+                auto& accumulator = accumulators.at(threadIndex);
+                accumulator.resize(nodeCount);
+
+                chaos[columnIndex] = expandColumn(clusterMatrix, columnIndex,
+                    inflation, MCL_PRUNE_LIMIT, accumulator, output);
+            }
+
+            location._size = output._rows.size() - location._offset;
+
+            target.setProgress(static_cast<int>((iteration++ * 100) / nodeCount));
         });
 
         target.setProgress(-1);
@@ -460,88 +429,66 @@ void MCLTransform::calculateMCL(float inflation, TransformedGraph& target) const
         if(cancelled())
             return;
 
-        size_t newNNZCount = 0;
-        for(const auto& column : matrixStorage)
-            newNNZCount += column.size();
+        // Gather the columns from each thread into the next matrix
+        nextMatrix._offsets.resize(nodeCount + 1);
+        nextMatrix._offsets[0] = 0;
+        for(size_t columnIndex = 0; columnIndex < nodeCount; columnIndex++)
+            nextMatrix._offsets[columnIndex + 1] = nextMatrix._offsets[columnIndex] + locations[columnIndex]._size;
 
-        MatrixType dstMatrix(clusterMatrix.rows(), clusterMatrix.rows());
-        dstMatrix.reserve(newNNZCount);
-        int row = 0;
-        for(const auto& matrixRow : matrixStorage)
-        {
-            for(auto matrixEntry: matrixRow)
-                dstMatrix.append(matrixEntry._row, matrixEntry._column, matrixEntry._value);
+        nextMatrix._rows.resize(nextMatrix._offsets.back());
+        nextMatrix._values.resize(nextMatrix._offsets.back());
 
-            dstMatrix.finalize(row);
-            row++;
-        }
-        clusterMatrix = dstMatrix;
-
-        if(_debugIteration)
+        concurrent_for(columns.begin(), columns.end(),
+        [&](Index columnIndex)
         {
-            int populationTime = threadedTimer.restart();
-            qDebug() << "Threaded Expansion Population time LL ms" << populationTime;
+            const auto& location = locations[columnIndex];
+            const auto& output = outputs.at(location._thread);
+            auto offset = static_cast<std::ptrdiff_t>(location._offset);
+            auto size = static_cast<std::ptrdiff_t>(location._size);
+            auto destination = static_cast<std::ptrdiff_t>(nextMatrix._offsets[columnIndex]);
+
+            std::copy(output._rows.begin() + offset, output._rows.begin() + offset + size,
+                nextMatrix._rows.begin() + destination);
+            std::copy(output._values.begin() + offset, output._values.begin() + offset + size,
+                nextMatrix._values.begin() + destination);
+        });
 
-            qDebug() << "Expand nnz" << clusterMatrix.nonZeros();
-        }
+        // Determine which columns will be stable in the next iteration
+        for(size_t columnIndex = 0; columnIndex < nodeCount; columnIndex++)
+            changed[columnIndex] = !stable[columnIndex] && !columnsEqual(clusterMatrix, nextMatrix, columnIndex);
 
-        if(_debugMatrices)
+        for(size_t columnIndex = 0; columnIndex < nodeCount; columnIndex++)
         {
-            matrixStream << "Expanded Matrix \n";
-            matrixStream << clusterMatrix;
-            qDebug().noquote() << QString::fromStdString(matrixStream.str());
-            matrixStream.clear();
-            matrixStream.str(std::string());
+            auto begin = nextMatrix._rows.begin() + static_cast<std::ptrdiff_t>(nextMatrix._offsets[columnIndex]);
+            auto end = nextMatrix._rows.begin() + static_cast<std::ptrdiff_t>(nextMatrix._offsets[columnIndex + 1]);
+
+            stable[columnIndex] = !changed[columnIndex] &&
+                std::none_of(begin, end, [&changed](Index row) { return changed[row]; });
         }
 
-        // Inflate the matrix
-        clusterMatrix = blaze::forEach(clusterMatrix, [&inflation](float d)
-            { return std::pow(d, inflation); });
+        std::swap(clusterMatrix, nextMatrix);
 
-        if(_debugMatrices)
+        if(_debugIteration)
         {
-            matrixStream << "Inflated Expanded Matrix \n";
-            matrixStream << clusterMatrix;
-            qDebug().noquote() << QString::fromStdString(matrixStream.str());
-            matrixStream.clear();
-            matrixStream.str(std::string());
-            qDebug() << "Inflated Expanded nnz" << clusterMatrix.nonZeros();
+            qDebug() << "Threaded Expansion time ms" << threadedTimer.restart();
+            qDebug() << "Expand nnz" << clusterMatrix.nonZeros();
         }
 
-        // Normalise
-        normaliseColumnsColumnMajor(clusterMatrix);
-
         if(_debugMatrices)
-        {
-            matrixStream << "Normalised Inflated Expanded Matrix \n";
-            matrixStream << clusterMatrix;
-            qDebug().noquote() << QString::fromStdString(matrixStream.str());
-            matrixStream.clear();
-            matrixStream.str(std::string());
-            qDebug() << "Normalise nnz" << clusterMatrix.nonZeros();
-        }
+            debugMatrix(QStringLiteral("Normalised Inflated Expanded Matrix"), clusterMatrix);
 
         // Check if matrix is idempotent
-        MatrixType sqClusterMatrix = blaze::forEach(clusterMatrix, [](float d) { return d * d; });
-        VectorType colSum(nodeCount, 0);
+        isEquiDistributed = std::all_of(chaos.begin(), chaos.end(),
+            [this](float columnChaos) { return !(columnChaos > MCL_CONVERGENCE_LIMIT); });
 
-        sumColumns(sqClusterMatrix, colSum);
-        for(size_t k=0; k<clusterMatrix.columns(); ++k)
+        if(_debugIteration)
         {
-            float max = 0;
-            for(MatrixType::ConstIterator it=clusterMatrix.cbegin(k); it!=clusterMatrix.cend(k); ++it )
-                max = std::max(it->value(),max);
-            if((max - colSum[k]) * clusterMatrix.nonZeros(k) > MCL_CONVERGENCE_LIMIT)
-            {
-                if(_debugIteration)
-                    qDebug() << "No Converge" << (max - colSum[k]) * clusterMatrix.nonZeros(k);
-                isEquiDistrubuted = false;
-                break;
-            }
+            qDebug() << "Max chaos" << *std::max_element(chaos.begin(), chaos.end()) <<
+                "stable columns" << std::count(stable.begin(), stable.end(), true);
         }
 
         iter++;
-    } while(!isEquiDistrubuted);
+    } while(!isEquiDistributed);
 
     if(_debugIteration)
         qDebug() << iter << "iterations";
@@ -552,30 +499,32 @@ void MCLTransform::calculateMCL(float inflation, TransformedGraph& target) const
     std::vector<std::set<size_t>> clusters;
     std::vector<size_t> clusterGroups(nodeCount, 0);
     std::vector<bool> clusterGroupAssigned(nodeCount, false);
-    for(size_t k = 0; k < clusterMatrix.columns(); ++k)
+    for(size_t k = 0; k < clusterMatrix.numColumns(); ++k)
     {
-        for(const auto* it = clusterMatrix.cbegin(k); it != clusterMatrix.cend(k); ++it )
+        for(auto i = clusterMatrix._offsets[k]; i < clusterMatrix._offsets[k + 1]; i++)
         {
-            if(it->value() < MCL_PRUNE_LIMIT)
+            const size_t index = clusterMatrix._rows[i];
+
+            if(clusterMatrix._values[i] < MCL_PRUNE_LIMIT)
                 continue;
 
-            auto rowCluster = clusterGroups[it->index()];
+            auto rowCluster = clusterGroups[index];
             auto columnCluster = clusterGroups[k];
-            auto rowClusterAssigned = clusterGroupAssigned[it->index()];
+            auto rowClusterAssigned = clusterGroupAssigned[index];
             auto columnClusterAssigned = clusterGroupAssigned[k];
 
             // If no cluster exists, make one
             if(!rowClusterAssigned && !columnClusterAssigned)
             {
                 std::set<size_t> newClusterNodeIndex;
-                newClusterNodeIndex.insert(it->index());
+                newClusterNodeIndex.insert(index);
                 newClusterNodeIndex.insert(k);
                 clusters.emplace_back(std::move(newClusterNodeIndex));
 
-                auto index = clusters.size() - 1;
-                clusterGroups[it->index()] = index;
-                clusterGroups[k] = index;
-                clusterGroupAssigned[it->index()] = true;
+                auto clusterIndex = clusters.size() - 1;
+                clusterGroups[index] = clusterIndex;
+                clusterGroups[k] = clusterIndex;
+                clusterGroupAssigned[index] = true;
                 clusterGroupAssigned[k] = true;
             }
             else if(rowClusterAssigned)
@@ -600,9 +549,9 @@ void MCLTransform::calculateMCL(float inflation, TransformedGraph& target) const
             else if(columnClusterAssigned)
             {
                 // Add to Column Cluster
-                clusterGroups[it->index()] = columnCluster;
-                clusterGroupAssigned[it->index()] = true;
-                clusters[columnCluster].insert(it->index());
+                clusterGroups[index] = columnCluster;
+                clusterGroupAssigned[index] = true;
+                clusters[columnCluster].insert(index);
             }
         }
     }
@@ -624,7 +573,7 @@ void MCLTransform::calculateMCL(float inflation, TransformedGraph& target) const
 
         for(auto index : cluster)
         {
-            auto nodeId = indexToNodeMap.at(index);
+            auto nodeId = adjacency->nodeIdOf(static_cast<Index>(index));
             auto clusterName = QString(QObject::tr("Cluster %1")).arg(QString::number(clusterNumber));
 
             clusterNames[nodeId] = clusterName;
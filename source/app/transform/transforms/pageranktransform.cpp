@@ -20,18 +20,38 @@
 
 #include "transform/transformedgraph.h"
 
-#include "graph/graphcomponent.h"
 #include "graph/graphmodel.h"
-#include "graph/componentmanager.h"
+#include "graph/adjacencysnapshot.h"
 
-#include <blaze/Blaze.h>
+#include "shared/utils/threadpool.h"
 
 #include <QElapsedTimer>
 #include <QDebug>
 
-#include <map>
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <vector>
 
-using VectorType = blaze::DynamicVector<float>;
+namespace
+{
+using Index = AdjacencySnapshot::Index;
+
+struct Component
+{
+    std::vector<Index> _nodes;
+    uint64_t _cost = 0;
+
+    uint64_t computeCostHint() const { return _cost; }
+};
+
+struct Convergence
+{
+    int _iterations = 0;
+    float _residual = 0.0f;
+};
+} // namespace
 
 void PageRankTransform::apply(TransformedGraph& target) const
 {
@@ -44,37 +64,76 @@ void PageRankTransform::calculatePageRank(TransformedGraph& target) const
     // not use a matrix. This dramatically lowers the memory footprint.
     // http://www.dcs.bbk.ac.uk/~dell/teaching/cc/book/mmds/mmds_ch5_2.pdf
     // http://michaelnielsen.org/blog/using-your-laptop-to-compute-pagerank-for-millions-of-webpages/
-    NodeArray<float> pageRankScores(target);
 
     target.setPhase(QStringLiteral("PageRank"));
 
-    // We must do our own componentisation as the graph's set of components
-    // won't necessarily be up-to-date
-    ComponentManager componentManager(target);
+    auto adjacency = target.adjacencySnapshot();
+    const auto numNodes = adjacency->numNodes();
+
+    // The graph's components won't necessarily be up-to-date, and in any
+    // case they're not expressed in terms of the snapshot's indices
+    std::vector<Component> components;
+    std::vector<bool> visited(numNodes, false);
+
+    for(Index root = 0; root < numNodes; root++)
+    {
+        if(visited[root])
+            continue;
 
-    int totalIterationCount = 0;
-    for(auto componentId : componentManager.componentIds())
-    {        
-        const IGraphComponent* component = componentManager.componentById(componentId);
-        auto componentNodeCount = static_cast<int>(component->nodeIds().size());
+        Component component;
+        component._nodes.push_back(root);
+        visited[root] = true;
 
-        // Map NodeIds to Matrix index
-        std::map<NodeId, int> nodeToIndexMap;
-        std::map<int, NodeId> indexToNodeMap;
-        for(auto nodeId : component->nodeIds())
+        for(size_t head = 0; head < component._nodes.size(); head++)
         {
-            auto index = static_cast<int>(nodeToIndexMap.size());
-            nodeToIndexMap[nodeId] = index;
-            indexToNodeMap[index] = nodeId;
+            auto node = component._nodes[head];
+            component._cost += 1 + adjacency->degreeOf(node);
+
+            for(auto neighbour : adjacency->neighboursOf(node))
+            {
+                if(!visited[neighbour])
+                {
+                    visited[neighbour] = true;
+                    component._nodes.push_back(neighbour);
+                }
+            }
         }
 
-        QElapsedTimer timer;
-        if (_debug)
-            timer.start();
+        components.emplace_back(std::move(component));
+    }
+
+    std::vector<float> inverseDegrees(numNodes, 0.0f);
+    for(Index node = 0; node < numNodes; node++)
+    {
+        auto degree = adjacency->degreeOf(node);
+        if(degree > 0)
+            inverseDegrees[node] = 1.0f / static_cast<float>(degree);
+    }
+
+    // Components are disjoint, so they can all share these
+    std::vector<float> pageRank(numNodes);
+    std::vector<float> newPageRank(numNodes);
+    std::vector<float> contributions(numNodes);
+
+    auto iterate = [&](const Component& component, bool parallel)
+    {
+        const auto& nodes = component._nodes;
+        const auto componentNodeCount = static_cast<float>(nodes.size());
+        const auto teleport = (1.0f - PAGERANK_DAMPING) / componentNodeCount;
+
+        for(auto node : nodes)
+            pageRank[node] = 1.0f / componentNodeCount;
+
+        // Pull based; each node sums the contributions of its neighbours
+        auto computeRow = [&](Index node)
+        {
+            float prSum = 0.0f;
+            for(auto neighbour : adjacency->neighboursOf(node))
+                prSum += contributions[neighbour];
+
+            newPageRank[node] = (prSum * PAGERANK_DAMPING) + teleport;
+        };
 
-        VectorType pageRankVector(componentNodeCount, 1.0f / componentNodeCount);
-        VectorType newPageRankVector(componentNodeCount);
-        VectorType delta(componentNodeCount);
         float change = std::numeric_limits<float>::max();
         int iterationCount = 0;
         std::deque<float> changeBuffer;
@@ -85,37 +144,35 @@ void PageRankTransform::calculatePageRank(TransformedGraph& target) const
               pagerankAcceleration > PAGERANK_ACCELERATION_MINIMUM)
         {
             if(cancelled())
-                return;
-
-            target.setPhase(QStringLiteral("PageRank Iteration %1").arg(
-                                QString::number(totalIterationCount + 1)));
+                break;
 
-            // Calculate pagerank
-            for(auto nodeId : component->nodeIds())
+            if(parallel)
             {
-                auto matrixId = nodeToIndexMap[nodeId];
-                float prSum = 0.0f;
-                for(auto edgeId : target.edgeIdsForNodeId(nodeId))
-                {
-                    auto oppositeNodeId = target.edgeById(edgeId).oppositeId(nodeId);
-                    prSum += pageRankVector[nodeToIndexMap[oppositeNodeId]] /
-                        static_cast<float>(target.nodeById(oppositeNodeId).degree());
-                }
-                 newPageRankVector[matrixId] = (prSum * PAGERANK_DAMPING) +
-                         ((1.0f - PAGERANK_DAMPING) / componentNodeCount);
+                target.setPhase(QStringLiteral("PageRank Iteration %1").arg(
+                    QString::number(iterationCount + 1)));
             }
 
+            for(auto node : nodes)
+                contributions[node] = pageRank[node] * inverseDegrees[node];
+
+            if(parallel)
+                concurrent_for(nodes.begin(), nodes.end(), computeRow);
+            else
+                std::for_each(nodes.begin(), nodes.end(), computeRow);
+
             // Normalise result
             float sum = 0.0f;
-            for(auto value : newPageRankVector)
-                sum += value;
-             newPageRankVector = newPageRankVector / sum;
+            for(auto node : nodes)
+                sum += newPageRank[node];
 
             // Detect PR Change
             change = 0.0f;
-            delta = blaze::abs(newPageRankVector - pageRankVector);
-            for(size_t i = 0UL; i < newPageRankVector.size(); ++i )
-                change += delta[i];
+            for(auto node : nodes)
+            {
+                auto value = newPageRank[node] / sum;
+                change += std::abs(value - pageRank[node]);
+                pageRank[node] = value;
+            }
 
             // Oscillation detection (delta avg)
             changeBuffer.push_front(change);
@@ -134,31 +191,78 @@ void PageRankTransform::calculatePageRank(TransformedGraph& target) const
             if(iterationCount % AVG_COUNT == 0)
                 previousBufferChangeAverage = bufferChangeAverage;
 
-            pageRankVector = newPageRankVector;
             iterationCount++;
-            totalIterationCount++;
         }
-        if(_debug && iterationCount == PAGERANK_ITERATION_LIMIT)
-            qDebug() << "HIT ITERATION LIMIT ON PAGERANK. LIKELY UNSTABLE PAGERANK VECTOR";
 
-        float maxValue = blaze::max(blaze::abs(pageRankVector) );
-        pageRankVector = pageRankVector / maxValue;
+        float maxValue = 0.0f;
+        for(auto node : nodes)
+            maxValue = std::max(maxValue, std::abs(pageRank[node]));
 
-        for(auto nodeId : component->nodeIds())
-            pageRankScores[nodeId] = pageRankVector[nodeToIndexMap[nodeId]];
+        for(auto node : nodes)
+            pageRank[node] /= maxValue;
 
-        if (_debug)
-        {
-            std::stringstream matrixStream;
-            matrixStream << pageRankVector;
-            qDebug() << "PageRank";
-            qDebug().noquote() << QString::fromStdString(matrixStream.str());
+        return Convergence{iterationCount, change};
+    };
 
-            qDebug() << "Pagerank took" << iterationCount << "iterations";
-            qDebug() << "The efficient pagerank operation took" << timer.elapsed();
-        }
+    QElapsedTimer timer;
+    if(_debug)
+        timer.start();
+
+    // Large components are iterated one at a time, parallelising each iteration,
+    // whereas small components are too small for that to be worthwhile, so
+    // instead they are iterated in parallel with each other
+    const size_t largeComponentThreshold = 4096;
+
+    auto smallComponentsBegin = std::partition(components.begin(), components.end(),
+        [largeComponentThreshold](const auto& component)
+        { return component._nodes.size() >= largeComponentThreshold; });
+
+    std::vector<Convergence> convergences;
+
+    for(auto it = components.begin(); it != smallComponentsBegin; ++it)
+        convergences.push_back(iterate(*it, true));
+
+    if(smallComponentsBegin != components.end())
+    {
+        target.setPhase(QStringLiteral("PageRank"));
+
+        auto results = concurrent_for(smallComponentsBegin, components.end(),
+            [&iterate](const Component& component) { return iterate(component, false); });
+        convergences.insert(convergences.end(), results.begin(), results.end());
+    }
+
+    if(cancelled())
+        return;
+
+    Convergence worst;
+    for(const auto& convergence : convergences)
+    {
+        worst._iterations = std::max(worst._iterations, convergence._iterations);
+        worst._residual = std::max(worst._residual, convergence._residual);
+    }
+
+    if(worst._iterations >= PAGERANK_ITERATION_LIMIT)
+    {
+        addAlert(AlertType::Warning, QObject::tr("Did not converge within %1 iterations (residual %2)")
+            .arg(worst._iterations).arg(static_cast<double>(worst._residual), 0, 'g', 3));
+    }
+    else
+    {
+        addAlert(AlertType::Info, QObject::tr("Converged after %1 iterations (residual %2)")
+            .arg(worst._iterations).arg(static_cast<double>(worst._residual), 0, 'g', 3));
+    }
+
+    if(_debug)
+    {
+        qDebug() << "PageRank took" << worst._iterations << "iterations, over" <<
+            components.size() << "components";
+        qDebug() << "The efficient pagerank operation took" << timer.elapsed();
     }
 
+    NodeArray<float> pageRankScores(target);
+    for(Index node = 0; node < numNodes; node++)
+        pageRankScores[adjacency->nodeIdOf(node)] = pageRank[node];
+
     _graphModel->createAttribute(QObject::tr("Node PageRank"))
         .setDescription(QObject::tr("A node's PageRank is a measure of relative importance in the graph."))
         .floatRange().setMin(0.0f)
@@ -30,6 +30,7 @@
 DEFINE_QML_ENUM(
     Q_GADGET, AlertType,
     None,
+    Info,
     Warning,
     Error);
 
@@ -37,7 +37,7 @@
 #include "loading/nativesaver.h"
 #include "loading/isaver.h"
 
-#include "layout/forcedirectedlayout.h"
+#include "layout/multilevellayout.h"
 #include "layout/layout.h"
 #include "layout/collision.h"
 
@@ -769,7 +769,7 @@ void Document::onLoadComplete(const QUrl&, bool success)
     if(!_bookmarks.empty())
         emit bookmarksChanged();
 
-    _layoutThread = std::make_unique<LayoutThread>(*_graphModel, std::make_unique<ForceDirectedLayoutFactory>(_graphModel.get()));
+    _layoutThread = std::make_unique<LayoutThread>(*_graphModel, std::make_unique<MultilevelLayoutFactory>(_graphModel.get()));
 
     for(const auto& layoutSetting : _loadedLayoutSettings)
         _layoutThread->setSettingValue(layoutSetting._name, layoutSetting._value);
@@ -40,6 +40,7 @@ Item
             switch(root.type)
             {
             case "error": return "error.png";
+            case "info": return "info.png";
             default:
             case "warning": return "warning.png";
             }
@@ -268,6 +268,12 @@ Item
             alertIcon.visible = true;
             break;
 
+        case AlertType.Info:
+            alertIcon.type = "info";
+            alertIcon.text = transformInfo.alertText;
+            alertIcon.visible = true;
+            break;
+
         default:
         case AlertType.None:
             alertIcon.visible = false;
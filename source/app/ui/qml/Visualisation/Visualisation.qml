@@ -613,6 +613,12 @@ Item
             alertIcon.visible = true;
             break;
 
+        case AlertType.Info:
+            alertIcon.type = "info";
+            alertIcon.text = visualisationInfo.alertText;
+            alertIcon.visible = true;
+            break;
+
         default:
         case AlertType.None:
             alertIcon.visible = false;
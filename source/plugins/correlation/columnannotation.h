@@ -20,6 +20,7 @@
 #define COLUMNANNOTATION_H
 
 #include <QString>
+#include <QStringList>
 
 #include <vector>
 #include <map>
@@ -33,7 +34,7 @@ private:
     std::map<QString, int> _uniqueValues;
 
 public:
-    using Iterator = std::vector<QString>::const_iterator;
+    using Iterator = QStringList::const_iterator;
 
     ColumnAnnotation(QString name, std::vector<QString> values);
     ColumnAnnotation(QString name, const Iterator& begin, const Iterator& end);
@@ -18,14 +18,145 @@
 
 #include "correlation.h"
 
-std::unique_ptr<Correlation> Correlation::create(CorrelationType correlationType)
+#include <algorithm>
+#include <functional>
+
+std::unique_ptr<Correlation> Correlation::create(CorrelationType correlationType,
+    CorrelationPrecision precision)
 {
+    std::unique_ptr<Correlation> correlation;
+
     switch(correlationType)
     {
-    case CorrelationType::Pearson:      return std::make_unique<PearsonCorrelation>();
-    case CorrelationType::SpearmanRank: return std::make_unique<SpearmanRankCorrelation>();
+    case CorrelationType::Pearson:      correlation = std::make_unique<PearsonCorrelation>(); break;
+    case CorrelationType::SpearmanRank: correlation = std::make_unique<SpearmanRankCorrelation>(); break;
     default: break;
     }
 
-    return nullptr;
+    if(correlation != nullptr)
+        correlation->setPrecision(precision);
+
+    return correlation;
+}
+
+CorrelationNearestNeighbours::CorrelationNearestNeighbours(size_t numRows, size_t k,
+    double minimumThreshold, CorrelationPolarity polarity) :
+    _k(k), _minimumThreshold(minimumThreshold), _polarity(polarity),
+    _neighbours(numRows), _mutexes((numRows + RowsPerMutex - 1) / RowsPerMutex)
+{
+    for(auto& neighbours : _neighbours)
+        neighbours.reserve(_k);
+}
+
+double CorrelationNearestNeighbours::rankOf(double r) const
+{
+    switch(_polarity)
+    {
+    default:
+    case CorrelationPolarity::Positive: return r;
+    case CorrelationPolarity::Negative: return -r;
+    case CorrelationPolarity::Both:     return std::abs(r);
+    }
+}
+
+void CorrelationNearestNeighbours::addNeighbour(size_t row, size_t neighbour, double r)
+{
+    auto& neighbours = _neighbours[row];
+    Neighbour candidate{neighbour, r, rankOf(r)};
+
+    if(neighbours.size() < _k)
+    {
+        neighbours.push_back(candidate);
+        std::push_heap(neighbours.begin(), neighbours.end(), std::greater<>());
+    }
+    else if(candidate > neighbours.front())
+    {
+        std::pop_heap(neighbours.begin(), neighbours.end(), std::greater<>());
+        neighbours.back() = candidate;
+        std::push_heap(neighbours.begin(), neighbours.end(), std::greater<>());
+    }
+}
+
+void CorrelationNearestNeighbours::add(const CorrelationTile& tile)
+{
+    // Rows of the tile...
+    {
+        auto firstMutex = tile._rowBegin / RowsPerMutex;
+        auto lastMutex = (tile._rowBegin + tile._numRows - 1) / RowsPerMutex;
+
+        for(auto m = firstMutex; m <= lastMutex; m++)
+            _mutexes[m].lock();
+
+        for(size_t i = 0; i < tile._numRows; i++)
+        {
+            for(size_t j = tile.firstColumnFor(i); j < tile._numColumns; j++)
+            {
+                double r = tile.valueAt(i, j);
+
+                if(correlationPassesThreshold(r, _minimumThreshold, _polarity))
+                    addNeighbour(tile._rowBegin + i, tile._columnBegin + j, r);
+            }
+        }
+
+        for(auto m = firstMutex; m <= lastMutex; m++)
+            _mutexes[m].unlock();
+    }
+
+    // ...and its columns, which are also rows, since the matrix is symmetric
+    {
+        auto firstMutex = tile._columnBegin / RowsPerMutex;
+        auto lastMutex = (tile._columnBegin + tile._numColumns - 1) / RowsPerMutex;
+
+        for(auto m = firstMutex; m <= lastMutex; m++)
+            _mutexes[m].lock();
+
+        for(size_t i = 0; i < tile._numRows; i++)
+        {
+            for(size_t j = tile.firstColumnFor(i); j < tile._numColumns; j++)
+            {
+                double r = tile.valueAt(i, j);
+
+                if(correlationPassesThreshold(r, _minimumThreshold, _polarity))
+                    addNeighbour(tile._columnBegin + j, tile._rowBegin + i, r);
+            }
+        }
+
+        for(auto m = firstMutex; m <= lastMutex; m++)
+            _mutexes[m].unlock();
+    }
+}
+
+EdgeList CorrelationNearestNeighbours::edges(const std::vector<CorrelationDataRow>& rows)
+{
+    Q_ASSERT(rows.size() == _neighbours.size());
+
+    auto byIndex = [](const auto& a, const auto& b) { return a._index < b._index; };
+
+    for(auto& neighbours : _neighbours)
+        std::sort(neighbours.begin(), neighbours.end(), byIndex);
+
+    EdgeList edges;
+
+    for(size_t row = 0; row < _neighbours.size(); row++)
+    {
+        for(const auto& neighbour : _neighbours[row])
+        {
+            // If the relationship is mutual, only emit it from the lower indexed row
+            if(neighbour._index < row)
+            {
+                const auto& reverseNeighbours = _neighbours[neighbour._index];
+                if(std::binary_search(reverseNeighbours.begin(), reverseNeighbours.end(),
+                    Neighbour{row, 0.0, 0.0}, byIndex))
+                {
+                    continue;
+                }
+            }
+
+            edges.push_back({rows[row].nodeId(), rows[neighbour._index].nodeId(), neighbour._r});
+        }
+    }
+
+    _neighbours.clear();
+
+    return edges;
 }
@@ -20,6 +20,7 @@
 #define CORRELATION_H
 
 #include "correlationdatarow.h"
+#include "correlationkernel.h"
 
 #include "shared/utils/qmlenum.h"
 #include "shared/utils/progressable.h"
@@ -29,8 +30,15 @@
 
 #include "shared/graph/edgelist.h"
 
+#include "shared/loading/graphsizeestimate.h"
+
 #include <vector>
 #include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <type_traits>
 
 #include <QObject>
 #include <QString>
@@ -49,19 +57,121 @@ DEFINE_QML_ENUM(
     Negative,
     Both);
 
+DEFINE_QML_ENUM(
+    Q_GADGET, CorrelationPrecision,
+    Double,
+    Single);
+
+inline bool correlationPassesThreshold(double r, double minimumThreshold, CorrelationPolarity polarity)
+{
+    if(!std::isfinite(r))
+        return false;
+
+    switch(polarity)
+    {
+    default:
+    case CorrelationPolarity::Positive: return r >= minimumThreshold;
+    case CorrelationPolarity::Negative: return r <= -minimumThreshold;
+    case CorrelationPolarity::Both:     return std::abs(r) >= minimumThreshold;
+    }
+}
+
+// A rectangular section of the correlation matrix
+struct CorrelationTile
+{
+    size_t _rowBegin = 0;
+    size_t _columnBegin = 0;
+    size_t _numRows = 0;
+    size_t _numColumns = 0;
+
+    // When a tile lies on the diagonal of the matrix, only its upper triangle is valid
+    bool _diagonal = false;
+
+    const double* _values = nullptr;
+
+    double valueAt(size_t row, size_t column) const { return _values[(row * _numColumns) + column]; }
+    size_t firstColumnFor(size_t row) const { return _diagonal ? row + 1 : 0; }
+};
+
+// Retains, for each row, only the k rows it correlates most strongly with, such that
+// the memory required is proportional to the number of rows rather than its square
+class CorrelationNearestNeighbours
+{
+private:
+    struct Neighbour
+    {
+        size_t _index = 0;
+        double _r = 0.0;
+        double _rank = 0.0;
+
+        bool operator>(const Neighbour& other) const
+        {
+            // Ties are broken on index so that the result is deterministic
+            if(_rank != other._rank)
+                return _rank > other._rank;
+
+            return _index < other._index;
+        }
+    };
+
+    size_t _k = 0;
+    double _minimumThreshold = 0.0;
+    CorrelationPolarity _polarity = CorrelationPolarity::Positive;
+
+    // Each is a min-heap on _rank, so the front is the first to be displaced
+    std::vector<std::vector<Neighbour>> _neighbours;
+
+    // Rows are locked in groups, to keep the number of mutexes reasonable
+    static constexpr size_t RowsPerMutex = 64;
+    std::vector<std::mutex> _mutexes;
+
+    double rankOf(double r) const;
+    void addNeighbour(size_t row, size_t neighbour, double r);
+
+public:
+    CorrelationNearestNeighbours(size_t numRows, size_t k,
+        double minimumThreshold, CorrelationPolarity polarity);
+
+    // May be called concurrently
+    void add(const CorrelationTile& tile);
+
+    // Edges are created between each row and its nearest neighbours; the neighbour
+    // relationship isn't symmetric, but each resultant edge appears only once
+    EdgeList edges(const std::vector<CorrelationDataRow>& rows);
+};
+
 class Correlation
 {
+protected:
+    CorrelationPrecision _precision = CorrelationPrecision::Double;
+    size_t _maximumEdgesPerNode = 0;
+
 public:
     virtual ~Correlation() = default;
 
+    void setPrecision(CorrelationPrecision precision) { _precision = precision; }
+
+    // When non-zero, rather than creating an edge for every pair of rows that meets
+    // the threshold, only create edges to each row's k most strongly correlated rows
+    void setMaximumEdgesPerNode(size_t maximumEdgesPerNode) { _maximumEdgesPerNode = maximumEdgesPerNode; }
+
     virtual EdgeList process(const std::vector<CorrelationDataRow>& rows,
         double minimumThreshold, CorrelationPolarity polarity = CorrelationPolarity::Positive,
         Cancellable* cancellable = nullptr, Progressable* progressable = nullptr) const = 0;
 
+    // Bins the correlation value of every pair of rows that has the given polarity;
+    // unlike process, this is independent of any threshold, so it can be reused to
+    // estimate the size of the resultant graph as the threshold changes; if a maximum
+    // number of edges per node is set, that many of each row's strongest values are kept
+    virtual GraphSizeEstimateHistogram histogram(const std::vector<CorrelationDataRow>& rows,
+        CorrelationPolarity polarity = CorrelationPolarity::Positive,
+        Cancellable* cancellable = nullptr) const = 0;
+
     virtual QString attributeName() const = 0;
     virtual QString attributeDescription() const = 0;
 
-    static std::unique_ptr<Correlation> create(CorrelationType correlationType);
+    static std::unique_ptr<Correlation> create(CorrelationType correlationType,
+        CorrelationPrecision precision = CorrelationPrecision::Double);
 };
 
 enum class RowType
@@ -73,74 +183,165 @@ enum class RowType
 template<typename Algorithm, RowType rowType = RowType::Raw>
 class CovarianceCorrelation : public Correlation
 {
-public:
-    EdgeList process(const std::vector<CorrelationDataRow>& rows,
-        double minimumThreshold, CorrelationPolarity polarity = CorrelationPolarity::Positive,
-        Cancellable* cancellable = nullptr, Progressable* progressable = nullptr) const final
+private:
+    // Approximate size of a block of prepared rows; two blocks and the resultant tile
+    // should comfortably fit in a typical L2 cache
+    static constexpr size_t BlockSizeBytes = 96 * 1024;
+    static constexpr size_t MinimumBlockRows = 8;
+    static constexpr size_t MaximumBlockRows = 128;
+
+    // Each row is transformed such that the correlation value of any pair of rows
+    // is simply the dot product of the two, then stored contiguously with padding
+    template<typename Scalar>
+    struct PreparedRows
     {
-        if(rows.empty())
-            return {};
+        size_t _stride = 0;
+        CorrelationKernel::Matrix<Scalar> _values;
 
-        size_t numColumns = std::distance(rows.front().begin(), rows.front().end());
+        const Scalar* row(size_t index) const { return _values.data() + (index * _stride); }
+    };
 
-        if(progressable != nullptr)
-            progressable->setProgress(-1);
+    struct Tile
+    {
+        size_t _rowBlock = 0;
+        size_t _columnBlock = 0;
+        uint64_t _cost = 0;
 
-        uint64_t totalCost = 0;
-        for(const auto& row : rows)
+        uint64_t computeCostHint() const { return _cost; }
+    };
+
+    template<typename Scalar>
+    static PreparedRows<Scalar> prepare(const std::vector<CorrelationDataRow>& rows, size_t numColumns)
+    {
+        PreparedRows<Scalar> preparedRows;
+        preparedRows._stride = CorrelationKernel::paddedStride(numColumns);
+        preparedRows._values.resize(rows.size() * preparedRows._stride, Scalar(0));
+
+        ThreadPool(QStringLiteral("CorrelationPrep")).concurrent_for(rows.begin(), rows.end(),
+        [&](std::vector<CorrelationDataRow>::const_iterator rowIt)
         {
-            totalCost += row.computeCostHint();
+            const auto* row = &(*rowIt);
 
             if constexpr(rowType == RowType::Ranking)
-                row.generateRanking();
-        }
+                row = row->ranking();
 
-        std::atomic<uint64_t> cost(0);
+            auto index = static_cast<size_t>(std::distance(rows.begin(), rowIt));
+            Algorithm::prepare(numColumns, row, &preparedRows._values.at(index * preparedRows._stride));
+        });
 
-        auto results = ThreadPool(QStringLiteral("Correlation")).concurrent_for(rows.begin(), rows.end(),
-        [&](std::vector<CorrelationDataRow>::const_iterator rowAIt)
-        {
-            const auto* rowA = &(*rowAIt);
+        return preparedRows;
+    }
 
-            if constexpr(rowType == RowType::Ranking)
-                rowA = rowA->ranking();
+    template<typename Scalar>
+    static size_t blockRowsFor(size_t stride)
+    {
+        auto blockRows = BlockSizeBytes / (stride * sizeof(Scalar));
+        blockRows = std::clamp(blockRows, MinimumBlockRows, MaximumBlockRows);
 
-            EdgeList edges;
+        // Keep the blocks a multiple of the micro-kernel size
+        return blockRows - (blockRows % 4);
+    }
 
-            if(cancellable != nullptr && cancellable->cancelled())
-                return edges;
+    // Computes the upper triangle of the correlation matrix, a tile at a time, passing
+    // each to fn; the results of fn, if any, are returned in the manner of concurrent_for
+    template<typename Scalar, typename Fn>
+    static auto forEachTile(const std::vector<CorrelationDataRow>& rows, size_t numColumns,
+        Cancellable* cancellable, Progressable* progressable, Fn&& fn)
+    {
+        auto preparedRows = prepare<Scalar>(rows, numColumns);
+
+        const auto numRows = rows.size();
+        const auto blockRows = blockRowsFor<Scalar>(preparedRows._stride);
+        const auto numBlocks = (numRows + blockRows - 1) / blockRows;
+
+        auto blockSize = [&](size_t block)
+        {
+            return std::min(blockRows, numRows - (block * blockRows));
+        };
 
-            for(auto rowBIt = rowAIt + 1; rowBIt != rows.end(); ++rowBIt)
+        // Only the upper triangle of the correlation matrix is required, so
+        // only tiles on or above the diagonal are computed
+        std::vector<Tile> tiles;
+        tiles.reserve((numBlocks * (numBlocks + 1)) / 2);
+        uint64_t totalCost = 0;
+
+        for(size_t rowBlock = 0; rowBlock < numBlocks; rowBlock++)
+        {
+            for(size_t columnBlock = rowBlock; columnBlock < numBlocks; columnBlock++)
             {
-                const auto* rowB = &(*rowBIt);
+                uint64_t cost = blockSize(rowBlock) * blockSize(columnBlock);
+                if(rowBlock == columnBlock)
+                    cost = (cost / 2) + 1;
 
-                if constexpr(rowType == RowType::Ranking)
-                    rowB = rowB->ranking();
+                tiles.push_back({rowBlock, columnBlock, cost});
+                totalCost += cost;
+            }
+        }
 
-                double r = Algorithm::evaluate(numColumns, rowA, rowB);
+        std::vector<std::vector<double>> tileBuffers(std::thread::hardware_concurrency());
+        std::atomic<uint64_t> cost(0);
 
-                if(!std::isfinite(r))
-                    continue;
+        using ResultType = std::invoke_result_t<Fn, const CorrelationTile&>;
 
-                bool createEdge = false;
+        return ThreadPool(QStringLiteral("Correlation")).concurrent_for(tiles.cbegin(), tiles.cend(),
+        [&](typename std::vector<Tile>::const_iterator tileIt, size_t threadIndex)
+        {
+            if(cancellable != nullptr && cancellable->cancelled())
+                return ResultType();
 
-                switch(polarity)
-                {
-                default:
-                case CorrelationPolarity::Positive: createEdge = (r >= minimumThreshold); break;
-                case CorrelationPolarity::Negative: createEdge = (r <= -minimumThreshold); break;
-                case CorrelationPolarity::Both:     createEdge = (std::abs(r) >= minimumThreshold); break;
-                }
+            const auto& tile = *tileIt;
 
-                if(createEdge)
-                    edges.push_back({rowA->nodeId(), rowB->nodeId(), r});
-            }
+            CorrelationTile correlationTile;
+            correlationTile._rowBegin = tile._rowBlock * blockRows;
+            correlationTile._columnBegin = tile._columnBlock * blockRows;
+            correlationTile._numRows = blockSize(tile._rowBlock);
+            correlationTile._numColumns = blockSize(tile._columnBlock);
+            correlationTile._diagonal = tile._rowBlock == tile._columnBlock;
+
+            auto& tileBuffer = tileBuffers.at(threadIndex);
+            tileBuffer.resize(correlationTile._numRows * correlationTile._numColumns);
+            correlationTile._values = tileBuffer.data();
+
+            CorrelationKernel::dotProductTile(preparedRows.row(correlationTile._rowBegin), correlationTile._numRows,
+                preparedRows.row(correlationTile._columnBegin), correlationTile._numColumns, preparedRows._stride,
+                tileBuffer.data());
 
-            cost += rowA->computeCostHint();
+            if constexpr(std::is_void_v<ResultType>)
+                fn(correlationTile);
+
+            cost += tile.computeCostHint();
 
             if(progressable != nullptr)
                 progressable->setProgress(static_cast<int>((cost * 100) / totalCost));
 
+            if constexpr(!std::is_void_v<ResultType>)
+                return fn(correlationTile);
+        });
+    }
+
+    template<typename Scalar>
+    EdgeList thresholded(const std::vector<CorrelationDataRow>& rows, size_t numColumns,
+        double minimumThreshold, CorrelationPolarity polarity,
+        Cancellable* cancellable, Progressable* progressable) const
+    {
+        auto results = forEachTile<Scalar>(rows, numColumns, cancellable, progressable,
+        [&](const CorrelationTile& tile)
+        {
+            EdgeList edges;
+
+            for(size_t i = 0; i < tile._numRows; i++)
+            {
+                const auto& rowA = rows[tile._rowBegin + i];
+
+                for(size_t j = tile.firstColumnFor(i); j < tile._numColumns; j++)
+                {
+                    double r = tile.valueAt(i, j);
+
+                    if(correlationPassesThreshold(r, minimumThreshold, polarity))
+                        edges.push_back({rowA.nodeId(), rows[tile._columnBegin + j].nodeId(), r});
+                }
+            }
+
             return edges;
         });
 
@@ -157,17 +358,157 @@ public:
 
         return edges;
     }
+
+    template<typename Scalar>
+    EdgeList nearestNeighbours(const std::vector<CorrelationDataRow>& rows, size_t numColumns,
+        double minimumThreshold, CorrelationPolarity polarity,
+        Cancellable* cancellable, Progressable* progressable) const
+    {
+        CorrelationNearestNeighbours nearestNeighbours(rows.size(),
+            _maximumEdgesPerNode, minimumThreshold, polarity);
+
+        forEachTile<Scalar>(rows, numColumns, cancellable, progressable,
+        [&](const CorrelationTile& tile)
+        {
+            nearestNeighbours.add(tile);
+        });
+
+        if(progressable != nullptr)
+            progressable->setProgress(-1);
+
+        if(cancellable != nullptr && cancellable->cancelled())
+            return {};
+
+        return nearestNeighbours.edges(rows);
+    }
+
+    template<typename Scalar>
+    EdgeList processTiles(const std::vector<CorrelationDataRow>& rows, size_t numColumns,
+        double minimumThreshold, CorrelationPolarity polarity,
+        Cancellable* cancellable, Progressable* progressable) const
+    {
+        if(_maximumEdgesPerNode > 0)
+        {
+            return nearestNeighbours<Scalar>(rows, numColumns, minimumThreshold,
+                polarity, cancellable, progressable);
+        }
+
+        return thresholded<Scalar>(rows, numColumns, minimumThreshold,
+            polarity, cancellable, progressable);
+    }
+
+    template<typename Scalar>
+    GraphSizeEstimateHistogram histogramTiles(const std::vector<CorrelationDataRow>& rows,
+        size_t numColumns, CorrelationPolarity polarity, Cancellable* cancellable) const
+    {
+        GraphSizeEstimateHistogram histogram(rows.size(), 1.0,
+            GraphSizeEstimateHistogram::DefaultNumBins, _maximumEdgesPerNode);
+        std::mutex mutex;
+
+        forEachTile<Scalar>(rows, numColumns, cancellable, nullptr,
+        [&](const CorrelationTile& tile)
+        {
+            GraphSizeEstimateHistogram tileHistogram(rows.size(), 1.0,
+                GraphSizeEstimateHistogram::DefaultNumBins, _maximumEdgesPerNode);
+
+            for(size_t i = 0; i < tile._numRows; i++)
+            {
+                for(size_t j = tile.firstColumnFor(i); j < tile._numColumns; j++)
+                {
+                    double r = tile.valueAt(i, j);
+
+                    if(correlationPassesThreshold(r, 0.0, polarity))
+                        tileHistogram.add(tile._rowBegin + i, tile._columnBegin + j, r);
+                }
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            histogram.merge(tileHistogram);
+        });
+
+        if(cancellable != nullptr && cancellable->cancelled())
+            return {};
+
+        return histogram;
+    }
+
+public:
+    EdgeList process(const std::vector<CorrelationDataRow>& rows,
+        double minimumThreshold, CorrelationPolarity polarity = CorrelationPolarity::Positive,
+        Cancellable* cancellable = nullptr, Progressable* progressable = nullptr) const final
+    {
+        if(rows.empty())
+            return {};
+
+        size_t numColumns = std::distance(rows.front().begin(), rows.front().end());
+        if(numColumns == 0)
+            return {};
+
+        if(progressable != nullptr)
+            progressable->setProgress(-1);
+
+        if constexpr(rowType == RowType::Ranking)
+        {
+            for(const auto& row : rows)
+                row.generateRanking();
+        }
+
+        if(_precision == CorrelationPrecision::Single)
+        {
+            return processTiles<float>(rows, numColumns, minimumThreshold,
+                polarity, cancellable, progressable);
+        }
+
+        return processTiles<double>(rows, numColumns, minimumThreshold,
+            polarity, cancellable, progressable);
+    }
+
+    GraphSizeEstimateHistogram histogram(const std::vector<CorrelationDataRow>& rows,
+        CorrelationPolarity polarity = CorrelationPolarity::Positive,
+        Cancellable* cancellable = nullptr) const final
+    {
+        if(rows.empty())
+            return {};
+
+        size_t numColumns = std::distance(rows.front().begin(), rows.front().end());
+        if(numColumns == 0)
+            return {};
+
+        if constexpr(rowType == RowType::Ranking)
+        {
+            for(const auto& row : rows)
+                row.generateRanking();
+        }
+
+        if(_precision == CorrelationPrecision::Single)
+            return histogramTiles<float>(rows, numColumns, polarity, cancellable);
+
+        return histogramTiles<double>(rows, numColumns, polarity, cancellable);
+    }
 };
 
 struct PearsonAlgorithm
 {
-    static double evaluate(size_t numColumns, const CorrelationDataRow* rowA, const CorrelationDataRow* rowB)
+    // Centre the row on its mean and scale it to unit length, so that the Pearson
+    // correlation of two prepared rows is simply their dot product
+    template<typename Scalar>
+    static void prepare(size_t numColumns, const CorrelationDataRow* row, Scalar* out)
     {
-        double productSum = std::inner_product(rowA->begin(), rowA->end(), rowB->begin(), 0.0);
-        double numerator = (numColumns * productSum) - (rowA->sum() * rowB->sum());
-        double denominator = rowA->variability() * rowB->variability();
+        double mean = row->sum() / static_cast<double>(numColumns);
+
+        double sumSq = 0.0;
+        for(auto value : *row)
+        {
+            double centred = value - mean;
+            sumSq += centred * centred;
+        }
+
+        // A row with no variance has an undefined correlation with any other row;
+        // making it NaN ensures its pairs fail the std::isfinite test
+        double scale = sumSq > 0.0 ? 1.0 / std::sqrt(sumSq) : std::nan("1");
 
-        return numerator / denominator;
+        for(auto value : *row)
+            *out++ = static_cast<Scalar>((value - mean) * scale);
     }
 };
 
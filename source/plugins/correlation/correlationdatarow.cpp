@@ -19,18 +19,27 @@
 #include "correlationdatarow.h"
 
 #include "shared/utils/container.h"
+#include "shared/utils/threadpool.h"
 
 #include <algorithm>
 #include <cmath>
 
 void CorrelationDataRow::update()
 {
-    _statistics = u::findStatisticsFor(_data);
+    _statistics = u::findStatisticsFor(begin(), end());
+}
+
+void CorrelationDataRow::update(std::vector<CorrelationDataRow>& dataRows)
+{
+    concurrent_for(dataRows.begin(), dataRows.end(),
+    [](CorrelationDataRow& dataRow) { dataRow.update(); });
 }
 
 void CorrelationDataRow::generateRanking() const
 {
-    _rankingRow = std::make_shared<CorrelationDataRow>(u::rankingOf(_data), _nodeId, _cost);
+    auto ranking = u::rankingOf(std::vector<double>(begin(), end()));
+    _rankingRow = std::make_shared<CorrelationDataRow>(ranking, _nodeId, _cost);
+    _rankingRow->update();
 }
 
 const CorrelationDataRow* CorrelationDataRow::ranking() const
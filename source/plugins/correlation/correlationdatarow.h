@@ -22,50 +22,53 @@
 #include "shared/graph/elementid.h"
 #include "shared/utils/statistics.h"
 
+#include <QtGlobal>
+
 #include <vector>
 #include <limits>
 #include <iterator>
 #include <memory>
 
+// A CorrelationDataRow is either a view onto a row of an externally owned, contiguous
+// data matrix, or when constructed from a standalone vector, the owner of a copy of it;
+// in either case its statistics are only computed when update() is called
 class CorrelationDataRow
 {
 public:
-    using ConstDataIterator = std::vector<double>::const_iterator;
-    using DataIterator = std::vector<double>::iterator;
-    using DataOffset = std::vector<double>::size_type;
+    using ConstDataIterator = const double*;
+    using DataIterator = double*;
+    using DataOffset = size_t;
 
     CorrelationDataRow() = default;
     CorrelationDataRow(const CorrelationDataRow&) = default;
 
-    template<typename T>
-    CorrelationDataRow(const std::vector<T>& data, size_t row, size_t numColumns,
+    // Note that data must outlive the CorrelationDataRow, and not be reallocated
+    CorrelationDataRow(std::vector<double>& data, size_t row, size_t numColumns,
         NodeId nodeId, uint64_t computeCost = 1) :
-        _nodeId(nodeId), _cost(computeCost)
+        _data(data.data() + (row * numColumns)),
+        _numColumns(numColumns), _nodeId(nodeId), _cost(computeCost)
     {
-        auto cbegin = data.cbegin() + (row * numColumns);
-        auto cend = cbegin + numColumns;
-        _data = {cbegin, cend};
-        _numColumns = std::distance(begin(), end());
-
-        update();
+        Q_ASSERT(((row + 1) * numColumns) <= data.size());
     }
 
     template<typename T>
     CorrelationDataRow(const std::vector<T>& dataRow,
         NodeId nodeId, uint64_t computeCost = 1) :
-        CorrelationDataRow(dataRow, 0, dataRow.size(), nodeId, computeCost)
+        _ownedData(std::make_shared<std::vector<double>>(dataRow.begin(), dataRow.end())),
+        _data(_ownedData->data()), _numColumns(dataRow.size()),
+        _nodeId(nodeId), _cost(computeCost)
     {}
 
-    DataIterator begin() { return _data.begin(); }
-    DataIterator end() { return _data.end(); }
+    DataIterator begin() { return _data; }
+    DataIterator end() { return _data + _numColumns; }
 
-    ConstDataIterator begin() const { return _data.begin(); }
-    ConstDataIterator end() const { return _data.end(); }
+    ConstDataIterator begin() const { return _data; }
+    ConstDataIterator end() const { return _data + _numColumns; }
 
     uint64_t computeCostHint() const { return _cost; }
 
     size_t numColumns() const { return _numColumns; }
-    double valueAt(size_t column) const { return _data.at(column); }
+    double valueAt(size_t column) const { Q_ASSERT(column < _numColumns); return _data[column]; }
     void setValueAt(size_t column, double value) { _data[column] = value; }
 
     NodeId nodeId() const { return _nodeId; }
@@ -82,12 +85,15 @@ public:
     size_t largestColumnIndex() const { return _statistics._largestIndex; }
 
     void update();
+    static void update(std::vector<CorrelationDataRow>& dataRows);
 
     void generateRanking() const;
     const CorrelationDataRow* ranking() const;
 
 private:
-    std::vector<double> _data;
+    // Only used when the row isn't a view; shared so that copies remain valid
+    std::shared_ptr<std::vector<double>> _ownedData;
+    double* _data = nullptr;
 
     size_t _numColumns = 0;
 
@@ -0,0 +1,359 @@
+/* Copyright © 2013-2020 Graphia Technologies Ltd.
+ *
+ * This file is part of Graphia.
+ *
+ * Graphia is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Graphia is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Graphia.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "correlationkernel.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+// GCC and clang can compile individual functions for instruction sets that
+// aren't enabled globally, so we pick the best one at runtime
+#define CORRELATION_KERNEL_RUNTIME_DISPATCH
+#define CORRELATION_KERNEL_AVX2
+#define CORRELATION_KERNEL_AVX512
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#elif defined(_MSC_VER) && defined(__AVX2__)
+// MSVC can't, so only use what the build is configured for
+#define CORRELATION_KERNEL_AVX2
+#define TARGET_AVX2
+#endif
+
+#if defined(CORRELATION_KERNEL_AVX2) || defined(CORRELATION_KERNEL_AVX512)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+// The micro-kernels compute a block of MR rows of A against NR rows of B at a
+// time, so that each value loaded from memory is used several times
+constexpr size_t MR = 4;
+constexpr size_t NR = 2;
+
+template<typename Scalar>
+using TileFn = void(*)(const Scalar*, size_t, const Scalar*, size_t, size_t, double*);
+
+template<typename Scalar>
+void dotProductTileScalar(const Scalar* a, size_t numA,
+    const Scalar* b, size_t numB, size_t stride, double* tile)
+{
+    for(size_t i = 0; i < numA; i++)
+    {
+        const auto* rowA = a + (i * stride);
+
+        for(size_t j = 0; j < numB; j++)
+        {
+            const auto* rowB = b + (j * stride);
+
+            // stride is always a multiple of StrideAlignment, so
+            // splitting the sum four ways never leaves a remainder
+            Scalar s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+            for(size_t k = 0; k < stride; k += 4)
+            {
+                s0 += rowA[k + 0] * rowB[k + 0];
+                s1 += rowA[k + 1] * rowB[k + 1];
+                s2 += rowA[k + 2] * rowB[k + 2];
+                s3 += rowA[k + 3] * rowB[k + 3];
+            }
+
+            tile[(i * numB) + j] = static_cast<double>((s0 + s1) + (s2 + s3));
+        }
+    }
+}
+
+#ifdef CORRELATION_KERNEL_AVX2
+namespace AVX2
+{
+template<typename Scalar> struct Vector;
+template<> struct Vector<double> { using Type = __m256d; };
+template<> struct Vector<float> { using Type = __m256; };
+
+TARGET_AVX2 inline __m256d load(const double* p) { return _mm256_loadu_pd(p); }
+TARGET_AVX2 inline __m256 load(const float* p) { return _mm256_loadu_ps(p); }
+TARGET_AVX2 inline void zero(__m256d& v) { v = _mm256_setzero_pd(); }
+TARGET_AVX2 inline void zero(__m256& v) { v = _mm256_setzero_ps(); }
+TARGET_AVX2 inline __m256d fmadd(__m256d a, __m256d b, __m256d c) { return _mm256_fmadd_pd(a, b, c); }
+TARGET_AVX2 inline __m256 fmadd(__m256 a, __m256 b, __m256 c) { return _mm256_fmadd_ps(a, b, c); }
+
+TARGET_AVX2 inline double horizontalSum(__m256d v)
+{
+    auto low = _mm256_castpd256_pd128(v);
+    auto high = _mm256_extractf128_pd(v, 1);
+    low = _mm_add_pd(low, high);
+    auto swapped = _mm_unpackhi_pd(low, low);
+    return _mm_cvtsd_f64(_mm_add_sd(low, swapped));
+}
+
+TARGET_AVX2 inline double horizontalSum(__m256 v)
+{
+    auto low = _mm256_castps256_ps128(v);
+    auto high = _mm256_extractf128_ps(v, 1);
+    low = _mm_add_ps(low, high);
+    low = _mm_add_ps(low, _mm_movehl_ps(low, low));
+    low = _mm_add_ss(low, _mm_shuffle_ps(low, low, 0x1));
+    return static_cast<double>(_mm_cvtss_f32(low));
+}
+
+template<typename Scalar>
+TARGET_AVX2 double dotProduct(const Scalar* a, const Scalar* b, size_t stride)
+{
+    constexpr size_t Width = 32 / sizeof(Scalar);
+    typename Vector<Scalar>::Type sum; zero(sum);
+
+    for(size_t k = 0; k < stride; k += Width)
+        sum = fmadd(load(a + k), load(b + k), sum);
+
+    return horizontalSum(sum);
+}
+
+template<typename Scalar>
+TARGET_AVX2 void dotProductTile(const Scalar* a, size_t numA,
+    const Scalar* b, size_t numB, size_t stride, double* tile)
+{
+    constexpr size_t Width = 32 / sizeof(Scalar);
+    const size_t blockedA = numA - (numA % MR);
+    const size_t blockedB = numB - (numB % NR);
+
+    for(size_t i = 0; i < blockedA; i += MR)
+    {
+        const auto* a0 = a + ((i + 0) * stride);
+        const auto* a1 = a + ((i + 1) * stride);
+        const auto* a2 = a + ((i + 2) * stride);
+        const auto* a3 = a + ((i + 3) * stride);
+
+        for(size_t j = 0; j < blockedB; j += NR)
+        {
+            const auto* b0 = b + ((j + 0) * stride);
+            const auto* b1 = b + ((j + 1) * stride);
+
+            typename Vector<Scalar>::Type c00, c01, c10, c11, c20, c21, c30, c31;
+            zero(c00); zero(c01); zero(c10); zero(c11);
+            zero(c20); zero(c21); zero(c30); zero(c31);
+
+            for(size_t k = 0; k < stride; k += Width)
+            {
+                auto vb0 = load(b0 + k);
+                auto vb1 = load(b1 + k);
+
+                auto va = load(a0 + k);
+                c00 = fmadd(va, vb0, c00);
+                c01 = fmadd(va, vb1, c01);
+
+                va = load(a1 + k);
+                c10 = fmadd(va, vb0, c10);
+                c11 = fmadd(va, vb1, c11);
+
+                va = load(a2 + k);
+                c20 = fmadd(va, vb0, c20);
+                c21 = fmadd(va, vb1, c21);
+
+                va = load(a3 + k);
+                c30 = fmadd(va, vb0, c30);
+                c31 = fmadd(va, vb1, c31);
+            }
+
+            tile[((i + 0) * numB) + j + 0] = horizontalSum(c00);
+            tile[((i + 0) * numB) + j + 1] = horizontalSum(c01);
+            tile[((i + 1) * numB) + j + 0] = horizontalSum(c10);
+            tile[((i + 1) * numB) + j + 1] = horizontalSum(c11);
+            tile[((i + 2) * numB) + j + 0] = horizontalSum(c20);
+            tile[((i + 2) * numB) + j + 1] = horizontalSum(c21);
+            tile[((i + 3) * numB) + j + 0] = horizontalSum(c30);
+            tile[((i + 3) * numB) + j + 1] = horizontalSum(c31);
+        }
+
+        for(size_t j = blockedB; j < numB; j++)
+        {
+            for(size_t ii = i; ii < i + MR; ii++)
+                tile[(ii * numB) + j] = dotProduct(a + (ii * stride), b + (j * stride), stride);
+        }
+    }
+
+    for(size_t i = blockedA; i < numA; i++)
+    {
+        for(size_t j = 0; j < numB; j++)
+            tile[(i * numB) + j] = dotProduct(a + (i * stride), b + (j * stride), stride);
+    }
+}
+} // namespace AVX2
+#endif
+
+#ifdef CORRELATION_KERNEL_AVX512
+namespace AVX512
+{
+template<typename Scalar> struct Vector;
+template<> struct Vector<double> { using Type = __m512d; };
+template<> struct Vector<float> { using Type = __m512; };
+
+TARGET_AVX512 inline __m512d load(const double* p) { return _mm512_loadu_pd(p); }
+TARGET_AVX512 inline __m512 load(const float* p) { return _mm512_loadu_ps(p); }
+TARGET_AVX512 inline void zero(__m512d& v) { v = _mm512_setzero_pd(); }
+TARGET_AVX512 inline void zero(__m512& v) { v = _mm512_setzero_ps(); }
+TARGET_AVX512 inline __m512d fmadd(__m512d a, __m512d b, __m512d c) { return _mm512_fmadd_pd(a, b, c); }
+TARGET_AVX512 inline __m512 fmadd(__m512 a, __m512 b, __m512 c) { return _mm512_fmadd_ps(a, b, c); }
+
+// _mm512_reduce_add_p[sd] provoke spurious -Wmaybe-uninitialized warnings on some
+// versions of GCC, and they're only used outside the inner loops anyway
+TARGET_AVX512 inline double horizontalSum(__m512d v)
+{
+    alignas(64) double lanes[8];
+    _mm512_store_pd(lanes, v);
+
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+        ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+TARGET_AVX512 inline double horizontalSum(__m512 v)
+{
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, v);
+
+    float sum = 0.0f;
+    for(auto lane : lanes)
+        sum += lane;
+
+    return static_cast<double>(sum);
+}
+
+template<typename Scalar>
+TARGET_AVX512 double dotProduct(const Scalar* a, const Scalar* b, size_t stride)
+{
+    constexpr size_t Width = 64 / sizeof(Scalar);
+    typename Vector<Scalar>::Type sum; zero(sum);
+
+    for(size_t k = 0; k < stride; k += Width)
+        sum = fmadd(load(a + k), load(b + k), sum);
+
+    return horizontalSum(sum);
+}
+
+template<typename Scalar>
+TARGET_AVX512 void dotProductTile(const Scalar* a, size_t numA,
+    const Scalar* b, size_t numB, size_t stride, double* tile)
+{
+    constexpr size_t Width = 64 / sizeof(Scalar);
+    const size_t blockedA = numA - (numA % MR);
+    const size_t blockedB = numB - (numB % NR);
+
+    for(size_t i = 0; i < blockedA; i += MR)
+    {
+        const auto* a0 = a + ((i + 0) * stride);
+        const auto* a1 = a + ((i + 1) * stride);
+        const auto* a2 = a + ((i + 2) * stride);
+        const auto* a3 = a + ((i + 3) * stride);
+
+        for(size_t j = 0; j < blockedB; j += NR)
+        {
+            const auto* b0 = b + ((j + 0) * stride);
+            const auto* b1 = b + ((j + 1) * stride);
+
+            typename Vector<Scalar>::Type c00, c01, c10, c11, c20, c21, c30, c31;
+            zero(c00); zero(c01); zero(c10); zero(c11);
+            zero(c20); zero(c21); zero(c30); zero(c31);
+
+            for(size_t k = 0; k < stride; k += Width)
+            {
+                auto vb0 = load(b0 + k);
+                auto vb1 = load(b1 + k);
+
+                auto va = load(a0 + k);
+                c00 = fmadd(va, vb0, c00);
+                c01 = fmadd(va, vb1, c01);
+
+                va = load(a1 + k);
+                c10 = fmadd(va, vb0, c10);
+                c11 = fmadd(va, vb1, c11);
+
+                va = load(a2 + k);
+                c20 = fmadd(va, vb0, c20);
+                c21 = fmadd(va, vb1, c21);
+
+                va = load(a3 + k);
+                c30 = fmadd(va, vb0, c30);
+                c31 = fmadd(va, vb1, c31);
+            }
+
+            tile[((i + 0) * numB) + j + 0] = horizontalSum(c00);
+            tile[((i + 0) * numB) + j + 1] = horizontalSum(c01);
+            tile[((i + 1) * numB) + j + 0] = horizontalSum(c10);
+            tile[((i + 1) * numB) + j + 1] = horizontalSum(c11);
+            tile[((i + 2) * numB) + j + 0] = horizontalSum(c20);
+            tile[((i + 2) * numB) + j + 1] = horizontalSum(c21);
+            tile[((i + 3) * numB) + j + 0] = horizontalSum(c30);
+            tile[((i + 3) * numB) + j + 1] = horizontalSum(c31);
+        }
+
+        for(size_t j = blockedB; j < numB; j++)
+        {
+            for(size_t ii = i; ii < i + MR; ii++)
+                tile[(ii * numB) + j] = dotProduct(a + (ii * stride), b + (j * stride), stride);
+        }
+    }
+
+    for(size_t i = blockedA; i < numA; i++)
+    {
+        for(size_t j = 0; j < numB; j++)
+            tile[(i * numB) + j] = dotProduct(a + (i * stride), b + (j * stride), stride);
+    }
+}
+} // namespace AVX512
+#endif
+
+struct Implementation
+{
+    TileFn<double> _doubleFn = &dotProductTileScalar<double>;
+    TileFn<float> _floatFn = &dotProductTileScalar<float>;
+
+    Implementation()
+    {
+#if defined(CORRELATION_KERNEL_RUNTIME_DISPATCH)
+        __builtin_cpu_init();
+
+        if(__builtin_cpu_supports("avx512f"))
+        {
+            _doubleFn = &AVX512::dotProductTile<double>;
+            _floatFn = &AVX512::dotProductTile<float>;
+        }
+        else if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        {
+            _doubleFn = &AVX2::dotProductTile<double>;
+            _floatFn = &AVX2::dotProductTile<float>;
+        }
+#elif defined(CORRELATION_KERNEL_AVX2)
+        _doubleFn = &AVX2::dotProductTile<double>;
+        _floatFn = &AVX2::dotProductTile<float>;
+#endif
+    }
+};
+
+const Implementation& implementation()
+{
+    static const Implementation instance;
+    return instance;
+}
+} // namespace
+
+void CorrelationKernel::dotProductTile(const double* a, size_t numA,
+    const double* b, size_t numB, size_t stride, double* tile)
+{
+    implementation()._doubleFn(a, numA, b, numB, stride, tile);
+}
+
+void CorrelationKernel::dotProductTile(const float* a, size_t numA,
+    const float* b, size_t numB, size_t stride, double* tile)
+{
+    implementation()._floatFn(a, numA, b, numB, stride, tile);
+}
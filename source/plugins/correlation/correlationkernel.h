@@ -0,0 +1,80 @@
+/* Copyright © 2013-2020 Graphia Technologies Ltd.
+ *
+ * This file is part of Graphia.
+ *
+ * Graphia is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Graphia is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Graphia.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CORRELATIONKERNEL_H
+#define CORRELATIONKERNEL_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace CorrelationKernel
+{
+// Row strides of matrices passed to dotProductTile must be a multiple of this
+// (in elements), with any padding zero filled, so that the SIMD paths never
+// need to handle a remainder
+constexpr size_t StrideAlignment = 16;
+
+// Alignment of the start of each matrix; in combination with the stride
+// this means every row starts on a cache line boundary
+constexpr size_t MatrixAlignment = 64;
+
+constexpr size_t paddedStride(size_t numColumns)
+{
+    return ((numColumns + StrideAlignment - 1) / StrideAlignment) * StrideAlignment;
+}
+
+template<typename T>
+struct AlignedAllocator
+{
+    using value_type = T;
+
+    AlignedAllocator() = default;
+    template<typename U> explicit AlignedAllocator(const AlignedAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(MatrixAlignment)));
+    }
+
+    void deallocate(T* p, size_t) noexcept
+    {
+        ::operator delete(p, std::align_val_t(MatrixAlignment));
+    }
+
+    template<typename U> struct rebind { using other = AlignedAllocator<U>; };
+
+    bool operator==(const AlignedAllocator&) const { return true; }
+    bool operator!=(const AlignedAllocator&) const { return false; }
+};
+
+template<typename T>
+using Matrix = std::vector<T, AlignedAllocator<T>>;
+
+// For each row i in [0, numA) of a and row j in [0, numB) of b, writes the dot
+// product of the two rows to tile[(i * numB) + j]; this is essentially A·Bᵀ
+void dotProductTile(const double* a, size_t numA,
+    const double* b, size_t numB, size_t stride, double* tile);
+
+// As above, but in single precision, which is less accurate, but twice as fast
+// and uses half the memory; the results are widened to double for convenience
+void dotProductTile(const float* a, size_t numA,
+    const float* b, size_t numB, size_t stride, double* tile);
+} // namespace CorrelationKernel
+
+#endif // CORRELATIONKERNEL_H
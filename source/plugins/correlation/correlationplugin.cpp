@@ -39,7 +39,11 @@
 
 #include <json_helper.h>
 
+#include <QDataStream>
+
 #include <map>
+#include <numeric>
+#include <atomic>
 
 CorrelationPluginInstance::CorrelationPluginInstance()
 {
@@ -76,82 +80,77 @@ bool CorrelationPluginInstance::loadUserData(const TabularData& tabularData,
 
     parser.setProgress(-1);
 
-    uint64_t numDataPoints = static_cast<uint64_t>(tabularData.numColumns()) * tabularData.numRows();
     size_t left = dataRect.x();
     size_t right = dataRect.x() + dataRect.width();
     size_t top = dataRect.y();
     size_t bottom = dataRect.y() + dataRect.height();
 
-    for(size_t rowIndex = 0; rowIndex < tabularData.numRows(); rowIndex++)
-    {
-        for(size_t columnIndex = 0; columnIndex < tabularData.numColumns(); columnIndex++)
-        {
-            if(parser.cancelled())
-                return false;
+    Q_ASSERT(right - left == _numColumns && bottom - top == _numRows);
 
-            uint64_t rowOffset = static_cast<uint64_t>(rowIndex) * tabularData.numColumns();
-            uint64_t dataPoint = columnIndex + rowOffset;
-            parser.setProgress(static_cast<int>((dataPoint * 100) / numDataPoints));
+    // Row attribute names and data column names
+    for(size_t columnIndex = 0; columnIndex < right; columnIndex++)
+    {
+        const auto& value = tabularData.valueAt(columnIndex, 0);
 
-            const auto& value = tabularData.valueAt(columnIndex, rowIndex);
+        if(columnIndex < left)
+            _userNodeData.add(value);
+        else
+            setDataColumnName(columnIndex - left, value);
+    }
 
-            size_t dataColumnIndex = columnIndex - dataRect.x();
-            size_t dataRowIndex = rowIndex - dataRect.y();
-            bool isColumnInDataRect = left <= columnIndex && columnIndex < right;
-            bool isRowInDataRect = top <= rowIndex && rowIndex < bottom;
-            bool isColumnAnnotation = rowIndex < top;
-            bool isRowAttribute = columnIndex < left;
+    // Column annotations
+    for(size_t rowIndex = 1; rowIndex < top; rowIndex++)
+    {
+        const auto& annotationName = tabularData.valueAt(0, rowIndex);
+        _userColumnData.add(annotationName);
 
-            if((isColumnInDataRect && dataColumnIndex >= _numColumns) ||
-                (isRowInDataRect && dataRowIndex >= _numRows))
-            {
-                qDebug() << QString("WARNING: Attempting to set data at coordinate (%1, %2) in "
-                                    "dataRect of dimensions (%3, %4)")
-                    .arg(dataColumnIndex).arg(dataRowIndex)
-                    .arg(_numColumns).arg(_numRows);
+        for(size_t columnIndex = left; columnIndex < right; columnIndex++)
+        {
+            _userColumnData.setValue(columnIndex - left, annotationName,
+                tabularData.valueAt(columnIndex, rowIndex));
+        }
+    }
 
-                continue;
-            }
+    // Row attributes
+    for(size_t rowIndex = top; rowIndex < bottom; rowIndex++)
+    {
+        if(parser.cancelled())
+            return false;
 
-            if(rowIndex == 0)
-            {
-                if(isColumnInDataRect)
-                    setDataColumnName(dataColumnIndex, value);
-                else if(isRowAttribute)
-                    _userNodeData.add(value);
-            }
-            else if(isColumnAnnotation)
-            {
-                if(columnIndex == 0)
-                    _userColumnData.add(value);
-                else if(isColumnInDataRect)
-                    _userColumnData.setValue(dataColumnIndex, tabularData.valueAt(0, rowIndex), value);
-            }
-            else if(isColumnInDataRect)
-            {
-                double transformedValue = 0.0;
-
-                if(!value.isEmpty())
-                {
-                    bool success = false;
-                    transformedValue = value.toDouble(&success);
-                    Q_ASSERT(success);
-                }
-                else
-                {
-                    transformedValue = CorrelationFileParser::imputeValue(_missingDataType, _missingDataReplacementValue,
-                        tabularData, dataRect, columnIndex, rowIndex);
-                }
-
-                transformedValue = CorrelationFileParser::scaleValue(_scalingType, transformedValue);
-
-                setData(dataColumnIndex, dataRowIndex, transformedValue);
-            }
-            else if(isRowAttribute)
-                _userNodeData.setValue(dataRowIndex, tabularData.valueAt(columnIndex, 0), value);
+        for(size_t columnIndex = 0; columnIndex < left; columnIndex++)
+        {
+            _userNodeData.setValue(rowIndex - top, tabularData.valueAt(columnIndex, 0),
+                tabularData.valueAt(columnIndex, rowIndex));
         }
     }
 
+    std::vector<double> columnAverages;
+    if(_missingDataType == MissingDataType::ColumnAverage)
+        columnAverages = CorrelationFileParser::columnAverages(tabularData, dataRect);
+
+    std::vector<size_t> rowIndices(bottom - top);
+    std::iota(rowIndices.begin(), rowIndices.end(), top);
+    std::atomic<size_t> numRowsTransformed(0);
+
+    // The data rows are independent of each other, so are
+    // transformed concurrently, directly into place in _data
+    concurrent_for(rowIndices.cbegin(), rowIndices.cend(),
+    [&](size_t rowIndex)
+    {
+        if(parser.cancelled())
+            return;
+
+        auto dataRowIndex = rowIndex - top;
+        CorrelationFileParser::transformDataRow(tabularData, dataRect, rowIndex,
+            _missingDataType, _missingDataReplacementValue, columnAverages,
+            _scalingType, &_data.at(dataRowIndex * _numColumns));
+
+        parser.setProgress(static_cast<int>((++numRowsTransformed * 100) / rowIndices.size()));
+    });
+
+    if(parser.cancelled())
+        return false;
+
     makeDataColumnNamesUnique();
     setNodeAttributeTableModelDataColumns();
     parser.setProgress(-1);
@@ -161,19 +160,17 @@ bool CorrelationPluginInstance::loadUserData(const TabularData& tabularData,
 
 void CorrelationPluginInstance::normalise(IParser* parser)
 {
+    // _dataRows are views onto _data, so this normalises _data in place,
+    // and also computes the statistics of each data row
     CorrelationFileParser::normalise(_normaliseType, _dataRows, parser);
-
-    // Normalising obviously changes all the values in _dataRows, so we
-    // must sync _data up so that it matches
-    _data.clear();
-    for(const auto& dataRow : _dataRows)
-        _data.insert(_data.end(), dataRow.begin(), dataRow.end());
 }
 
 void CorrelationPluginInstance::finishDataRows()
 {
+    auto nodeIds = graphModel()->mutableGraph().addNewNodes(_numRows);
+
     for(size_t row = 0; row < _numRows; row++)
-        finishDataRow(row);
+        finishDataRow(row, nodeIds.at(row));
 }
 
 void CorrelationPluginInstance::createAttributes()
@@ -315,26 +312,24 @@ QStringList CorrelationPluginInstance::sharedValuesAttributeNames() const
 
 EdgeList CorrelationPluginInstance::correlation(double minimumThreshold, IParser& parser)
 {
-    auto correlation = Correlation::create(static_cast<CorrelationType>(_correlationType));
+    auto correlation = Correlation::create(static_cast<CorrelationType>(_correlationType),
+        static_cast<CorrelationPrecision>(_correlationPrecision));
+    correlation->setMaximumEdgesPerNode(_maximumEdgesPerNode);
+
     return correlation->process(_dataRows, minimumThreshold,
         static_cast<CorrelationPolarity>(_correlationPolarity), &parser, &parser);
 }
 
 bool CorrelationPluginInstance::createEdges(const EdgeList& edges, IParser& parser)
 {
-    parser.setProgress(-1);
-    for(auto edgeIt = edges.begin(); edgeIt != edges.end(); ++edgeIt)
-    {
-        if(parser.cancelled())
-            return false;
+    if(parser.cancelled())
+        return false;
 
-        parser.setProgress(static_cast<int>(std::distance(edges.begin(), edgeIt)) * 100 /
-            static_cast<int>(edges.size()));
+    parser.setProgress(-1);
+    auto edgeIds = graphModel()->mutableGraph().addEdges(edges);
 
-        const auto& edge = *edgeIt;
-        auto edgeId = graphModel()->mutableGraph().addEdge(edge._source, edge._target);
-        _correlationValues->set(edgeId, edge._weight);
-    }
+    for(size_t i = 0; i < edges.size(); i++)
+        _correlationValues->set(edgeIds[i], edges[i]._weight);
 
     return true;
 }
@@ -381,18 +376,10 @@ void CorrelationPluginInstance::makeDataColumnNamesUnique()
     }
 }
 
-void CorrelationPluginInstance::setData(size_t column, size_t row, double value)
-{
-    auto index = (row * _numColumns) + column;
-    Q_ASSERT(index < _data.size());
-    _data.at(index) = value;
-}
-
-void CorrelationPluginInstance::finishDataRow(size_t row)
+void CorrelationPluginInstance::finishDataRow(size_t row, NodeId nodeId)
 {
     Q_ASSERT(row < _numRows);
 
-    auto nodeId = graphModel()->mutableGraph().addNode();
     auto computeCost = static_cast<uint64_t>(_numRows - row + 1);
 
     _dataRows.emplace_back(_data, row, _numColumns, nodeId, computeCost);
@@ -451,7 +438,8 @@ void CorrelationPluginInstance::buildColumnAnnotations()
         if((numValues > 300) && (numUniqueValues * 2 > numValues))
             continue;
 
-        _columnAnnotations.emplace_back(name, values.begin(), values.end());
+        auto valueList = values.toStringList();
+        _columnAnnotations.emplace_back(name, valueList.begin(), valueList.end());
     }
 
     emit columnAnnotationNamesChanged();
@@ -494,6 +482,10 @@ void CorrelationPluginInstance::applyParameter(const QString& name, const QVaria
         _correlationType = static_cast<CorrelationType>(value.toInt());
     else if(name == QLatin1String("correlationPolarity"))
         _correlationPolarity = static_cast<CorrelationPolarity>(value.toInt());
+    else if(name == QLatin1String("correlationPrecision"))
+        _correlationPrecision = static_cast<CorrelationPrecision>(value.toInt());
+    else if(name == QLatin1String("maximumEdgesPerNode"))
+        _maximumEdgesPerNode = static_cast<size_t>(std::max(value.toInt(), 0));
     else if(name == QLatin1String("scaling"))
         _scalingType = static_cast<ScalingType>(value.toInt());
     else if(name == QLatin1String("normalise"))
@@ -619,66 +611,188 @@ QString CorrelationPluginInstance::attributeValueFor(const QString& attributeNam
     return attribute->stringValueOf(nodeId);
 }
 
+static void initialiseStream(QDataStream& stream)
+{
+    stream.setVersion(QDataStream::Qt_5_8);
+    stream.setByteOrder(QDataStream::LittleEndian);
+}
+
 QByteArray CorrelationPluginInstance::save(IMutableGraph& graph, Progressable& progressable) const
 {
+    // The parameters are few, so they're saved as JSON, but the data matrix and
+    // correlation values can be very large, so they're written in binary form
     json jsonObject;
 
     jsonObject["numColumns"] = static_cast<int>(_numColumns);
     jsonObject["numRows"] = static_cast<int>(_numRows);
-    jsonObject["userNodeData"] = _userNodeData.save(graph, graph.nodeIds(), progressable);
-    jsonObject["userColumnData"] =_userColumnData.save(progressable);
     jsonObject["dataColumnNames"] = jsonArrayFrom(_dataColumnNames, &progressable);
+    jsonObject["minimumCorrelationValue"] = _minimumCorrelationValue;
+    jsonObject["transpose"] = _transpose;
+    jsonObject["correlationType"] = static_cast<int>(_correlationType);
+    jsonObject["correlationPolarity"] = static_cast<int>(_correlationPolarity);
+    jsonObject["scaling"] = static_cast<int>(_scalingType);
+    jsonObject["normalisation"] = static_cast<int>(_normaliseType);
+    jsonObject["missingDataType"] = static_cast<int>(_missingDataType);
+    jsonObject["missingDataReplacementValue"] = _missingDataReplacementValue;
+
+    QByteArray byteArray;
+    QDataStream stream(&byteArray, QIODevice::WriteOnly);
+    initialiseStream(stream);
+
+    stream << QByteArray::fromStdString(jsonObject.dump());
+
+    _userNodeData.save(graph, graph.nodeIds(), stream, progressable);
+    _userColumnData.save(stream, progressable);
 
     graph.setPhase(QObject::tr("Data"));
-    jsonObject["data"] = [&]
+    stream << static_cast<quint64>(graph.nodeIds().size() * _numColumns);
+
+    uint64_t i = 0;
+    for(const auto& nodeId : graph.nodeIds())
     {
-        json array;
+        for(auto value : dataRowForNodeId(nodeId))
+            stream << value;
 
-        uint64_t i = 0;
-        for(const auto& nodeId : graph.nodeIds())
-        {
-            const auto& dataRow = dataRowForNodeId(nodeId);
-            std::copy(dataRow.begin(), dataRow.end(), std::back_inserter(array));
+        progressable.setProgress(static_cast<int>((i++) * 100 / graph.nodeIds().size()));
+    }
 
-            progressable.setProgress(static_cast<int>((i++) * 100 / graph.nodeIds().size()));
-        }
+    progressable.setProgress(-1);
 
-        progressable.setProgress(-1);
+    graph.setPhase(QObject::tr("Correlation Values"));
+    stream << static_cast<quint32>(graph.edgeIds().size());
 
-        return array;
-    }();
+    i = 0;
+    for(auto edgeId : graph.edgeIds())
+    {
+        stream << static_cast<qint32>(static_cast<int>(edgeId)) << _correlationValues->get(edgeId);
+        progressable.setProgress(static_cast<int>((i++) * 100 / graph.edgeIds().size()));
+    }
 
-    graph.setPhase(QObject::tr("Correlation Values"));
-    jsonObject["correlationValues"] = u::graphArrayAsJson(*_correlationValues, graph.edgeIds(), &progressable);
+    progressable.setProgress(-1);
 
-    jsonObject["minimumCorrelationValue"] = _minimumCorrelationValue;
-    jsonObject["transpose"] = _transpose;
-    jsonObject["correlationType"] = static_cast<int>(_correlationType);
-    jsonObject["correlationPolarity"] = static_cast<int>(_correlationPolarity);
-    jsonObject["scaling"] = static_cast<int>(_scalingType);
-    jsonObject["normalisation"] = static_cast<int>(_normaliseType);
-    jsonObject["missingDataType"] = static_cast<int>(_missingDataType);
-    jsonObject["missingDataReplacementValue"] = _missingDataReplacementValue;
+    return byteArray;
+}
+
+bool CorrelationPluginInstance::loadParameters(const json& jsonObject, int dataVersion)
+{
+    if(!u::contains(jsonObject, "numColumns") || !u::contains(jsonObject, "numRows"))
+        return false;
+
+    _numColumns = static_cast<size_t>(jsonObject["numColumns"].get<int>());
+    _numRows = static_cast<size_t>(jsonObject["numRows"].get<int>());
+
+    if(!u::contains(jsonObject, "dataColumnNames"))
+        return false;
+
+    const auto& dataColumnNames = jsonObject["dataColumnNames"];
+    std::transform(dataColumnNames.begin(), dataColumnNames.end(), std::back_inserter(_dataColumnNames),
+    [](const auto& dataColumnName)
+    {
+        return QString::fromStdString(dataColumnName);
+    });
+
+    if(!u::containsAllOf(jsonObject, {"minimumCorrelationValue", "transpose", "scaling",
+        "normalisation", "missingDataType", "missingDataReplacementValue"}))
+    {
+        return false;
+    }
+
+    _minimumCorrelationValue = jsonObject["minimumCorrelationValue"];
+    _transpose = jsonObject["transpose"];
+    _scalingType = static_cast<ScalingType>(jsonObject["scaling"]);
+    _normaliseType = static_cast<NormaliseType>(jsonObject["normalisation"]);
+    _missingDataType = static_cast<MissingDataType>(jsonObject["missingDataType"]);
+    _missingDataReplacementValue = jsonObject["missingDataReplacementValue"];
+
+    if(dataVersion >= 3)
+    {
+        if(!u::contains(jsonObject, "correlationType") || !u::contains(jsonObject, "correlationPolarity"))
+            return false;
 
-    return QByteArray::fromStdString(jsonObject.dump());
+        _correlationType = static_cast<CorrelationType>(jsonObject["correlationType"]);
+        _correlationPolarity = static_cast<CorrelationPolarity>(jsonObject["correlationPolarity"]);
+    }
+
+    return true;
 }
 
-bool CorrelationPluginInstance::load(const QByteArray& data, int dataVersion, IMutableGraph& graph,
-                                     IParser& parser)
+bool CorrelationPluginInstance::loadBinary(const QByteArray& data, int dataVersion,
+    IMutableGraph& graph, IParser& parser)
 {
-    json jsonObject = parseJsonFrom(data, &parser);
+    QDataStream stream(data);
+    initialiseStream(stream);
 
-    if(parser.cancelled())
+    QByteArray jsonParameters;
+    stream >> jsonParameters;
+
+    json jsonObject = parseJsonFrom(jsonParameters, &parser);
+
+    if(parser.cancelled() || stream.status() != QDataStream::Ok)
         return false;
 
-    if(jsonObject.is_null() || !jsonObject.is_object())
+    if(jsonObject.is_null() || !jsonObject.is_object() || !loadParameters(jsonObject, dataVersion))
         return false;
 
-    if(!u::contains(jsonObject, "numColumns") || !u::contains(jsonObject, "numRows"))
+    if(!_userNodeData.load(stream, parser) || !_userColumnData.load(stream, parser))
         return false;
 
-    _numColumns = static_cast<size_t>(jsonObject["numColumns"].get<int>());
-    _numRows = static_cast<size_t>(jsonObject["numRows"].get<int>());
+    graph.setPhase(QObject::tr("Data"));
+
+    quint64 numDataValues = 0;
+    stream >> numDataValues;
+
+    // The data rows are views onto _data, so it must be exactly the right size
+    if(numDataValues != static_cast<quint64>(_numRows) * _numColumns)
+        return false;
+
+    // Don't trust the count too far, in case the data is corrupt
+    _data.reserve(static_cast<size_t>(std::min<quint64>(numDataValues, 1u << 24)));
+
+    for(quint64 i = 0; i < numDataValues && stream.status() == QDataStream::Ok; i++)
+    {
+        double value = 0.0;
+        stream >> value;
+        _data.push_back(value);
+
+        if(i % 1024 == 0)
+            parser.setProgress(static_cast<int>((i * 100) / numDataValues));
+    }
+
+    parser.setProgress(-1);
+
+    graph.setPhase(QObject::tr("Correlation Values"));
+
+    quint32 numCorrelationValues = 0;
+    stream >> numCorrelationValues;
+
+    for(quint32 i = 0; i < numCorrelationValues && stream.status() == QDataStream::Ok; i++)
+    {
+        qint32 edgeId = 0;
+        double correlationValue = 0.0;
+        stream >> edgeId >> correlationValue;
+
+        if(!graph.containsEdgeId(edgeId))
+            return false;
+
+        _correlationValues->set(edgeId, correlationValue);
+        parser.setProgress(static_cast<int>((static_cast<uint64_t>(i) * 100) / numCorrelationValues));
+    }
+
+    parser.setProgress(-1);
+
+    return stream.status() == QDataStream::Ok;
+}
+
+bool CorrelationPluginInstance::loadJson(const QByteArray& data, int dataVersion,
+    IMutableGraph& graph, IParser& parser)
+{
+    json jsonObject = parseJsonFrom(data, &parser);
+
+    if(parser.cancelled())
+        return false;
+
+    if(jsonObject.is_null() || !jsonObject.is_object() || !loadParameters(jsonObject, dataVersion))
+        return false;
 
     if(!u::contains(jsonObject, "userNodeData") || !u::contains(jsonObject, "userColumnData"))
         return false;
@@ -691,16 +805,6 @@ bool CorrelationPluginInstance::load(const QByteArray& data, int dataVersion, IM
 
     parser.setProgress(-1);
 
-    if(!u::contains(jsonObject, "dataColumnNames"))
-        return false;
-
-    const auto& dataColumnNames = jsonObject["dataColumnNames"];
-    std::transform(dataColumnNames.begin(), dataColumnNames.end(), std::back_inserter(_dataColumnNames),
-    [](const auto& dataColumnName)
-    {
-        return QString::fromStdString(dataColumnName);
-    });
-
     uint64_t i = 0;
 
     if(!u::contains(jsonObject, "data"))
@@ -716,18 +820,6 @@ bool CorrelationPluginInstance::load(const QByteArray& data, int dataVersion, IM
 
     parser.setProgress(-1);
 
-    for(size_t row = 0; row < _numRows; row++)
-    {
-        auto nodeId = _userNodeData.elementIdForIndex(row);
-
-        if(!nodeId.isNull())
-            _dataRows.emplace_back(_data, row, _numColumns, nodeId);
-
-        parser.setProgress(static_cast<int>((row * 100) / _numRows));
-    }
-
-    parser.setProgress(-1);
-
     const char* correlationValuesKey =
         dataVersion >= 3 ? "correlationValues" : "pearsonValues";
 
@@ -764,28 +856,34 @@ bool CorrelationPluginInstance::load(const QByteArray& data, int dataVersion, IM
 
     parser.setProgress(-1);
 
-    if(!u::containsAllOf(jsonObject, {"minimumCorrelationValue", "transpose", "scaling",
-        "normalisation", "missingDataType", "missingDataReplacementValue"}))
-    {
-        return false;
-    }
+    return true;
+}
 
-    _minimumCorrelationValue = jsonObject["minimumCorrelationValue"];
-    _transpose = jsonObject["transpose"];
-    _scalingType = static_cast<ScalingType>(jsonObject["scaling"]);
-    _normaliseType = static_cast<NormaliseType>(jsonObject["normalisation"]);
-    _missingDataType = static_cast<MissingDataType>(jsonObject["missingDataType"]);
-    _missingDataReplacementValue = jsonObject["missingDataReplacementValue"];
+bool CorrelationPluginInstance::load(const QByteArray& data, int dataVersion, IMutableGraph& graph,
+                                     IParser& parser)
+{
+    // Prior to version 7, everything was saved as JSON
+    bool success = dataVersion >= 7 ?
+        loadBinary(data, dataVersion, graph, parser) :
+        loadJson(data, dataVersion, graph, parser);
 
-    if(dataVersion >= 3)
+    if(!success)
+        return false;
+
+    for(size_t row = 0; row < _numRows; row++)
     {
-        if(!u::contains(jsonObject, "correlationType") || !u::contains(jsonObject, "correlationPolarity"))
-            return false;
+        auto nodeId = _userNodeData.elementIdForIndex(row);
 
-        _correlationType = static_cast<CorrelationType>(jsonObject["correlationType"]);
-        _correlationPolarity = static_cast<CorrelationPolarity>(jsonObject["correlationPolarity"]);
+        if(!nodeId.isNull())
+            _dataRows.emplace_back(_data, row, _numColumns, nodeId);
+
+        parser.setProgress(static_cast<int>((row * 100) / _numRows));
     }
 
+    parser.setProgress(-1);
+
+    CorrelationDataRow::update(_dataRows);
+
     createAttributes();
     makeDataColumnNamesUnique();
     setNodeAttributeTableModelDataColumns();
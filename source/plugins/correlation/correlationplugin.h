@@ -78,6 +78,8 @@ private:
 
     CorrelationNodeAttributeTableModel _nodeAttributeTableModel;
 
+    // The data matrix, in row major order; each element of _dataRows is a
+    // view onto a row of it, so it must not be reallocated once they exist
     std::vector<double> _data;
 
     std::vector<CorrelationDataRow> _dataRows;
@@ -90,6 +92,8 @@ private:
     QRect _dataRect;
     CorrelationType _correlationType = CorrelationType::Pearson;
     CorrelationPolarity _correlationPolarity = CorrelationPolarity::Positive;
+    CorrelationPrecision _correlationPrecision = CorrelationPrecision::Double;
+    size_t _maximumEdgesPerNode = 0;
     ScalingType _scalingType = ScalingType::None;
     NormaliseType _normaliseType = NormaliseType::None;
     MissingDataType _missingDataType = MissingDataType::Constant;
@@ -109,9 +113,7 @@ private:
     void setDataColumnName(size_t column, const QString& name);
     void makeDataColumnNamesUnique();
 
-    void setData(size_t column, size_t row, double value);
-
-    void finishDataRow(size_t row);
+    void finishDataRow(size_t row, NodeId nodeId);
 
     QAbstractTableModel* nodeAttributeTableModel() { return &_nodeAttributeTableModel; }
     void setNodeAttributeTableModelDataColumns();
@@ -126,6 +128,10 @@ private:
 
     QStringList sharedValuesAttributeNames() const;
 
+    bool loadParameters(const json& jsonObject, int dataVersion);
+    bool loadBinary(const QByteArray& data, int dataVersion, IMutableGraph& graph, IParser& parser);
+    bool loadJson(const QByteArray& data, int dataVersion, IMutableGraph& graph, IParser& parser);
+
 public:
     void setDimensions(size_t numColumns, size_t numRows);
     bool loadUserData(const TabularData& tabularData, const QRect& dataRect, IParser& parser);
@@ -187,7 +193,7 @@ public:
 
     QString imageSource() const override { return QStringLiteral("qrc:///plots.svg"); }
 
-    int dataVersion() const override { return 6; }
+    int dataVersion() const override { return 7; }
 
     QStringList identifyUrl(const QUrl& url) const override;
     QString failureReason(const QUrl& url) const override;
@@ -20,11 +20,48 @@
 
 #include "shared/loading/iparser.h"
 #include "shared/utils/cancellable.h"
+#include "shared/utils/threadpool.h"
 
 #include <limits>
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 
+// Columns are processed in blocks of this size, so that each block only
+// reads a cache line's worth from each (row major) data row
+static constexpr size_t ColumnBlockSize = 8;
+
+// Concurrently passes the [begin, end) range of each column block to fn
+template<typename Fn>
+static bool forEachColumnBlock(const std::vector<CorrelationDataRow>& dataRows,
+    IParser* parser, Fn&& fn)
+{
+    auto numColumns = dataRows.at(0).numColumns();
+
+    std::vector<size_t> blockBegins;
+    for(size_t column = 0; column < numColumns; column += ColumnBlockSize)
+        blockBegins.push_back(column);
+
+    std::atomic<size_t> numBlocksProcessed(0);
+
+    concurrent_for(blockBegins.cbegin(), blockBegins.cend(),
+    [&](size_t blockBegin)
+    {
+        if(parser != nullptr && parser->cancelled())
+            return;
+
+        fn(blockBegin, std::min(blockBegin + ColumnBlockSize, numColumns));
+
+        if(parser != nullptr)
+            parser->setProgress(static_cast<int>((++numBlocksProcessed * 100) / blockBegins.size()));
+    });
+
+    if(parser != nullptr)
+        parser->setProgress(-1);
+
+    return parser == nullptr || !parser->cancelled();
+}
+
 struct StandardNormalisationValues
 {
     std::vector<double>* mins = nullptr;
@@ -57,67 +94,49 @@ static bool calcStandardValues(const std::vector<CorrelationDataRow>& dataRows,
     if(values.stddevs != nullptr)
         values.stddevs->resize(numColumns, 0.0);
 
-    uint64_t i = 0;
-
-    for(const auto& dataRow : dataRows)
+    // Each column's values are accumulated in row order, as if done serially
+    return forEachColumnBlock(dataRows, parser, [&](size_t columnBegin, size_t columnEnd)
     {
-        if(parser != nullptr && parser->cancelled())
-            return false;
-
-        for(size_t column = 0; column < numColumns; column++)
+        for(const auto& dataRow : dataRows)
         {
-            auto value = dataRow.valueAt(column);
+            for(size_t column = columnBegin; column < columnEnd; column++)
+            {
+                auto value = dataRow.valueAt(column);
 
-            if(values.mins != nullptr)
-                (*values.mins)[column] = std::min((*values.mins)[column], value);
+                if(values.mins != nullptr)
+                    (*values.mins)[column] = std::min((*values.mins)[column], value);
 
-            if(values.maxs != nullptr)
-                (*values.maxs)[column] = std::max((*values.maxs)[column], value);
+                if(values.maxs != nullptr)
+                    (*values.maxs)[column] = std::max((*values.maxs)[column], value);
 
-            if(values.means != nullptr)
-                (*values.means)[column] += (value / static_cast<double>(numColumns));
+                if(values.means != nullptr)
+                    (*values.means)[column] += (value / static_cast<double>(numColumns));
+            }
         }
 
-        if(parser != nullptr)
-            parser->setProgress(static_cast<int>((i * 100) / dataRows.size()));
-
-        i++;
-    }
-
-    if(values.ranges != nullptr && values.mins != nullptr && values.maxs != nullptr)
-    {
-        for(size_t column = 0; column < numColumns; column++)
-            (*values.ranges)[column] = (*values.maxs)[column] - (*values.mins)[column];
-    }
-
-    if(values.stddevs != nullptr && values.means != nullptr)
-    {
-        i = 0;
-
-        for(const auto& dataRow : dataRows)
+        if(values.ranges != nullptr && values.mins != nullptr && values.maxs != nullptr)
         {
-            if(parser != nullptr && parser->cancelled())
-                return false;
+            for(size_t column = columnBegin; column < columnEnd; column++)
+                (*values.ranges)[column] = (*values.maxs)[column] - (*values.mins)[column];
+        }
 
-            for(size_t column = 0; column < numColumns; column++)
+        if(values.stddevs != nullptr && values.means != nullptr)
+        {
+            for(const auto& dataRow : dataRows)
             {
-                auto deviation = dataRow.valueAt(column) - (*values.means)[column];
-                deviation *= deviation;
-                (*values.stddevs)[column] += (deviation / static_cast<double>(numColumns));
+                for(size_t column = columnBegin; column < columnEnd; column++)
+                {
+                    auto deviation = dataRow.valueAt(column) - (*values.means)[column];
+                    deviation *= deviation;
+                    (*values.stddevs)[column] += (deviation / static_cast<double>(numColumns));
+                }
             }
 
-            if(parser != nullptr)
-                parser->setProgress(static_cast<int>((i * 100) / dataRows.size()));
-
-            i++;
+            // Variance -> Std. Deviations
+            for(size_t column = columnBegin; column < columnEnd; column++)
+                (*values.stddevs)[column] = std::sqrt((*values.stddevs)[column]);
         }
-
-        // Variance -> Std. Deviations
-        for(size_t column = 0; column < numColumns; column++)
-            (*values.stddevs)[column] = std::sqrt((*values.stddevs)[column]);
-    }
-
-    return true;
+    });
 }
 
 static bool normalise(std::vector<CorrelationDataRow>& dataRows,
@@ -127,34 +146,16 @@ static bool normalise(std::vector<CorrelationDataRow>& dataRows,
 {
     auto numColumns = dataRows.at(0).numColumns();
 
-    uint64_t i = 0;
-
-    for(auto& dataRow : dataRows)
+    return normaliseDataRows(dataRows, parser, [&](CorrelationDataRow& dataRow)
     {
-        if(parser != nullptr && parser->cancelled())
-            return false;
+        auto* dataValues = dataRow.begin();
 
         for(size_t column = 0; column < numColumns; column++)
         {
-            if(denominators[column] > 0.0)
-            {
-                dataRow.setValueAt(column,
-                    (dataRow.valueAt(column) - subtractors[column]) / denominators[column]);
-            }
-            else
-                dataRow.setValueAt(column, 0.0);
+            dataValues[column] = denominators[column] > 0.0 ?
+                (dataValues[column] - subtractors[column]) / denominators[column] : 0.0;
         }
-
-        if(parser != nullptr)
-            parser->setProgress(static_cast<int>((i * 100) / dataRows.size()));
-
-        i++;
-    }
-
-    if(parser != nullptr)
-        parser->setProgress(-1);
-
-    return true;
+    });
 }
 
 bool MinMaxNormaliser::process(std::vector<CorrelationDataRow>& dataRows,
@@ -208,53 +209,36 @@ bool StandardisationNormaliser::process(std::vector<CorrelationDataRow>& dataRow
 
 bool UnitScalingNormaliser::process(std::vector<CorrelationDataRow>& dataRows, IParser* parser) const
 {
+    if(dataRows.empty())
+        return true;
+
     auto numColumns = dataRows.at(0).numColumns();
 
     std::vector<double> vectorLengthColumn(numColumns);
 
-    uint64_t i = 0;
-
-    for(auto& dataRow : dataRows)
+    bool success = forEachColumnBlock(dataRows, parser, [&](size_t columnBegin, size_t columnEnd)
     {
-        if(parser != nullptr && parser->cancelled())
-            return false;
-
-        for(size_t column = 0; column < numColumns; column++)
+        for(const auto& dataRow : dataRows)
         {
-            auto value = dataRow.valueAt(column);
-            vectorLengthColumn[column] += (value * value);
+            for(size_t column = columnBegin; column < columnEnd; column++)
+            {
+                auto value = dataRow.valueAt(column);
+                vectorLengthColumn[column] += (value * value);
+            }
         }
 
-        if(parser != nullptr)
-            parser->setProgress(static_cast<int>((i * 100) / dataRows.size()));
-
-        i++;
-    }
-
-    if(parser != nullptr)
-        parser->setProgress(-1);
-
-    for(size_t column = 0; column < numColumns; column++)
-        vectorLengthColumn[column] = std::sqrt(vectorLengthColumn[column]);
+        for(size_t column = columnBegin; column < columnEnd; column++)
+            vectorLengthColumn[column] = std::sqrt(vectorLengthColumn[column]);
+    });
 
-    i = 0;
+    if(!success)
+        return false;
 
-    for(auto& dataRow : dataRows)
+    return normaliseDataRows(dataRows, parser, [&](CorrelationDataRow& dataRow)
     {
-        if(parser != nullptr && parser->cancelled())
-            return false;
+        auto* dataValues = dataRow.begin();
 
         for(size_t column = 0; column < numColumns; column++)
-        {
-            auto scaledValue = dataRow.valueAt(column) / vectorLengthColumn[column];
-            dataRow.setValueAt(column, scaledValue);
-        }
-
-        if(parser != nullptr)
-            parser->setProgress(static_cast<int>((i * 100) / dataRows.size()));
-
-        i++;
-    }
-
-    return true;
+            dataValues[column] /= vectorLengthColumn[column];
+    });
 }
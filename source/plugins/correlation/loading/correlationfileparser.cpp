@@ -32,12 +32,17 @@
 #include "shared/utils/container.h"
 #include "shared/utils/container_randomsample.h"
 #include "shared/utils/scope_exit.h"
+#include "shared/utils/threadpool.h"
 
 #include <QRect>
 
 #include <vector>
 #include <stack>
 #include <utility>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cmath>
 
 CorrelationFileParser::CorrelationFileParser(CorrelationPluginInstance* plugin, QString urlTypeName,
                                              TabularData& tabularData, QRect dataRect) :
@@ -53,8 +58,7 @@ static QRect findLargestDataRect(const TabularData& tabularData, size_t startCol
     {
         for(size_t row = tabularData.numRows(); row-- > startRow; )
         {
-            const auto& value = tabularData.valueAt(column, row);
-            if(u::isNumeric(value) || value.isEmpty())
+            if(tabularData.valueMissingAt(column, row) || tabularData.valueIsNumericAt(column, row))
                 heightHistogram.at(column)++;
             else
                 break;
@@ -127,10 +131,7 @@ static bool dataRectHasMissingValues(const TabularData& tabularData, const QRect
     {
         for(auto row = dataRect.top(); row <= dataRect.bottom(); row++)
         {
-            const auto& value = tabularData.valueAt(
-                static_cast<size_t>(column), static_cast<size_t>(row));
-
-            if(value.isEmpty())
+            if(tabularData.valueMissingAt(static_cast<size_t>(column), static_cast<size_t>(row)))
                 return true;
         }
     }
@@ -138,33 +139,28 @@ static bool dataRectHasMissingValues(const TabularData& tabularData, const QRect
     return false;
 }
 
-double CorrelationFileParser::imputeValue(MissingDataType missingDataType,
-    double replacementValue, const TabularData& tabularData,
-    const QRect& dataRect, size_t columnIndex, size_t rowIndex)
+std::vector<double> CorrelationFileParser::columnAverages(const TabularData& tabularData,
+    const QRect& dataRect)
 {
-    double imputedValue = 0.0;
+    auto left = static_cast<size_t>(dataRect.x());
+    auto top = static_cast<size_t>(dataRect.y());
+    auto bottom = top + static_cast<size_t>(dataRect.height());
 
-    size_t left = dataRect.x();
-    size_t right = dataRect.x() + dataRect.width();
+    std::vector<size_t> columns(static_cast<size_t>(dataRect.width()));
+    std::iota(columns.begin(), columns.end(), 0);
+    std::vector<double> averages(columns.size(), 0.0);
 
-    switch(missingDataType)
-    {
-    case MissingDataType::Constant:
+    concurrent_for(columns.cbegin(), columns.cend(),
+    [&](size_t column)
     {
-        imputedValue = replacementValue;
-        break;
-    }
-    case MissingDataType::ColumnAverage:
-    {
-        // Calculate column averages
         double averageValue = 0.0;
         size_t rowCount = 0;
-        for(size_t avgRowIndex = left; avgRowIndex < right; avgRowIndex++)
+
+        for(size_t rowIndex = top; rowIndex < bottom; rowIndex++)
         {
-            const auto& value = tabularData.valueAt(columnIndex, avgRowIndex);
-            if(!value.isEmpty())
+            if(!tabularData.valueMissingAt(left + column, rowIndex))
             {
-                averageValue += value.toDouble();
+                averageValue += tabularData.numericValueAt(left + column, rowIndex);
                 rowCount++;
             }
         }
@@ -172,68 +168,67 @@ double CorrelationFileParser::imputeValue(MissingDataType missingDataType,
         if(rowCount > 0)
             averageValue /= rowCount;
 
-        imputedValue = averageValue;
+        averages[column] = averageValue;
+    });
+
+    return averages;
+}
+
+// Denotes the absence of a column, when imputing missing values
+static constexpr size_t NoColumn = std::numeric_limits<size_t>::max();
+
+static void imputeValues(MissingDataType missingDataType, double replacementValue,
+    const std::vector<double>& columnAverages, double* data,
+    size_t begin, size_t end, size_t leftColumn, size_t rightColumn)
+{
+    // leftColumn and rightColumn are the nearest non-missing columns
+    // either side of [begin, end), or NoColumn if there isn't one
+    switch(missingDataType)
+    {
+    case MissingDataType::Constant:
+        std::fill(data + begin, data + end, replacementValue);
         break;
-    }
+
+    case MissingDataType::ColumnAverage:
+        Q_ASSERT(end <= columnAverages.size());
+        std::copy(columnAverages.begin() + static_cast<std::ptrdiff_t>(begin),
+            columnAverages.begin() + static_cast<std::ptrdiff_t>(end), data + begin);
+        break;
+
     case MissingDataType::RowInterpolation:
     {
-        double rightValue = 0.0;
-        double leftValue = 0.0;
-        size_t leftDistance = 0;
-        size_t rightDistance = 0;
-        bool rightValueFound = false;
-        bool leftValueFound = false;
-
-        // Find right value
-        for(size_t rightColumn = columnIndex; rightColumn < right; rightColumn++)
+        for(auto column = begin; column < end; column++)
         {
-            const auto& value = tabularData.valueAt(rightColumn, rowIndex);
-            if(!value.isEmpty())
-            {
-                rightValue = value.toDouble();
-                rightValueFound = true;
-                rightDistance = (rightColumn > columnIndex) ? rightColumn - columnIndex : columnIndex - rightColumn;
-                break;
-            }
-        }
-        // Find left value
-        for(size_t leftColumn = columnIndex; leftColumn-- != left;)
-        {
-            const auto& value = tabularData.valueAt(leftColumn, rowIndex);
-            if(!value.isEmpty())
+            double imputedValue = 0.0;
+
+            // Lerp the result if possible, otherwise just set to found value
+            if(leftColumn != NoColumn && rightColumn != NoColumn)
             {
-                leftValue = value.toDouble();
-                leftValueFound = true;
-                leftDistance = (leftColumn > columnIndex) ? leftColumn - columnIndex : columnIndex - leftColumn;
-                break;
+                double leftValue = data[leftColumn];
+                double rightValue = data[rightColumn];
+                size_t leftDistance = column - leftColumn;
+                size_t totalDistance = rightColumn - leftColumn;
+                double tween = static_cast<double>(leftDistance) / static_cast<double>(totalDistance);
+                // https://devblogs.nvidia.com/lerp-faster-cuda/
+                imputedValue = std::fma(tween, rightValue, std::fma(-tween, leftValue, leftValue));
             }
-        }
+            else if(leftColumn != NoColumn)
+                imputedValue = data[leftColumn];
+            else if(rightColumn != NoColumn)
+                imputedValue = data[rightColumn];
+            // ...otherwise there is nothing on the row, so just zero it
 
-        // Lerp the result if possible, otherwise just set to found value
-        if(leftValueFound && rightValueFound)
-        {
-            size_t totalDistance = leftDistance + rightDistance;
-            double tween = leftDistance / static_cast<double>(totalDistance);
-            // https://devblogs.nvidia.com/lerp-faster-cuda/
-            double lerpedValue = std::fma(tween, rightValue, std::fma(-tween, leftValue, leftValue));
-            imputedValue = lerpedValue;
+            data[column] = imputedValue;
         }
-        else if(leftValueFound && !rightValueFound)
-            imputedValue = leftValue;
-        else if(!leftValueFound && rightValueFound)
-            imputedValue = rightValue;
-        else // Nothing on the row, just zero it
-            imputedValue = 0.0;
         break;
     }
+
     default:
         break;
     }
-
-    return imputedValue;
 }
 
-double CorrelationFileParser::scaleValue(ScalingType scalingType, double value)
+static void scaleValues(ScalingType scalingType, double* first, double* last)
 {
     // LogY(x+c) where c is EPSILON
     // This prevents LogY(0) which is -inf
@@ -241,22 +236,78 @@ double CorrelationFileParser::scaleValue(ScalingType scalingType, double value)
     // Document this!
     const double EPSILON = std::nextafter(0.0, 1.0);
 
+    // The scaling is chosen once per row, rather than per value, leaving
+    // tight loops over contiguous values that the compiler can vectorise
     switch(scalingType)
     {
     case ScalingType::Log2:
-        return std::log2(value + EPSILON);
+        std::transform(first, last, first, [EPSILON](double value) { return std::log2(value + EPSILON); });
+        break;
     case ScalingType::Log10:
-        return std::log10(value + EPSILON);
+        std::transform(first, last, first, [EPSILON](double value) { return std::log10(value + EPSILON); });
+        break;
     case ScalingType::AntiLog2:
-        return std::pow(2.0, value);
+        std::transform(first, last, first, [](double value) { return std::pow(2.0, value); });
+        break;
     case ScalingType::AntiLog10:
-        return std::pow(10.0, value);
+        std::transform(first, last, first, [](double value) { return std::pow(10.0, value); });
+        break;
     case ScalingType::ArcSin:
-        return std::asin(value);
+        std::transform(first, last, first, [](double value) { return std::asin(value); });
+        break;
     default:
         break;
     }
-    return value;
+}
+
+void CorrelationFileParser::transformDataRow(const TabularData& tabularData, const QRect& dataRect,
+    size_t rowIndex, MissingDataType missingDataType, double replacementValue,
+    const std::vector<double>& columnAverages, ScalingType scalingType, double* data)
+{
+    auto left = static_cast<size_t>(dataRect.x());
+    auto numColumns = static_cast<size_t>(dataRect.width());
+
+    // Missing values are imputed a run at a time, once the
+    // non-missing values either side of the run are known
+    size_t leftColumn = NoColumn;
+    size_t missingBegin = NoColumn;
+
+    for(size_t column = 0; column < numColumns; column++)
+    {
+        if(tabularData.valueMissingAt(left + column, rowIndex))
+        {
+            if(missingBegin == NoColumn)
+                missingBegin = column;
+
+            continue;
+        }
+
+        bool success = false;
+        data[column] = tabularData.numericValueAt(left + column, rowIndex, &success);
+
+        if(!success)
+        {
+            qDebug() << QStringLiteral("WARNING: non-numeric value at (%1, %2): %3")
+                .arg(left + column).arg(rowIndex).arg(tabularData.valueAt(left + column, rowIndex));
+        }
+
+        if(missingBegin != NoColumn)
+        {
+            imputeValues(missingDataType, replacementValue, columnAverages,
+                data, missingBegin, column, leftColumn, column);
+            missingBegin = NoColumn;
+        }
+
+        leftColumn = column;
+    }
+
+    if(missingBegin != NoColumn)
+    {
+        imputeValues(missingDataType, replacementValue, columnAverages,
+            data, missingBegin, numColumns, leftColumn, NoColumn);
+    }
+
+    scaleValues(scalingType, data, data + numColumns);
 }
 
 void CorrelationFileParser::normalise(NormaliseType normaliseType,
@@ -295,14 +346,10 @@ void CorrelationFileParser::normalise(NormaliseType normaliseType,
         break;
     }
     default:
+        // Nothing to normalise, but the statistics are still required
+        CorrelationDataRow::update(dataRows);
         break;
     }
-
-    if(normaliseType != NormaliseType::None)
-    {
-        for(auto& dataRow : dataRows)
-            dataRow.update();
-    }
 }
 
 bool CorrelationFileParser::parse(const QUrl&, IGraphModel* graphModel)
@@ -336,10 +383,10 @@ bool CorrelationFileParser::parse(const QUrl&, IGraphModel* graphModel)
     _plugin->finishDataRows();
 
     if(_plugin->requiresNormalisation())
-    {
         graphModel->mutableGraph().setPhase(QObject::tr("Normalisation"));
-        _plugin->normalise(this);
-    }
+
+    // Even without normalisation, this computes the data rows' statistics
+    _plugin->normalise(this);
 
     if(cancelled())
         return false;
@@ -430,8 +477,12 @@ CorrelationTabularDataParser::CorrelationTabularDataParser()
 
     connect(&_graphSizeEstimateFutureWatcher, &QFutureWatcher<QVariantMap>::finished, [this]
     {
-        _graphSizeEstimate = _graphSizeEstimateFutureWatcher.result();
-        emit graphSizeEstimateChanged();
+        // A cancelled estimate is incomplete, so keep showing the previous one
+        if(!_graphSizeEstimateCancellable.cancelled())
+        {
+            _graphSizeEstimate = _graphSizeEstimateFutureWatcher.result();
+            emit graphSizeEstimateChanged();
+        }
 
         // Another estimate was queued while we were busy
         if(_graphSizeEstimateQueued)
@@ -522,8 +573,7 @@ std::vector<CorrelationDataRow> CorrelationTabularDataParser::sampledDataRows(si
     Q_ASSERT(static_cast<size_t>(_dataRect.x() + _dataRect.width() - 1) < _dataPtr->numColumns());
     Q_ASSERT(static_cast<size_t>(_dataRect.y() + _dataRect.height() - 1) < _dataPtr->numRows());
 
-    std::vector<double> rowData;
-    rowData.reserve(_dataPtr->numColumns() - _dataRect.x());
+    std::vector<double> rowData(static_cast<size_t>(_dataRect.width()));
 
     // Choose numSamples random row indices from tabularData
     std::vector<size_t> rowIndices(_dataPtr->numRows() - _dataRect.y());
@@ -531,45 +581,22 @@ std::vector<CorrelationDataRow> CorrelationTabularDataParser::sampledDataRows(si
     rowIndices = u::randomSample(rowIndices, numSamples);
     std::sort(rowIndices.begin(), rowIndices.end());
 
+    auto missingDataType = static_cast<MissingDataType>(_missingDataType);
+
+    std::vector<double> columnAverages;
+    if(missingDataType == MissingDataType::ColumnAverage && _hasMissingValues)
+        columnAverages = CorrelationFileParser::columnAverages(*_dataPtr, _dataRect);
+
     NodeId nodeId(0);
 
     for(size_t rowIndex : rowIndices)
     {
-        rowData.clear();
+        if(_graphSizeEstimateCancellable.cancelled())
+            return {};
 
-        auto startColumn = static_cast<size_t>(_dataRect.x());
-        auto finishColumn = startColumn + _dataRect.width();
-        for(auto columnIndex = startColumn; columnIndex < finishColumn; columnIndex++)
-        {
-            if(_graphSizeEstimateCancellable.cancelled())
-                return {};
-
-            const auto& value = _dataPtr->valueAt(columnIndex, rowIndex);
-            double transformedValue = 0.0;
-
-            if(!value.isEmpty())
-            {
-                bool success = false;
-                transformedValue = value.toDouble(&success);
-
-                if(!success)
-                {
-                    qDebug() << QStringLiteral("WARNING: non-numeric value at (%1, %2): %3")
-                        .arg(columnIndex).arg(rowIndex).arg(value);
-                }
-            }
-            else
-            {
-                transformedValue = CorrelationFileParser::imputeValue(
-                    static_cast<MissingDataType>(_missingDataType), _replacementValue,
-                    *_dataPtr, _dataRect, columnIndex, rowIndex);
-            }
-
-            transformedValue = CorrelationFileParser::scaleValue(
-                static_cast<ScalingType>(_scalingType), transformedValue);
-
-            rowData.emplace_back(transformedValue);
-        }
+        CorrelationFileParser::transformDataRow(*_dataPtr, _dataRect, rowIndex,
+            missingDataType, _replacementValue, columnAverages,
+            static_cast<ScalingType>(_scalingType), rowData.data());
 
         dataRows.emplace_back(rowData, nodeId);
         ++nodeId;
@@ -580,43 +607,83 @@ std::vector<CorrelationDataRow> CorrelationTabularDataParser::sampledDataRows(si
     return dataRows;
 }
 
+CorrelationTabularDataParser::GraphSizeEstimateSampleKey CorrelationTabularDataParser::graphSizeEstimateSampleKey() const
+{
+    return {_dataPtr.get(), _dataRect, transposed(), _correlationType, _correlationPolarity,
+        _scalingType, _normaliseType, _missingDataType, _replacementValue, _maximumEdgesPerNode};
+}
+
 void CorrelationTabularDataParser::estimateGraphSize()
 {
     if(_dataPtr == nullptr)
         return;
 
+    auto sampleKey = graphSizeEstimateSampleKey();
+
     if(_graphSizeEstimateFutureWatcher.isRunning() || _autoDetectDataRectangleWatcher.isRunning())
     {
+        // The sample currently being correlated is no longer relevant, so
+        // abandon it; the queued estimate will start as soon as it stops
+        if(_graphSizeEstimateFutureWatcher.isRunning() && sampleKey != _graphSizeEstimateSampleKey)
+            _graphSizeEstimateCancellable.cancel();
+
         _graphSizeEstimateQueued = true;
         return;
     }
 
     _graphSizeEstimateQueued = false;
     _graphSizeEstimateCancellable.uncancel();
+    _graphSizeEstimateSampleKey = sampleKey;
 
-    QFuture<QVariantMap> future = QtConcurrent::run([this]
+    QFuture<QVariantMap> future = QtConcurrent::run([this, sampleKey, minimumCorrelation = _minimumCorrelation,
+        maximumEdgesPerNode = static_cast<size_t>(std::max(_maximumEdgesPerNode, 0))]
     {
         if(_dataPtr->numRows() == 0)
             return QVariantMap();
 
-        const size_t maxSampleRows = 1400;
-        const auto numSampleRows = std::min(maxSampleRows, _dataPtr->numRows());
+        // Only resample and correlate when something other than the threshold has changed
+        if(_graphSizeEstimateHistogram.empty() || sampleKey != _graphSizeEstimateHistogramKey)
+        {
+            const size_t maxSampleRows = 1400;
+            const auto numSampleRows = std::min(maxSampleRows, _dataPtr->numRows());
 
-        auto dataRows = sampledDataRows(numSampleRows);
+            auto dataRows = sampledDataRows(numSampleRows);
 
-        if(dataRows.empty())
-            return QVariantMap();
+            if(dataRows.empty())
+                return QVariantMap();
+
+            auto correlation = Correlation::create(static_cast<CorrelationType>(_correlationType));
+
+            if(maximumEdgesPerNode > 0)
+            {
+                // Each row of the sample has proportionately fewer candidate neighbours than
+                // it does in the full data, so correspondingly fewer of them are needed
+                auto sampleMaximumEdgesPerNode = static_cast<size_t>(std::ceil(
+                    (static_cast<double>(maximumEdgesPerNode) * static_cast<double>(numSampleRows)) /
+                    static_cast<double>(_dataPtr->numRows())));
 
-        auto correlation = Correlation::create(static_cast<CorrelationType>(_correlationType));
-        auto sampleEdges = correlation->process(dataRows, _minimumCorrelation,
-            static_cast<CorrelationPolarity>(_correlationPolarity), &_graphSizeEstimateCancellable);
+                correlation->setMaximumEdgesPerNode(std::max<size_t>(sampleMaximumEdgesPerNode, 1));
+            }
+
+            auto histogram = correlation->histogram(dataRows,
+                static_cast<CorrelationPolarity>(_correlationPolarity), &_graphSizeEstimateCancellable);
+
+            if(_graphSizeEstimateCancellable.cancelled())
+                return QVariantMap();
+
+            _graphSizeEstimateHistogram = std::move(histogram);
+            _graphSizeEstimateHistogramKey = sampleKey;
+            _graphSizeEstimateNumSampleRows = numSampleRows;
+        }
 
-        auto nodesScale = static_cast<double>(_dataPtr->numRows() / numSampleRows);
+        auto nodesScale = static_cast<double>(_dataPtr->numRows()) /
+            static_cast<double>(_graphSizeEstimateNumSampleRows);
         auto edgesScale = nodesScale * nodesScale;
         auto maxNodes = static_cast<double>(_dataPtr->numRows());
         auto maxEdges = maxNodes * maxNodes;
 
-        return graphSizeEstimate(sampleEdges, nodesScale, edgesScale, maxNodes, maxEdges);
+        return _graphSizeEstimateHistogram.estimate(minimumCorrelation,
+            nodesScale, edgesScale, maxNodes, maxEdges, maximumEdgesPerNode);
     });
 
     _graphSizeEstimateFutureWatcher.setFuture(future);
@@ -37,6 +37,7 @@
 
 #include <memory>
 #include <atomic>
+#include <tuple>
 
 // Note: the ordering of these enums is important from a save
 // file point of view; i.e. only append, don't reorder
@@ -93,9 +94,16 @@ public:
     explicit CorrelationFileParser(CorrelationPluginInstance* plugin, QString urlTypeName,
         TabularData& tabularData, QRect dataRect);
 
-    static double imputeValue(MissingDataType missingDataType, double replacementValue,
-        const TabularData& tabularData, const QRect& dataRect, size_t columnIndex, size_t rowIndex);
-    static double scaleValue(ScalingType scalingType, double value);
+    // The averages of the non-missing values in each column of dataRect
+    static std::vector<double> columnAverages(const TabularData& tabularData, const QRect& dataRect);
+
+    // Parses row rowIndex of dataRect into data, imputing any missing values then scaling them
+    // all; columnAverages is only required when missingDataType is ColumnAverage
+    static void transformDataRow(const TabularData& tabularData, const QRect& dataRect,
+        size_t rowIndex, MissingDataType missingDataType, double replacementValue,
+        const std::vector<double>& columnAverages, ScalingType scalingType, double* data);
+
+    // Normalises dataRows, if required, and in any case computes their statistics
     static void normalise(NormaliseType normaliseType,
         std::vector<CorrelationDataRow>& dataRows,
         IParser* parser = nullptr);
@@ -130,6 +138,7 @@ class CorrelationTabularDataParser : public QObject, public Cancellable
     Q_PROPERTY(int normaliseType MEMBER _normaliseType NOTIFY parameterChanged)
     Q_PROPERTY(int missingDataType MEMBER _missingDataType NOTIFY parameterChanged)
     Q_PROPERTY(double replacementValue MEMBER _replacementValue NOTIFY parameterChanged)
+    Q_PROPERTY(int maximumEdgesPerNode MEMBER _maximumEdgesPerNode NOTIFY parameterChanged)
 
     Q_PROPERTY(QVariantMap graphSizeEstimate MEMBER _graphSizeEstimate NOTIFY graphSizeEstimateChanged)
     Q_PROPERTY(bool graphSizeEstimateInProgress READ graphSizeEstimateInProgress
@@ -156,6 +165,7 @@ private:
     int _normaliseType = static_cast<int>(NormaliseType::None);
     int _missingDataType = static_cast<int>(MissingDataType::Constant);
     double _replacementValue = 0.0;
+    int _maximumEdgesPerNode = 0;
 
     void setProgress(int progress);
 
@@ -165,6 +175,21 @@ private:
     QFutureWatcher<QVariantMap> _graphSizeEstimateFutureWatcher;
     QVariantMap _graphSizeEstimate;
 
+    // Everything that determines the correlation values of the sample, but not the threshold
+    using GraphSizeEstimateSampleKey = std::tuple<const TabularData*, QRect, bool,
+        int, int, int, int, int, double, int>;
+    GraphSizeEstimateSampleKey graphSizeEstimateSampleKey() const;
+
+    // The key of the most recently started estimate
+    GraphSizeEstimateSampleKey _graphSizeEstimateSampleKey;
+
+    // The histogram of the most recently completed sample, and the key it was made with,
+    // so that when only the threshold changes, the estimate can be regenerated from it
+    // without resampling; only accessed from the estimate's (serialised) thread
+    GraphSizeEstimateSampleKey _graphSizeEstimateHistogramKey;
+    GraphSizeEstimateHistogram _graphSizeEstimateHistogram;
+    size_t _graphSizeEstimateNumSampleRows = 0;
+
     std::vector<CorrelationDataRow> sampledDataRows(size_t numSamples);
 
 public:
@@ -21,17 +21,53 @@
 
 #include "correlationdatarow.h"
 
+#include "shared/loading/iparser.h"
+#include "shared/utils/threadpool.h"
+
 #include <vector>
+#include <atomic>
+#include <numeric>
 #include <cstdlib>
 
-class Cancellable;
-class IParser;
-
 class Normaliser
 {
 public:
     virtual ~Normaliser() = default;
+
+    // Normalises dataRows in place, also updating their statistics
     virtual bool process(std::vector<CorrelationDataRow>& dataRows, IParser* parser = nullptr) const = 0;
 };
 
+// Concurrently applies fn to each data row, then updates the row's statistics while
+// its values are still in cache, rather than doing so in a separate pass afterwards
+template<typename Fn>
+bool normaliseDataRows(std::vector<CorrelationDataRow>& dataRows, IParser* parser, Fn&& fn)
+{
+    std::atomic<size_t> numRowsNormalised(0);
+
+    // Iterate over indices so that the rows' cost hint, which is the cost of correlating
+    // them, doesn't skew the distribution of work; each row costs the same to normalise
+    std::vector<size_t> rowIndices(dataRows.size());
+    std::iota(rowIndices.begin(), rowIndices.end(), 0);
+
+    concurrent_for(rowIndices.cbegin(), rowIndices.cend(),
+    [&](size_t rowIndex)
+    {
+        if(parser != nullptr && parser->cancelled())
+            return;
+
+        auto& dataRow = dataRows[rowIndex];
+        fn(dataRow);
+        dataRow.update();
+
+        if(parser != nullptr)
+            parser->setProgress(static_cast<int>((++numRowsNormalised * 100) / dataRows.size()));
+    });
+
+    if(parser != nullptr)
+        parser->setProgress(-1);
+
+    return parser == nullptr || !parser->cancelled();
+}
+
 #endif // NORMALISER_H
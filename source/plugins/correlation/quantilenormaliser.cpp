@@ -20,9 +20,12 @@
 
 #include "shared/loading/iparser.h"
 #include "shared/utils/cancellable.h"
+#include "shared/utils/threadpool.h"
 
-#include <set>
 #include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <iterator>
 
 #include <QtGlobal>
 
@@ -36,63 +39,64 @@ bool QuantileNormaliser::process(std::vector<CorrelationDataRow>& dataRows, IPar
     std::vector<std::vector<double>> sortedColumnValues(numColumns);
     std::vector<size_t> ranking(dataRows.size() * numColumns);
 
-    uint64_t j = 0;
-    size_t row = 0;
+    std::vector<size_t> columns(numColumns);
+    std::iota(columns.begin(), columns.end(), 0);
+    std::atomic<size_t> numColumnsRanked(0);
 
-    for(size_t column = 0; column < numColumns; column++)
+    concurrent_for(columns.cbegin(), columns.cend(),
+    [&](size_t column)
     {
         if(parser != nullptr && parser->cancelled())
-            return false;
+            return;
 
-        std::vector<double> columnValues;
-        columnValues.reserve(dataRows.size());
+        std::vector<double> sortedValues;
+        sortedValues.reserve(dataRows.size());
 
         // Get column values
-        std::transform(dataRows.begin(), dataRows.end(), std::back_inserter(columnValues),
+        std::transform(dataRows.begin(), dataRows.end(), std::back_inserter(sortedValues),
         [column](const auto& dataRow)
         {
             return dataRow.valueAt(column);
         });
 
         // Sort
-        auto sortedValues = columnValues;
         std::sort(sortedValues.begin(), sortedValues.end());
         auto uniqueSortedValues = sortedValues;
         uniqueSortedValues.erase(std::unique(uniqueSortedValues.begin(), uniqueSortedValues.end()),
             uniqueSortedValues.end());
 
-        row = 0;
-        for(const auto& dataRow : dataRows)
+        // Set the ranking, i.e. the index of each value amongst the unique values
+        for(size_t row = 0; row < dataRows.size(); row++)
         {
-            auto index = (row * numColumns) + column;
+            auto value = dataRows[row].valueAt(column);
+            auto it = std::lower_bound(uniqueSortedValues.begin(), uniqueSortedValues.end(), value);
 
-            // Set the ranking
-            size_t i = 0;
-            for(auto uniqueValue : uniqueSortedValues)
+            if(it != uniqueSortedValues.end() && *it == value)
             {
-                if(uniqueValue == dataRow.valueAt(column))
-                    ranking[index] = i;
-
-                i++;
+                auto index = (row * numColumns) + column;
+                ranking[index] = static_cast<size_t>(std::distance(uniqueSortedValues.begin(), it));
             }
-
-            row++;
-
-            if(parser != nullptr)
-                parser->setProgress(static_cast<int>((j++ * 100) / dataRows.size()));
         }
 
         // Copy Result to sortedColumns
-        sortedColumnValues[column] = sortedValues;
-    }
+        sortedColumnValues[column] = std::move(sortedValues);
+
+        if(parser != nullptr)
+            parser->setProgress(static_cast<int>((++numColumnsRanked * 100) / numColumns));
+    });
 
     if(parser != nullptr)
+    {
+        if(parser->cancelled())
+            return false;
+
         parser->setProgress(-1);
+    }
 
     std::vector<double> rowMeans(dataRows.size());
 
     // Populate row means
-    for(row = 0; row < rowMeans.size(); row++)
+    for(size_t row = 0; row < rowMeans.size(); row++)
     {
         double meanValue = 0.0;
         for(size_t column = 0; column < numColumns; column++)
@@ -101,11 +105,9 @@ bool QuantileNormaliser::process(std::vector<CorrelationDataRow>& dataRows, IPar
         rowMeans[row] = meanValue / static_cast<double>(numColumns);
     }
 
-    row = 0;
-    for(auto& dataRow : dataRows)
+    return normaliseDataRows(dataRows, parser, [&](CorrelationDataRow& dataRow)
     {
-        if(parser != nullptr && parser->cancelled())
-            return false;
+        auto row = static_cast<size_t>(std::distance(dataRows.data(), &dataRow));
 
         for(size_t column = 0; column < numColumns; column++)
         {
@@ -115,9 +117,5 @@ bool QuantileNormaliser::process(std::vector<CorrelationDataRow>& dataRows, IPar
 
             dataRow.setValueAt(column, rowMeans[rank]);
         }
-
-        row++;
-    }
-
-    return true;
+    });
 }
@@ -59,6 +59,7 @@ BaseParameterDialog
         normaliseType: { return normalise.model.get(normalise.currentIndex).value; }
         missingDataType: { return missingDataType.model.get(missingDataType.currentIndex).value; }
         replacementValue: replacementConstant.text
+        maximumEdgesPerNode: limitEdgesPerNodeCheckBox.checked ? maximumEdgesPerNodeSpinBox.value : 0
 
         onDataRectChanged:
         {
@@ -654,6 +655,31 @@ BaseParameterDialog
                                            "account of the magnitude of the correlation.")
                             }
                         }
+
+                        CheckBox
+                        {
+                            id: singlePrecisionCheckBox
+
+                            text: qsTr("Single Precision")
+                            onCheckedChanged:
+                            {
+                                parameters.correlationPrecision = checked ?
+                                    CorrelationPrecision.Single : CorrelationPrecision.Double;
+                            }
+                        }
+
+                        HelpTooltip
+                        {
+                            title: qsTr("Single Precision")
+                            Text
+                            {
+                                wrapMode: Text.WordWrap
+                                text: qsTr("Compute the correlation values using single precision " +
+                                           "arithmetic. This is roughly twice as fast and uses half " +
+                                           "the working memory, at the expense of the values only " +
+                                           "being accurate to around 6 decimal places.")
+                            }
+                        }
                     }
 
                     RowLayout
@@ -759,6 +785,55 @@ BaseParameterDialog
                         }
                     }
 
+                    RowLayout
+                    {
+                        Layout.fillWidth: true
+
+                        CheckBox
+                        {
+                            id: limitEdgesPerNodeCheckBox
+
+                            text: qsTr("Limit Edges Per Node:")
+                            onCheckedChanged:
+                            {
+                                parameters.maximumEdgesPerNode = checked ?
+                                    maximumEdgesPerNodeSpinBox.value : 0;
+                            }
+                        }
+
+                        SpinBox
+                        {
+                            id: maximumEdgesPerNodeSpinBox
+
+                            implicitWidth: 70
+                            enabled: limitEdgesPerNodeCheckBox.checked
+
+                            minimumValue: 1
+                            maximumValue: 1000
+                            value: 5
+
+                            onValueChanged:
+                            {
+                                if(limitEdgesPerNodeCheckBox.checked)
+                                    parameters.maximumEdgesPerNode = value;
+                            }
+                        }
+
+                        HelpTooltip
+                        {
+                            title: qsTr("Limit Edges Per Node")
+                            Text
+                            {
+                                wrapMode: Text.WordWrap
+                                text: qsTr("Only create edges between each row and the rows it is most " +
+                                           "strongly correlated with, rather than every row that meets the " +
+                                           "minimum correlation value. This is similar to applying a k-NN " +
+                                           "transform, but because the excess edges are never created, it " +
+                                           "requires far less memory when the minimum value is low.")
+                            }
+                        }
+                    }
+
                     GraphSizeEstimatePlot
                     {
                         id: graphSizeEstimatePlot
@@ -1411,6 +1486,16 @@ BaseParameterDialog
 
                         summaryString += qsTr("Correlation Metric: ") + algorithm.currentText + "<br>";
                         summaryString += qsTr("Correlation Polarity: ") + polarity.currentText + "<br>";
+
+                        if(singlePrecisionCheckBox.checked)
+                            summaryString += qsTr("Single Precision<br>");
+
+                        if(limitEdgesPerNodeCheckBox.checked)
+                        {
+                            summaryString += qsTr("Maximum Edges Per Node: ") +
+                                maximumEdgesPerNodeSpinBox.value + "<br>";
+                        }
+
                         summaryString += qsTr("Minimum Correlation Value: ") + minimumCorrelationSpinBox.value + "<br>";
                         summaryString += qsTr("Initial Correlation Threshold: ") + initialCorrelationSpinBox.value + "<br>";
 
@@ -1521,12 +1606,16 @@ BaseParameterDialog
             initialThreshold: DEFAULT_INITIAL_CORRELATION, transpose: false,
             correlationType: CorrelationType.Pearson,
             correlationPolarity: CorrelationPolarity.Positive,
+            correlationPrecision: CorrelationPrecision.Double,
+            maximumEdgesPerNode: 0,
             scaling: ScalingType.None, normalise: NormaliseType.None,
             missingDataType: MissingDataType.Constant };
 
         minimumCorrelationSpinBox.value = DEFAULT_MINIMUM_CORRELATION;
         initialCorrelationSpinBox.value = DEFAULT_INITIAL_CORRELATION;
         transposeCheckBox.checked = false;
+        singlePrecisionCheckBox.checked = false;
+        limitEdgesPerNodeCheckBox.checked = false;
     }
 
     onVisibleChanged:
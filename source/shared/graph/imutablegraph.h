@@ -23,6 +23,9 @@
 #include "shared/graph/elementid_containers.h"
 
 #include "shared/graph/igraph.h"
+#include "shared/graph/edgelist.h"
+
+#include <vector>
 
 class IMutableGraph : public virtual IGraph
 {
@@ -36,6 +39,10 @@ public:
     virtual NodeId addNode() = 0;
     virtual NodeId addNode(NodeId nodeId) = 0;
     virtual NodeId addNode(const INode& node) = 0;
+
+    // Adds numNodes new nodes in one go, returning their ids
+    virtual std::vector<NodeId> addNewNodes(size_t numNodes) = 0;
+
     template<typename C> void addNodes(const C& nodeIds)
     {
         if(nodeIds.empty())
@@ -68,6 +75,10 @@ public:
     virtual EdgeId addEdge(NodeId sourceId, NodeId targetId) = 0;
     virtual EdgeId addEdge(EdgeId edgeId, NodeId sourceId, NodeId targetId) = 0;
     virtual EdgeId addEdge(const IEdge& edge) = 0;
+
+    // Adds every edge in edges in one go, returning their ids in the same order
+    virtual std::vector<EdgeId> addEdges(const EdgeList& edges) = 0;
+
     template<typename C> void addEdges(const C& edges)
     {
         if(edges.empty())
@@ -226,7 +226,7 @@ bool AdjacencyMatrixTabularDataParser::onParseComplete()
         {
             NodeId source = data.valueAt(0, rowIndex).toInt();
             NodeId target = data.valueAt(1, rowIndex).toInt();
-            double weight = data.valueAt(2, rowIndex).toDouble();
+            double weight = data.numericValueAt(2, rowIndex);
             EdgeListEdge edge{source, target, weight};
 
             edgeList.emplace_back(edge);
@@ -240,7 +240,7 @@ bool AdjacencyMatrixTabularDataParser::onParseComplete()
         {
             for(size_t columnIndex = static_cast<size_t>(topLeft.x()); columnIndex < data.numColumns(); columnIndex++)
             {
-                double weight = data.valueAt(columnIndex, rowIndex).toDouble();
+                double weight = data.numericValueAt(columnIndex, rowIndex);
 
                 if(weight == 0.0)
                     continue;
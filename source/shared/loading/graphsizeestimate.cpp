@@ -18,82 +18,203 @@
 
 #include "graphsizeestimate.h"
 
-#include "shared/graph/elementid_containers.h"
 #include "shared/graph/undirectededge.h"
 
 #include <QVector>
 
 #include <algorithm>
-#include <set>
-#include <cstdlib>
+#include <functional>
+#include <numeric>
+#include <cmath>
 
-QVariantMap graphSizeEstimate(EdgeList edgeList,
-    double nodesScale, double edgesScale,
-    double nodesMax, double edgesMax)
+GraphSizeEstimateHistogram::GraphSizeEstimateHistogram(size_t numNodes,
+    double maximumWeight, size_t numBins, size_t numStrongestWeightsPerNode) :
+    _maximumWeight(maximumWeight > 0.0 ? maximumWeight : 1.0),
+    _numEdges(numBins), _numUniqueEdges(numBins),
+    _nodeMaximumWeights(numNodes, -1.0),
+    _numStrongestWeightsPerNode(numStrongestWeightsPerNode)
 {
-    if(edgeList.empty())
-        return QVariantMap();
+    if(_numStrongestWeightsPerNode > 0)
+        _nodeStrongestWeights.resize(numNodes);
+}
 
-    std::sort(edgeList.begin(), edgeList.end(),
-        [](const auto& a, const auto& b) { return std::abs(a._weight) > std::abs(b._weight); });
+size_t GraphSizeEstimateHistogram::binFor(double weight) const
+{
+    Q_ASSERT(!_numEdges.empty());
+    auto bin = static_cast<size_t>((weight / _maximumWeight) * static_cast<double>(_numEdges.size()));
 
-    const auto smallestWeight = std::abs(edgeList.back()._weight);
-    const auto largestWeight = std::abs(edgeList.front()._weight);
-    const auto numEstimateSamples = 100;
-    const auto sampleQuantum = (largestWeight - smallestWeight) / (numEstimateSamples - 1);
-    auto sampleCutoff = std::abs(largestWeight) - sampleQuantum;
+    return std::min(bin, _numEdges.size() - 1);
+}
 
-    QVector<double> keys;
-    QVector<double> estimatedNumNodes;
-    QVector<double> estimatedNumEdges;
-    QVector<double> estimatedNumUniqueEdges;
+void GraphSizeEstimateHistogram::addStrongestWeight(size_t nodeIndex, double weight)
+{
+    // Kept in descending order
+    auto& weights = _nodeStrongestWeights[nodeIndex];
 
-    keys.reserve(static_cast<int>(edgeList.size()));
-    estimatedNumNodes.reserve(static_cast<int>(edgeList.size()));
-    estimatedNumEdges.reserve(static_cast<int>(edgeList.size()));
-    estimatedNumUniqueEdges.reserve(static_cast<int>(edgeList.size()));
+    if(weights.size() == _numStrongestWeightsPerNode)
+    {
+        if(weight <= weights.back())
+            return;
 
-    size_t numEdges = 0;
-    size_t numUniqueEdges = 0;
-    NodeIdSet nonSingletonNodes;
-    std::set<UndirectedEdge> uniqueEdges;
-    auto weight = std::abs(edgeList.front()._weight);
+        weights.pop_back();
+    }
 
-    for(const auto& edge : edgeList)
+    weights.insert(std::upper_bound(weights.begin(), weights.end(),
+        weight, std::greater<>()), weight);
+}
+
+void GraphSizeEstimateHistogram::add(size_t sourceIndex, size_t targetIndex, double weight, bool unique)
+{
+    Q_ASSERT(sourceIndex < _nodeMaximumWeights.size());
+    Q_ASSERT(targetIndex < _nodeMaximumWeights.size());
+
+    weight = std::abs(weight);
+    auto bin = binFor(weight);
+
+    _numEdges[bin]++;
+    if(unique)
+        _numUniqueEdges[bin]++;
+
+    _nodeMaximumWeights[sourceIndex] = std::max(_nodeMaximumWeights[sourceIndex], weight);
+    _nodeMaximumWeights[targetIndex] = std::max(_nodeMaximumWeights[targetIndex], weight);
+
+    if(_numStrongestWeightsPerNode > 0)
+    {
+        addStrongestWeight(sourceIndex, weight);
+        addStrongestWeight(targetIndex, weight);
+    }
+
+    _smallestWeight = std::min(_smallestWeight, weight);
+    _largestWeight = std::max(_largestWeight, weight);
+}
+
+void GraphSizeEstimateHistogram::merge(const GraphSizeEstimateHistogram& other)
+{
+    if(other.empty())
+        return;
+
+    Q_ASSERT(_numEdges.size() == other._numEdges.size());
+    Q_ASSERT(_nodeMaximumWeights.size() == other._nodeMaximumWeights.size());
+    Q_ASSERT(_maximumWeight == other._maximumWeight);
+
+    for(size_t bin = 0; bin < _numEdges.size(); bin++)
+    {
+        _numEdges[bin] += other._numEdges[bin];
+        _numUniqueEdges[bin] += other._numUniqueEdges[bin];
+    }
+
+    for(size_t node = 0; node < _nodeMaximumWeights.size(); node++)
     {
-        if(std::abs(edge._weight) < sampleCutoff)
+        _nodeMaximumWeights[node] = std::max(_nodeMaximumWeights[node],
+            other._nodeMaximumWeights[node]);
+    }
+
+    Q_ASSERT(_numStrongestWeightsPerNode == other._numStrongestWeightsPerNode);
+    for(size_t node = 0; node < _nodeStrongestWeights.size(); node++)
+    {
+        for(auto weight : other._nodeStrongestWeights[node])
+            addStrongestWeight(node, weight);
+    }
+
+    _smallestWeight = std::min(_smallestWeight, other._smallestWeight);
+    _largestWeight = std::max(_largestWeight, other._largestWeight);
+}
+
+QVariantMap GraphSizeEstimateHistogram::estimate(double minimumThreshold,
+    double nodesScale, double edgesScale,
+    double nodesMax, double edgesMax,
+    size_t maximumEdgesPerNode) const
+{
+    Q_ASSERT(maximumEdgesPerNode == 0 || !_nodeStrongestWeights.empty());
+    if(_nodeStrongestWeights.empty())
+        maximumEdgesPerNode = 0;
+
+    // When the number of edges per node is limited, each node in the full graph
+    // has nodesScale times as many candidate neighbours at or above a weight as
+    // it does in the sample, of which at most maximumEdgesPerNode are chosen
+    // This counts each node's choices, so mutual choices are counted twice, but
+    // as an upper bound it's the right order of magnitude, unlike the unlimited
+    // estimate, which may be far larger
+    auto limitedNumEdges = [&](double weight)
+    {
+        const auto limit = static_cast<double>(maximumEdgesPerNode);
+        double numEdges = 0.0;
+
+        for(const auto& weights : _nodeStrongestWeights)
         {
-            keys.append(weight);
-            estimatedNumNodes.append(std::min(nonSingletonNodes.size() * nodesScale, nodesMax));
-            estimatedNumEdges.append(std::min(numEdges * edgesScale, edgesMax));
-            estimatedNumUniqueEdges.append(std::min(numUniqueEdges * edgesScale, edgesMax));
+            auto count = std::distance(weights.begin(), std::upper_bound(
+                weights.begin(), weights.end(), weight, std::greater<>()));
 
-            sampleCutoff -= sampleQuantum;
-            weight = std::abs(edge._weight);
+            numEdges += std::min(static_cast<double>(count) * nodesScale, limit);
         }
 
-        nonSingletonNodes.insert(edge._source);
-        nonSingletonNodes.insert(edge._target);
-        numEdges++;
+        return numEdges * nodesScale;
+    };
 
-        if(uniqueEdges.emplace(edge._source, edge._target).second)
-            numUniqueEdges++;
+    if(empty() || minimumThreshold > _largestWeight)
+        return QVariantMap();
+
+    const auto numBins = _numEdges.size();
+
+    // Nodes are binned by the largest weight incident to them, so that
+    // the number of nodes at or above any bin is the number of
+    // nodes that won't be singletons at that threshold
+    std::vector<uint64_t> numNodes(numBins);
+    for(auto nodeMaximumWeight : _nodeMaximumWeights)
+    {
+        if(nodeMaximumWeight >= 0.0)
+            numNodes[binFor(nodeMaximumWeight)]++;
     }
 
-    keys.append(std::min(weight, smallestWeight));
-    estimatedNumNodes.append(std::min(nonSingletonNodes.size() * nodesScale, nodesMax));
-    estimatedNumEdges.append(std::min(numEdges * edgesScale, edgesMax));
-    estimatedNumUniqueEdges.append(std::min(numUniqueEdges * edgesScale, edgesMax));
+    // Cumulative counts, from the largest weight downwards
+    auto accumulate = [](std::vector<uint64_t> counts)
+    {
+        std::partial_sum(counts.rbegin(), counts.rend(), counts.rbegin());
+        return counts;
+    };
+
+    auto cumulativeNumNodes = accumulate(std::move(numNodes));
+    auto cumulativeNumEdges = accumulate(_numEdges);
+    auto cumulativeNumUniqueEdges = accumulate(_numUniqueEdges);
+
+    const auto smallestWeight = std::max(minimumThreshold, _smallestWeight);
+    const auto largestWeight = _largestWeight;
+    const auto numEstimateSamples = smallestWeight < largestWeight ? 100 : 1;
 
-    std::reverse(keys.begin(), keys.end());
-    std::reverse(estimatedNumNodes.begin(), estimatedNumNodes.end());
-    std::reverse(estimatedNumEdges.begin(), estimatedNumEdges.end());
-    std::reverse(estimatedNumUniqueEdges.begin(), estimatedNumUniqueEdges.end());
+    QVector<double> keys;
+    QVector<double> estimatedNumNodes;
+    QVector<double> estimatedNumEdges;
+    QVector<double> estimatedNumUniqueEdges;
+
+    keys.reserve(numEstimateSamples);
+    estimatedNumNodes.reserve(numEstimateSamples);
+    estimatedNumEdges.reserve(numEstimateSamples);
+    estimatedNumUniqueEdges.reserve(numEstimateSamples);
 
-    keys.shrink_to_fit();
-    estimatedNumNodes.shrink_to_fit();
-    estimatedNumEdges.shrink_to_fit();
-    estimatedNumUniqueEdges.shrink_to_fit();
+    for(int sample = 0; sample < numEstimateSamples; sample++)
+    {
+        auto weight = numEstimateSamples > 1 ? smallestWeight + (((largestWeight - smallestWeight) *
+            sample) / (numEstimateSamples - 1)) : smallestWeight;
+
+        // The bin containing the weight may also contain slightly smaller weights, but
+        // with a reasonable number of bins the error is well below what's perceptible
+        auto bin = binFor(weight);
+
+        auto numEdges = std::min(static_cast<double>(cumulativeNumEdges[bin]) * edgesScale, edgesMax);
+        auto numUniqueEdges = std::min(static_cast<double>(cumulativeNumUniqueEdges[bin]) * edgesScale, edgesMax);
+
+        if(maximumEdgesPerNode > 0)
+        {
+            auto limit = limitedNumEdges(weight);
+            numEdges = std::min(numEdges, limit);
+            numUniqueEdges = std::min(numUniqueEdges, limit);
+        }
+
+        keys.append(weight);
+        estimatedNumNodes.append(std::min(static_cast<double>(cumulativeNumNodes[bin]) * nodesScale, nodesMax));
+        estimatedNumEdges.append(numEdges);
+        estimatedNumUniqueEdges.append(numUniqueEdges);
+    }
 
     QVariantMap map;
     map.insert(QStringLiteral("keys"), QVariant::fromValue(keys));
@@ -102,3 +223,58 @@ QVariantMap graphSizeEstimate(EdgeList edgeList,
     map.insert(QStringLiteral("numUniqueEdges"), QVariant::fromValue(estimatedNumUniqueEdges));
     return map;
 }
+
+QVariantMap graphSizeEstimate(const EdgeList& edgeList,
+    double nodesScale, double edgesScale,
+    double nodesMax, double edgesMax)
+{
+    if(edgeList.empty())
+        return QVariantMap();
+
+    double maximumWeight = 0.0;
+    int maximumNodeId = 0;
+
+    for(const auto& edge : edgeList)
+    {
+        maximumWeight = std::max(maximumWeight, std::abs(edge._weight));
+        maximumNodeId = std::max({maximumNodeId,
+            static_cast<int>(edge._source), static_cast<int>(edge._target)});
+    }
+
+    // An edge is unique if it's the strongest of all the edges between its two nodes,
+    // in either direction; order the edges such that this is the first in each group
+    std::vector<size_t> order(edgeList.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&edgeList](auto a, auto b)
+    {
+        UndirectedEdge edgeA(edgeList[a]._source, edgeList[a]._target);
+        UndirectedEdge edgeB(edgeList[b]._source, edgeList[b]._target);
+
+        if(edgeA < edgeB) return true;
+        if(edgeB < edgeA) return false;
+
+        return std::abs(edgeList[a]._weight) > std::abs(edgeList[b]._weight);
+    });
+
+    GraphSizeEstimateHistogram histogram(static_cast<size_t>(maximumNodeId) + 1, maximumWeight);
+
+    for(size_t i = 0; i < order.size(); i++)
+    {
+        const auto& edge = edgeList[order[i]];
+
+        bool unique = i == 0;
+        if(!unique)
+        {
+            const auto& previousEdge = edgeList[order[i - 1]];
+            UndirectedEdge undirectedEdge(edge._source, edge._target);
+            UndirectedEdge previousUndirectedEdge(previousEdge._source, previousEdge._target);
+
+            unique = previousUndirectedEdge < undirectedEdge;
+        }
+
+        histogram.add(static_cast<size_t>(static_cast<int>(edge._source)),
+            static_cast<size_t>(static_cast<int>(edge._target)), edge._weight, unique);
+    }
+
+    return histogram.estimate(0.0, nodesScale, edgesScale, nodesMax, edgesMax);
+}
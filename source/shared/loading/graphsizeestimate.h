@@ -23,9 +23,56 @@
 
 #include <QVariantMap>
 
+#include <cstdint>
 #include <limits>
+#include <vector>
 
-QVariantMap graphSizeEstimate(EdgeList edgeList,
+// A fixed bin histogram of absolute edge weights, along with the largest absolute
+// weight incident to each node, which is enough to estimate the size of the graph
+// at any threshold without having to revisit (or even keep) the edges themselves
+// When the number of edges per node is to be limited, each node's strongest
+// weights are also kept, up to numStrongestWeightsPerNode of them
+class GraphSizeEstimateHistogram
+{
+private:
+    double _maximumWeight = 1.0;
+
+    std::vector<uint64_t> _numEdges;
+    std::vector<uint64_t> _numUniqueEdges;
+    std::vector<double> _nodeMaximumWeights;
+
+    size_t _numStrongestWeightsPerNode = 0;
+    std::vector<std::vector<double>> _nodeStrongestWeights;
+
+    double _smallestWeight = std::numeric_limits<double>::max();
+    double _largestWeight = 0.0;
+
+    size_t binFor(double weight) const;
+    void addStrongestWeight(size_t nodeIndex, double weight);
+
+public:
+    static constexpr size_t DefaultNumBins = 1000;
+
+    GraphSizeEstimateHistogram() = default;
+    GraphSizeEstimateHistogram(size_t numNodes, double maximumWeight = 1.0,
+        size_t numBins = DefaultNumBins, size_t numStrongestWeightsPerNode = 0);
+
+    bool empty() const { return _largestWeight < _smallestWeight; }
+
+    // Not thread safe; accumulate into separate histograms and merge them instead
+    void add(size_t sourceIndex, size_t targetIndex, double weight, bool unique = true);
+    void merge(const GraphSizeEstimateHistogram& other);
+
+    // If maximumEdgesPerNode is non-zero, the histogram must have been created with
+    // at least maximumEdgesPerNode / nodesScale (rounded up) strongest weights per node
+    QVariantMap estimate(double minimumThreshold = 0.0,
+        double nodesScale = 1.0, double edgesScale = 1.0,
+        double nodesMax = std::numeric_limits<double>::max(),
+        double edgesMax = std::numeric_limits<double>::max(),
+        size_t maximumEdgesPerNode = 0) const;
+};
+
+QVariantMap graphSizeEstimate(const EdgeList& edgeList,
     double nodesScale = 1.0, double edgesScale = 1.0,
     double nodesMax = std::numeric_limits<double>::max(),
     double edgesMax = std::numeric_limits<double>::max());
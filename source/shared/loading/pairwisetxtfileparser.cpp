@@ -18,8 +18,8 @@
 
 #include "pairwisetxtfileparser.h"
 
-#include "shared/utils/container.h"
 #include "shared/utils/string.h"
+#include "shared/utils/threadpool.h"
 #include "shared/graph/igraphmodel.h"
 #include "shared/graph/imutablegraph.h"
 #include "shared/loading/userelementdata.h"
@@ -27,226 +27,615 @@
 #include <utfcpp/utf8.h>
 
 #include <QFile>
-#include <QTextStream>
+#include <QByteArray>
 #include <QStringList>
 #include <QUrl>
 #include <QDebug>
 
-#include <unordered_map>
 #include <vector>
-
 #include <string>
-#include <iostream>
-#include <fstream>
+#include <string_view>
+#include <atomic>
+#include <numeric>
+#include <thread>
+#include <limits>
+#include <cstring>
 #include <cctype>
+#include <cmath>
 
-PairwiseTxtFileParser::PairwiseTxtFileParser(UserNodeData* userNodeData, UserEdgeData* userEdgeData) :
-    _userNodeData(userNodeData), _userEdgeData(userEdgeData)
+namespace
 {
-    // Add this up front, so that it appears first in the attribute table
-    userNodeData->add(QObject::tr("Node Name"));
-}
+// Node names stored end to end in one buffer, indexed by an open addressed hash table
+class NameTable
+{
+private:
+    static constexpr uint32_t EmptySlot = std::numeric_limits<uint32_t>::max();
 
-bool PairwiseTxtFileParser::parse(const QUrl& url, IGraphModel* graphModel)
+    std::string _arena;
+    std::vector<size_t> _offsets{0};
+    std::vector<uint32_t> _slots = std::vector<uint32_t>(64, EmptySlot);
+    std::vector<size_t> _hashes;
+
+    size_t slotFor(std::string_view name, size_t hash) const
+    {
+        auto mask = _slots.size() - 1;
+        auto slot = hash & mask;
+
+        while(_slots[slot] != EmptySlot)
+        {
+            auto index = _slots[slot];
+            if(_hashes[index] == hash && at(index) == name)
+                break;
+
+            slot = (slot + 1) & mask;
+        }
+
+        return slot;
+    }
+
+    void grow()
+    {
+        std::vector<uint32_t> slots(_slots.size() * 2, EmptySlot);
+        auto mask = slots.size() - 1;
+
+        for(uint32_t index = 0; index < size(); index++)
+        {
+            auto slot = _hashes[index] & mask;
+            while(slots[slot] != EmptySlot)
+                slot = (slot + 1) & mask;
+
+            slots[slot] = index;
+        }
+
+        _slots = std::move(slots);
+    }
+
+public:
+    static constexpr uint32_t NotFound = EmptySlot;
+
+    uint32_t size() const { return static_cast<uint32_t>(_hashes.size()); }
+
+    std::string_view at(uint32_t index) const
+    {
+        return std::string_view(_arena).substr(_offsets[index], _offsets[index + 1] - _offsets[index]);
+    }
+
+    uint32_t find(std::string_view name) const
+    {
+        return _slots[slotFor(name, std::hash<std::string_view>()(name))];
+    }
+
+    // Returns the index of name, and whether or not it needed to be added
+    std::pair<uint32_t, bool> insert(std::string_view name)
+    {
+        auto hash = std::hash<std::string_view>()(name);
+        auto slot = slotFor(name, hash);
+
+        if(_slots[slot] != EmptySlot)
+            return {_slots[slot], false};
+
+        auto index = size();
+        _slots[slot] = index;
+        _hashes.push_back(hash);
+        _arena.append(name);
+        _offsets.push_back(_arena.size());
+
+        // Keep the load factor below a half
+        if(size() * 2 > _slots.size())
+            grow();
+
+        return {index, true};
+    }
+};
+
+using Tokens = std::vector<std::string>;
+
+// The lines of one chunk of the file, in a form that can be quickly added to the graph
+struct Chunk
 {
-    Q_ASSERT(graphModel != nullptr);
+    NameTable _names;
 
-    std::ifstream file(url.toLocalFile().toStdString());
-    if(!file || graphModel == nullptr)
-        return false;
+    // Indexes into _names
+    std::vector<std::pair<uint32_t, uint32_t>> _edges;
 
-    auto fileSize = file.tellg();
-    file.seekg(0, std::ios::end);
-    fileSize = file.tellg() - fileSize;
+    // Only populated if some edge has a weight, in which case those that don't are NaN
+    std::vector<double> _weights;
 
-    std::unordered_map<std::string, NodeId> nodeIdMap;
+    // Comment lines, along with the number of edges that preceded them
+    std::vector<std::pair<size_t, Tokens>> _comments;
+};
+} // namespace
 
-    std::string line;
-    std::string token;
-    std::vector<std::string> tokens;
+// Finds the end of the line beginning at begin, noting whether or not it's entirely
+// ASCII; this works 8 bytes at a time, which in practice is most of the line
+static const char* findLineEnd(const char* begin, const char* end, bool& ascii)
+{
+    const uint64_t Ones = 0x0101010101010101ull;
+    const uint64_t HighBits = 0x8080808080808080ull;
+
+    auto hasZeroByte = [&](uint64_t word) { return ((word - Ones) & ~word & HighBits) != 0; };
 
-    setProgress(-1);
+    uint64_t highBits = 0;
+    const auto* it = begin;
 
-    file.seekg(0, std::ios::beg);
-    while(u::getline(file, line))
+    while(end - it >= 8)
     {
-        if(cancelled())
-            return false;
+        uint64_t word = 0;
+        std::memcpy(&word, it, sizeof(word));
 
-        tokens.clear();
+        if(hasZeroByte(word ^ (Ones * '\n')) || hasZeroByte(word ^ (Ones * '\r')))
+            break;
+
+        highBits |= word;
+        it += 8;
+    }
+
+    while(it < end && *it != '\n' && *it != '\r')
+        highBits |= static_cast<unsigned char>(*it++);
 
-        bool inQuotes = false;
-        bool isComment = false;
+    ascii = (highBits & HighBits) == 0;
+
+    return it;
+}
+
+static bool isAsciiSpace(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// This is the same algorithm as tokeniseUtf8Line, for the case where every
+// byte is a code point, so it can skip decoding and validation entirely
+static bool tokeniseAsciiLine(const char* line, size_t length, std::string& token, Tokens& tokens)
+{
+    bool inQuotes = false;
+    bool isComment = false;
+
+    size_t i = 0;
+    while(i < length)
+    {
+        auto c = line[i++];
 
-        std::string validatedLine;
-        utf8::replace_invalid(line.begin(), line.end(), std::back_inserter(validatedLine));
-        auto it = validatedLine.begin();
-        auto end = validatedLine.end();
-        while(it < end)
+        if(i < length - 1 && c == '/' && line[i] == '/')
         {
-            uint32_t codePoint = utf8::next(it, end);
+            isComment = true;
 
-            if(it < end && it < (end - 1) &&
-               codePoint == '/' && utf8::peek_next(it, end) == '/')
-            {
-                isComment = true;
+            // Skip the second /
+            i++;
+            c = line[i++];
+        }
 
-                // Skip the second /
-                utf8::advance(it, 1, end);
-                codePoint = utf8::next(it, end);
+        if(c == '\"')
+        {
+            if(inQuotes)
+            {
+                tokens.emplace_back(std::move(token));
+                token.clear();
             }
 
-            if(codePoint == '\"')
-            {
-                if(inQuotes)
-                {
-                    tokens.emplace_back(std::move(token));
-                    token.clear();
-                }
+            inQuotes = !inQuotes;
+        }
+        else
+        {
+            bool space = isAsciiSpace(c);
+            bool trailingSpace = space && !token.empty();
 
-                inQuotes = !inQuotes;
+            if(trailingSpace && !inQuotes)
+            {
+                tokens.emplace_back(std::move(token));
+                token.clear();
             }
-            else
+            else if(!space || inQuotes)
+                token += c;
+        }
+    }
+
+    if(!token.empty())
+    {
+        tokens.emplace_back(std::move(token));
+        token.clear();
+    }
+
+    return isComment;
+}
+
+static bool tokeniseUtf8Line(const char* line, size_t length, std::string& token, Tokens& tokens)
+{
+    bool inQuotes = false;
+    bool isComment = false;
+
+    std::string validatedLine;
+    utf8::replace_invalid(line, line + length, std::back_inserter(validatedLine));
+    auto it = validatedLine.begin();
+    auto end = validatedLine.end();
+    while(it < end)
+    {
+        uint32_t codePoint = utf8::next(it, end);
+
+        if(it < end && it < (end - 1) &&
+           codePoint == '/' && utf8::peek_next(it, end) == '/')
+        {
+            isComment = true;
+
+            // Skip the second /
+            utf8::advance(it, 1, end);
+            codePoint = utf8::next(it, end);
+        }
+
+        if(codePoint == '\"')
+        {
+            if(inQuotes)
             {
-                bool space = (codePoint < 0xFF) && (std::isspace(codePoint) != 0);
-                bool trailingSpace = space && !token.empty();
+                tokens.emplace_back(std::move(token));
+                token.clear();
+            }
 
-                if(trailingSpace && !inQuotes)
-                {
-                    tokens.emplace_back(std::move(token));
-                    token.clear();
-                }
-                else if(!space || inQuotes)
-                    utf8::unchecked::append(codePoint, std::back_inserter(token));
+            inQuotes = !inQuotes;
+        }
+        else
+        {
+            bool space = (codePoint < 0xFF) && (std::isspace(codePoint) != 0);
+            bool trailingSpace = space && !token.empty();
+
+            if(trailingSpace && !inQuotes)
+            {
+                tokens.emplace_back(std::move(token));
+                token.clear();
             }
+            else if(!space || inQuotes)
+                utf8::unchecked::append(codePoint, std::back_inserter(token));
         }
+    }
+
+    if(!token.empty())
+    {
+        tokens.emplace_back(std::move(token));
+        token.clear();
+    }
+
+    return isComment;
+}
+
+// Parses plain decimals, e.g. "-12.5", which is almost always what edge weights
+// are; when the mantissa and power of ten are both exactly representable, a single
+// division gives the correctly rounded result, as u::toNumber would
+static bool parseSimpleDecimal(std::string_view string, double& value)
+{
+    static const double PowersOfTen[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    size_t i = 0;
+    bool negative = false;
+
+    if(i < string.size() && (string[i] == '-' || string[i] == '+'))
+        negative = string[i++] == '-';
+
+    uint64_t mantissa = 0;
+    int numDigits = 0;
+    int numFractionDigits = 0;
 
-        if(!token.empty())
+    auto parseDigits = [&](bool fraction)
+    {
+        while(i < string.size() && string[i] >= '0' && string[i] <= '9')
         {
-            tokens.emplace_back(std::move(token));
-            token.clear();
+            mantissa = (mantissa * 10) + static_cast<uint64_t>(string[i++] - '0');
+            numDigits++;
+
+            if(fraction)
+                numFractionDigits++;
+
+            if(numDigits > 18)
+                return false;
         }
 
+        return true;
+    };
+
+    if(!parseDigits(false))
+        return false;
+
+    if(i < string.size() && string[i] == '.')
+    {
+        i++;
+
+        if(!parseDigits(true))
+            return false;
+    }
+
+    if(i != string.size() || numDigits == 0 || mantissa > (1ull << 53))
+        return false;
+
+    value = static_cast<double>(mantissa) / PowersOfTen[numFractionDigits];
+
+    if(negative)
+        value = -value;
+
+    return true;
+}
+
+static void parseChunk(const char* begin, const char* end, Chunk& chunk,
+    std::atomic<uint64_t>& bytesParsed, Cancellable& cancellable)
+{
+    std::string token;
+    Tokens tokens;
+    size_t numLines = 0;
+
+    const auto* lineBegin = begin;
+    while(lineBegin < end)
+    {
+        if((numLines++ % 4096) == 0 && cancellable.cancelled())
+            return;
+
+        bool ascii = true;
+        const auto* lineEnd = findLineEnd(lineBegin, end, ascii);
+        auto length = static_cast<size_t>(lineEnd - lineBegin);
+
+        tokens.clear();
+
+        bool isComment = ascii ?
+            tokeniseAsciiLine(lineBegin, length, token, tokens) :
+            tokeniseUtf8Line(lineBegin, length, token, tokens);
+
+        // Consume the terminator, treating \r\n as one
+        if(lineEnd < end && *lineEnd == '\r' && lineEnd + 1 < end && lineEnd[1] == '\n')
+            lineEnd++;
+
+        lineBegin = lineEnd < end ? lineEnd + 1 : end;
+
         if(isComment)
         {
-            if(!tokens.empty() && _userNodeData != nullptr)
-            {
-                NodeId nodeId;
-                QString attributeName;
-                QString value;
+            if(!tokens.empty())
+                chunk._comments.emplace_back(chunk._edges.size(), std::move(tokens));
 
-                const std::string NODE("NODE");
-                auto& firstToken = tokens.at(0);
+            continue;
+        }
 
-                if(firstToken.compare(0, NODE.length(), NODE) == 0)
-                {
-                    auto& secondToken = tokens.at(1);
-                    if(u::contains(nodeIdMap, secondToken))
-                        nodeId = nodeIdMap.at(secondToken);
+        if(tokens.size() < 2)
+            continue;
 
-                    std::string property = firstToken.substr(NODE.length(), std::string::npos);
+        auto source = chunk._names.insert(tokens.at(0)).first;
+        auto target = chunk._names.insert(tokens.at(1)).first;
+        chunk._edges.emplace_back(source, target);
 
-                    if(tokens.size() == 4 && property == "CLASS")
-                    {
-                        attributeName = QString::fromStdString(tokens.at(3));
-                        value = QString::fromStdString(tokens.at(2));
-                    }
-                    else if(tokens.size() == 3 && property == "SIZE")
-                    {
-                        attributeName = QObject::tr("BioLayout Node Size");
-                        value = QString::fromStdString(tokens.at(2));
-                    }
-                    else if(tokens.size() == 4 && property == "SHAPE")
-                    {
-                        attributeName = QObject::tr("BioLayout Node Shape");
-                        value = QString::fromStdString(tokens.at(3));
-                    }
-                    else if(tokens.size() == 3 && property == "ALPHA")
-                    {
-                        attributeName = QObject::tr("BioLayout Node Opacity");
-                        value = QString::fromStdString(tokens.at(2));
-                    }
-                    else if(tokens.size() == 3 && property == "COLOR")
-                    {
-                        attributeName = QObject::tr("BioLayout Node Colour");
-                        value = QString::fromStdString(tokens.at(2));
-                    }
-                    else if(tokens.size() == 3 && property == "DESC")
-                    {
-                        attributeName = QObject::tr("BioLayout Node Description");
-                        value = QString::fromStdString(tokens.at(2));
-                    }
-                    else if(tokens.size() == 3 && property == "URL")
-                    {
-                        attributeName = QObject::tr("BioLayout Node URL");
-                        value = QString::fromStdString(tokens.at(2));
-                    }
-                }
+        if(tokens.size() >= 3)
+        {
+            // We have an edge weight too
+            const auto& thirdToken = tokens.at(2);
+            double edgeWeight = 0.0;
+            bool isNumeric = parseSimpleDecimal(thirdToken, edgeWeight);
+
+            if(!isNumeric && u::isNumeric(thirdToken))
+            {
+                isNumeric = true;
+                edgeWeight = u::toNumber(thirdToken);
+            }
+
+            if(isNumeric)
+            {
+                if(std::isnan(edgeWeight) || !std::isfinite(edgeWeight))
+                    edgeWeight = 1.0;
 
-                if(!nodeId.isNull())
-                    _userNodeData->setValueBy(nodeId, attributeName, value);
+                chunk._weights.resize(chunk._edges.size() - 1, std::numeric_limits<double>::quiet_NaN());
+                chunk._weights.push_back(edgeWeight);
             }
         }
-        else if(tokens.size() >= 2)
+    }
+
+    if(!chunk._weights.empty())
+        chunk._weights.resize(chunk._edges.size(), std::numeric_limits<double>::quiet_NaN());
+
+    bytesParsed += static_cast<uint64_t>(end - begin);
+}
+
+PairwiseTxtFileParser::PairwiseTxtFileParser(UserNodeData* userNodeData, UserEdgeData* userEdgeData) :
+    _userNodeData(userNodeData), _userEdgeData(userEdgeData)
+{
+    // Add this up front, so that it appears first in the attribute table
+    userNodeData->add(QObject::tr("Node Name"));
+}
+
+void PairwiseTxtFileParser::parseComment(const std::vector<std::string>& tokens, NodeId nodeId)
+{
+    if(_userNodeData == nullptr)
+        return;
+
+    QString attributeName;
+    QString value;
+
+    const std::string NODE("NODE");
+    const auto& firstToken = tokens.at(0);
+
+    if(firstToken.compare(0, NODE.length(), NODE) != 0)
+        return;
+
+    std::string property = firstToken.substr(NODE.length(), std::string::npos);
+
+    if(tokens.size() == 4 && property == "CLASS")
+    {
+        attributeName = QString::fromStdString(tokens.at(3));
+        value = QString::fromStdString(tokens.at(2));
+    }
+    else if(tokens.size() == 3 && property == "SIZE")
+    {
+        attributeName = QObject::tr("BioLayout Node Size");
+        value = QString::fromStdString(tokens.at(2));
+    }
+    else if(tokens.size() == 4 && property == "SHAPE")
+    {
+        attributeName = QObject::tr("BioLayout Node Shape");
+        value = QString::fromStdString(tokens.at(3));
+    }
+    else if(tokens.size() == 3 && property == "ALPHA")
+    {
+        attributeName = QObject::tr("BioLayout Node Opacity");
+        value = QString::fromStdString(tokens.at(2));
+    }
+    else if(tokens.size() == 3 && property == "COLOR")
+    {
+        attributeName = QObject::tr("BioLayout Node Colour");
+        value = QString::fromStdString(tokens.at(2));
+    }
+    else if(tokens.size() == 3 && property == "DESC")
+    {
+        attributeName = QObject::tr("BioLayout Node Description");
+        value = QString::fromStdString(tokens.at(2));
+    }
+    else if(tokens.size() == 3 && property == "URL")
+    {
+        attributeName = QObject::tr("BioLayout Node URL");
+        value = QString::fromStdString(tokens.at(2));
+    }
+
+    if(!nodeId.isNull())
+        _userNodeData->setValueBy(nodeId, attributeName, value);
+}
+
+bool PairwiseTxtFileParser::parse(const QUrl& url, IGraphModel* graphModel)
+{
+    Q_ASSERT(graphModel != nullptr);
+
+    QFile file(url.toLocalFile());
+    if(graphModel == nullptr || !file.open(QIODevice::ReadOnly))
+        return false;
+
+    const auto size = static_cast<size_t>(file.size());
+    if(size == 0)
+        return true;
+
+    const auto* data = reinterpret_cast<const char*>(file.map(0, file.size())); // NOLINT
+
+    // If the file can't be mapped, read it instead
+    QByteArray contents;
+    if(data == nullptr)
+    {
+        contents = file.readAll();
+        if(static_cast<size_t>(contents.size()) != size)
+            return false;
+
+        data = contents.constData();
+    }
+
+    // Split the file into chunks that begin on line boundaries; lines are independent
+    // of each other, so each chunk can be tokenised concurrently
+    const size_t ChunkSize = 1 << 22;
+    const auto numChunks = std::max(static_cast<size_t>(1), size / ChunkSize);
+
+    std::vector<size_t> chunkBegins(numChunks + 1, size);
+    chunkBegins.front() = 0;
+
+    for(size_t chunk = 1; chunk < numChunks; chunk++)
+    {
+        auto nominal = std::max(chunk * (size / numChunks), chunkBegins.at(chunk - 1));
+        const auto* newline = static_cast<const char*>(std::memchr(data + nominal, '\n', size - nominal));
+
+        chunkBegins.at(chunk) = newline != nullptr ?
+            static_cast<size_t>(newline - data) + 1 : size;
+    }
+
+    // Chunks are processed in waves, so that the tokenised form of the
+    // whole file need not be held in memory at once
+    const size_t WaveSize = std::max(std::thread::hardware_concurrency(), 1u) * 4;
+
+    NameTable nodeNames;
+    std::vector<NodeId> nodeIds;
+    std::atomic<uint64_t> bytesParsed(0);
+
+    auto& graph = graphModel->mutableGraph();
+    IMutableGraph::ScopedTransaction transaction(graph);
+
+    for(size_t waveBegin = 0; waveBegin < numChunks; waveBegin += WaveSize)
+    {
+        auto waveEnd = std::min(waveBegin + WaveSize, numChunks);
+
+        std::vector<size_t> chunkIndexes(waveEnd - waveBegin);
+        std::iota(chunkIndexes.begin(), chunkIndexes.end(), waveBegin);
+        std::vector<Chunk> chunks(chunkIndexes.size());
+
+        concurrent_for(chunkIndexes.begin(), chunkIndexes.end(), [&](size_t chunkIndex)
         {
-            auto& firstToken = tokens.at(0);
-            auto& secondToken = tokens.at(1);
+            parseChunk(data + chunkBegins.at(chunkIndex), data + chunkBegins.at(chunkIndex + 1),
+                chunks.at(chunkIndex - waveBegin), bytesParsed, *this);
 
-            NodeId firstNodeId;
-            NodeId secondNodeId;
+            setProgress(static_cast<int>((bytesParsed * 100) / size));
+        });
 
-            if(!u::contains(nodeIdMap, firstToken))
-            {
-                firstNodeId = graphModel->mutableGraph().addNode();
-                nodeIdMap.emplace(firstToken, firstNodeId);
+        if(cancelled())
+            return false;
 
-                if(_userNodeData != nullptr)
-                {
-                    auto nodeName = QString::fromStdString(firstToken);
-                    _userNodeData->setValueBy(firstNodeId, QObject::tr("Node Name"), nodeName);
-                    graphModel->setNodeName(firstNodeId, nodeName);
-                }
-            }
-            else
-                firstNodeId = nodeIdMap[firstToken];
+        // Add everything to the graph, in file order
+        for(auto& chunk : chunks)
+        {
+            std::vector<NodeId> chunkNodeIds(chunk._names.size());
 
-            if(!u::contains(nodeIdMap, secondToken))
+            auto nodeIdFor = [&](uint32_t index)
             {
-                secondNodeId = graphModel->mutableGraph().addNode();
-                nodeIdMap.emplace(secondToken, secondNodeId);
+                auto& nodeId = chunkNodeIds[index];
 
-                if(_userNodeData != nullptr)
+                if(nodeId.isNull())
                 {
-                    auto nodeName = QString::fromStdString(secondToken);
-                    _userNodeData->setValueBy(secondNodeId, QObject::tr("Node Name"), nodeName);
-                    graphModel->setNodeName(secondNodeId, nodeName);
+                    auto name = chunk._names.at(index);
+                    auto [nodeNameIndex, added] = nodeNames.insert(name);
+
+                    if(added)
+                    {
+                        nodeId = graph.addNode();
+                        nodeIds.push_back(nodeId);
+
+                        if(_userNodeData != nullptr)
+                        {
+                            auto nodeName = QString::fromUtf8(name.data(), static_cast<int>(name.size()));
+                            _userNodeData->setValueBy(nodeId, QObject::tr("Node Name"), nodeName);
+                            graphModel->setNodeName(nodeId, nodeName);
+                        }
+                    }
+                    else
+                        nodeId = nodeIds.at(nodeNameIndex);
                 }
-            }
-            else
-                secondNodeId = nodeIdMap[secondToken];
 
-            auto edgeId = graphModel->mutableGraph().addEdge(firstNodeId, secondNodeId);
+                return nodeId;
+            };
 
-            if(tokens.size() >= 3)
+            auto commentIt = chunk._comments.begin();
+            auto parseCommentsBefore = [&](size_t edgeIndex)
             {
-                // We have an edge weight too
-                auto& thirdToken = tokens.at(2);
-
-                if(u::isNumeric(thirdToken))
+                for(; commentIt != chunk._comments.end() && commentIt->first <= edgeIndex; ++commentIt)
                 {
-                    auto edgeWeight = u::toNumber(thirdToken);
+                    const auto& tokens = commentIt->second;
 
-                    if(std::isnan(edgeWeight) || !std::isfinite(edgeWeight))
-                        edgeWeight = 1.0;
+                    NodeId nodeId;
+                    if(tokens.size() >= 2)
+                    {
+                        auto nodeNameIndex = nodeNames.find(tokens.at(1));
+                        if(nodeNameIndex != NameTable::NotFound)
+                            nodeId = nodeIds.at(nodeNameIndex);
+                    }
 
-                    _userEdgeData->setValueBy(edgeId, QObject::tr("Edge Weight"), QString::number(edgeWeight));
+                    parseComment(tokens, nodeId);
+                }
+            };
+
+            for(size_t edgeIndex = 0; edgeIndex < chunk._edges.size(); edgeIndex++)
+            {
+                parseCommentsBefore(edgeIndex);
+
+                const auto& [source, target] = chunk._edges[edgeIndex];
+                auto sourceId = nodeIdFor(source);
+                auto targetId = nodeIdFor(target);
+                auto edgeId = graph.addEdge(sourceId, targetId);
+
+                if(!chunk._weights.empty() && !std::isnan(chunk._weights[edgeIndex]))
+                {
+                    _userEdgeData->setValueBy(edgeId, QObject::tr("Edge Weight"),
+                        QString::number(chunk._weights[edgeIndex]));
                 }
             }
-        }
 
-        auto filePosition = file.tellg();
-        if(filePosition >= 0)
-            setProgress(static_cast<int>(filePosition * 100 / fileSize));
+            parseCommentsBefore(std::numeric_limits<size_t>::max());
+
+            chunk = {};
+        }
     }
 
     return true;
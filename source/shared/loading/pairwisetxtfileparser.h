@@ -22,12 +22,17 @@
 #include "shared/loading/iparser.h"
 #include "shared/loading/userelementdata.h"
 
+#include <string>
+#include <vector>
+
 class PairwiseTxtFileParser : public IParser
 {
 private:
     UserNodeData* _userNodeData;
     UserEdgeData* _userEdgeData;
 
+    void parseComment(const std::vector<std::string>& tokens, NodeId nodeId);
+
 public:
     explicit PairwiseTxtFileParser(UserNodeData* userNodeData, UserEdgeData* userEdgeData);
 
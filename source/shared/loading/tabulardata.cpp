@@ -19,12 +19,54 @@
 #include "tabulardata.h"
 
 #include "shared/utils/progressable.h"
+#include "shared/utils/threadpool.h"
+
+#include <QByteArray>
+#include <QLocale>
 
 #include <set>
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <numeric>
+#include <thread>
+
+// A cell code with this bit set is the index of a number, rather than a string
+static constexpr StringDictionary::Code NumberFlag = 1u << 31;
+
+static bool isNumberCode(StringDictionary::Code code) { return (code & NumberFlag) != 0; }
+static size_t numberIndex(StringDictionary::Code code) { return code & ~NumberFlag; }
+
+static QString canonicalText(double value) { return QString::number(value, 'g', QLocale::FloatingPointShortest); }
+
+static StringDictionary::Code encodeValue(const QString& value,
+    StringDictionary& strings, std::vector<double>& numbers)
+{
+    // Only bother trying the conversion when the value might be a number
+    // with a canonical form; this excludes the likes of "nan" and "inf"
+    if(!value.isEmpty() && numbers.size() < NumberFlag &&
+        (value.at(0).isDigit() || value.at(0) == '-' || value.at(0) == '.'))
+    {
+        bool success = false;
+        auto number = value.toDouble(&success);
+
+        if(success && value == canonicalText(number))
+        {
+            numbers.push_back(number);
+            return NumberFlag | static_cast<StringDictionary::Code>(numbers.size() - 1);
+        }
+    }
+
+    auto code = strings.codeFor(value);
+    Q_ASSERT(!isNumberCode(code));
+
+    return code;
+}
 
 TabularData::TabularData(TabularData&& other) noexcept :
     _data(std::move(other._data)),
+    _strings(std::move(other._strings)),
+    _numbers(std::move(other._numbers)),
     _columns(other._columns),
     _rows(other._rows),
     _transposed(other._transposed)
@@ -38,6 +80,8 @@ TabularData& TabularData::operator=(TabularData&& other) noexcept
     if(this != &other)
     {
         _data = std::move(other._data);
+        _strings = std::move(other._strings);
+        _numbers = std::move(other._numbers);
         _columns = other._columns;
         _rows = other._rows;
         _transposed = other._transposed;
@@ -80,10 +124,8 @@ size_t TabularData::numRows() const
     return !_transposed ? _rows : _columns;
 }
 
-void TabularData::setValueAt(size_t column, size_t row, QString&& value, int progressHint)
+void TabularData::resize(size_t columns, size_t rows)
 {
-    size_t columns = column >= _columns ? column + 1 : _columns;
-    size_t rows = row >= _rows ? row + 1 : _rows;
     auto newSize = columns * rows;
 
     // If the column count is increasing, jiggle all the existing rows around,
@@ -101,11 +143,27 @@ void TabularData::setValueAt(size_t column, size_t row, QString&& value, int pro
                 oldPosition + _columns,
                 newPosition + _columns);
         }
+
+        // Whatever was left behind in the new columns is stale
+        for(size_t offset = 0; offset < _rows; offset++)
+        {
+            auto rowBegin = _data.begin() + (offset * columns);
+            std::fill(rowBegin + _columns, rowBegin + columns, StringDictionary::EmptyCode);
+        }
     }
 
     _columns = columns;
     _rows = rows;
 
+    _data.resize(newSize);
+}
+
+void TabularData::setValueAt(size_t column, size_t row, QString&& value, int progressHint)
+{
+    size_t columns = column >= _columns ? column + 1 : _columns;
+    size_t rows = row >= _rows ? row + 1 : _rows;
+    auto newSize = columns * rows;
+
     if(newSize > _data.capacity())
     {
         size_t reserveSize = newSize;
@@ -132,8 +190,66 @@ void TabularData::setValueAt(size_t column, size_t row, QString&& value, int pro
         _data.reserve(reserveSize);
     }
 
-    _data.resize(newSize);
-    _data.at(index(column, row)) = value.trimmed();
+    resize(columns, rows);
+    _data.at(index(column, row)) = encodeValue(value.trimmed(), _strings, _numbers);
+}
+
+void TabularData::append(TabularDataBlock&& block)
+{
+    Q_ASSERT(!_transposed);
+
+    // Translate the block's codes into this table's
+    std::vector<StringDictionary::Code> codes(block._strings.size());
+    for(size_t code = 0; code < codes.size(); code++)
+        codes[code] = _strings.codeFor(block._strings.at(static_cast<StringDictionary::Code>(code)));
+
+    // Free the block's strings as early as possible
+    block._strings.clear();
+
+    auto numbersOffset = _numbers.size();
+    auto numNumbers = std::min(block._numbers.size(), NumberFlag - numbersOffset);
+    _numbers.insert(_numbers.end(), block._numbers.begin(),
+        block._numbers.begin() + static_cast<std::ptrdiff_t>(numNumbers));
+
+    auto translate = [&](StringDictionary::Code code)
+    {
+        if(!isNumberCode(code))
+            return codes[code];
+
+        auto index = numberIndex(code);
+
+        // If there are more numbers than can be indexed, the remainder are stored as text
+        if(index >= numNumbers)
+            return _strings.codeFor(canonicalText(block._numbers[index]));
+
+        return NumberFlag | static_cast<StringDictionary::Code>(numbersOffset + index);
+    };
+
+    size_t columns = _columns;
+    size_t rowBegin = 0;
+    for(auto rowEnd : block._rowEnds)
+    {
+        columns = std::max(columns, rowEnd - rowBegin);
+        rowBegin = rowEnd;
+    }
+
+    auto firstRow = _rows;
+    resize(columns, _rows + block._rowEnds.size());
+
+    rowBegin = 0;
+    auto row = firstRow;
+    for(auto rowEnd : block._rowEnds)
+    {
+        auto rowData = _data.begin() + static_cast<std::ptrdiff_t>(row * _columns);
+
+        for(auto cell = rowBegin; cell < rowEnd; cell++)
+            *(rowData + static_cast<std::ptrdiff_t>(cell - rowBegin)) = translate(block._cells[cell]);
+
+        rowBegin = rowEnd;
+        row++;
+    }
+
+    block = {};
 }
 
 void TabularData::shrinkToFit()
@@ -141,7 +257,7 @@ void TabularData::shrinkToFit()
     auto lastRowIsEmpty = [this]
     {
         size_t column = 0;
-        while(column < _columns && valueAt(column, _rows - 1).isEmpty())
+        while(column < _columns && valueMissingAt(column, _rows - 1))
             column++;
 
         return column >= _columns;
@@ -155,11 +271,14 @@ void TabularData::shrinkToFit()
     }
 
     _data.shrink_to_fit();
+    _numbers.shrink_to_fit();
 }
 
 void TabularData::reset()
 {
     _data.clear();
+    _strings.clear();
+    _numbers.clear();
     _columns = 0;
     _rows = 0;
     _transposed = false;
@@ -178,9 +297,44 @@ TypeIdentity TabularData::typeIdentity(size_t columnIndex) const
     return identity;
 }
 
-const QString& TabularData::valueAt(size_t column, size_t row) const
+QString TabularData::valueAt(size_t column, size_t row) const
 {
-    return _data.at(index(column, row));
+    auto code = _data.at(index(column, row));
+
+    if(isNumberCode(code))
+        return canonicalText(_numbers.at(numberIndex(code)));
+
+    return _strings.at(code);
+}
+
+bool TabularData::valueMissingAt(size_t column, size_t row) const
+{
+    return _data.at(index(column, row)) == StringDictionary::EmptyCode;
+}
+
+bool TabularData::valueIsNumericAt(size_t column, size_t row) const
+{
+    auto code = _data.at(index(column, row));
+
+    if(isNumberCode(code))
+        return true;
+
+    return u::isNumeric(_strings.at(code));
+}
+
+double TabularData::numericValueAt(size_t column, size_t row, bool* success) const
+{
+    auto code = _data.at(index(column, row));
+
+    if(isNumberCode(code))
+    {
+        if(success != nullptr)
+            *success = true;
+
+        return _numbers.at(numberIndex(code));
+    }
+
+    return _strings.at(code).toDouble(success);
 }
 
 std::vector<TypeIdentity> TabularData::typeIdentities(Progressable* progressable) const
@@ -229,3 +383,217 @@ int TabularData::columnMatchPercentage(size_t columnIndex, const QStringList& re
 
     return percent;
 }
+
+// Tokenises rows starting at begin, until a row starts at or beyond limit, returning
+// where it stopped; this mirrors the behaviour of aria::csv::CsvParser exactly
+static size_t tokeniseDelimitedText(const char* data, size_t size, size_t begin, size_t limit,
+    char delimiter, TabularDataBlock& block, Cancellable& cancellable)
+{
+    const char Quote = '"';
+    auto isTerminator = [](char c) { return c == '\r' || c == '\n'; };
+
+    block = {};
+
+    QByteArray quotedField;
+    size_t numRows = 0;
+    size_t pos = begin;
+
+    auto addField = [&block](const char* field, size_t length)
+    {
+        block._cells.push_back(encodeValue(QString::fromUtf8(field,
+            static_cast<int>(length)).trimmed(), block._strings, block._numbers));
+    };
+
+    // Consumes a terminator, treating \r\n as one
+    auto endRow = [&]
+    {
+        if(data[pos] == '\r' && pos + 1 < size && data[pos + 1] == '\n')
+            pos++;
+
+        pos++;
+    };
+
+    while(pos < size && pos < limit)
+    {
+        if((numRows++ % 1024) == 0 && cancellable.cancelled())
+            return size;
+
+        auto rowBegin = block._cells.size();
+
+        for(;;)
+        {
+            // At the end of the input, an empty trailing field is dropped, as is an empty row
+            if(pos >= size)
+            {
+                if(block._cells.size() > rowBegin)
+                    block._rowEnds.push_back(block._cells.size());
+
+                break;
+            }
+
+            auto c = data[pos];
+
+            if(isTerminator(c))
+            {
+                endRow();
+                block._rowEnds.push_back(block._cells.size());
+                break;
+            }
+
+            if(c == delimiter)
+            {
+                addField(data + pos, 0);
+                pos++;
+                continue;
+            }
+
+            if(c != Quote)
+            {
+                auto fieldBegin = pos;
+                while(pos < size && data[pos] != delimiter && !isTerminator(data[pos]))
+                    pos++;
+
+                addField(data + fieldBegin, pos - fieldBegin);
+
+                // N.B. a delimiter followed by a terminator or the end of the
+                // input does not imply an empty field after it
+                if(pos < size && data[pos] == delimiter)
+                    pos++;
+
+                continue;
+            }
+
+            // Quoted field; doubled quotes are escaped quotes, and anything following
+            // the closing quote is appended to the field
+            quotedField.clear();
+            pos++;
+
+            for(;;)
+            {
+                auto quotedBegin = pos;
+                while(pos < size && data[pos] != Quote)
+                    pos++;
+
+                quotedField.append(data + quotedBegin, static_cast<int>(pos - quotedBegin));
+
+                if(pos >= size)
+                    break;
+
+                pos++; // Closing (or first escaping) quote
+
+                if(pos < size && data[pos] == Quote)
+                {
+                    quotedField.append(Quote);
+                    pos++;
+                    continue;
+                }
+
+                break;
+            }
+
+            auto unquotedBegin = pos;
+            while(pos < size && data[pos] != delimiter && !isTerminator(data[pos]))
+                pos++;
+
+            quotedField.append(data + unquotedBegin, static_cast<int>(pos - unquotedBegin));
+
+            if(pos >= size && quotedField.isEmpty())
+                continue;
+
+            addField(quotedField.constData(), static_cast<size_t>(quotedField.size()));
+
+            if(pos < size && data[pos] == delimiter)
+                pos++;
+        }
+    }
+
+    return pos;
+}
+
+bool parseDelimitedTextConcurrently(const char* data, size_t size, char delimiter,
+    TabularData& tabularData, IParser& parser)
+{
+    const size_t ChunkSize = 1 << 23;
+    const size_t MinimumChunkSize = 1 << 18;
+    const size_t NumThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    // Use enough chunks to occupy every thread, unless that would make them tiny
+    const auto numChunks = std::max(static_cast<size_t>(1),
+        std::min(size / MinimumChunkSize, std::max(size / ChunkSize, NumThreads)));
+
+    // Speculative chunk boundaries, just beyond the first newline after each nominal split
+    std::vector<size_t> chunkBegins(numChunks + 1, size);
+    chunkBegins.front() = 0;
+
+    for(size_t chunk = 1; chunk < numChunks; chunk++)
+    {
+        auto nominal = std::max(chunk * (size / numChunks), chunkBegins.at(chunk - 1));
+        const auto* newline = static_cast<const char*>(std::memchr(data + nominal, '\n', size - nominal));
+
+        chunkBegins.at(chunk) = newline != nullptr ?
+            static_cast<size_t>(newline - data) + 1 : size;
+    }
+
+    // Chunks are processed in waves, so that the tokenised form of the
+    // whole file need not be held in memory at once
+    const size_t WaveSize = NumThreads * 2;
+
+    std::atomic<uint64_t> bytesParsed(0);
+    size_t pos = 0;
+
+    for(size_t waveBegin = 0; waveBegin < numChunks; waveBegin += WaveSize)
+    {
+        auto waveEnd = std::min(waveBegin + WaveSize, numChunks);
+
+        std::vector<TabularDataBlock> blocks(waveEnd - waveBegin);
+        std::vector<size_t> chunkEnds(blocks.size());
+        std::vector<size_t> chunks(blocks.size());
+        std::iota(chunks.begin(), chunks.end(), waveBegin);
+
+        concurrent_for(chunks.begin(), chunks.end(), [&](size_t chunk)
+        {
+            // The previous wave's final row consumed all of this chunk
+            if(pos >= chunkBegins.at(chunk + 1) && chunk + 1 < numChunks)
+                return;
+
+            chunkEnds.at(chunk - waveBegin) = tokeniseDelimitedText(data, size, chunkBegins.at(chunk),
+                chunkBegins.at(chunk + 1), delimiter, blocks.at(chunk - waveBegin), parser);
+
+            bytesParsed += chunkBegins.at(chunk + 1) - chunkBegins.at(chunk);
+            parser.setProgress(static_cast<int>((bytesParsed * 100) / std::max(size, static_cast<size_t>(1))));
+        });
+
+        if(parser.cancelled())
+            return false;
+
+        // Stitch the chunks together in order; a chunk whose speculative beginning
+        // doesn't match where the previous one actually ended, was begun inside a
+        // quoted field, so is reparsed from the correct position
+        for(auto chunk : chunks)
+        {
+            auto limit = chunkBegins.at(chunk + 1);
+            auto& block = blocks.at(chunk - waveBegin);
+            auto& chunkEnd = chunkEnds.at(chunk - waveBegin);
+
+            // The previous chunk's final row consumed all of this one
+            if(pos >= limit && chunk + 1 < numChunks)
+                continue;
+
+            if(chunkBegins.at(chunk) != pos)
+            {
+                chunkEnd = tokeniseDelimitedText(data, size, pos,
+                    limit, delimiter, block, parser);
+
+                if(parser.cancelled())
+                    return false;
+            }
+
+            tabularData.append(std::move(block));
+            pos = chunkEnd;
+        }
+    }
+
+    parser.setProgress(-1);
+
+    return true;
+}
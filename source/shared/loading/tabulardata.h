@@ -23,6 +23,7 @@
 #include "shared/graph/imutablegraph.h"
 #include "shared/loading/iparser.h"
 #include "shared/utils/string.h"
+#include "shared/utils/stringdictionary.h"
 #include "shared/utils/typeidentity.h"
 
 #include <csv/parser.hpp>
@@ -31,6 +32,7 @@
 #include <QString>
 #include <QStringList>
 #include <QUrl>
+#include <QFile>
 
 #include <fstream>
 #include <iostream>
@@ -41,15 +43,35 @@
 
 class Progressable;
 
+// A run of consecutive rows, built independently of any TabularData, so
+// that several can be tokenised concurrently then appended in order
+struct TabularDataBlock
+{
+    StringDictionary _strings;
+    std::vector<double> _numbers;
+    std::vector<StringDictionary::Code> _cells;
+
+    // For each row, the offset into _cells one beyond its last cell
+    std::vector<size_t> _rowEnds;
+};
+
 class TabularData
 {
 private:
-    std::vector<QString> _data;
+    // Cells are dictionary encoded; tables often repeat the same few values
+    // many times over, and a code is much smaller than a QString. Numbers
+    // rarely repeat though, so a cell whose text is the canonical form of a
+    // number instead refers to it in _numbers; numbers that aren't written
+    // canonically (e.g. "007") keep their original text in _strings
+    std::vector<StringDictionary::Code> _data;
+    StringDictionary _strings;
+    std::vector<double> _numbers;
     size_t _columns = 0;
     size_t _rows = 0;
     bool _transposed = false;
 
     size_t index(size_t column, size_t row) const;
+    void resize(size_t columns, size_t rows);
 
 public:
     TabularData() = default;
@@ -66,10 +88,16 @@ public:
     size_t numColumns() const;
     size_t numRows() const;
     bool transposed() const { return _transposed; }
-    const QString& valueAt(size_t column, size_t row) const;
+    QString valueAt(size_t column, size_t row) const;
+
+    // Typed access, which avoids going via a string where the value is a number
+    bool valueMissingAt(size_t column, size_t row) const;
+    bool valueIsNumericAt(size_t column, size_t row) const;
+    double numericValueAt(size_t column, size_t row, bool* success = nullptr) const;
 
     void setTransposed(bool transposed) { _transposed = transposed; }
     void setValueAt(size_t column, size_t row, QString&& value, int progressHint = -1);
+    void append(TabularDataBlock&& block);
 
     void shrinkToFit();
     void reset();
@@ -82,6 +110,12 @@ public:
 
 Q_DECLARE_METATYPE(std::shared_ptr<TabularData>)
 
+// Tokenises delimited text on the thread pool; the text is split into chunks at
+// newlines, each chunk is parsed speculatively, assuming it doesn't begin inside
+// a quoted field, and any chunk where that turns out to be wrong is reparsed
+bool parseDelimitedTextConcurrently(const char* data, size_t size, char delimiter,
+    TabularData& tabularData, IParser& parser);
+
 template<const char Delimiter>
 class TextDelimitedTabularDataParser : public IParser
 {
@@ -103,6 +137,29 @@ public:
         if(graphModel != nullptr)
             graphModel->mutableGraph().setPhase(QObject::tr("Parsing"));
 
+        // Below this size, the serial parser is quick enough
+        const qint64 MinimumConcurrentParseSize = 1 << 22;
+
+        QFile qFile(url.toLocalFile());
+        if(_rowLimit == 0 && qFile.size() >= MinimumConcurrentParseSize && qFile.open(QIODevice::ReadOnly))
+        {
+            const auto* data = qFile.map(0, qFile.size());
+
+            // If the file can't be mapped, fall back to the serial parser
+            if(data != nullptr)
+            {
+                if(!parseDelimitedTextConcurrently(reinterpret_cast<const char*>(data), // NOLINT
+                    static_cast<size_t>(qFile.size()), Delimiter, _tabularData, *this))
+                {
+                    return false;
+                }
+
+                _tabularData.shrinkToFit();
+
+                return true;
+            }
+        }
+
         size_t columnIndex = 0;
         size_t rowIndex = 0;
 
@@ -23,7 +23,7 @@
 QString UserData::firstUserDataVectorName() const
 {
     if(!_userDataVectors.empty())
-        return _userDataVectors.at(0).first;
+        return _userDataVectors.front().first;
 
     return {};
 }
@@ -75,28 +75,35 @@ void UserData::setValue(size_t index, const QString& name, const QString& value)
     _numValues = std::max(_numValues, userDataVector.numValues());
 }
 
-QVariant UserData::value(size_t index, const QString& name) const
+const UserDataVector* UserData::vector(const QString& name) const
 {
     auto it = std::find_if(_userDataVectors.begin(), _userDataVectors.end(),
         [&name](const auto& it2) { return it2.first == name; });
 
     if(it != _userDataVectors.end())
-    {
-        const auto& userDataVector = it->second;
-        const auto& stringValue = userDataVector.get(index);
+        return &it->second;
+
+    return nullptr;
+}
 
-        switch(userDataVector.type())
+QVariant UserData::value(size_t index, const QString& name) const
+{
+    const auto* userDataVector = vector(name);
+
+    if(userDataVector != nullptr)
+    {
+        switch(userDataVector->type())
         {
         default:
         case UserDataVector::Type::Unknown:
         case UserDataVector::Type::String:
-            return stringValue;
+            return userDataVector->get(index);
 
         case UserDataVector::Type::Float:
-            return stringValue.toFloat();
+            return userDataVector->floatAt(index);
 
         case UserDataVector::Type::Int:
-            return stringValue.toInt();
+            return userDataVector->intAt(index);
         }
     }
 
@@ -105,11 +112,10 @@ QVariant UserData::value(size_t index, const QString& name) const
 
 void UserData::remove(const QString& name)
 {
-    _userDataVectors.erase(std::remove_if(_userDataVectors.begin(), _userDataVectors.end(),
-    [&name](const auto& pair)
+    _userDataVectors.remove_if([&name](const auto& pair)
     {
         return pair.first == name;
-    }), _userDataVectors.end());
+    });
 
     u::removeByValue(_vectorNames, name);
 }
@@ -163,7 +169,7 @@ bool UserData::load(const json& jsonObject, Progressable& progressable)
             return false;
 
         _vectorNames.emplace_back(name);
-        _userDataVectors.emplace_back(std::make_pair(name, userDataVector));
+        _userDataVectors.emplace_back(name, std::move(userDataVector));
 
         progressable.setProgress(static_cast<int>((i++ * 100) / vectorsObject.size()));
     }
@@ -175,3 +181,50 @@ bool UserData::load(const json& jsonObject, Progressable& progressable)
 
     return true;
 }
+
+void UserData::save(QDataStream& stream, Progressable& progressable, const std::vector<size_t>& indexes) const
+{
+    int i = 0;
+
+    stream << static_cast<quint32>(_userDataVectors.size());
+    for(const auto& userDataVector : _userDataVectors)
+    {
+        stream << userDataVector.first;
+        userDataVector.second.save(stream, indexes);
+        progressable.setProgress((i++ * 100) / static_cast<int>(_userDataVectors.size()));
+    }
+
+    progressable.setProgress(-1);
+}
+
+bool UserData::load(QDataStream& stream, Progressable& progressable)
+{
+    _userDataVectors.clear();
+    _vectorNames.clear();
+    _numValues = 0;
+
+    quint32 numVectors = 0;
+    stream >> numVectors;
+
+    for(quint32 i = 0; i < numVectors; i++)
+    {
+        QString name;
+        stream >> name;
+
+        UserDataVector userDataVector;
+        if(stream.status() != QDataStream::Ok || !userDataVector.load(name, stream))
+            return false;
+
+        _vectorNames.emplace_back(name);
+        _userDataVectors.emplace_back(name, std::move(userDataVector));
+
+        progressable.setProgress(static_cast<int>((i * 100) / numVectors));
+    }
+
+    progressable.setProgress(-1);
+
+    for(const auto& userDataVector : _userDataVectors)
+        _numValues = std::max(_numValues, userDataVector.second.numValues());
+
+    return true;
+}
@@ -27,16 +27,19 @@
 #include <QString>
 #include <QVariant>
 #include <QSet>
+#include <QDataStream>
 
 #include <json_helper.h>
 
+#include <list>
 #include <vector>
 
 class UserData
 {
 private:
-    // This is not a map because the data needs to be ordered
-    std::vector<std::pair<QString, UserDataVector>> _userDataVectors;
+    // This is not a map because the data needs to be ordered; it is a list so that
+    // references to a UserDataVector remain valid as other vectors come and go
+    std::list<std::pair<QString, UserDataVector>> _userDataVectors;
     std::vector<QString> _vectorNames;
     int _numValues = 0;
 
@@ -56,6 +59,7 @@ public:
     auto end() const { return _userDataVectors.end(); }
 
     UserDataVector& add(QString name);
+    const UserDataVector* vector(const QString& name) const;
     void setValue(size_t index, const QString& name, const QString& value);
     QVariant value(size_t index, const QString& name) const;
 
@@ -63,6 +67,9 @@ public:
 
     json save(Progressable& progressable, const std::vector<size_t>& indexes = {}) const;
     bool load(const json& jsonObject, Progressable& progressable);
+
+    void save(QDataStream& stream, Progressable& progressable, const std::vector<size_t>& indexes = {}) const;
+    bool load(QDataStream& stream, Progressable& progressable);
 };
 
 #endif // USERDATA_H
@@ -20,45 +20,178 @@
 
 #include "shared/utils/container.h"
 
+#include <QDataStream>
+#include <QLocale>
+
+#include <algorithm>
+
+// The text a number is expected to have been written as; values whose
+// text is something else are kept verbatim in the string dictionary
+static QString canonicalText(int value) { return QString::number(value); }
+static QString canonicalText(double value) { return QString::number(value, 'g', QLocale::FloatingPointShortest); }
+
 QStringList UserDataVector::toStringList() const
 {
     QStringList list;
     list.reserve(numValues());
 
-    for(const auto& value : _values)
-        list.append(value);
+    for(size_t index = 0; index < _codes.size(); index++)
+        list.append(get(index));
 
     return list;
 }
 
 int UserDataVector::numUniqueValues() const
 {
-    auto v = _values;
+    if(type() == Type::String || type() == Type::Unknown)
+    {
+        // Every value is a code, so counting distinct codes suffices
+        std::vector<bool> seen(_strings.size(), false);
+        int numUnique = 0;
+
+        for(auto code : _codes)
+        {
+            if(!seen[code])
+            {
+                seen[code] = true;
+                numUnique++;
+            }
+        }
+
+        return numUnique;
+    }
+
+    auto v = toStringList();
     std::sort(v.begin(), v.end());
     auto last = std::unique(v.begin(), v.end());
-    v.erase(last, v.end());
 
-    return static_cast<int>(v.size());
+    return static_cast<int>(std::distance(v.begin(), last));
 }
 
-void UserDataVector::set(size_t index, const QString& value)
+void UserDataVector::reserve(int size)
+{
+    _codes.reserve(static_cast<size_t>(size));
+
+    if(type() == Type::Int)
+        _ints.reserve(static_cast<size_t>(size));
+    else if(type() == Type::Float)
+        _floats.reserve(static_cast<size_t>(size));
+}
+
+void UserDataVector::clear()
+{
+    _codes.clear();
+    _strings.clear();
+    _ints.clear();
+    _floats.clear();
+}
+
+void UserDataVector::changeType(Type from, Type to)
+{
+    const auto size = _codes.size();
+
+    switch(to)
+    {
+    case Type::Int:
+        // Only reachable from Unknown, i.e. when all existing values are empty
+        _ints.assign(size, 0);
+        break;
+
+    case Type::Float:
+        _floats.assign(size, 0.0);
+
+        if(from == Type::Int)
+        {
+            for(size_t index = 0; index < size; index++)
+            {
+                _floats[index] = _ints[index];
+
+                // An int's canonical text isn't necessarily the same as that of
+                // the equivalent float (e.g. 1000000 vs. 1e+06)
+                if(_codes[index] == NumericCode)
+                {
+                    auto text = canonicalText(_ints[index]);
+
+                    if(text != canonicalText(_floats[index]))
+                        _codes[index] = _strings.codeFor(text);
+                }
+            }
+        }
+        break;
+
+    case Type::String:
+        for(size_t index = 0; index < size; index++)
+        {
+            if(_codes[index] == NumericCode)
+                _codes[index] = _strings.codeFor(get(index));
+        }
+        break;
+
+    default: break;
+    }
+
+    if(to != Type::Int)
+        std::vector<int>().swap(_ints);
+
+    if(to != Type::Float)
+        std::vector<double>().swap(_floats);
+}
+
+void UserDataVector::store(size_t index, const QString& value)
 {
-    if(index >= _values.size())
-        _values.resize(index + 1);
+    if(index >= _codes.size())
+    {
+        _codes.resize(index + 1, StringDictionary::EmptyCode);
+
+        if(type() == Type::Int)
+            _ints.resize(index + 1, 0);
+        else if(type() == Type::Float)
+            _floats.resize(index + 1, 0.0);
+    }
+
+    switch(type())
+    {
+    case Type::Int:
+    {
+        auto intValue = value.toInt();
+        _ints[index] = intValue;
+        _codes[index] = value == canonicalText(intValue) ? NumericCode : _strings.codeFor(value);
+        break;
+    }
+
+    case Type::Float:
+    {
+        auto floatValue = value.toDouble();
+        _floats[index] = floatValue;
+        _codes[index] = value == canonicalText(floatValue) ? NumericCode : _strings.codeFor(value);
+        break;
+    }
 
-    _values.at(index) = value;
+    default:
+        _codes[index] = _strings.codeFor(value);
+        break;
+    }
+}
 
+void UserDataVector::set(size_t index, const QString& value)
+{
+    auto oldType = type();
     updateType(value);
 
+    if(type() != oldType)
+        changeType(oldType, type());
+
+    store(index, value);
+
     if(type() == Type::Int)
     {
-        int intValue = value.toInt();
+        int intValue = _ints[index];
         _intMin = std::min(_intMin, intValue);
         _intMax = std::max(_intMax, intValue);
     }
     else if(type() == Type::Float)
     {
-        double floatValue = value.toDouble();
+        double floatValue = _floats[index];
         _floatMin = std::min(_floatMin, floatValue);
         _floatMax = std::max(_floatMax, floatValue);
     }
@@ -66,10 +199,27 @@ void UserDataVector::set(size_t index, const QString& value)
 
 QString UserDataVector::get(size_t index) const
 {
-    if(index >= _values.size())
+    if(index >= _codes.size())
         return {};
 
-    return _values.at(index);
+    auto code = _codes[index];
+
+    if(code != NumericCode)
+        return _strings.at(code);
+
+    if(index < _ints.size())
+        return canonicalText(_ints[index]);
+
+    return canonicalText(_floats.at(index));
+}
+
+bool UserDataVector::valueMissingAt(size_t index) const
+{
+    // Numeric values are never considered missing; empty values read as 0
+    if(type() == Type::Int || type() == Type::Float)
+        return false;
+
+    return index >= _codes.size() || _codes[index] == StringDictionary::EmptyCode;
 }
 
 json UserDataVector::save(const std::vector<size_t>& indexes) const
@@ -102,17 +252,19 @@ json UserDataVector::save(const std::vector<size_t>& indexes) const
         json jsonValues = json::array();
 
         for(auto index : indexes)
-        {
-            if(index < _values.size())
-                jsonValues.push_back(_values.at(index));
-            else
-                jsonValues.push_back(QString());
-        }
+            jsonValues.push_back(get(index));
 
         jsonObject["values"] = jsonValues;
     }
     else
-        jsonObject["values"] = _values;
+    {
+        json jsonValues = json::array();
+
+        for(size_t index = 0; index < _codes.size(); index++)
+            jsonValues.push_back(get(index));
+
+        jsonObject["values"] = jsonValues;
+    }
 
     return jsonObject;
 }
@@ -154,12 +306,125 @@ bool UserDataVector::load(const QString& name, const json& jsonObject)
     if(!jsonObject["values"].is_array())
         return false;
 
-    _values.clear();
-    for(const auto& value : jsonObject["values"])
+    clear();
+
+    const auto& values = jsonObject["values"];
+    reserve(static_cast<int>(values.size()));
+
+    size_t index = 0;
+    for(const auto& value : values)
+        store(index++, value.get<QString>());
+
+    return true;
+}
+
+void UserDataVector::save(QDataStream& stream, const std::vector<size_t>& indexes) const
+{
+    stream << static_cast<qint32>(type()) << _intMin << _intMax << _floatMin << _floatMax;
+
+    // The dictionary, excluding the implicit empty string
+    stream << static_cast<quint32>(_strings.size() - 1);
+    for(size_t code = 1; code < _strings.size(); code++)
+        stream << _strings.at(static_cast<StringDictionary::Code>(code));
+
+    auto saveValues = [&](auto&& saveValue)
+    {
+        if(!indexes.empty())
+        {
+            for(auto index : indexes)
+                saveValue(index);
+        }
+        else
+        {
+            for(size_t index = 0; index < _codes.size(); index++)
+                saveValue(index);
+        }
+    };
+
+    stream << static_cast<quint32>(!indexes.empty() ? indexes.size() : _codes.size());
+
+    // Indexes beyond the end of the vector are values that were never set
+    saveValues([&](size_t index)
     {
-        // cppcheck-suppress useStlAlgorithm
-        _values.push_back(value);
+        stream << static_cast<quint32>(index < _codes.size() ?
+            _codes[index] : StringDictionary::EmptyCode);
+    });
+
+    if(type() == Type::Int)
+        saveValues([&](size_t index) { stream << static_cast<qint32>(intAt(index)); });
+    else if(type() == Type::Float)
+        saveValues([&](size_t index) { stream << floatAt(index); });
+}
+
+bool UserDataVector::load(const QString& name, QDataStream& stream)
+{
+    _name = name;
+
+    qint32 typeValue = 0;
+    stream >> typeValue >> _intMin >> _intMax >> _floatMin >> _floatMax;
+
+    if(typeValue < static_cast<qint32>(Type::Unknown) || typeValue > static_cast<qint32>(Type::Float))
+        return false;
+
+    setType(static_cast<Type>(typeValue));
+    clear();
+
+    quint32 numStrings = 0;
+    stream >> numStrings;
+
+    for(quint32 i = 0; i < numStrings && stream.status() == QDataStream::Ok; i++)
+    {
+        QString string;
+        stream >> string;
+
+        // Codes are only meaningful if the dictionary is rebuilt exactly as it was
+        if(_strings.codeFor(string) != i + 1)
+            return false;
     }
 
-    return true;
+    quint32 numValues = 0;
+    stream >> numValues;
+
+    // Values are read in batches, so that a corrupt count can't provoke a huge allocation
+    const quint32 BatchSize = 1u << 20;
+    const bool numeric = type() == Type::Int || type() == Type::Float;
+
+    for(quint32 i = 0; i < numValues && stream.status() == QDataStream::Ok; i++)
+    {
+        if(i % BatchSize == 0)
+            _codes.reserve(std::min(numValues, i + BatchSize));
+
+        quint32 code = 0;
+        stream >> code;
+
+        if(code >= _strings.size() && !(numeric && code == NumericCode))
+            return false;
+
+        _codes.push_back(code);
+    }
+
+    if(type() == Type::Int)
+    {
+        _ints.reserve(_codes.size());
+
+        for(size_t i = 0; i < _codes.size() && stream.status() == QDataStream::Ok; i++)
+        {
+            qint32 value = 0;
+            stream >> value;
+            _ints.push_back(value);
+        }
+    }
+    else if(type() == Type::Float)
+    {
+        _floats.reserve(_codes.size());
+
+        for(size_t i = 0; i < _codes.size() && stream.status() == QDataStream::Ok; i++)
+        {
+            double value = 0.0;
+            stream >> value;
+            _floats.push_back(value);
+        }
+    }
+
+    return stream.status() == QDataStream::Ok;
 }
@@ -21,6 +21,7 @@
 
 #include <QString>
 
+#include "shared/utils/stringdictionary.h"
 #include "shared/utils/typeidentity.h"
 
 #include <json_helper.h>
@@ -31,18 +32,35 @@
 
 #include <QStringList>
 
+class QDataStream;
+
 class UserDataVector : public TypeIdentity
 {
 private:
     QString _name;
 
-    std::vector<QString> _values;
+    // Every value has a code into _strings, unless it is NumericCode, in which case
+    // its text is the canonical form of its number in _ints or _floats; numeric
+    // values that aren't written canonically (e.g. "007") keep their original text
+    static constexpr StringDictionary::Code NumericCode = std::numeric_limits<StringDictionary::Code>::max();
+    std::vector<StringDictionary::Code> _codes;
+    StringDictionary _strings;
+
+    // Only one of these is populated, depending on type()
+    std::vector<int> _ints;
+    std::vector<double> _floats;
 
     int _intMin = std::numeric_limits<int>::max();
     int _intMax = std::numeric_limits<int>::lowest();
     double _floatMin = std::numeric_limits<double>::max();
     double _floatMax = std::numeric_limits<double>::lowest();
 
+    void changeType(Type from, Type to);
+    void clear();
+
+    // Encodes a value according to the current type(), without updating it
+    void store(size_t index, const QString& value);
+
 public:
     UserDataVector() = default;
     UserDataVector(const UserDataVector&) = default;
@@ -55,15 +73,12 @@ public:
         _name(std::move(name))
     {}
 
-    auto begin() const { return _values.begin(); }
-    auto end() const { return _values.end(); }
-
     QStringList toStringList() const;
 
     const QString& name() const { return _name; }
-    int numValues() const { return static_cast<int>(_values.size()); }
+    int numValues() const { return static_cast<int>(_codes.size()); }
     int numUniqueValues() const;
-    void reserve(int size) { _values.reserve(size); }
+    void reserve(int size);
 
     int intMin() const { return _intMin; }
     int intMax() const { return _intMax; }
@@ -73,8 +88,17 @@ public:
     void set(size_t index, const QString& value);
     QString get(size_t index) const;
 
+    // Typed access, without going via a string; these are what attributes use
+    int intAt(size_t index) const { return index < _ints.size() ? _ints[index] : 0; }
+    double floatAt(size_t index) const { return index < _floats.size() ? _floats[index] : 0.0; }
+    bool valueMissingAt(size_t index) const;
+
     json save(const std::vector<size_t>& indexes = {}) const;
     bool load(const QString& name, const json& jsonObject);
+
+    // Binary equivalents of the above
+    void save(QDataStream& stream, const std::vector<size_t>& indexes = {}) const;
+    bool load(const QString& name, QDataStream& stream);
 };
 
 #endif // USERDATAVECTOR_H
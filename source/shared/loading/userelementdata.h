@@ -146,22 +146,32 @@ public:
 
             createdAttributeNames.emplace_back(attributeName);
 
+            // The vector's address is stable for as long as it exists, and the
+            // attribute is removed along with it
+            const auto* vector = &userDataVector;
+
             switch(userDataVector.type())
             {
             case UserDataVector::Type::Float:
                 attribute.setFloatValueFn(
-                [this, userDataVectorName](E elementId)
+                [this, vector](E elementId)
                 {
-                    return valueBy(elementId, userDataVectorName).toFloat();
+                    if(!this->haveIndexFor(elementId))
+                        return 0.0;
+
+                    return vector->floatAt(this->indexFor(elementId));
                 })
                 .setFlag(AttributeFlag::AutoRange);
                 break;
 
             case UserDataVector::Type::Int:
                 attribute.setIntValueFn(
-                [this, userDataVectorName](E elementId)
+                [this, vector](E elementId)
                 {
-                    return valueBy(elementId, userDataVectorName).toInt();
+                    if(!this->haveIndexFor(elementId))
+                        return 0;
+
+                    return vector->intAt(this->indexFor(elementId));
                 })
                 .setFlag(AttributeFlag::AutoRange);
                 break;
@@ -171,9 +181,12 @@ public:
             // happening is if the entire vector is empty
             case UserDataVector::Type::String:
                 attribute.setStringValueFn(
-                [this, userDataVectorName](E elementId)
+                [this, vector](E elementId)
                 {
-                    return valueBy(elementId, userDataVectorName).toString();
+                    if(!this->haveIndexFor(elementId))
+                        return QString();
+
+                    return vector->get(this->indexFor(elementId));
                 })
                 .setFlag(AttributeFlag::FindShared);
                 break;
@@ -181,12 +194,12 @@ public:
             default: break;
             }
 
-            attribute.setValueMissingFn([this, userDataVectorName](E elementId)
+            attribute.setValueMissingFn([this, vector](E elementId)
             {
                 if(!this->haveIndexFor(elementId))
                     return false;
 
-                return value(this->indexFor(elementId), userDataVectorName).toString().isEmpty();
+                return vector->valueMissingAt(this->indexFor(elementId));
             });
 
             attribute.setDescription(QString(QObject::tr("%1 is a user defined attribute.")).arg(userDataVectorName));
@@ -244,6 +257,55 @@ public:
 
         return true;
     }
+
+    void save(const IMutableGraph&, const std::vector<E>& elementIds,
+        QDataStream& stream, Progressable& progressable) const
+    {
+        std::vector<size_t> indexes;
+        std::vector<E> savedElementIds;
+
+        for(auto elementId : elementIds)
+        {
+            if(this->haveIndexFor(elementId))
+            {
+                savedElementIds.push_back(elementId);
+                indexes.push_back(this->indexFor(elementId));
+            }
+        }
+
+        stream << static_cast<quint32>(savedElementIds.size());
+        for(auto elementId : savedElementIds)
+            stream << static_cast<qint32>(static_cast<int>(elementId));
+
+        UserData::save(stream, progressable, indexes);
+    }
+
+    bool load(QDataStream& stream, Progressable& progressable)
+    {
+        quint32 numElementIds = 0;
+        stream >> numElementIds;
+
+        std::vector<E> elementIds;
+        for(quint32 i = 0; i < numElementIds && stream.status() == QDataStream::Ok; i++)
+        {
+            qint32 elementId = 0;
+            stream >> elementId;
+            elementIds.emplace_back(elementId);
+        }
+
+        if(stream.status() != QDataStream::Ok || !UserData::load(stream, progressable))
+            return false;
+
+        this->resetMapping();
+
+        size_t index = 0;
+        for(auto elementId : elementIds)
+            this->setElementIdForIndex(elementId, index++);
+
+        this->setNumMappings(numValues());
+
+        return true;
+    }
 };
 
 using UserNodeData = UserElementData<NodeId>;
@@ -22,6 +22,8 @@
 #include <vector>
 #include <limits>
 #include <cmath>
+#include <algorithm>
+#include <iterator>
 
 namespace u
 {
@@ -50,30 +52,27 @@ struct Statistics
     }
 };
 
-template<typename T, typename Fn,
-    template<typename, typename...> class C, typename... Args>
-Statistics findStatisticsFor(const C<T, Args...>& container,
-    Fn&& fn, bool storeValues = false)
+// Finds the Statistics of the values in [first, last), without copying them
+template<typename It>
+Statistics findStatisticsFor(It first, It last)
 {
     Statistics s;
 
     bool allPositive = true;
 
+    const auto size = static_cast<double>(std::distance(first, last));
     size_t column = 0u;
     double largestValue = 0.0;
 
-    std::vector<double> values;
-    values.reserve(std::distance(std::begin(container), std::end(container)));
-    for(const auto& element : container)
-        values.emplace_back(fn(element));
-
-    for(auto value : values)
+    for(auto it = first; it != last; ++it)
     {
+        double value = *it;
+
         allPositive = allPositive && !std::signbit(value);
 
         s._sum += value;
         s._sumSq += value * value;
-        s._mean += value / container.size();
+        s._mean += value / size;
         s._min = std::min(s._min, value);
         s._max = std::max(s._max, value);
 
@@ -88,20 +87,35 @@ Statistics findStatisticsFor(const C<T, Args...>& container,
 
     s._range = s._max - s._min;
     s._sumAllSq = s._sum * s._sum;
-    s._variability = std::sqrt((container.size() * s._sumSq) - s._sumAllSq);
+    s._variability = std::sqrt((size * s._sumSq) - s._sumAllSq);
 
     double sum = 0.0;
-    for(auto value : values)
+    for(auto it = first; it != last; ++it)
     {
-        double x = (value - s._mean);
+        double x = (*it - s._mean);
         x *= x;
         sum += x;
     }
 
-    s._variance = sum / container.size();
+    s._variance = sum / size;
     s._stddev = std::sqrt(s._variance);
     s._coefVar = (allPositive && s._mean > 0.0) ? s._stddev / s._mean : std::nan("1");
 
+    return s;
+}
+
+template<typename T, typename Fn,
+    template<typename, typename...> class C, typename... Args>
+Statistics findStatisticsFor(const C<T, Args...>& container,
+    Fn&& fn, bool storeValues = false)
+{
+    std::vector<double> values;
+    values.reserve(std::distance(std::begin(container), std::end(container)));
+    for(const auto& element : container)
+        values.emplace_back(fn(element));
+
+    auto s = findStatisticsFor(values.data(), values.data() + values.size());
+
     if(storeValues)
         s._values = std::move(values);
 
@@ -0,0 +1,72 @@
+/* Copyright © 2013-2020 Graphia Technologies Ltd.
+ *
+ * This file is part of Graphia.
+ *
+ * Graphia is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Graphia is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Graphia.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STRINGDICTIONARY_H
+#define STRINGDICTIONARY_H
+
+#include <QString>
+#include <QHash>
+
+#include <deque>
+#include <cstdint>
+
+// Stores each distinct string once, handing out a compact code for it; columns
+// of repetitive text can then be held as a vector of codes rather than strings
+class StringDictionary
+{
+public:
+    using Code = uint32_t;
+
+    // The empty string is always present and always has this code
+    static constexpr Code EmptyCode = 0;
+
+private:
+    // A deque so that references returned by at(...) survive further additions
+    std::deque<QString> _strings;
+    QHash<QString, Code> _codes;
+
+public:
+    StringDictionary() { clear(); }
+
+    Code codeFor(const QString& string)
+    {
+        auto it = _codes.constFind(string);
+        if(it != _codes.constEnd())
+            return it.value();
+
+        auto code = static_cast<Code>(_strings.size());
+        _strings.emplace_back(string);
+        _codes.insert(string, code);
+
+        return code;
+    }
+
+    const QString& at(Code code) const { return _strings.at(code); }
+    size_t size() const { return _strings.size(); }
+
+    void clear()
+    {
+        _strings.clear();
+        _codes.clear();
+
+        _strings.emplace_back();
+        _codes.insert(_strings.front(), EmptyCode);
+    }
+};
+
+#endif // STRINGDICTIONARY_H
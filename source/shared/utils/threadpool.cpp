@@ -20,32 +20,53 @@
 
 #include "thread.h"
 
+#include <chrono>
+
+namespace
+{
+// The pool, if any, the current thread belongs to, and its index therein
+thread_local ThreadPool* currentThreadPool = nullptr;
+thread_local size_t currentThreadIndex = 0;
+} // namespace
+
+void ThreadPool::Loop::grainFinished()
+{
+    if(--_numGrainsRemaining == 0)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _finished.notify_all();
+    }
+}
+
 ThreadPool::ThreadPool(const QString& threadNamePrefix, unsigned int numThreads) :
-    _stop(false), _activeThreads(0)
+    _numQueuedTasks(0), _stop(false), _activeThreads(0)
 {
+    for(unsigned int i = 0U; i < numThreads; i++)
+        _workerTasks.emplace_back(std::make_unique<TaskQueue>());
+
     for(unsigned int i = 0U; i < numThreads; i++)
     {
         _threads.emplace_back([threadNamePrefix, i, this]
             {
                 u::setCurrentThreadName(QStringLiteral("%1%2").arg(threadNamePrefix).arg(i + 1));
 
+                currentThreadPool = this;
+                currentThreadIndex = i;
+
                 while(!_stop)
                 {
-                    std::unique_lock<std::mutex> lock(_mutex);
+                    Task task;
 
-                    if(!_tasks.empty())
-                    {
-                        auto task = _tasks.front();
-                        _tasks.pop();
-                        lock.unlock();
-                        task();
-                        _activeThreads--;
-                    }
-                    else if(!_stop)
+                    if(takeTask(i, task))
                     {
-                        // Block until a new task is queued
-                        _waitForNewTask.wait(lock);
+                        execute(task, i);
+                        continue;
                     }
+
+                    std::unique_lock<std::mutex> lock(_mutex);
+
+                    // Block until a new task is queued
+                    _waitForNewTask.wait(lock, [this] { return _stop || _numQueuedTasks > 0; });
                 }
             });
     }
@@ -56,8 +77,18 @@ ThreadPool::~ThreadPool()
     // Cancel all pending tasks
     std::unique_lock<std::mutex> lock(_mutex);
     _stop = true;
-    while(!_tasks.empty())
-        _tasks.pop();
+
+    for(auto& workerTasks : _workerTasks)
+    {
+        std::unique_lock<std::mutex> workerLock(workerTasks->_mutex);
+        workerTasks->_tasks.clear();
+    }
+
+    {
+        std::unique_lock<std::mutex> submittedLock(_submittedTasks._mutex);
+        _submittedTasks._tasks.clear();
+    }
+
     lock.unlock();
 
     // Tell all idle threads to unblock
@@ -70,3 +101,171 @@ ThreadPool::~ThreadPool()
             thread.join();
     }
 }
+
+void ThreadPool::push(TaskQueue& queue, Task&& task)
+{
+    {
+        std::unique_lock<std::mutex> lock(queue._mutex);
+        queue._tasks.emplace_back(std::move(task));
+    }
+
+    _numQueuedTasks++;
+
+    // Taking the lock, albeit briefly, ensures that a thread that has just
+    // found nothing to do is either already waiting, or will see the new count
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+    }
+
+    // Wake a thread up
+    _waitForNewTask.notify_one();
+}
+
+bool ThreadPool::takeTask(size_t threadIndex, Task& task)
+{
+    auto take = [this, &task](TaskQueue& queue, bool back)
+    {
+        std::unique_lock<std::mutex> lock(queue._mutex);
+
+        if(queue._tasks.empty())
+            return false;
+
+        if(back)
+        {
+            task = std::move(queue._tasks.back());
+            queue._tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(queue._tasks.front());
+            queue._tasks.pop_front();
+        }
+
+        _numQueuedTasks--;
+        return true;
+    };
+
+    // Our own most recent work first, then new work, then anyone else's oldest work
+    if(take(*_workerTasks.at(threadIndex), true))
+        return true;
+
+    if(take(_submittedTasks, false))
+        return true;
+
+    for(size_t i = 1; i < _workerTasks.size(); i++)
+    {
+        if(take(*_workerTasks.at((threadIndex + i) % _workerTasks.size()), false))
+            return true;
+    }
+
+    return false;
+}
+
+bool ThreadPool::takeTaskFor(const Loop& loop, size_t threadIndex, Task& task)
+{
+    auto take = [this, &loop, &task](TaskQueue& queue)
+    {
+        std::unique_lock<std::mutex> lock(queue._mutex);
+
+        // Search from the back, as that's where our own work is
+        for(auto it = queue._tasks.rbegin(); it != queue._tasks.rend(); ++it)
+        {
+            if(it->_loop.get() == &loop)
+            {
+                task = std::move(*it);
+                queue._tasks.erase(std::next(it).base());
+                _numQueuedTasks--;
+                return true;
+            }
+        }
+
+        return false;
+    };
+
+    for(size_t i = 0; i < _workerTasks.size(); i++)
+    {
+        if(take(*_workerTasks.at((threadIndex + i) % _workerTasks.size())))
+            return true;
+    }
+
+    return take(_submittedTasks);
+}
+
+void ThreadPool::execute(Task& task, size_t threadIndex)
+{
+    if(task._loop == nullptr)
+    {
+        task._function();
+        _activeThreads--;
+        return;
+    }
+
+    auto begin = task._begin;
+    auto end = task._end;
+
+    // Repeatedly halve the range, leaving the upper halves where other threads can
+    // steal them, until only a single grain remains; if nobody steals the halves,
+    // this thread will go on to execute them itself, in order
+    while(end - begin > 1)
+    {
+        auto middle = begin + ((end - begin) / 2);
+
+        Task remainder;
+        remainder._loop = task._loop;
+        remainder._begin = middle;
+        remainder._end = end;
+        push(*_workerTasks.at(threadIndex), std::move(remainder));
+
+        end = middle;
+    }
+
+    task._loop->execute(begin, threadIndex);
+    task._loop->grainFinished();
+}
+
+void ThreadPool::start(std::shared_ptr<Loop> loop)
+{
+    if(loop->_numGrains == 0)
+        return;
+
+    Task task;
+    task._loop = std::move(loop);
+    task._begin = 0;
+    task._end = task._loop->_numGrains;
+
+    // Nested loops are started on the current thread's own queue, so that
+    // it will pick the work up itself when it waits on the loop
+    if(currentThreadPool == this)
+        push(*_workerTasks.at(currentThreadIndex), std::move(task));
+    else
+        push(_submittedTasks, std::move(task));
+}
+
+void ThreadPool::wait(Loop& loop)
+{
+    if(currentThreadPool != this)
+    {
+        std::unique_lock<std::mutex> lock(loop._mutex);
+        loop._finished.wait(lock, [&loop] { return loop.finished(); });
+        return;
+    }
+
+    // This is one of our own threads, so rather than blocking (and potentially
+    // starving the pool), help out; only the loop's own work is taken on though,
+    // as anything else might reuse the per thread state of the work we're nested in
+    while(!loop.finished())
+    {
+        Task task;
+
+        if(takeTaskFor(loop, currentThreadIndex, task))
+        {
+            execute(task, currentThreadIndex);
+            continue;
+        }
+
+        // The remaining grains are all in progress on other threads
+        std::unique_lock<std::mutex> lock(loop._mutex);
+        loop._finished.wait_for(lock, std::chrono::milliseconds(1),
+            [&loop] { return loop.finished(); });
+    }
+}
@@ -29,11 +29,12 @@
 #include <algorithm>
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <future>
+#include <iterator>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
 #include <vector>
 #include <utility>
@@ -42,13 +43,77 @@
 class ThreadPool
 {
 private:
+    // A parallel loop, divided into grains of roughly equal cost
+    class Loop
+    {
+        friend class ThreadPool;
+
+    private:
+        size_t _numGrains = 0;
+        std::atomic<size_t> _numGrainsRemaining;
+        std::mutex _mutex;
+        std::condition_variable _finished;
+
+        void grainFinished();
+
+    protected:
+        virtual void execute(size_t grain, size_t threadIndex) = 0;
+
+    public:
+        explicit Loop(size_t numGrains) :
+            _numGrains(numGrains), _numGrainsRemaining(numGrains)
+        {}
+
+        virtual ~Loop() = default;
+
+        Loop(const Loop&) = delete;
+        Loop(Loop&&) = delete;
+        Loop& operator=(const Loop&) = delete;
+        Loop& operator=(Loop&&) = delete;
+
+        bool finished() const { return _numGrainsRemaining == 0; }
+    };
+
+    // Either a function, or a range of grains [_begin, _end) of a Loop
+    struct Task
+    {
+        std::function<void()> _function;
+
+        std::shared_ptr<Loop> _loop;
+        size_t _begin = 0;
+        size_t _end = 0;
+    };
+
+    // Owners push and pop at the back, thieves take from the front, so
+    // owners work depth first and thieves take the largest ranges
+    struct TaskQueue
+    {
+        std::mutex _mutex;
+        std::deque<Task> _tasks;
+    };
+
     std::vector<std::thread> _threads;
+    std::vector<std::unique_ptr<TaskQueue>> _workerTasks;
+    TaskQueue _submittedTasks;
+    std::atomic<size_t> _numQueuedTasks;
+
     std::mutex _mutex;
     std::condition_variable _waitForNewTask;
-    std::queue<std::function<void()>> _tasks;
     std::atomic<bool> _stop;
     std::atomic<int> _activeThreads;
 
+    void push(TaskQueue& queue, Task&& task);
+    bool takeTask(size_t threadIndex, Task& task);
+    bool takeTaskFor(const Loop& loop, size_t threadIndex, Task& task);
+    void execute(Task& task, size_t threadIndex);
+
+    // Starts a loop, by queuing a single task that covers all its grains
+    void start(std::shared_ptr<Loop> loop);
+
+    // Blocks until a loop has finished; if called from one of our own threads,
+    // i.e. the loop is nested, that thread helps out with the loop's work
+    void wait(Loop& loop);
+
 public:
     explicit ThreadPool(const QString& threadNamePrefix = QStringLiteral("Worker"),
         unsigned int numThreads = std::thread::hardware_concurrency());
@@ -71,18 +136,15 @@ public:
 
         auto taskPtr = std::make_shared<std::packaged_task<ReturnType<Fn, Args...>(Args...)>>(f);
 
+        Task task;
+        task._function = [taskPtr, args...]() mutable
         {
-            std::unique_lock<std::mutex> lock(_mutex);
-            _tasks.push(
-                [taskPtr, args...]() mutable
-                {
-                    (*taskPtr)(std::forward<Args>(args)...);
-                });
-        }
+            (*taskPtr)(std::forward<Args>(args)...);
+        };
 
-        // Wake a thread up
-        _waitForNewTask.notify_one();
         _activeThreads++;
+        push(_submittedTasks, std::move(task));
+
         return taskPtr->get_future();
     }
 
@@ -102,27 +164,49 @@ private:
         mutable std::vector<ResultsVectorOrVoid> _values;
     };
 
+    // The results of each grain of a loop, if it has any
+    template<typename ResultsVectorOrVoid, bool = std::is_void_v<ResultsVectorOrVoid>>
+    class LoopResults : public Loop
+    {
+    public:
+        using Loop::Loop;
+    };
+
+    template<typename ResultsVectorOrVoid>
+    class LoopResults<ResultsVectorOrVoid, false> : public Loop
+    {
+    public:
+        explicit LoopResults(size_t numGrains) :
+            Loop(numGrains), _results(numGrains)
+        {}
+
+        std::vector<ResultsVectorOrVoid> _results;
+    };
+
     template<typename ResultsVectorOrVoid> class ResultsType : public ResultMember<ResultsVectorOrVoid>
     {
         friend class ThreadPool;
 
     private:
-        mutable std::vector<std::future<ResultsVectorOrVoid>> _futures;
+        ThreadPool* _threadPool = nullptr;
+        mutable std::shared_ptr<LoopResults<ResultsVectorOrVoid>> _loop;
 
-        explicit ResultsType(std::vector<std::future<ResultsVectorOrVoid>>&& futures) :
-            _futures(std::move(futures))
+        ResultsType(ThreadPool* threadPool, std::shared_ptr<LoopResults<ResultsVectorOrVoid>> loop) :
+            _threadPool(threadPool), _loop(std::move(loop))
         {}
 
     public:
         void wait() const
         {
-            for(auto& future : _futures)
-            {
-                future.wait();
+            if(_loop == nullptr)
+                return;
 
-                if constexpr(!std::is_void_v<ResultsVectorOrVoid>)
-                    this->_values.emplace_back(std::move(future.get()));
-            }
+            _threadPool->wait(*_loop);
+
+            if constexpr(!std::is_void_v<ResultsVectorOrVoid>)
+                this->_values = std::move(_loop->_results);
+
+            _loop = nullptr;
         }
 
         // This iterator allows the results to be iterated over in a single pass
@@ -467,6 +551,36 @@ private:
         }
     };
 
+    template<typename It, typename Fn>
+    class LoopImpl : public LoopResults<typename Executor<It, Fn>::ResultsVectorOrVoid>
+    {
+    private:
+        std::vector<It> _boundaries;
+        Fn _f;
+
+    protected:
+        void execute(size_t grain, size_t threadIndex) override
+        {
+            Executor<It, Fn> executor;
+            executor.setIndex(threadIndex);
+
+            if constexpr(std::is_void_v<typename Executor<It, Fn>::ResultsVectorOrVoid>)
+                executor(_boundaries[grain], _boundaries[grain + 1], _f);
+            else
+                this->_results[grain] = executor(_boundaries[grain], _boundaries[grain + 1], _f);
+        }
+
+    public:
+        LoopImpl(std::vector<It>&& boundaries, Fn f) :
+            LoopResults<typename Executor<It, Fn>::ResultsVectorOrVoid>(boundaries.size() - 1),
+            _boundaries(std::move(boundaries)), _f(std::move(f))
+        {}
+    };
+
+    // Each thread's share of a loop is divided into this many grains, so that
+    // there is slack for the work stealing to absorb poor cost estimates
+    static constexpr uint64_t GrainsPerThread = 16;
+
 public:
     template<typename It, typename Fn> using Results =
         ResultsType<typename Executor<It, Fn>::ResultsVectorOrVoid>;
@@ -477,16 +591,14 @@ public:
         NonBlocking
     };
 
+    // Note that f may be called concurrently from several threads, and that the
+    // (optional) thread index argument identifies the executing thread, in the
+    // range [0, number of threads), rather than the portion of the range
     template<typename It, typename Fn>
     auto concurrent_for(It first, It last, Fn f, ResultsPolicy resultsPolicy = Blocking)
     {
         Coster<It> coster(first, last);
 
-        const auto totalCost = coster.total(); Q_ASSERT(totalCost > 0);
-        const auto numThreads = static_cast<int>(_threads.size());
-        const auto costPerThread = totalCost / numThreads +
-                ((totalCost % numThreads) ? 1 : 0);
-
         static_assert(std::is_convertible_v<FirstArgumentType<Fn>, It> ||
             std::is_convertible_v<FirstArgumentType<Fn>, typename It::value_type>,
             "Fn's argument must be an It or an It::value_type");
@@ -494,34 +606,31 @@ public:
         static_assert(function_traits<Fn>::arity == 1 || HasThreadIndexArgument<Fn>,
             "Fn's (optional) second index argument must be size_t");
 
-        Executor<It, Fn> executor;
-        std::vector<std::future<typename Executor<It, Fn>::ResultsVectorOrVoid>> futures;
-        size_t threadIndex = 0;
+        const auto totalCost = coster.total();
+        const auto numGrains = std::max<uint64_t>(_threads.size() * GrainsPerThread, 1);
+        const auto costPerGrain = std::max<uint64_t>(totalCost / numGrains, 1);
+
+        std::vector<It> boundaries;
+        boundaries.reserve(numGrains + 1);
+        boundaries.push_back(first);
 
         for(It it = first; it != last;)
         {
-            It threadLast = it;
             uint64_t cost = 0;
             do
             {
-                cost += coster(threadLast);
-                ++threadLast;
+                cost += coster(it);
+                ++it;
             }
-            while(threadLast != last && cost < costPerThread);
-
-            Q_ASSERT(threadIndex < _threads.size());
-
-            futures.emplace_back(makeFuture([executor, it, threadLast, f, threadIndex]() mutable
-            {
-                executor.setIndex(threadIndex);
-                return executor(it, threadLast, f);
-            }));
+            while(it != last && cost < costPerGrain);
 
-            it = threadLast;
-            threadIndex++;
+            boundaries.push_back(it);
         }
 
-        auto results = Results<It, Fn>(std::move(futures));
+        auto loop = std::make_shared<LoopImpl<It, Fn>>(std::move(boundaries), std::move(f));
+        start(loop);
+
+        auto results = Results<It, Fn>(this, std::move(loop));
 
         if(resultsPolicy == Blocking)
             results.wait();
@@ -544,4 +653,21 @@ auto concurrent_for(It first, It last, Fn&& f, ThreadPool::ResultsPolicy results
     return S(ThreadPoolSingleton)->concurrent_for(first, last, std::forward<Fn>(f), resultsPolicy);
 }
 
+// Like concurrent_for, except that ranges of fewer than minimumSize elements are simply
+// iterated over on the calling thread, as the overhead of distributing a small amount of
+// work over the pool outweighs any gain; f takes an element rather than an iterator
+template<typename It, typename Fn>
+void concurrent_for_if_large(It first, It last, size_t minimumSize, Fn&& f)
+{
+    if(static_cast<size_t>(std::distance(first, last)) < minimumSize)
+    {
+        for(auto it = first; it != last; ++it)
+            f(*it);
+
+        return;
+    }
+
+    concurrent_for(first, last, std::forward<Fn>(f));
+}
+
 #endif // THREADPOOL_H